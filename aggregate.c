@@ -0,0 +1,509 @@
+//
+// Created on 19/10/26.
+//
+
+#define _GNU_SOURCE // getdelim
+
+#include "aggregate.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "graph_index.h"
+#include "header_reader.h"
+
+/*!
+ * @brief aggregate_reader_open opens an aggregate file and reads its header
+ * @param reader the reader to initialize
+ * @param path the path to the aggregate file
+ * @return true if the file is an aggregate file, false else
+ */
+bool aggregate_reader_open(aggregate_reader_t *reader, char *path) {
+    memset(reader, 0, offsetof(aggregate_reader_t, batch));
+    reader->batch_count = reader->batch_position = 0;
+    reader->file = fopen(path, "r");
+    if (!reader->file) {
+        perror(path);
+        return false;
+    }
+    if (fread(&reader->header, sizeof(aggregate_header_t), 1, reader->file) != 1 ||
+        memcmp(reader->header.magic, AGGREGATE_MAGIC, sizeof(reader->header.magic)) != 0) {
+        printf("%s: not an aggregate file\n", path);
+        fclose(reader->file);
+        reader->file = NULL;
+        return false;
+    }
+    reader->addresses_left = reader->header.addresses_count;
+    reader->triples_left = reader->header.triples_count;
+    return true;
+}
+
+/*!
+ * @brief aggregate_reader_next_address reads the next address of the dictionary into reader->address
+ * @param reader the reader
+ * @return true if an address was read, false at the end of the dictionary or on a truncated file
+ */
+bool aggregate_reader_next_address(aggregate_reader_t *reader) {
+    if (reader->addresses_left == 0) {
+        return false;
+    }
+    --reader->addresses_left;
+    ssize_t length = getdelim(&reader->address, &reader->address_capacity, '\0', reader->file);
+    return length > 0 && reader->address[length - 1] == '\0';
+}
+
+/*!
+ * @brief aggregate_reader_next_triple reads the next triple, once the whole dictionary is read. Triples are read by
+ * batches of AGGREGATE_READ_BATCH.
+ * @param reader the reader
+ * @param triple set to the triple read
+ * @return true if a triple was read, false at the end of the file or on a truncated file
+ */
+bool aggregate_reader_next_triple(aggregate_reader_t *reader, aggregate_triple_t *triple) {
+    if (reader->batch_position == reader->batch_count) {
+        size_t wanted = reader->triples_left < AGGREGATE_READ_BATCH ? reader->triples_left : AGGREGATE_READ_BATCH;
+        if (wanted == 0 || reader->addresses_left > 0) {
+            return false;
+        }
+        reader->batch_count = fread(reader->batch, sizeof(aggregate_triple_t), wanted, reader->file);
+        reader->batch_position = 0;
+        reader->triples_left -= reader->batch_count;
+        if (reader->batch_count < wanted) {
+            reader->triples_left = 0; // Truncated file: the triples read are still returned
+        }
+        if (reader->batch_count == 0) {
+            return false;
+        }
+    }
+    *triple = reader->batch[reader->batch_position++];
+    return true;
+}
+
+/*!
+ * @brief aggregate_reader_close closes an aggregate file
+ * @param reader the reader
+ */
+void aggregate_reader_close(aggregate_reader_t *reader) {
+    if (reader->file) {
+        fclose(reader->file);
+        reader->file = NULL;
+    }
+    free(reader->address);
+    reader->address = NULL;
+    reader->address_capacity = 0;
+}
+
+/*!
+ * @brief aggregate_writer_open creates an aggregate file. Addresses must be added in strcmp order, then triples in
+ * (sender, recipient) order.
+ * @param writer the writer to initialize
+ * @param path the path to the aggregate file
+ * @param flags the file flags (AGGREGATE_APPROXIMATE)
+ * @param runs the number of runs summed up in the file
+ * @return true if the file could be created, false else
+ */
+bool aggregate_writer_open(aggregate_writer_t *writer, char *path, uint32_t flags, uint64_t runs) {
+    memset(writer, 0, sizeof(aggregate_writer_t));
+    memcpy(writer->header.magic, AGGREGATE_MAGIC, sizeof(writer->header.magic));
+    writer->header.flags = flags;
+    writer->header.runs = runs;
+    writer->file = fopen(path, "w");
+    if (!writer->file) {
+        perror(path);
+        return false;
+    }
+    setvbuf(writer->file, NULL, _IOFBF, 1 << 16);
+    // The header is written again with the final counts when the file is closed
+    return fwrite(&writer->header, sizeof(aggregate_header_t), 1, writer->file) == 1;
+}
+
+/*!
+ * @brief aggregate_writer_add_address appends an address to the dictionary: its id is the number of addresses added
+ * before it
+ * @param writer the writer
+ * @param address the address
+ * @return true if the address was written, false else
+ */
+bool aggregate_writer_add_address(aggregate_writer_t *writer, const char *address) {
+    ++writer->header.addresses_count;
+    return fwrite(address, 1, strlen(address) + 1, writer->file) > 0;
+}
+
+/*!
+ * @brief aggregate_writer_add_triple appends a triple, once all the addresses are added
+ * @param writer the writer
+ * @param triple the triple
+ * @return true if the triple was written, false else
+ */
+bool aggregate_writer_add_triple(aggregate_writer_t *writer, aggregate_triple_t *triple) {
+    ++writer->header.triples_count;
+    return fwrite(triple, sizeof(aggregate_triple_t), 1, writer->file) == 1;
+}
+
+/*!
+ * @brief aggregate_writer_close writes the final header and closes the file
+ * @param writer the writer
+ * @return true if the whole file was written, false else
+ */
+bool aggregate_writer_close(aggregate_writer_t *writer) {
+    if (!writer->file) {
+        return false;
+    }
+    bool success = fseek(writer->file, 0, SEEK_SET) == 0 &&
+                   fwrite(&writer->header, sizeof(aggregate_header_t), 1, writer->file) == 1 && !ferror(writer->file);
+    success = fclose(writer->file) == 0 && success;
+    writer->file = NULL;
+    return success;
+}
+
+/*!
+ * @brief compare_triples orders triples by sender then recipient id (qsort callback)
+ */
+static int compare_triples(const void *a, const void *b) {
+    const aggregate_triple_t *first = a, *second = b;
+    if (first->sender != second->sender) {
+        return first->sender < second->sender ? -1 : 1;
+    }
+    return first->recipient < second->recipient ? -1 : (first->recipient > second->recipient);
+}
+
+/*!
+ * @brief write_aggregate writes the counts of a senders list as an aggregate file, which merges with the aggregates
+ * of other runs (@see merge_aggregates)
+ * @param list the senders list, as built by files_reducer
+ * @param path the path to the aggregate file
+ * @param flags the file flags (AGGREGATE_APPROXIMATE for counts scaled up from a sample)
+ * @return true if the file was written, false else
+ */
+bool write_aggregate(sender_t *list, char *path, uint32_t flags) {
+    uint32_t addresses_count;
+    uint64_t edges_count, senders_count = 0;
+    char **dictionary = build_address_dictionary(list, &addresses_count, &edges_count);
+    for (sender_t *sender = list; sender != NULL; sender = sender->next) {
+        ++senders_count;
+    }
+    aggregate_triple_t *triples = malloc((edges_count + senders_count + 1) * sizeof(aggregate_triple_t));
+    if (!dictionary || !triples) {
+        perror("Cannot allocate aggregate");
+        free(dictionary);
+        free(triples);
+        return false;
+    }
+    uint64_t triples_count = 0;
+    for (sender_t *sender = list; sender != NULL; sender = sender->next) {
+        uint32_t sender_id = dictionary_address_id(dictionary, addresses_count, sender->sender_address);
+        if (!sender->head) {
+            triples[triples_count++] = (aggregate_triple_t) {sender_id, AGGREGATE_NO_RECIPIENT, 0};
+        }
+        for (recipient_t *recipient = sender->head; recipient != NULL; recipient = recipient->next) {
+            uint32_t recipient_id = dictionary_address_id(dictionary, addresses_count, recipient->recipient_address);
+            triples[triples_count++] = (aggregate_triple_t) {sender_id, recipient_id, recipient->occurrences};
+        }
+    }
+    qsort(triples, triples_count, sizeof(aggregate_triple_t), compare_triples);
+
+    aggregate_writer_t writer;
+    bool success = aggregate_writer_open(&writer, path, flags, 1);
+    for (uint32_t i = 0; i < addresses_count && success; ++i) {
+        success = aggregate_writer_add_address(&writer, dictionary[i]);
+    }
+    for (uint64_t t = 0; t < triples_count && success; ++t) {
+        success = aggregate_writer_add_triple(&writer, &triples[t]);
+    }
+    success = aggregate_writer_close(&writer) && success;
+    if (!success) {
+        perror("Cannot write aggregate file");
+    }
+    free(triples);
+    free(dictionary);
+    return success;
+}
+
+// An input of the merge: its reader, the ids of its addresses in the merged dictionary, and its current triple
+typedef struct {
+    aggregate_reader_t reader;
+    uint32_t *merged_ids;
+    aggregate_triple_t triple; // Current triple, with merged ids
+} merge_input_t;
+
+/*!
+ * @brief read_merge_triple reads the next triple of an input and translates its ids to the merged dictionary
+ * @param input the input
+ * @return true if a valid triple was read, false at the end of the input or on an invalid id
+ */
+static bool read_merge_triple(merge_input_t *input) {
+    aggregate_triple_t triple;
+    uint32_t count = input->reader.header.addresses_count;
+    if (!aggregate_reader_next_triple(&input->reader, &triple) || triple.sender >= count ||
+        (triple.recipient >= count && triple.recipient != AGGREGATE_NO_RECIPIENT)) {
+        return false;
+    }
+    input->triple.sender = input->merged_ids[triple.sender];
+    input->triple.recipient = triple.recipient == AGGREGATE_NO_RECIPIENT ? AGGREGATE_NO_RECIPIENT
+                                                                          : input->merged_ids[triple.recipient];
+    input->triple.count = triple.count;
+    return true;
+}
+
+/*!
+ * @brief heap_sift_inputs restores the heap property from index i in a min-heap of inputs, ordered by their current
+ * triple
+ * @param heap the heap of inputs
+ * @param size the heap size
+ * @param i the index to start from
+ */
+static void heap_sift_inputs(merge_input_t **heap, size_t size, size_t i) {
+    while (2 * i + 1 < size) {
+        size_t child = 2 * i + 1;
+        if (child + 1 < size && compare_triples(&heap[child + 1]->triple, &heap[child]->triple) < 0) {
+            ++child;
+        }
+        if (compare_triples(&heap[child]->triple, &heap[i]->triple) >= 0) {
+            return;
+        }
+        merge_input_t *swap = heap[i];
+        heap[i] = heap[child];
+        heap[child] = swap;
+        i = child;
+    }
+}
+
+/*!
+ * @brief merge_dictionaries merges the sorted dictionaries of the inputs into the output, and maps the ids of each
+ * input to the merged ids. The merged order is the order of each input, so that translated triples stay sorted.
+ * @param inputs the inputs, whose dictionaries are read
+ * @param count the number of inputs
+ * @param writer the output
+ * @return true if all the dictionaries were read and written, false else
+ */
+static bool merge_dictionaries(merge_input_t *inputs, size_t count, aggregate_writer_t *writer) {
+    bool *has_address = calloc(count, sizeof(bool));
+    uint32_t *positions = calloc(count, sizeof(uint32_t));
+    growable_buffer_t smallest = {0};
+    bool success = has_address && positions;
+    for (size_t i = 0; i < count && success; ++i) {
+        has_address[i] = aggregate_reader_next_address(&inputs[i].reader);
+    }
+    for (uint32_t merged_id = 0; success; ++merged_id) {
+        size_t first = count;
+        for (size_t i = 0; i < count; ++i) {
+            if (has_address[i] && (first == count || strcmp(inputs[i].reader.address, inputs[first].reader.address) < 0)) {
+                first = i;
+            }
+        }
+        if (first == count) {
+            break;
+        }
+        smallest.length = 0;
+        success = growable_buffer_append(&smallest, inputs[first].reader.address,
+                                         strlen(inputs[first].reader.address) + 1) &&
+                  aggregate_writer_add_address(writer, smallest.data);
+        for (size_t i = first; i < count && success; ++i) {
+            if (has_address[i] && strcmp(inputs[i].reader.address, smallest.data) == 0) {
+                inputs[i].merged_ids[positions[i]++] = merged_id;
+                has_address[i] = aggregate_reader_next_address(&inputs[i].reader);
+            }
+        }
+    }
+    for (size_t i = 0; i < count && success; ++i) {
+        success = positions[i] == inputs[i].reader.header.addresses_count;
+    }
+    growable_buffer_free(&smallest);
+    free(positions);
+    free(has_address);
+    return success;
+}
+
+/*!
+ * @brief merge_aggregates sums up aggregate files into one, in a single streaming pass: dictionaries are merged
+ * first, then triples are merged with a heap of the inputs, the counts of a pair found in several inputs being added.
+ * Memory holds a batch of triples per input and 4 bytes per address of each input, whatever the number of triples.
+ * @param inputs the paths to the aggregate files
+ * @param count the number of aggregate files
+ * @param output the path to the merged aggregate file
+ * @return true if all the inputs were merged, false else
+ */
+bool merge_aggregates(char **inputs, size_t count, char *output) {
+    merge_input_t *merged = calloc(count, sizeof(merge_input_t));
+    merge_input_t **heap = calloc(count + 1, sizeof(merge_input_t *));
+    bool success = merged && heap;
+    uint32_t flags = 0;
+    uint64_t runs = 0;
+    size_t opened = 0;
+    for (; opened < count && success; ++opened) {
+        success = aggregate_reader_open(&merged[opened].reader, inputs[opened]);
+        if (success) {
+            flags |= merged[opened].reader.header.flags;
+            runs += merged[opened].reader.header.runs;
+            merged[opened].merged_ids = malloc((merged[opened].reader.header.addresses_count + 1) * sizeof(uint32_t));
+            success = merged[opened].merged_ids != NULL;
+        }
+    }
+
+    aggregate_writer_t writer = {0};
+    success = success && aggregate_writer_open(&writer, output, flags, runs) &&
+              merge_dictionaries(merged, count, &writer);
+    size_t heap_size = 0;
+    for (size_t i = 0; i < count && success; ++i) {
+        if (read_merge_triple(&merged[i])) {
+            heap[heap_size++] = &merged[i];
+        }
+    }
+    for (size_t i = heap_size / 2; i-- > 0;) {
+        heap_sift_inputs(heap, heap_size, i);
+    }
+
+    // Equal pairs come out of the heap one after the other: their counts are added up before the pair is written. A
+    // sender without recipients in one input may have some in another: its empty triple is then dropped.
+    aggregate_triple_t pending = {0};
+    bool has_pending = false;
+    while (success && heap_size > 0) {
+        merge_input_t *input = heap[0];
+        if (has_pending && compare_triples(&pending, &input->triple) == 0) {
+            pending.count += input->triple.count;
+        } else {
+            bool is_empty_sender = input->triple.recipient == AGGREGATE_NO_RECIPIENT && has_pending &&
+                                   pending.sender == input->triple.sender;
+            if (!is_empty_sender) {
+                success = !has_pending || aggregate_writer_add_triple(&writer, &pending);
+                pending = input->triple;
+                has_pending = true;
+            }
+        }
+        if (!read_merge_triple(input)) {
+            heap[0] = heap[--heap_size];
+        }
+        heap_sift_inputs(heap, heap_size, 0);
+    }
+    success = success && (!has_pending || aggregate_writer_add_triple(&writer, &pending));
+    for (size_t i = 0; i < opened && success; ++i) {
+        success = merged[i].reader.triples_left == 0 && merged[i].reader.batch_position == merged[i].reader.batch_count;
+    }
+    if (writer.file) {
+        success = aggregate_writer_close(&writer) && success;
+    }
+    if (!success) {
+        printf("Could not merge the aggregate files into %s\n", output);
+    }
+    for (size_t i = 0; i < opened; ++i) {
+        aggregate_reader_close(&merged[i].reader);
+        free(merged[i].merged_ids);
+    }
+    free(heap);
+    free(merged);
+    return success;
+}
+
+/*!
+ * @brief compare_by_count orders the triples of a sender by decreasing count, then recipient id (qsort callback), as
+ * write_sorted_output orders recipients
+ */
+static int compare_by_count(const void *a, const void *b) {
+    const aggregate_triple_t *first = a, *second = b;
+    if (first->count != second->count) {
+        return first->count > second->count ? -1 : 1;
+    }
+    return first->recipient < second->recipient ? -1 : (first->recipient > second->recipient);
+}
+
+/*!
+ * @brief write_sender_line writes the output line of a sender (@see write_sorted_output)
+ * @param buffer the output buffer
+ * @param sender the sender address
+ * @param triples the triples of the sender, sorted by decreasing count
+ * @param count the number of triples
+ * @param strings the dictionary
+ * @param offsets the offsets of the addresses in the dictionary
+ * @return true if the line was written, false else
+ */
+static bool write_sender_line(output_buffer_t *buffer, const char *sender, aggregate_triple_t *triples, size_t count,
+                              growable_buffer_t *strings, uint64_t *offsets) {
+    char count_text[32];
+    bool success = output_buffer_write(buffer, sender, strlen(sender)) && output_buffer_write(buffer, " ", 1);
+    for (size_t i = 0; i < count && success; ++i) {
+        const char *recipient = strings->data + offsets[triples[i].recipient];
+        int length = snprintf(count_text, sizeof(count_text), "%llu:", (unsigned long long) triples[i].count);
+        success = output_buffer_write(buffer, count_text, length) &&
+                  output_buffer_write(buffer, recipient, strlen(recipient)) && output_buffer_write(buffer, " ", 1);
+    }
+    return success && output_buffer_write(buffer, "\n", 1);
+}
+
+/*!
+ * @brief write_aggregate_text writes an aggregate file as the output of a run (@see write_sorted_output): the same
+ * run gives the same file either way. The dictionary is loaded, triples are read one sender at a time.
+ * @param aggregate the path to the aggregate file
+ * @param output_file the path to the text output
+ * @param top_k the maximum number of recipients written per sender, 0 to write all of them
+ * @return true if the output was written, false else
+ */
+bool write_aggregate_text(char *aggregate, char *output_file, uint32_t top_k) {
+    aggregate_reader_t *reader = malloc(sizeof(aggregate_reader_t));
+    if (!reader || !aggregate_reader_open(reader, aggregate)) {
+        free(reader);
+        return false;
+    }
+    uint32_t addresses_count = reader->header.addresses_count;
+    uint64_t *offsets = malloc((addresses_count + 1) * sizeof(uint64_t));
+    growable_buffer_t strings = {0};
+    bool success = offsets != NULL;
+    for (uint32_t i = 0; i < addresses_count && success; ++i) {
+        offsets[i] = strings.length;
+        success = aggregate_reader_next_address(reader) &&
+                  growable_buffer_append(&strings, reader->address, strlen(reader->address) + 1);
+    }
+
+    int fd = success ? open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+    output_buffer_t buffer = {.fd = fd, .data = malloc(OUTPUT_BUFFER_SIZE), .used = 0, .capacity = OUTPUT_BUFFER_SIZE};
+    success = success && fd != -1 && buffer.data;
+    aggregate_triple_t *group = NULL, triple;
+    size_t group_count = 0, group_capacity = 0;
+    uint32_t sender = 0;
+    bool has_sender = false;
+    while (success) {
+        bool has_triple = aggregate_reader_next_triple(reader, &triple);
+        success = !has_triple || (triple.sender < addresses_count &&
+                                  (triple.recipient < addresses_count || triple.recipient == AGGREGATE_NO_RECIPIENT));
+        if (has_sender && (!has_triple || triple.sender != sender)) {
+            qsort(group, group_count, sizeof(aggregate_triple_t), compare_by_count);
+            size_t written = top_k > 0 && group_count > top_k ? top_k : group_count;
+            success = success && write_sender_line(&buffer, strings.data + offsets[sender], group, written, &strings,
+                                                   offsets);
+            group_count = 0;
+        }
+        if (!has_triple || !success) {
+            break;
+        }
+        sender = triple.sender;
+        has_sender = true;
+        if (triple.recipient == AGGREGATE_NO_RECIPIENT) {
+            continue;
+        }
+        if (group_count == group_capacity) {
+            group_capacity = group_capacity ? 2 * group_capacity : 64;
+            aggregate_triple_t *grown = realloc(group, group_capacity * sizeof(aggregate_triple_t));
+            if (!grown) {
+                success = false;
+                break;
+            }
+            group = grown;
+        }
+        group[group_count++] = triple;
+    }
+    success = success && output_buffer_flush(&buffer) && reader->triples_left == 0;
+    if (!success) {
+        printf("Could not write %s from %s\n", output_file, aggregate);
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    free(buffer.data);
+    free(group);
+    free(offsets);
+    growable_buffer_free(&strings);
+    aggregate_reader_close(reader);
+    free(reader);
+    return success;
+}
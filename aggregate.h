@@ -0,0 +1,70 @@
+//
+// Created on 19/10/26.
+//
+
+#ifndef A2022_AGGREGATE_H
+#define A2022_AGGREGATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "reducers.h"
+
+#define AGGREGATE_MAGIC "LP25AGG1"
+
+// On-disk layout: this header, the dictionary (addresses_count NUL-terminated addresses, sorted with strcmp, the id of
+// an address is its rank), then triples_count triples sorted by sender then recipient id, all in host byte order like
+// the graph index. Both parts are read sequentially, so that files merge in one streaming pass (@see
+// merge_aggregates).
+typedef struct {
+    char magic[8];
+    uint32_t addresses_count;
+    uint32_t flags;
+    uint64_t triples_count;
+    uint64_t runs; // Analysis runs summed up in the file, 1 for the aggregate of a run
+} aggregate_header_t;
+
+#define AGGREGATE_APPROXIMATE 0x1u        // Flag: counts scaled up from a sample (@see sketch.h)
+#define AGGREGATE_NO_RECIPIENT UINT32_MAX // Recipient of the only triple of a sender without recipients (count 0)
+#define AGGREGATE_READ_BATCH 4096         // Triples read at once from each file
+
+typedef struct {
+    uint32_t sender;
+    uint32_t recipient;
+    uint64_t count;
+} aggregate_triple_t;
+
+typedef struct {
+    FILE *file;
+    aggregate_header_t header;
+    uint32_t addresses_left;
+    uint64_t triples_left;
+    char *address; // Last address read
+    size_t address_capacity;
+    aggregate_triple_t batch[AGGREGATE_READ_BATCH];
+    size_t batch_count;
+    size_t batch_position;
+} aggregate_reader_t;
+
+typedef struct {
+    FILE *file;
+    aggregate_header_t header;
+} aggregate_writer_t;
+
+bool aggregate_reader_open(aggregate_reader_t *reader, char *path);
+bool aggregate_reader_next_address(aggregate_reader_t *reader);
+bool aggregate_reader_next_triple(aggregate_reader_t *reader, aggregate_triple_t *triple);
+void aggregate_reader_close(aggregate_reader_t *reader);
+
+bool aggregate_writer_open(aggregate_writer_t *writer, char *path, uint32_t flags, uint64_t runs);
+bool aggregate_writer_add_address(aggregate_writer_t *writer, const char *address);
+bool aggregate_writer_add_triple(aggregate_writer_t *writer, aggregate_triple_t *triple);
+bool aggregate_writer_close(aggregate_writer_t *writer);
+
+bool write_aggregate(sender_t *list, char *path, uint32_t flags);
+bool merge_aggregates(char **inputs, size_t count, char *output);
+bool write_aggregate_text(char *aggregate, char *output_file, uint32_t top_k);
+
+#endif //A2022_AGGREGATE_H
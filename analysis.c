@@ -5,6 +5,7 @@
 #include "analysis.h"
 
 #include <dirent.h>
+#include <errno.h>
 #include <stddef.h>
 #include <unistd.h>
 #include <libgen.h>
@@ -12,9 +13,57 @@
 #include <fcntl.h>
 #include <ctype.h>
 #include <stdlib.h>
-#include <sys/file.h>
-
+#include <strings.h>
+#include <sys/stat.h>
+
+#include "block_file.h"
+#include "file_errors.h"
+#include "header_reader.h"
+#include "mail_date.h"
+#include "normalization.h"
+#include "path_builder.h"
+#include "plugins.h"
+#include "timeline.h"
 #include "utility.h"
+#include "metrics.h"
+
+/*!
+ * @brief parse_dir_at lists the files of an open directory and its subdirs. Subdirs are opened relative to their
+ * parent (openat), and paths are built by appending to the current one, not rebuilt for each entry.
+ * @param dir_fd the directory file descriptor, closed when done
+ * @param path the path of the directory, restored when done
+ * @param output_file a pointer to an already opened file
+ */
+static void parse_dir_at(int dir_fd, path_builder_t *path, FILE *output_file) {
+    DIR *dir = fdopendir(dir_fd);
+    if (!dir) {
+        close(dir_fd);
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        unsigned char type = entry->d_type;
+        struct stat status;
+        if (type == DT_UNKNOWN && fstatat(dirfd(dir), entry->d_name, &status, AT_SYMLINK_NOFOLLOW) == 0) {
+            type = S_ISDIR(status.st_mode) ? DT_DIR : (S_ISREG(status.st_mode) ? DT_REG : DT_UNKNOWN);
+        }
+        size_t length = path_builder_push(path, entry->d_name);
+        if (type == DT_DIR) {
+            int subdir_fd = openat(dirfd(dir), entry->d_name, O_RDONLY | O_DIRECTORY);
+            if (subdir_fd != -1) {
+                parse_dir_at(subdir_fd, path, output_file);
+            }
+        } else if (type == DT_REG) {
+            fwrite(path->buffer.data, 1, path->buffer.length, output_file);
+            fputc('\n', output_file);
+        }
+        path_builder_pop(path, length);
+    }
+    closedir(dir);
+}
 
 /*!
  * @brief parse_dir parses a directory to find all files in it and its subdirs (recursive analysis of root directory)
@@ -24,166 +73,403 @@
  */
 void parse_dir(char *path, FILE *output_file) {
     // 1. Check parameters
+    if (!path || !output_file) return;
+    int dir_fd = open(path, O_RDONLY | O_DIRECTORY);
+    if (dir_fd == -1) return;
+
+    // 2. Go through all entries: if file, write it to the output file; if a dir, parse it
+    path_builder_t builder = {0};
+    if (path_builder_init(&builder, path)) {
+        parse_dir_at(dir_fd, &builder, output_file);
+    } else {
+        close(dir_fd);
+    }
+    // 3. Clear all allocated resources
+    path_builder_free(&builder);
+}
 
-    if (!directory_exists(path)) return;
-    DIR *dir = opendir(path);
-    if (!dir) return;
-    struct dirent *entries;
-
-    char entry_path[STR_MAX_LEN];
-
-    // 2. Gor through all entries: if file, write it to the output file; if a dir, call parse dir on it
-    do {
-        entries = readdir(dir);
-        if (entries) {
-            switch (entries->d_type) {
-            case DT_DIR:
-                if (strcmp(entries->d_name, ".") != 0 && strcmp(entries->d_name, "..") != 0) {
-                    concat_path(path, entries->d_name, entry_path);
-                    parse_dir(entry_path, output_file);
-                }
-                break;
-            case DT_REG:
-                concat_path(path, entries->d_name, entry_path);
-                fprintf(output_file, "%s\n", entry_path);
-                break;
-            default:
-                break;
-            }
-        }
-    } while (entries);
-    // 3. Clear all allocated resources (dirent pointer should not be free'd)
-    closedir(dir);
+/*!
+ * @brief address_list_reset empties an address list, keeping its memory for the next file
+ * @param list the list to reset
+ */
+void address_list_reset(address_list_t *list) {
+    list->addresses.length = 0;
+    list->count = 0;
 }
 
 /*!
- * @brief clear_recipient_list clears all recipients in a recipients list
- * @param list the list to be cleared
+ * @brief address_list_add copies an address at the end of an address list
+ * @param list the list to add the address to
+ * @param address the address (not NUL-terminated)
+ * @param length the address length
+ * @return true if the address was added, false if the list could not grow
  */
-void clear_recipient_list(simple_recipient_t *list) {
-    while (list) {
-        simple_recipient_t *next = list->next;
-        free(list);
-        list = next;
+bool address_list_add(address_list_t *list, const char *address, size_t length) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? 2 * list->capacity : 64;
+        address_span_t *spans = realloc(list->spans, capacity * sizeof(address_span_t));
+        if (!spans) {
+            return false;
+        }
+        list->spans = spans;
+        list->capacity = capacity;
+    }
+    size_t offset = list->addresses.length;
+    if (!growable_buffer_append(&list->addresses, address, length) ||
+        !growable_buffer_append(&list->addresses, " ", 1)) {
+        list->addresses.length = offset;
+        return false;
     }
+    list->spans[list->count++] = (address_span_t) {.offset = offset, .length = length};
+    return true;
 }
 
 /*!
- * @brief add_recipient_to_list adds a recipient to a recipients list (as a pointer to a recipient)
- * @param recipient_email the string containing the e-mail to add
- * @param list the list to add the e-mail to
- * @return a pointer to the new recipient (to update the list with)
+ * @brief address_list_free releases the memory of an address list
+ * @param list the list to free
  */
-simple_recipient_t *add_recipient_to_list(char *recipient_email, simple_recipient_t *list) {
-    if (recipient_email) {
-        simple_recipient_t *new_mail = (simple_recipient_t *) malloc(sizeof(simple_recipient_t));
-        strcpy(new_mail->email, recipient_email);
-        new_mail->next = list;
-        return new_mail;
-    } else {
-        return list;
-    }
+void address_list_free(address_list_t *list) {
+    growable_buffer_free(&list->addresses);
+    free(list->spans);
+    list->spans = NULL;
+    list->count = 0;
+    list->capacity = 0;
 }
 
+/*!
+ * @brief last_word locates the last word of a buffer (words are separated by spaces or tabs)
+ * @param buffer the buffer
+ * @param end the end of the buffer
+ * @param length set to the word length, 0 if the buffer is blank
+ * @return a pointer to the first character of the word
+ */
+static char *last_word(char *buffer, char *end, size_t *length) {
+    while (end > buffer && isspace((unsigned char) end[-1])) {
+        --end;
+    }
+    char *start = end;
+    while (start > buffer && !isspace((unsigned char) start[-1])) {
+        --start;
+    }
+    *length = end - start;
+    return start;
+}
 
 /*!
- * @brief extract_e_mail extracts an e-mail from a buffer
+ * @brief extract_e_mail extracts an e-mail from a buffer: the last word of the buffer (words are separated by spaces
+ * or tabs) in canonical form (@see normalization.h), truncated to STR_MAX_LEN - 1 characters
  * @param buffer the buffer containing the e-mail
  * @param destination the buffer into which the e-mail is copied
  */
 void extract_e_mail(char *buffer, char *destination) {
-    sscanf(buffer, "%[^\n]", destination);  // récupère le premier mot (mot délimité par des espaces ou des tabulations)
-    char *last_space = strrchr(destination, ' ');  // trouve le dernier espace
-    if (last_space) {
-        char *last_word = last_space + 1;  // trouve le dernier mot en démarrant juste après le dernier espace
-        char temp[STR_MAX_LEN];
-        strncpy(temp, last_word, STR_MAX_LEN);
-        strncpy(destination, temp, STR_MAX_LEN);
+    size_t length;
+    char *word = last_word(buffer, buffer + strlen(buffer), &length);
+    const char *start = normalize_address(word, length, &length);
+    if (length > STR_MAX_LEN - 1) {
+        length = STR_MAX_LEN - 1;
     }
-    sscanf(destination, "%s", destination); //getting rid of tabs and spaces
+    memcpy(destination, start, length);
+    destination[length] = '\0';
 }
 
 
 /*!
- * @brief extract_emails extracts all the e-mails from a buffer and put the e-mails into a recipients list
+ * @brief extract_emails extracts all the e-mails from a buffer (one per comma separated item, its last word) and adds
+ * them to an address list in canonical form (@see normalization.h), without any allocation once the list is large
+ * enough
  * @param buffer the buffer containing one or more e-mails
- * @param list the resulting list
- * @return the updated list
- */
-simple_recipient_t *extract_emails(char *buffer, simple_recipient_t *list) {
-    if (buffer) { // 1. Check parameters
-        char *token = strtok(buffer, ",");
-        while (token) {
-            char dest[STR_MAX_LEN];
-            extract_e_mail(token, dest); // 2. Go through buffer and extract e-mails
-            if (strlen(dest) > 2) list = add_recipient_to_list(dest, list); // 3. Add each e-mail to list
-            token = strtok(NULL, ",");
+ * @param list the list to add the e-mails to
+ */
+void extract_emails(char *buffer, address_list_t *list) {
+    while (buffer && *buffer) {
+        char *comma = strchr(buffer, ',');
+        char *end = comma ? comma : buffer + strlen(buffer);
+        size_t length;
+        char *word = last_word(buffer, end, &length);
+        if (length > 2) {
+            const char *address = normalize_address(word, length, &length);
+            if (length > 0) {
+                address_list_add(list, address, length);
+            }
         }
+        buffer = comma ? comma + 1 : NULL;
     }
-    return list; // 4. Return list
 }
 
-// Used to track status in e-mail (for multi lines To, Cc, and Bcc fields)
-typedef enum {IN_DEST_FIELD, OUT_OF_DEST_FIELD} read_status_t;
+/*!
+ * @brief settings_fingerprint hashes the settings which shape the output lines of a mail: the plugins, the timeline
+ * lines and the aliases. Output written with other settings must not be mixed with it (tcp workers, resumed runs).
+ * @return the hash
+ */
+uint64_t settings_fingerprint() {
+    uint64_t hash = plugins_fingerprint() ^ (aliases_fingerprint() * 0x100000001b3ULL);
+    return are_timeline_lines_written() ? ~hash : hash;
+}
 
 /*!
- * @brief parse_file parses mail file at filepath location and writes the result to
- * file whose location is on path output
- * @param filepath name of the e-mail file to analyze
- * @param output path to output file
- * Uses previous utility functions: extract_email, extract_emails, add_recipient_to_list,
- * and clear_recipient_list
+ * @brief is_recipient_field tells if a header field lists recipients
+ * @param name the field name
+ * @return true for To, Cc and Bcc (exact names, case insensitive: X-To or Reply-To do not match), false else
  */
-void parse_file(char *filepath, char *output) {
-    FILE *file, *output_file;
+static bool is_recipient_field(char *name) {
+    return strcasecmp(name, "To") == 0 || strcasecmp(name, "Cc") == 0 || strcasecmp(name, "Bcc") == 0;
+}
 
-    // 1. Check parameters
-    if (!(file = fopen(filepath, "r"))) return;
-    if (!(output_file = fopen(output, "a"))) {
-        fclose(file);
-        return;
+// Header reader, recipients and output lines of the process, their buffers are reused from one mail to the next
+static header_reader_t header_reader;
+static address_list_t recipients;
+static growable_buffer_t mail_lines;
+
+// Directory of the last mail opened by the process: mails listed in a row mostly share their directory, they are
+// opened relative to it (openat), so that the kernel does not walk their whole path each time
+static int mail_directory_fd = -1;
+static growable_buffer_t mail_directory_path;
+
+// Output (step2) stream of the process, opened once for all its mails
+static FILE *mail_output = NULL;
+static char mail_output_path[STR_MAX_LEN];
+// Last file tasks of the process whose lines are still buffered by a compressed output stream
+static uint32_t unflushed_tasks = 0;
+
+/*!
+ * @brief prepare_mail_directory makes the directory of a mail the cached directory, opening it only if it changed.
+ * A dispatcher may call it before forking, so that its children inherit the opened directory.
+ * @param filepath the mail path
+ * @return the offset of the file name in filepath
+ */
+size_t prepare_mail_directory(char *filepath) {
+    char *slash = strrchr(filepath, '/');
+    size_t name_offset = slash ? (size_t) (slash - filepath) + 1 : 0;
+    size_t directory_length = slash == filepath ? 1 : (slash ? name_offset - 1 : 0); // "/x" is in "/"
+    if (mail_directory_fd != -1 && mail_directory_path.length == directory_length + 1 &&
+        memcmp(mail_directory_path.data, filepath, directory_length) == 0) {
+        return name_offset;
     }
+    if (mail_directory_fd != -1) {
+        close(mail_directory_fd);
+        mail_directory_fd = -1;
+    }
+    mail_directory_path.length = 0;
+    if (growable_buffer_append(&mail_directory_path, filepath, directory_length) &&
+        growable_buffer_append(&mail_directory_path, "", 1)) {
+        mail_directory_fd = open(directory_length ? mail_directory_path.data : ".", O_RDONLY | O_DIRECTORY);
+    }
+    return name_offset;
+}
 
-    char *buffer = (char *) malloc(sizeof(char) * STR_MAX_LEN);
-    char sender[STR_MAX_LEN];
-    read_status_t read_status = OUT_OF_DEST_FIELD;
-    simple_recipient_t *recipient_list = NULL;
+/*!
+ * @brief prepare_mail_output opens the output stream of the mails, unless it is already open on this path. A
+ * dispatcher may call it before forking, so that its children inherit the opened stream.
+ * @param output path to the output file
+ * @return the output stream, NULL if it could not be opened
+ */
+FILE *prepare_mail_output(char *output) {
+    if (mail_output && strcmp(mail_output_path, output) == 0) {
+        return mail_output;
+    }
+    if (mail_output) {
+        fclose(mail_output);
+    }
+    if ((mail_output = open_intermediate(output, "a"))) {
+        strncpy(mail_output_path, output, STR_MAX_LEN - 1);
+        mail_output_path[STR_MAX_LEN - 1] = '\0';
+    }
+    return mail_output;
+}
 
-    // 2. Go through e-mail and extract From: address into a buffer
-    while ((buffer = fgets(buffer,STR_MAX_LEN, file)) && !strstr(buffer, "From:"));
+/*!
+ * @brief release_mail_caches closes the cached mail directory and output stream, and frees the output lines and the
+ * addresses cache
+ */
+void release_mail_caches() {
+    if (mail_directory_fd != -1) {
+        close(mail_directory_fd);
+        mail_directory_fd = -1;
+    }
+    growable_buffer_free(&mail_directory_path);
+    growable_buffer_free(&mail_lines);
+    normalization_cache_free();
+    if (mail_output) {
+        fclose(mail_output);
+        mail_output = NULL;
+    }
+}
+
+/*!
+ * @brief close_mail_output closes the output stream of the mails, so that a compressed stream writes its last lines.
+ * Persistent workers run it as a task at the end of the files analysis (@see supervise_tasks).
+ * @param task unused
+ */
+void close_mail_output(task_t *task) {
+    (void) task;
+    if (mail_output) {
+        fclose(mail_output);
+        mail_output = NULL;
+    }
+    unflushed_tasks = 0;
+}
+
+/*!
+ * @brief unflushed_mail_tasks tells how many of the last file tasks of the process, the current one included, have
+ * lines which are not in the output file yet: a compressed stream buffers them until it writes a block. These tasks
+ * are lost with the process.
+ * @return the number of tasks, 0 if all the lines were written
+ */
+uint32_t unflushed_mail_tasks() {
+    return unflushed_tasks;
+}
+
+/*!
+ * @brief open_mail opens a mail for reading, relative to the cached directory when possible
+ * @param filepath the mail path
+ * @return the mail stream, NULL on failure (with errno set)
+ */
+FILE *open_mail(char *filepath) {
+    size_t name_offset = prepare_mail_directory(filepath);
+    int fd = mail_directory_fd != -1 ? openat(mail_directory_fd, filepath + name_offset, O_RDONLY)
+                                     : open(filepath, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    FILE *file = fdopen(fd, "r");
+    if (!file) {
+        close(fd);
+    }
+    return file;
+}
 
-    if (buffer) {
-        extract_e_mail(buffer, sender);
-        read_status = IN_DEST_FIELD;
+/*!
+ * @brief write_mail_lines writes the output lines of a mail. The workers inherit the same open output file, whose lock
+ * would not keep them apart: a plain file gets the lines in a single write, which O_APPEND keeps whole, and a
+ * compressed stream only writes blocks of whole lines (@see block_file.h).
+ * @param output_file the output stream
+ * @return true if the lines were written, false else
+ */
+static bool write_mail_lines(FILE *output_file) {
+    int fd = fileno(output_file);
+    if (fd == -1) {
+        return fwrite(mail_lines.data, 1, mail_lines.length, output_file) == mail_lines.length &&
+               fflush(output_file) == 0;
+    }
+    if (fflush(output_file) != 0) {
+        return false;
+    }
+    for (size_t offset = 0; offset < mail_lines.length;) {
+        ssize_t written = write(fd, mail_lines.data + offset, mail_lines.length - offset);
+        if (written <= 0) {
+            return false;
+        }
+        offset += written;
+    }
+    return true;
+}
 
-        // 3. Extract recipients (To, Cc, Bcc fields) and put it to a recipients list.
-        while (read_status == IN_DEST_FIELD) {
-            fgets(buffer, STR_MAX_LEN, file);
-            if (buffer[0] != '\t' && !strstr(buffer, "To:") && !strstr(buffer, "Cc:") && !strstr(buffer, "Bcc:")) {
-                read_status = OUT_OF_DEST_FIELD;
-            } else {
-                recipient_list = extract_emails(buffer, recipient_list);
+/*!
+ * @brief parse_mail extracts the sender and recipients of a mail and writes them as one line of the output file. The
+ * whole header is read (up to the blank line before the body), with folded fields unfolded, so that no field is missed
+ * or cut whatever its length.
+ * @param mail the mail stream, positioned at the start of the header (a file, or a mail read from an archive)
+ * @param output_file the output stream, shared with the other workers
+ * @return FILE_STATUS_OK if the line was written, the reason of the failure else
+ */
+file_status_t parse_mail(FILE *mail, FILE *output_file) {
+    char sender[STR_MAX_LEN] = "";
+    address_list_reset(&recipients);
+
+    // Go through the header fields: extract From: address, recipients (To, Cc, Bcc fields) into a list, and the day of
+    // the mail for the timeline. Plugins capture their fields in the same pass.
+    char *name, *value;
+    bool has_plugins = plugins_count() > 0;
+    bool has_timeline = are_timeline_lines_written(), has_day = false;
+    int32_t day = 0;
+    if (has_plugins) {
+        plugins_start_mail();
+    }
+    header_reader_start(&header_reader, mail);
+    while (header_reader_next(&header_reader, &name, &value)) {
+        if (sender[0] == '\0' && strcasecmp(name, "From") == 0) {
+            extract_e_mail(value, sender);
+        } else if (is_recipient_field(name)) {
+            extract_emails(value, &recipients);
+        } else if (has_timeline && !has_day && strcasecmp(name, "Date") == 0) {
+            mail_date_t date;
+            if ((has_day = parse_mail_date(value, &date))) {
+                day = mail_date_utc_day(&date);
             }
         }
+        if (has_plugins) {
+            plugins_capture(name, value);
+        }
+    }
 
-        flock(fileno(output_file), LOCK_EX); // 4. Lock output file
+    normalization_counts_t counts = take_normalization_counts();
+    metrics_addresses_normalized(counts.addresses, counts.rewritten, counts.cache_hits);
+    if (sender[0] == '\0') {
+        return FILE_STATUS_MALFORMED_HEADER;
+    }
+    // Lines of the mail according to project instructions, then the lines of the plugins and the timeline
+    mail_lines.length = 0;
+    bool is_composed = growable_buffer_append(&mail_lines, sender, strlen(sender)) &&
+                       growable_buffer_append(&mail_lines, " ", 1) &&
+                       growable_buffer_append(&mail_lines, recipients.addresses.data, recipients.addresses.length) &&
+                       growable_buffer_append(&mail_lines, "\n", 1) &&
+                       (!has_plugins || plugins_write_keys(&mail_lines, sender)) &&
+                       (!has_day || write_timeline_line(&mail_lines, sender, recipients.addresses.data,
+                                                        recipients.addresses.length, day));
+    if (!is_composed) {
+        return FILE_STATUS_OUTPUT_FAILED;
+    }
+    return write_mail_lines(output_file) ? FILE_STATUS_OK : FILE_STATUS_OUTPUT_FAILED;
+}
 
-        // 5. Write to output file according to project instructions
-        fprintf(output_file, "%s ", sender);
-        for (simple_recipient_t *recipient = recipient_list; recipient != NULL; recipient = recipient->next) {
-            fprintf(output_file, "%s ", recipient->email);
-        }
-        flock(fileno(output_file), LOCK_UN); // 6. Unlock file
-        fprintf(output_file, "\n");
-    };
+/*!
+ * @brief parse_file_to parses the mail file at filepath location and writes the result to an output stream (@see
+ * parse_mail).
+ * The mail is opened once, without any prior existence check: failures are reported by the returned status, counted
+ * in metrics and recorded in the rejected files log.
+ * @param filepath name of the e-mail file to analyze
+ * @param output_file the output stream, NULL if it could not be opened
+ * @return FILE_STATUS_OK if the mail was analyzed, the reason of the failure else
+ * Uses previous utility functions: extract_email and extract_emails
+ */
+file_status_t parse_file_to(char *filepath, FILE *output_file) {
+    FILE *file;
+    uint64_t start_us = metrics_now_us();
+
+    // 1. Check parameters
+    if (!(file = open_mail(filepath))) {
+        file_status_t status = file_status_from_errno(errno);
+        metrics_file_parsed(0, metrics_now_us() - start_us, status);
+        file_errors_record(filepath, status);
+        return status;
+    }
+    if (!output_file) {
+        fclose(file);
+        metrics_file_parsed(0, metrics_now_us() - start_us, FILE_STATUS_OUTPUT_FAILED);
+        return FILE_STATUS_OUTPUT_FAILED;
+    }
+
+    // 2. Extract the addresses and write them
+    file_status_t status = parse_mail(file, output_file);
 
-    // 7. Close file
+    // 3. Close file
+    long bytes_read = ftell(file);
     fclose(file);
-    fclose(output_file);
 
-    // 8. Clear all allocated resources
-    free(buffer);
-    clear_recipient_list(recipient_list);
+    metrics_file_parsed(bytes_read > 0 ? bytes_read : 0, metrics_now_us() - start_us, status);
+    file_errors_record(filepath, status);
+    return status;
+}
+
+/*!
+ * @brief parse_file parses mail file at filepath location and writes the result to file whose location is on path
+ * output (@see parse_file_to).
+ * @param filepath name of the e-mail file to analyze
+ * @param output path to output file
+ * @return FILE_STATUS_OK if the mail was analyzed, the reason of the failure else
+ */
+file_status_t parse_file(char *filepath, char *output) {
+    return parse_file_to(filepath, prepare_mail_output(output));
 }
 
 /*!
@@ -203,7 +489,7 @@ void process_directory(task_t *task) {
 
     if (!directory_exists(directory_task->object_directory)) return;
 
-    FILE *output_file = fopen(directory_task->temporary_directory, "a");
+    FILE *output_file = open_intermediate(directory_task->temporary_directory, "w");
     if (!output_file) return;
 
     parse_dir(directory_task->object_directory, output_file);
@@ -220,15 +506,23 @@ void process_file(task_t *task) {
     if (!task) return;
     file_task_t *file_task = (file_task_t *) task;
 
-    if (!path_to_file_exists(file_task->object_file)) return;
+    if (file_errors_skip(file_task->object_file)) {
+        metrics_file_skipped();
+        return;
+    }
     
-    // 2. Build full path to all parameters
-    char filepath[STR_MAX_LEN];
-    realpath(file_task->object_file, filepath);
-
-    char output[STR_MAX_LEN];
-    realpath(file_task->temporary_directory, output);
-
-    // 3. Call parse_file
-    parse_file(filepath, output);
+    // 2. Call parse_file: paths are used as given (workers never change their working directory, relative paths stay
+    // valid), the output stream and the mail directory are cached from one task to the next
+    uint64_t flushes = block_file_flushes();
+    file_status_t status = parse_file(file_task->object_file, file_task->temporary_directory);
+
+    // 3. Count the tasks whose lines are buffered: a block written during this task holds the lines of all the
+    // previous ones (@see block_file_flushes)
+    if (block_file_pending_bytes() == 0) {
+        unflushed_tasks = 0;
+    } else if (block_file_flushes() != flushes) {
+        unflushed_tasks = 1;
+    } else if (status == FILE_STATUS_OK) {
+        ++unflushed_tasks;
+    }
 }
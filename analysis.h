@@ -6,12 +6,24 @@
 #define A2022_ANALYSIS_H
 
 #include "global_defs.h"
+#include "file_errors.h"
+#include "header_reader.h"
 #include <stdio.h>
 
-typedef struct _simple_recipient {
-    char email[STR_MAX_LEN];
-    struct _simple_recipient *next;
-} simple_recipient_t;
+typedef struct {
+    size_t offset; // Position of the address in the addresses arena
+    size_t length;
+} address_span_t;
+
+// Recipients of a mail: addresses are copied one after the other in a text arena (each followed by a space, so that
+// the arena is also the recipients part of the output line), spans locate them. Both only grow, and are reset between
+// files, so that a worker stops allocating once it has seen its largest mail.
+typedef struct {
+    growable_buffer_t addresses;
+    address_span_t *spans;
+    size_t count;
+    size_t capacity;
+} address_list_t;
 
 typedef struct {
     void (* task_callback)(task_t *);
@@ -25,8 +37,24 @@ typedef struct {
     char temporary_directory[STR_MAX_LEN];
 } file_task_t;
 
+void address_list_reset(address_list_t *list);
+bool address_list_add(address_list_t *list, const char *address, size_t length);
+void address_list_free(address_list_t *list);
+
+size_t prepare_mail_directory(char *filepath);
+FILE *prepare_mail_output(char *output);
+void release_mail_caches();
+void close_mail_output(task_t *task);
+uint32_t unflushed_mail_tasks();
+FILE *open_mail(char *filepath);
+
+uint64_t settings_fingerprint();
+void extract_e_mail(char *buffer, char *destination);
+void extract_emails(char *buffer, address_list_t *list);
 void parse_dir(char *path, FILE *output_file);
-void parse_file(char *filepath, char *output);
+file_status_t parse_mail(FILE *mail, FILE *output_file);
+file_status_t parse_file_to(char *filepath, FILE *output_file);
+file_status_t parse_file(char *filepath, char *output);
 
 void process_directory(task_t *task);
 void process_file(task_t *task);
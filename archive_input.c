@@ -0,0 +1,615 @@
+//
+// Created on 19/10/26.
+//
+
+#define _GNU_SOURCE // F_SETPIPE_SZ
+
+#include "archive_input.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "analysis.h"
+#include "file_errors.h"
+#include "global_defs.h"
+#include "metrics.h"
+#include "scheduling.h"
+#include "trace.h"
+#include "utility.h"
+
+// POSIX ustar header, the first block of each member
+typedef struct {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char type;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char padding[12];
+} tar_header_t;
+
+// Sequential reader of the members of an archive, decompressed by a child process when compressed
+typedef struct {
+    FILE *stream;
+    pid_t decompressor;       // 0 for a plain tar, or once reaped
+    int decompressor_status;  // Exit status of the decompressor, once reaped
+    char name[STR_MAX_LEN];   // Path of the current member in the archive
+    uint64_t data_left;       // Bytes of the current member not read yet
+    uint64_t padding_left;    // Bytes up to the next block after the member data
+} archive_reader_t;
+
+typedef struct {
+    size_t name_offset;   // Offsets in the batch data
+    size_t header_offset;
+    size_t header_length;
+} batched_mail_t;
+
+// Mails read from an archive and not parsed yet: names (NUL-terminated) and headers, one after the other
+typedef struct {
+    growable_buffer_t data;
+    batched_mail_t *mails;
+    size_t count;
+    size_t capacity;
+} mail_batch_t;
+
+/*!
+ * @brief archive_format detects the format of an archive from its first bytes
+ * @param path the path to the file
+ * @return the archive format, ARCHIVE_NONE if the path is not a (supported) archive
+ */
+archive_format_t archive_format(char *path) {
+    struct stat status;
+    if (stat(path, &status) == -1 || !S_ISREG(status.st_mode)) {
+        return ARCHIVE_NONE;
+    }
+    unsigned char block[TAR_BLOCK_SIZE];
+    FILE *file = fopen(path, "r");
+    size_t length = file ? fread(block, 1, sizeof(block), file) : 0;
+    if (file) {
+        fclose(file);
+    }
+    if (length >= 2 && block[0] == 0x1f && block[1] == 0x8b) {
+        return ARCHIVE_GZIP;
+    }
+    if (length >= 4 && block[0] == 0x28 && block[1] == 0xb5 && block[2] == 0x2f && block[3] == 0xfd) {
+        return ARCHIVE_ZSTD;
+    }
+    if (length == TAR_BLOCK_SIZE && memcmp(((tar_header_t *) block)->magic, "ustar", 5) == 0) {
+        return ARCHIVE_TAR;
+    }
+    return ARCHIVE_NONE;
+}
+
+/*!
+ * @brief is_archive_input tells if the data source is made of archives: an archive file of the whole corpus, or a
+ * directory of archives (e.g. one per mailbox) without any subdirectory
+ * @param data_source the data source path
+ * @return true if the data source is to be read with analyze_archives, false else
+ */
+bool is_archive_input(char *data_source) {
+    if (archive_format(data_source) != ARCHIVE_NONE) {
+        return true;
+    }
+    DIR *dir = opendir(data_source);
+    if (!dir) {
+        return false;
+    }
+    bool has_archives = false, has_directories = false;
+    char path[STR_MAX_LEN];
+    struct dirent *entry;
+    while (!has_directories && (entry = next_dir(NULL, dir)) != NULL) {
+        concat_path(data_source, entry->d_name, path);
+        has_directories = directory_exists(path);
+        has_archives = has_archives || archive_format(path) != ARCHIVE_NONE;
+    }
+    closedir(dir);
+    return has_archives && !has_directories;
+}
+
+/*!
+ * @brief start_decompressor runs a decompressor reading an archive and writing to a pipe
+ * @param path the archive path
+ * @param format the archive format (ARCHIVE_GZIP or ARCHIVE_ZSTD)
+ * @param reader the reader, whose stream and decompressor are set
+ * @return true if the decompressor was started, false else
+ */
+static bool start_decompressor(char *path, archive_format_t format, archive_reader_t *reader) {
+    int input = open(path, O_RDONLY);
+    int pipe_fds[2];
+    if (input == -1 || pipe(pipe_fds) == -1) {
+        perror("Cannot read archive");
+        if (input != -1) {
+            close(input);
+        }
+        return false;
+    }
+    fcntl(pipe_fds[1], F_SETPIPE_SZ, ARCHIVE_PIPE_SIZE); // Best effort: the default size only means more switches
+    reader->decompressor = fork();
+    if (reader->decompressor == 0) {
+        dup2(input, STDIN_FILENO);
+        dup2(pipe_fds[1], STDOUT_FILENO);
+        close(input);
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        if (format == ARCHIVE_GZIP) {
+            execlp("gzip", "gzip", "-dc", (char *) NULL);
+        } else {
+            execlp("zstd", "zstd", "-dcq", (char *) NULL);
+        }
+        perror("Cannot run decompressor");
+        _exit(EXIT_FAILURE);
+    }
+    close(input);
+    close(pipe_fds[1]);
+    if (reader->decompressor == -1 || !(reader->stream = fdopen(pipe_fds[0], "r"))) {
+        perror("Cannot run decompressor");
+        close(pipe_fds[0]);
+        reader->decompressor = 0;
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * @brief archive_open opens an archive for reading its members
+ * @param reader the reader to initialize
+ * @param path the archive path
+ * @return true if the archive could be opened, false else
+ */
+static bool archive_open(archive_reader_t *reader, char *path) {
+    memset(reader, 0, sizeof(archive_reader_t));
+    archive_format_t format = archive_format(path);
+    if (format == ARCHIVE_TAR) {
+        reader->stream = fopen(path, "r");
+        return reader->stream != NULL;
+    }
+    return format != ARCHIVE_NONE && start_decompressor(path, format, reader);
+}
+
+/*!
+ * @brief archive_close closes an archive and waits for its decompressor
+ * @param reader the reader
+ * @return true if the decompressor (if any) succeeded, false else
+ */
+static bool archive_close(archive_reader_t *reader) {
+    if (reader->stream) {
+        fclose(reader->stream); // Stops a decompressor still writing (when reading ended early)
+    }
+    if (reader->decompressor > 0) {
+        while (waitpid(reader->decompressor, &reader->decompressor_status, 0) == -1 && errno == EINTR) {
+        }
+        reader->decompressor = 0;
+    }
+    return WIFEXITED(reader->decompressor_status) && WEXITSTATUS(reader->decompressor_status) == EXIT_SUCCESS;
+}
+
+/*!
+ * @brief archive_skip reads and discards bytes of the archive
+ * @param reader the reader
+ * @param length the number of bytes to skip
+ * @return true if all were read, false at the end of the stream
+ */
+static bool archive_skip(archive_reader_t *reader, uint64_t length) {
+    char buffer[16 * TAR_BLOCK_SIZE];
+    while (length > 0) {
+        size_t chunk = length < sizeof(buffer) ? length : sizeof(buffer);
+        if (fread(buffer, 1, chunk, reader->stream) != chunk) {
+            return false;
+        }
+        length -= chunk;
+    }
+    return true;
+}
+
+/*!
+ * @brief tar_number reads a numeric field of a tar header: octal text, or base-256 (GNU) for large values
+ * @param field the field
+ * @param length the field length
+ * @return the value
+ */
+static uint64_t tar_number(const char *field, size_t length) {
+    uint64_t value = 0;
+    if ((unsigned char) field[0] & 0x80) {
+        for (size_t i = 1; i < length; ++i) {
+            value = (value << 8) | (unsigned char) field[i];
+        }
+        return value;
+    }
+    for (size_t i = 0; i < length && field[i] >= '0' && field[i] <= '7'; ++i) {
+        value = (value << 3) | (field[i] - '0');
+    }
+    return value;
+}
+
+/*!
+ * @brief tar_checksum_matches checks the checksum of a header block (sum of its bytes, the checksum field counting as
+ * spaces), so that a corrupted or non-tar stream is not taken for members
+ * @param block the header block
+ * @return true if the checksum is valid, false else
+ */
+static bool tar_checksum_matches(const unsigned char *block) {
+    const tar_header_t *header = (const tar_header_t *) block;
+    uint64_t sum = 0;
+    for (size_t i = 0; i < TAR_BLOCK_SIZE; ++i) {
+        bool is_checksum = i >= offsetof(tar_header_t, checksum) &&
+                           i < offsetof(tar_header_t, checksum) + sizeof(header->checksum);
+        sum += is_checksum ? ' ' : block[i];
+    }
+    return sum == tar_number(header->checksum, sizeof(header->checksum));
+}
+
+/*!
+ * @brief read_long_name reads the data of a GNU long name ('L') or pax ('x') member, which sets the name of the next
+ * member
+ * @param reader the reader
+ * @param type the member type
+ * @param size the member data size
+ * @param name set to the name of the next member, unchanged if the pax header has no path
+ * @return true if the member was read, false else
+ */
+static bool read_long_name(archive_reader_t *reader, char type, uint64_t size, char *name) {
+    uint64_t blocks_size = (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+    if (size >= 64 * STR_MAX_LEN) {
+        return archive_skip(reader, blocks_size);
+    }
+    char *data = malloc(blocks_size + 1);
+    if (!data || fread(data, 1, blocks_size, reader->stream) != blocks_size) {
+        free(data);
+        return false;
+    }
+    data[size] = '\0';
+    if (type == 'L') {
+        strncpy(name, data, STR_MAX_LEN - 1);
+        name[STR_MAX_LEN - 1] = '\0';
+    }
+    // pax records: "<length> <key>=<value>\n"
+    for (char *record = data; type == 'x' && record < data + size;) {
+        char *key = strchr(record, ' ');
+        uint64_t length = strtoull(record, NULL, 10);
+        if (!key || length == 0 || record + length > data + size) {
+            break;
+        }
+        if (strncmp(key + 1, "path=", 5) == 0) {
+            size_t name_length = record + length - 1 - (key + 6);
+            if (name_length < STR_MAX_LEN) {
+                memcpy(name, key + 6, name_length);
+                name[name_length] = '\0';
+            }
+        }
+        record += length;
+    }
+    free(data);
+    return true;
+}
+
+/*!
+ * @brief archive_next moves to the next regular file of the archive. The data of the current member must have been
+ * read or skipped (@see archive_read_header).
+ * @param reader the reader
+ * @return 1 if a member was found (its name in reader->name), 0 at the end of the archive, -1 if the archive is
+ * truncated or corrupted
+ */
+static int archive_next(archive_reader_t *reader) {
+    unsigned char block[TAR_BLOCK_SIZE];
+    char long_name[STR_MAX_LEN] = "";
+    while (fread(block, 1, TAR_BLOCK_SIZE, reader->stream) == TAR_BLOCK_SIZE) {
+        tar_header_t *header = (tar_header_t *) block;
+        if (header->name[0] == '\0' && tar_number(header->checksum, sizeof(header->checksum)) == 0) {
+            return 0; // End of archive (zero blocks)
+        }
+        if (!tar_checksum_matches(block)) {
+            return -1;
+        }
+        uint64_t size = tar_number(header->size, sizeof(header->size));
+        uint64_t padding = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+        if (header->type == 'L' || header->type == 'x') {
+            if (!read_long_name(reader, header->type, size, long_name)) {
+                return -1;
+            }
+        } else if (header->type == '0' || header->type == '\0' || header->type == '7') {
+            if (long_name[0] != '\0') {
+                strncpy(reader->name, long_name, STR_MAX_LEN);
+            } else if (header->prefix[0] != '\0' && memcmp(header->magic, "ustar", 5) == 0) {
+                snprintf(reader->name, STR_MAX_LEN, "%.155s/%.100s", header->prefix, header->name);
+            } else {
+                snprintf(reader->name, STR_MAX_LEN, "%.100s", header->name);
+            }
+            reader->data_left = size;
+            reader->padding_left = padding;
+            return 1;
+        } else if (!archive_skip(reader, size + padding)) {
+            return -1; // Directories, links, pax global headers...
+        }
+    }
+    return -1; // No end of archive blocks: the stream was cut
+}
+
+/*!
+ * @brief archive_read_header appends the header of the current member to a buffer (up to and including the blank
+ * line which ends it) and skips the body, so that only the part of the mail the parser reads is kept
+ * @param reader the reader
+ * @param buffer the buffer to append to
+ * @return true if the member was read, false if the archive is truncated or memory is exhausted
+ */
+static bool archive_read_header(archive_reader_t *reader, growable_buffer_t *buffer) {
+    size_t start = buffer->length;
+    bool is_header_read = false;
+    char chunk[16 * TAR_BLOCK_SIZE];
+    while (reader->data_left > 0 && !is_header_read) {
+        size_t length = reader->data_left < sizeof(chunk) ? reader->data_left : sizeof(chunk);
+        if (fread(chunk, 1, length, reader->stream) != length || !growable_buffer_append(buffer, chunk, length)) {
+            return false;
+        }
+        reader->data_left -= length;
+        // The blank line may straddle two chunks: look from just before the new data
+        size_t from = buffer->length - length > start + 2 ? buffer->length - length - 2 : start;
+        char *end = memmem(buffer->data + from, buffer->length - from, "\n\n", 2);
+        char *crlf_end = memmem(buffer->data + from, buffer->length - from, "\n\r\n", 3);
+        if (crlf_end && (!end || crlf_end < end)) {
+            end = crlf_end + 1;
+        }
+        if (end) {
+            buffer->length = end + 2 - buffer->data;
+            is_header_read = true;
+        }
+    }
+    bool success = archive_skip(reader, reader->data_left + reader->padding_left);
+    reader->data_left = 0;
+    reader->padding_left = 0;
+    return success;
+}
+
+/*!
+ * @brief batch_add reads the current member of an archive into a batch
+ * @param batch the batch
+ * @param archive the archive path, prefixed to the member name for the rejected files log and skip list
+ * @param reader the reader, on a member
+ * @return true if the mail was added, false else
+ */
+static bool batch_add(mail_batch_t *batch, char *archive, archive_reader_t *reader) {
+    if (batch->count == batch->capacity) {
+        size_t capacity = batch->capacity ? 2 * batch->capacity : ARCHIVE_BATCH_MAILS;
+        batched_mail_t *mails = realloc(batch->mails, capacity * sizeof(batched_mail_t));
+        if (!mails) {
+            return false;
+        }
+        batch->mails = mails;
+        batch->capacity = capacity;
+    }
+    batched_mail_t *mail = &batch->mails[batch->count];
+    char name[STR_MAX_LEN];
+    concat_path(archive, reader->name, name);
+    mail->name_offset = batch->data.length;
+    if (!growable_buffer_append(&batch->data, name, strlen(name) + 1)) {
+        return false;
+    }
+    mail->header_offset = batch->data.length;
+    if (!archive_read_header(reader, &batch->data)) {
+        return false;
+    }
+    mail->header_length = batch->data.length - mail->header_offset;
+    ++batch->count;
+    return true;
+}
+
+/*!
+ * @brief parse_batch parses the mails of a batch, as parse_file does for mail files
+ * @param batch the batch
+ * @param output_file the output stream
+ */
+static void parse_batch(mail_batch_t *batch, FILE *output_file) {
+    for (size_t i = 0; i < batch->count; ++i) {
+        batched_mail_t *mail = &batch->mails[i];
+        char *name = batch->data.data + mail->name_offset;
+        if (file_errors_skip(name)) {
+            metrics_file_skipped();
+            continue;
+        }
+        uint64_t start_us = metrics_now_us();
+        file_status_t status = FILE_STATUS_MALFORMED_HEADER; // Empty member
+        FILE *header = mail->header_length > 0 ? fmemopen(batch->data.data + mail->header_offset,
+                                                          mail->header_length, "r") : NULL;
+        if (header) {
+            status = parse_mail(header, output_file);
+            fclose(header);
+        }
+        metrics_file_parsed(mail->header_length, metrics_now_us() - start_us, status);
+        file_errors_record(name, status);
+    }
+}
+
+/*!
+ * @brief wait_for_batch waits for a batch worker to end. The decompressor is a child too: when it is the one which
+ * ended, its status is kept for archive_close and another child is waited for.
+ * @param reader the archive reader
+ * @return true if a batch worker ended, false if there is none left
+ */
+static bool wait_for_batch(archive_reader_t *reader) {
+    int status;
+    pid_t pid;
+    while ((pid = wait(&status)) != -1 || errno == EINTR) {
+        if (pid > 0 && pid == reader->decompressor) {
+            reader->decompressor_status = status;
+            reader->decompressor = 0;
+        } else if (pid > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * @brief dispatch_batch parses a batch: in a new worker when workers are allowed, so that the parent reads the next
+ * batch meanwhile, else in the calling process. The batch is emptied.
+ * @param batch the batch
+ * @param reader the archive reader (its decompressor may be reaped while waiting for a worker)
+ * @param output_file the output stream
+ * @param nb_proc the maximum number of simultaneous workers, 1 or less to parse in the calling process
+ * @param running the number of running workers, updated
+ * @param tasks_count the number of batches dispatched so far, updated
+ */
+static void dispatch_batch(mail_batch_t *batch, archive_reader_t *reader, FILE *output_file, uint16_t nb_proc,
+                           uint16_t *running, uint32_t *tasks_count) {
+    uint64_t task_start_us = metrics_now_us();
+    metrics_task_dispatched();
+    pid_t pid = -1;
+    if (nb_proc > 1) {
+        while (*running >= nb_proc && wait_for_batch(reader)) {
+            --*running;
+        }
+        pid = fork();
+    }
+    if (pid <= 0) {
+        if (pid == 0) {
+            // The archive offset is shared with the parent: exit must not seek it back to what this copy has consumed
+            close(fileno(reader->stream));
+            metrics_set_worker(*tasks_count);
+            trace_set_worker(*tasks_count);
+            scheduling_pin_worker(*tasks_count);
+        }
+        parse_batch(batch, output_file);
+        metrics_task_done();
+        trace_record(TRACE_FILE_TASK, task_start_us, metrics_now_us(), batch->data.data + batch->mails[0].name_offset);
+        if (pid == 0) {
+            release_mail_caches(); // Writes the last lines of a compressed output
+            exit(EXIT_SUCCESS);
+        }
+    } else {
+        ++*running;
+    }
+    ++*tasks_count;
+    batch->data.length = 0;
+    batch->count = 0;
+}
+
+/*!
+ * @brief analyze_archive analyzes the mails of an archive in a pipeline: a decompressor process, the reading of the
+ * members by the calling process, and the parsing of batches of their headers by up to nb_proc workers. No file is
+ * written but the output.
+ * @param archive the archive path
+ * @param output_file the output stream
+ * @param nb_proc the maximum number of parsing workers, 1 or less to parse in the calling process
+ * @return true if the whole archive was analyzed, false else
+ */
+static bool analyze_archive(char *archive, FILE *output_file, uint16_t nb_proc) {
+    archive_reader_t reader;
+    if (!archive_open(&reader, archive)) {
+        printf("Cannot read archive %s\n", archive);
+        return false;
+    }
+    mail_batch_t batch = {0};
+    uint16_t running = 0;
+    uint32_t tasks_count = 0;
+    int result;
+    while ((result = archive_next(&reader)) > 0) {
+        if (!batch_add(&batch, archive, &reader)) {
+            result = -1;
+            break;
+        }
+        if (batch.count >= ARCHIVE_BATCH_MAILS || batch.data.length >= ARCHIVE_BATCH_BYTES) {
+            dispatch_batch(&batch, &reader, output_file, nb_proc, &running, &tasks_count);
+        }
+    }
+    if (batch.count > 0) {
+        dispatch_batch(&batch, &reader, output_file, nb_proc, &running, &tasks_count);
+    }
+    while (running > 0 && wait_for_batch(&reader)) {
+        --running;
+    }
+    bool is_decompressed = archive_close(&reader);
+    growable_buffer_free(&batch.data);
+    free(batch.mails);
+    if (result < 0 || !is_decompressed) {
+        printf("Archive %s is truncated or corrupted, its analysis is incomplete\n", archive);
+    }
+    return result == 0 && is_decompressed;
+}
+
+/*!
+ * @brief analyze_archives analyzes the mails of archives into step2_output, without extracting them: the data source
+ * is either one archive, whose parsing is shared between workers, or a directory of archives, each analyzed by its own
+ * worker (decompressions then run in parallel)
+ * @param data_source the archive, or the directory of archives
+ * @param output the path to the output file (step2_output), emptied first
+ * @param nb_proc the maximum number of simultaneous workers
+ * @return true if all the archives were analyzed, false else
+ */
+bool analyze_archives(char *data_source, char *output, uint16_t nb_proc) {
+    int output_fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (output_fd != -1) {
+        close(output_fd);
+    }
+    FILE *output_file = prepare_mail_output(output); // Inherited by all the workers
+    if (!output_file) {
+        perror("Cannot open step2_output");
+        return false;
+    }
+    if (archive_format(data_source) != ARCHIVE_NONE) {
+        bool success = analyze_archive(data_source, output_file, nb_proc);
+        release_mail_caches();
+        return success;
+    }
+
+    DIR *dir = opendir(data_source);
+    if (!dir) {
+        release_mail_caches();
+        return false;
+    }
+    bool success = true;
+    uint16_t running = 0;
+    uint32_t tasks_count = 0;
+    char path[STR_MAX_LEN];
+    struct dirent *entry;
+    while ((entry = next_dir(NULL, dir)) != NULL) {
+        concat_path(data_source, entry->d_name, path);
+        if (archive_format(path) == ARCHIVE_NONE) {
+            continue;
+        }
+        for (int status; running >= nb_proc && wait(&status) != -1; --running) {
+            success = success && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+        }
+        metrics_task_dispatched();
+        pid_t pid = fork();
+        if (pid == 0) {
+            uint64_t task_start_us = metrics_now_us();
+            metrics_set_worker(tasks_count);
+            trace_set_worker(tasks_count);
+            scheduling_pin_worker(tasks_count);
+            closedir(dir);
+            bool is_analyzed = analyze_archive(path, output_file, 1);
+            trace_record(TRACE_DIRECTORY_TASK, task_start_us, metrics_now_us(), path);
+            release_mail_caches();
+            exit(is_analyzed ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+        if (pid == -1) {
+            success = analyze_archive(path, output_file, 1) && success;
+        } else {
+            ++running;
+            ++tasks_count;
+        }
+    }
+    for (int status; running > 0 && wait(&status) != -1; --running) {
+        success = success && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+    }
+    closedir(dir);
+    release_mail_caches();
+    return success;
+}
@@ -0,0 +1,29 @@
+//
+// Created on 19/10/26.
+//
+
+#ifndef A2022_ARCHIVE_INPUT_H
+#define A2022_ARCHIVE_INPUT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TAR_BLOCK_SIZE 512
+// Mails are parsed by batches: one worker per batch, while the parent reads the next one from the archive
+#define ARCHIVE_BATCH_MAILS 1024
+#define ARCHIVE_BATCH_BYTES (1 << 22)
+// Decompressors are separate processes writing to a pipe, enlarged so that they run ahead of the parent
+#define ARCHIVE_PIPE_SIZE (1 << 20)
+
+typedef enum {
+    ARCHIVE_NONE, // Not an archive (e.g. a maildir directory)
+    ARCHIVE_TAR,
+    ARCHIVE_GZIP, // Read through "gzip -dc"
+    ARCHIVE_ZSTD, // Read through "zstd -dc"
+} archive_format_t;
+
+archive_format_t archive_format(char *path);
+bool is_archive_input(char *data_source);
+bool analyze_archives(char *data_source, char *output, uint16_t nb_proc);
+
+#endif //A2022_ARCHIVE_INPUT_H
@@ -0,0 +1,614 @@
+//
+// Created on 19/10/26.
+//
+
+#define _GNU_SOURCE // fopencookie
+
+#include "block_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Blocks are LZ4-style sequences: a token (literals count, match length - 4), the literals, then a 2 bytes offset
+// back in the decompressed data and the match. Counts of 15 or more continue in the next bytes (255 meaning more).
+#define MIN_MATCH 4
+#define HASH_BITS 13
+// The last literals are never searched for a match (and a match never reads past the end of the block)
+#define LAST_LITERALS 8
+
+// Writers compress with this flag (@see open_intermediate), readers detect block files whatever its value
+static bool intermediates_compressed = false;
+
+// Bytes buffered by the writers of this process, and the writes of their blocks so far: a worker tells from them
+// whether the lines of its last tasks reached the file (@see block_file_pending_bytes)
+static size_t writers_pending_bytes = 0;
+static uint64_t writers_flushes = 0;
+
+typedef struct {
+    int fd;
+    char *pending; // Lines not written yet, less than a block once written
+    size_t pending_length;
+    size_t pending_capacity;
+} block_writer_t;
+
+typedef struct {
+    int fd;
+    off_t position; // Offset of the next block
+    off_t end;      // Blocks starting at or after this offset are not read
+    char *raw;      // Current decompressed block
+    size_t raw_length;
+    size_t raw_offset;
+    char *packed;
+} block_reader_t;
+
+/*!
+ * @brief read_le32 reads 4 bytes of possibly unaligned data
+ */
+static uint32_t read_le32(const char *data) {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+/*!
+ * @brief write_count writes the continuation bytes of a literals count or match length (@see block_compress)
+ * @param destination where to write
+ * @param end the end of the destination buffer
+ * @param count the count minus 15
+ * @return the position after the written bytes, NULL if they do not fit
+ */
+static char *write_count(char *destination, char *end, size_t count) {
+    for (; count >= 255; count -= 255) {
+        if (destination >= end) {
+            return NULL;
+        }
+        *destination++ = (char) 255;
+    }
+    if (destination >= end) {
+        return NULL;
+    }
+    *destination++ = (char) count;
+    return destination;
+}
+
+/*!
+ * @brief write_sequence writes literals followed by a match (none when match_length is 0, for the last literals)
+ * @param destination where to write
+ * @param end the end of the destination buffer
+ * @param literals the literals
+ * @param literals_length the number of literals
+ * @param offset the distance back to the match
+ * @param match_length the match length, 0 or at least MIN_MATCH
+ * @return the position after the sequence, NULL if it does not fit
+ */
+static char *write_sequence(char *destination, char *end, const char *literals, size_t literals_length,
+                            size_t offset, size_t match_length) {
+    size_t match_code = match_length ? match_length - MIN_MATCH : 0;
+    if (destination >= end) {
+        return NULL;
+    }
+    size_t literals_code = literals_length < 15 ? literals_length : 15;
+    *destination++ = (char) ((literals_code << 4) | (match_code < 15 ? match_code : 15));
+    if (literals_length >= 15 && !(destination = write_count(destination, end, literals_length - 15))) {
+        return NULL;
+    }
+    if ((size_t) (end - destination) < literals_length) {
+        return NULL;
+    }
+    memcpy(destination, literals, literals_length);
+    destination += literals_length;
+    if (match_length == 0) {
+        return destination;
+    }
+    if (end - destination < 2) {
+        return NULL;
+    }
+    *destination++ = (char) (offset & 0xff);
+    *destination++ = (char) (offset >> 8);
+    return match_code >= 15 ? write_count(destination, end, match_code - 15) : destination;
+}
+
+/*!
+ * @brief block_compress compresses a block: repeated sequences of at least MIN_MATCH bytes, found with a hash table
+ * of the last position of each 4 bytes sequence, are replaced with a reference to their previous occurrence. Paths
+ * sharing their directories and addresses sharing their domains compress well, at the cost of a single pass.
+ * @param source the data to compress, BLOCK_FILE_SIZE bytes at most
+ * @param length the data length
+ * @param destination where to write the compressed data
+ * @param capacity the destination size: compression stops when the data does not fit
+ * @return the compressed size, 0 if it does not fit in capacity
+ */
+size_t block_compress(const char *source, size_t length, char *destination, size_t capacity) {
+    uint16_t positions[1 << HASH_BITS]; // Position + 1 of the last sequence with this hash, 0 for none
+    memset(positions, 0, sizeof(positions));
+    char *output = destination, *end = destination + capacity;
+    size_t anchor = 0, position = 0;
+    while (length > LAST_LITERALS && position < length - LAST_LITERALS) {
+        uint32_t sequence = read_le32(source + position);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - HASH_BITS);
+        size_t candidate = positions[hash];
+        positions[hash] = (uint16_t) (position + 1);
+        if (candidate == 0 || read_le32(source + candidate - 1) != sequence) {
+            // Unmatched data is skipped faster the longer it lasts
+            position += 1 + ((position - anchor) >> 6);
+            continue;
+        }
+        size_t match = candidate - 1, match_length = MIN_MATCH;
+        while (position + match_length < length - LAST_LITERALS &&
+               source[match + match_length] == source[position + match_length]) {
+            ++match_length;
+        }
+        output = write_sequence(output, end, source + anchor, position - anchor, position - match, match_length);
+        if (!output) {
+            return 0;
+        }
+        position += match_length;
+        anchor = position;
+    }
+    output = write_sequence(output, end, source + anchor, length - anchor, 0, 0);
+    return output ? (size_t) (output - destination) : 0;
+}
+
+/*!
+ * @brief read_count reads the continuation bytes of a literals count or match length
+ * @param source the compressed data, updated
+ * @param end the end of the compressed data
+ * @param count the count to complete
+ * @return true if the count was read, false if the data ends first
+ */
+static bool read_count(const char **source, const char *end, size_t *count) {
+    unsigned char byte;
+    do {
+        if (*source >= end) {
+            return false;
+        }
+        byte = (unsigned char) *(*source)++;
+        *count += byte;
+    } while (byte == 255);
+    return true;
+}
+
+/*!
+ * @brief block_decompress decompresses a block, checking every count and offset against the buffers, so that a
+ * corrupted block is reported instead of read or written out of bounds
+ * @param source the compressed data
+ * @param length the compressed data length
+ * @param destination where to write the data
+ * @param raw_size the decompressed size (from the block header)
+ * @return true if exactly raw_size bytes were decompressed, false if the block is corrupted
+ */
+bool block_decompress(const char *source, size_t length, char *destination, size_t raw_size) {
+    const char *end = source + length;
+    size_t written = 0;
+    while (source < end) {
+        unsigned char token = (unsigned char) *source++;
+        size_t literals_length = token >> 4, match_length = token & 15;
+        if (literals_length == 15 && !read_count(&source, end, &literals_length)) {
+            return false;
+        }
+        if ((size_t) (end - source) < literals_length || raw_size - written < literals_length) {
+            return false;
+        }
+        memcpy(destination + written, source, literals_length);
+        source += literals_length;
+        written += literals_length;
+        if (source == end) {
+            break; // Last literals
+        }
+        if (end - source < 2) {
+            return false;
+        }
+        size_t offset = (unsigned char) source[0] | ((size_t) (unsigned char) source[1] << 8);
+        source += 2;
+        if (match_length == 15 && !read_count(&source, end, &match_length)) {
+            return false;
+        }
+        match_length += MIN_MATCH;
+        if (offset == 0 || offset > written || raw_size - written < match_length) {
+            return false;
+        }
+        // Byte by byte: the match may overlap the data it produces (e.g. a run of a single character)
+        for (size_t i = 0; i < match_length; ++i, ++written) {
+            destination[written] = destination[written - offset];
+        }
+    }
+    return written == raw_size;
+}
+
+/*!
+ * @brief set_intermediates_compressed enables or disables the compression of the intermediate files written from now
+ * on, in this process and the ones it forks (@see open_intermediate)
+ * @param compressed true to write block files, false for plain text (default)
+ */
+void set_intermediates_compressed(bool compressed) {
+    intermediates_compressed = compressed;
+}
+
+/*!
+ * @brief are_intermediates_compressed tells if intermediate files are written as block files
+ * @return true if they are compressed, false else
+ */
+bool are_intermediates_compressed() {
+    return intermediates_compressed;
+}
+
+/*!
+ * @brief write_all writes a whole buffer to a file descriptor
+ * @return true if all was written, false else
+ */
+static bool write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+/*!
+ * @brief write_block compresses and writes one block with a single write, so that blocks appended by concurrent
+ * writers (O_APPEND) never interleave
+ * @param fd the file descriptor
+ * @param data the block data, BLOCK_FILE_SIZE bytes at most
+ * @param length the data length
+ * @param packed a buffer of sizeof(block_header_t) + BLOCK_FILE_SIZE bytes
+ * @return true if the block was written, false else
+ */
+static bool write_block(int fd, const char *data, size_t length, char *packed) {
+    char *payload = packed + sizeof(block_header_t);
+    size_t packed_size = block_compress(data, length, payload, length - length / BLOCK_FILE_MIN_SAVING);
+    if (packed_size == 0) {
+        memcpy(payload, data, length);
+        packed_size = length;
+    }
+    block_header_t header = {.magic = BLOCK_FILE_MAGIC, .raw_size = length, .packed_size = packed_size};
+    memcpy(packed, &header, sizeof(header));
+    return write_all(fd, packed, sizeof(header) + packed_size);
+}
+
+/*!
+ * @brief write_blocks writes data as blocks of whole lines: each block ends at the last line break of its
+ * BLOCK_FILE_SIZE bytes (or holds BLOCK_FILE_SIZE bytes of a longer line)
+ * @param fd the file descriptor
+ * @param data the data
+ * @param length the data length
+ * @param is_last true to write all data, false to keep the last line if it is incomplete and shorter than a block
+ * @param packed a buffer of sizeof(block_header_t) + BLOCK_FILE_SIZE bytes
+ * @return the number of bytes written, -1 on error
+ */
+static ssize_t write_blocks(int fd, const char *data, size_t length, bool is_last, char *packed) {
+    size_t offset = 0;
+    while (offset < length) {
+        size_t size = length - offset < BLOCK_FILE_SIZE ? length - offset : BLOCK_FILE_SIZE;
+        const char *line_end = memrchr(data + offset, '\n', size);
+        if (line_end && (size == BLOCK_FILE_SIZE || !is_last)) {
+            size = line_end + 1 - (data + offset);
+        } else if (!line_end && size < BLOCK_FILE_SIZE && !is_last) {
+            break;
+        }
+        if (!write_block(fd, data + offset, size, packed)) {
+            return -1;
+        }
+        offset += size;
+    }
+    return offset;
+}
+
+/*!
+ * @brief block_file_write writes the whole lines of a buffer at the end of a file, as blocks. The last line is kept
+ * when it is incomplete and shorter than a block: the writer passes it again with its end.
+ * @param fd the file descriptor
+ * @param data the data
+ * @param length the data length
+ * @param written set to the number of bytes written
+ * @param is_last true to write all data (the end of the file)
+ * @return true if no error happened, false else
+ */
+bool block_file_write(int fd, const char *data, size_t length, size_t *written, bool is_last) {
+    char *packed = malloc(sizeof(block_header_t) + BLOCK_FILE_SIZE);
+    ssize_t result = packed ? write_blocks(fd, data, length, is_last, packed) : -1;
+    free(packed);
+    *written = result > 0 ? result : 0;
+    return result != -1;
+}
+
+/*!
+ * @brief writer_flush writes the whole lines buffered by a writer, keeping the last line if it is incomplete
+ * @param writer the writer
+ * @param is_last true to write all the data
+ * @return true if no error happened, false else
+ */
+static bool writer_flush(block_writer_t *writer, bool is_last) {
+    size_t written;
+    if (!block_file_write(writer->fd, writer->pending, writer->pending_length, &written, is_last)) {
+        return false;
+    }
+    memmove(writer->pending, writer->pending + written, writer->pending_length - written);
+    writer->pending_length -= written;
+    writers_pending_bytes -= written;
+    writers_flushes += written > 0;
+    return true;
+}
+
+/*!
+ * @brief writer_write buffers data until a block of lines is ready (fopencookie callback). The lines buffered so far
+ * are written first when the data would make them exceed a block: callers which write whole lines at once (e.g. all
+ * the lines of a mail) find each of their writes whole in one block, written with a single write.
+ */
+static ssize_t writer_write(void *cookie, const char *data, size_t length) {
+    block_writer_t *writer = cookie;
+    if (writer->pending_length > 0 && writer->pending_length + length > BLOCK_FILE_SIZE &&
+        !writer_flush(writer, false)) {
+        return -1;
+    }
+    if (writer->pending_length + length > writer->pending_capacity) {
+        size_t capacity = writer->pending_capacity;
+        while (capacity < writer->pending_length + length) {
+            capacity = 2 * capacity;
+        }
+        char *grown = realloc(writer->pending, capacity);
+        if (!grown) {
+            return -1;
+        }
+        writer->pending = grown;
+        writer->pending_capacity = capacity;
+    }
+    memcpy(writer->pending + writer->pending_length, data, length);
+    writer->pending_length += length;
+    writers_pending_bytes += length;
+    if (writer->pending_length >= BLOCK_FILE_SIZE && !writer_flush(writer, false)) {
+        return -1;
+    }
+    return length;
+}
+
+/*!
+ * @brief writer_close writes the last block and closes the file (fopencookie callback)
+ */
+static int writer_close(void *cookie) {
+    block_writer_t *writer = cookie;
+    bool success = writer_flush(writer, true);
+    writers_pending_bytes -= writer->pending_length; // Left on error
+    success = close(writer->fd) == 0 && success;
+    free(writer->pending);
+    free(writer);
+    return success ? 0 : EOF;
+}
+
+/*!
+ * @brief block_file_pending_bytes tells how many bytes the block writers of this process buffer
+ * @return the bytes written to the open block files and not in the files yet
+ */
+size_t block_file_pending_bytes() {
+    return writers_pending_bytes;
+}
+
+/*!
+ * @brief block_file_flushes counts the writes of blocks by the block writers of this process
+ * @return the writes so far
+ */
+uint64_t block_file_flushes() {
+    return writers_flushes;
+}
+
+/*!
+ * @brief read_all reads a whole buffer at an offset
+ * @return true if all was read, false at the end of the file or on error
+ */
+static bool read_all(int fd, char *data, size_t length, off_t offset) {
+    while (length > 0) {
+        ssize_t result = pread(fd, data, length, offset);
+        if (result == -1 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            return false;
+        }
+        data += result;
+        offset += result;
+        length -= result;
+    }
+    return true;
+}
+
+/*!
+ * @brief read_block_header reads and checks the header of a block
+ * @param fd the file descriptor
+ * @param offset the block offset
+ * @param header the header to fill
+ * @return 1 if a header was read, 0 at the end of the file, -1 if the data is not a block
+ */
+static int read_block_header(int fd, off_t offset, block_header_t *header) {
+    ssize_t length;
+    while ((length = pread(fd, header, sizeof(block_header_t), offset)) == -1 && errno == EINTR) {
+    }
+    if (length == 0) {
+        return 0;
+    }
+    bool is_valid = length == sizeof(block_header_t) && header->magic == BLOCK_FILE_MAGIC &&
+                    header->raw_size <= BLOCK_FILE_SIZE && header->packed_size <= header->raw_size;
+    return is_valid ? 1 : -1;
+}
+
+/*!
+ * @brief reader_read gives decompressed data, reading the next block when the current one is consumed (fopencookie
+ * callback). Data is read with pread: the file offset shared with forked processes is never moved.
+ */
+static ssize_t reader_read(void *cookie, char *data, size_t length) {
+    block_reader_t *reader = cookie;
+    while (reader->raw_offset == reader->raw_length) {
+        block_header_t header;
+        int result = reader->position < reader->end ? read_block_header(reader->fd, reader->position, &header) : 0;
+        if (result == 0) {
+            return 0;
+        }
+        off_t payload = reader->position + sizeof(block_header_t);
+        bool is_read = result == 1 && read_all(reader->fd, reader->packed, header.packed_size, payload);
+        if (is_read && header.packed_size == header.raw_size) {
+            memcpy(reader->raw, reader->packed, header.raw_size);
+        } else if (is_read) {
+            is_read = block_decompress(reader->packed, header.packed_size, reader->raw, header.raw_size);
+        }
+        if (!is_read) {
+            errno = EIO;
+            return -1; // Truncated or corrupted block
+        }
+        reader->position = payload + header.packed_size;
+        reader->raw_length = header.raw_size;
+        reader->raw_offset = 0;
+    }
+    size_t available = reader->raw_length - reader->raw_offset;
+    if (length > available) {
+        length = available;
+    }
+    memcpy(data, reader->raw + reader->raw_offset, length);
+    reader->raw_offset += length;
+    return length;
+}
+
+/*!
+ * @brief reader_close closes the file (fopencookie callback)
+ */
+static int reader_close(void *cookie) {
+    block_reader_t *reader = cookie;
+    int result = close(reader->fd);
+    free(reader->raw);
+    free(reader->packed);
+    free(reader);
+    return result == 0 ? 0 : EOF;
+}
+
+/*!
+ * @brief open_reader opens a stream of the decompressed blocks of a file starting between two offsets
+ * @param fd the opened file, closed with the stream (or on failure)
+ * @param start the offset of the first block
+ * @param end the offset from which blocks are not read
+ * @return the stream, NULL on failure
+ */
+static FILE *open_reader(int fd, off_t start, off_t end) {
+    block_reader_t *reader = calloc(1, sizeof(block_reader_t));
+    FILE *stream = NULL;
+    if (reader && (reader->raw = malloc(BLOCK_FILE_SIZE)) && (reader->packed = malloc(BLOCK_FILE_SIZE))) {
+        reader->fd = fd;
+        reader->position = start;
+        reader->end = end;
+        stream = fopencookie(reader, "r", (cookie_io_functions_t) {.read = reader_read, .close = reader_close});
+    }
+    if (!stream) {
+        if (reader) {
+            free(reader->raw);
+            free(reader->packed);
+        }
+        free(reader);
+        close(fd);
+    }
+    return stream;
+}
+
+/*!
+ * @brief block_file_open opens a file for reading, or for writing as blocks. A file read is decompressed if it is a
+ * block file, and read as is else: readers need not know how their input was written.
+ * @param path the file path
+ * @param mode "r", "w" or "a" (see fopen)
+ * @return the stream, NULL on failure (with errno set)
+ */
+FILE *block_file_open(char *path, char *mode) {
+    if (mode[0] == 'r') {
+        int fd = open(path, O_RDONLY);
+        if (fd == -1) {
+            return NULL;
+        }
+        uint32_t magic = 0;
+        if (pread(fd, &magic, sizeof(magic), 0) == sizeof(magic) && magic == BLOCK_FILE_MAGIC) {
+            return open_reader(fd, 0, (off_t) INT64_MAX);
+        }
+        FILE *stream = fdopen(fd, "r");
+        if (!stream) {
+            close(fd);
+        }
+        return stream;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | (mode[0] == 'a' ? O_APPEND : O_TRUNC), 0644);
+    if (fd == -1) {
+        return NULL;
+    }
+    block_writer_t *writer = calloc(1, sizeof(block_writer_t));
+    FILE *stream = NULL;
+    if (writer && (writer->pending = malloc(2 * BLOCK_FILE_SIZE))) {
+        writer->fd = fd;
+        writer->pending_capacity = 2 * BLOCK_FILE_SIZE;
+        stream = fopencookie(writer, "w", (cookie_io_functions_t) {.write = writer_write, .close = writer_close});
+    }
+    if (!stream) {
+        if (writer) {
+            free(writer->pending);
+        }
+        free(writer);
+        close(fd);
+    }
+    return stream;
+}
+
+/*!
+ * @brief open_intermediate opens an intermediate file: written as blocks when intermediates are compressed (@see
+ * set_intermediates_compressed), read whatever the way it was written
+ * @param path the file path
+ * @param mode "r", "w" or "a" (see fopen)
+ * @return the stream, NULL on failure
+ */
+FILE *open_intermediate(char *path, char *mode) {
+    return mode[0] == 'r' || intermediates_compressed ? block_file_open(path, mode) : fopen(path, mode);
+}
+
+/*!
+ * @brief block_file_open_part opens a stream of the blocks starting in a part of a block file, so that parts cut at
+ * any offsets share the blocks between readers. Only the headers of the blocks before the part are read.
+ * @param path the block file path
+ * @param start the first offset of the part
+ * @param end the offset after the part
+ * @return the stream, NULL on failure
+ */
+FILE *block_file_open_part(char *path, off_t start, off_t end) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    off_t position = 0;
+    block_header_t header;
+    while (position < start && read_block_header(fd, position, &header) == 1) {
+        position += sizeof(block_header_t) + header.packed_size;
+    }
+    return open_reader(fd, position, position < start ? position : end); // Nothing to read if the blocks end first
+}
+
+/*!
+ * @brief block_file_stat sums the sizes of the blocks of a file, reading only their headers
+ * @param path the file path
+ * @param stats set to the blocks count and sizes
+ * @return true if the file is a block file, false else
+ */
+bool block_file_stat(char *path, block_file_stats_t *stats) {
+    *stats = (block_file_stats_t) {0};
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    block_header_t header;
+    int result;
+    while ((result = read_block_header(fd, stats->packed_bytes, &header)) == 1) {
+        ++stats->blocks;
+        stats->raw_bytes += header.raw_size;
+        stats->packed_bytes += sizeof(block_header_t) + header.packed_size;
+    }
+    close(fd);
+    return result == 0 && stats->blocks > 0;
+}
@@ -0,0 +1,46 @@
+//
+// Created on 19/10/26.
+//
+
+#ifndef A2022_BLOCK_FILE_H
+#define A2022_BLOCK_FILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+// Compressed files are a plain sequence of blocks, without any file header: block files concatenate (files_list_reducer
+// copies them as they are) and appending writers never rewrite what others wrote. Each block holds whole lines (unless
+// a line is longer than a block), so that a reader may start at any block.
+#define BLOCK_FILE_MAGIC 0x4B42504Cu // "LPBK"
+#define BLOCK_FILE_SIZE (1 << 16)    // Uncompressed bytes per block at most, also the farthest a match may refer to
+// A block is only stored compressed when it saves at least 1/16 of its size
+#define BLOCK_FILE_MIN_SAVING 16
+
+typedef struct {
+    uint32_t magic;
+    uint32_t raw_size;    // Uncompressed size
+    uint32_t packed_size; // Size of the data after the header, raw_size for a block stored as is
+} block_header_t;
+
+typedef struct {
+    uint64_t blocks;
+    uint64_t raw_bytes;
+    uint64_t packed_bytes; // With the block headers
+} block_file_stats_t;
+
+size_t block_compress(const char *source, size_t length, char *destination, size_t capacity);
+bool block_decompress(const char *source, size_t length, char *destination, size_t raw_size);
+
+void set_intermediates_compressed(bool compressed);
+bool are_intermediates_compressed();
+FILE *block_file_open(char *path, char *mode);
+FILE *open_intermediate(char *path, char *mode);
+FILE *block_file_open_part(char *path, off_t start, off_t end);
+bool block_file_write(int fd, const char *data, size_t length, size_t *written, bool is_last);
+size_t block_file_pending_bytes();
+uint64_t block_file_flushes();
+bool block_file_stat(char *path, block_file_stats_t *stats);
+
+#endif //A2022_BLOCK_FILE_H
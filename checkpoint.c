@@ -0,0 +1,224 @@
+//
+// Created on 19/10/26.
+//
+
+#include "checkpoint.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "analysis.h"
+#include "block_file.h"
+#include "global_defs.h"
+#include "metrics.h"
+#include "utility.h"
+
+// Set up by the parent only: workers never checkpoint. An empty path disables checkpoints (ephemeral intermediates).
+static char checkpoint_path[STR_MAX_LEN] = "";
+static char temporary_path[STR_MAX_LEN] = "";
+static checkpoint_record_t record;
+static uint64_t last_checkpoint_us = 0;
+
+/*!
+ * @brief source_hash hashes the data source path (FNV-1a)
+ * @param data_source the data source path
+ * @return the hash
+ */
+static uint64_t source_hash(char *data_source) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (char *c = data_source; *c; ++c) {
+        hash = (hash ^ (unsigned char) *c) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+/*!
+ * @brief analysis_settings_hash hashes the settings which shape step2_output: the settings of the lines of a mail
+ * (@see settings_fingerprint) and the skip list
+ * @return the hash
+ */
+static uint64_t analysis_settings_hash() {
+    return settings_fingerprint() ^ (file_errors_skip_fingerprint() * 0x100000001b3ull);
+}
+
+/*!
+ * @brief file_size gives the size of a file
+ * @param path the file path
+ * @return the size, -1 if the file does not exist
+ */
+static off_t file_size(char *path) {
+    struct stat status;
+    return stat(path, &status) == 0 ? status.st_size : -1;
+}
+
+/*!
+ * @brief save_record replaces the checkpoint file with the current record. The record is written to a temporary file
+ * renamed over the previous one, so that an interruption leaves either checkpoint whole.
+ */
+static void save_record() {
+    if (checkpoint_path[0] == '\0') {
+        return;
+    }
+    char saved_path[STR_MAX_LEN + 8];
+    snprintf(saved_path, sizeof(saved_path), "%s.new", checkpoint_path);
+    int fd = open(saved_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || write(fd, &record, sizeof(record)) != sizeof(record)) {
+        perror("Cannot write checkpoint");
+        if (fd != -1) {
+            close(fd);
+        }
+        return;
+    }
+    sync_temporary_file(fd);
+    close(fd);
+    if (rename(saved_path, checkpoint_path) == -1) {
+        perror("Cannot write checkpoint");
+        return;
+    }
+    sync_temporary_files(temporary_path);
+    last_checkpoint_us = metrics_now_us();
+}
+
+/*!
+ * @brief checkpoint_open enables checkpoints in the temporary directory. When resuming, the previous checkpoint is
+ * loaded if it was saved for the same data source; else checkpoints start over from the directories analysis.
+ * @param temporary_directory the temporary directory, where the checkpoint is kept with the intermediate files
+ * @param data_source the data source directory
+ * @param resume true to continue from the previous checkpoint, false to start over
+ * @param scale set to the sampling scale of the counts when step1_output is reused
+ * @return the stage to resume from
+ */
+checkpoint_stage_t checkpoint_open(char *temporary_directory, char *data_source, bool resume, double *scale) {
+    strncpy(temporary_path, temporary_directory, STR_MAX_LEN - 1);
+    concat_path(temporary_directory, CHECKPOINT_FILE, checkpoint_path);
+    last_checkpoint_us = metrics_now_us();
+    checkpoint_record_t previous;
+    FILE *file = resume ? fopen(checkpoint_path, "r") : NULL;
+    bool is_loaded = file && fread(&previous, sizeof(previous), 1, file) == 1;
+    if (file) {
+        fclose(file);
+    }
+    if (is_loaded && previous.magic == CHECKPOINT_MAGIC && previous.version == CHECKPOINT_VERSION &&
+        previous.source_hash == source_hash(data_source) && previous.stage <= CHECKPOINT_FILES_PARSED &&
+        previous.is_compressed == are_intermediates_compressed()) {
+        if (previous.settings_hash == analysis_settings_hash()) {
+            record = previous;
+            *scale = record.scale;
+            return record.stage;
+        }
+        printf("The checkpoint in %s was made with other plugins, timeline, aliases or skip list, starting over\n",
+               temporary_directory);
+    } else if (resume) {
+        printf("No checkpoint of %s in %s, starting over\n", data_source, temporary_directory);
+    }
+    record = (checkpoint_record_t) {
+            .magic = CHECKPOINT_MAGIC, .version = CHECKPOINT_VERSION, .stage = CHECKPOINT_STARTED,
+            .source_hash = source_hash(data_source), .settings_hash = analysis_settings_hash(),
+            .is_compressed = are_intermediates_compressed(),
+    };
+    unlink(checkpoint_path);
+    return CHECKPOINT_STARTED;
+}
+
+/*!
+ * @brief checkpoint_files_listed records the completion of the files list
+ * @param files_list the path to step1_output
+ * @param scale the sampling scale of the counts
+ */
+void checkpoint_files_listed(char *files_list, double scale) {
+    off_t size = file_size(files_list);
+    record.stage = CHECKPOINT_FILES_LISTED;
+    record.list_size = size > 0 ? size : 0;
+    record.list_offset = 0;
+    record.output_size = 0;
+    record.files_done = 0;
+    record.scale = scale;
+    save_record();
+}
+
+/*!
+ * @brief checkpoint_resume_files prepares the files analysis: the files list is positioned after the mails already
+ * analyzed, and the output truncated to their lines (later lines come from tasks which will run again). Without a
+ * usable checkpoint, the list is read from its start and the output emptied.
+ * @param files_list the opened step1_output
+ * @param output the path to step2_output
+ * @return the number of mails already analyzed
+ */
+uint64_t checkpoint_resume_files(FILE *files_list, char *output) {
+    off_t output_size = file_size(output);
+    struct stat list_status;
+    bool is_resumable = record.stage == CHECKPOINT_FILES_LISTED && record.list_offset > 0 &&
+                        fstat(fileno(files_list), &list_status) == 0 &&
+                        (uint64_t) list_status.st_size == record.list_size &&
+                        output_size >= (off_t) record.output_size &&
+                        fseeko(files_list, record.list_offset, SEEK_SET) == 0;
+    if (!is_resumable) {
+        rewind(files_list);
+        record.list_offset = 0;
+        record.output_size = 0;
+        record.files_done = 0;
+    }
+    if (output_size > (off_t) record.output_size && truncate(output, record.output_size) == -1) {
+        perror("Cannot truncate step2_output");
+    }
+    if (record.files_done > 0) {
+        printf("Resuming after %lu analyzed mails\n", (unsigned long) record.files_done);
+    }
+    return record.files_done;
+}
+
+/*!
+ * @brief checkpoint_due tells if the files analysis should be checkpointed. Never with compressed intermediates: the
+ * workers keep their last lines until they have a whole block, the output does not cover the tasks done.
+ * @return true if checkpoints are enabled and the last one is older than CHECKPOINT_INTERVAL_US
+ */
+bool checkpoint_due() {
+    return checkpoint_path[0] != '\0' && record.stage == CHECKPOINT_FILES_LISTED && !record.is_compressed &&
+           metrics_now_us() - last_checkpoint_us >= CHECKPOINT_INTERVAL_US;
+}
+
+/*!
+ * @brief checkpoint_files_progress records the progress of the files analysis. Must be called when no task is in
+ * flight: all the mails before list_offset are analyzed, and no later one.
+ * @param list_offset the position in step1_output of the next mail to analyze
+ * @param files_done the number of mails before list_offset
+ * @param output the path to step2_output, synced first so that the checkpoint never covers lost lines
+ */
+void checkpoint_files_progress(off_t list_offset, uint64_t files_done, char *output) {
+    if (checkpoint_path[0] == '\0' || list_offset < 0) {
+        return;
+    }
+    int fd = open(output, O_RDONLY);
+    if (fd == -1) {
+        return;
+    }
+    sync_temporary_file(fd);
+    struct stat status;
+    if (fstat(fd, &status) == 0) {
+        record.list_offset = list_offset;
+        record.output_size = status.st_size;
+        record.files_done = files_done;
+        save_record();
+    }
+    close(fd);
+}
+
+/*!
+ * @brief checkpoint_files_parsed records the completion of step2_output
+ */
+void checkpoint_files_parsed() {
+    record.stage = CHECKPOINT_FILES_PARSED;
+    save_record();
+}
+
+/*!
+ * @brief checkpoint_close removes the checkpoint at the end of a complete analysis
+ */
+void checkpoint_close() {
+    if (checkpoint_path[0] != '\0') {
+        unlink(checkpoint_path);
+        checkpoint_path[0] = '\0';
+    }
+}
@@ -0,0 +1,49 @@
+//
+// Created on 19/10/26.
+//
+
+#ifndef A2022_CHECKPOINT_H
+#define A2022_CHECKPOINT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#define CHECKPOINT_FILE "checkpoint"
+#define CHECKPOINT_MAGIC 0x4B435043u // "CPCK"
+#define CHECKPOINT_VERSION 3
+// Minimum time between two checkpoints of the files analysis: each one waits for the in-flight tasks to end
+#define CHECKPOINT_INTERVAL_US (10 * 1000000ull)
+
+typedef enum {
+    CHECKPOINT_STARTED,      // Nothing to reuse: the directories are analyzed again
+    CHECKPOINT_FILES_LISTED, // step1_output is complete (sampled if requested), step2_output covers list_offset
+    CHECKPOINT_FILES_PARSED, // step2_output is complete, only the final reduce remains
+} checkpoint_stage_t;
+
+// Checkpoint file content, written as is: all mails listed in the first list_offset bytes of step1_output are
+// analyzed, and their lines are the first output_size bytes of step2_output
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t stage;
+    uint64_t source_hash; // Hash of the data source path: a checkpoint of another corpus is not resumed
+    uint64_t settings_hash; // Hash of the plugins, timeline, aliases and skip list the output was written with
+    uint64_t list_size;   // step1_output size when it was completed
+    uint64_t list_offset;
+    uint64_t output_size;
+    uint64_t files_done;  // Mails listed before list_offset
+    double scale;         // Sampling scale of the counts (@see reducer_options_t)
+    uint32_t is_compressed; // Intermediates written as blocks (@see block_file.h), never mixed with plain lines
+} checkpoint_record_t;
+
+checkpoint_stage_t checkpoint_open(char *temporary_directory, char *data_source, bool resume, double *scale);
+void checkpoint_files_listed(char *files_list, double scale);
+uint64_t checkpoint_resume_files(FILE *files_list, char *output);
+bool checkpoint_due();
+void checkpoint_files_progress(off_t list_offset, uint64_t files_done, char *output);
+void checkpoint_files_parsed();
+void checkpoint_close();
+
+#endif //A2022_CHECKPOINT_H
@@ -0,0 +1,104 @@
+//
+// Created on 19/10/26.
+//
+
+#include "concurrency.h"
+
+#include <stddef.h>
+
+#include "metrics.h"
+
+// A window lasts at least this long and covers at least two tasks per allowed slot, so that the throughput of a
+// limit is measured once the pipeline is full
+#define WINDOW_MIN_US 20000
+#define WINDOW_TASKS_PER_SLOT 2
+// Relative throughput changes below this threshold are considered noise
+#define THROUGHPUT_TOLERANCE 0.05
+// Drops larger than this one halve the limit instead of stepping back
+#define THROUGHPUT_COLLAPSE 0.30
+
+/*!
+ * @brief concurrency_init initializes a controller. The limit starts at the middle of the bounds and first grows.
+ * @param controller the controller to initialize
+ * @param min_limit the minimal number of in-flight tasks (at least 1)
+ * @param max_limit the maximal number of in-flight tasks (at least min_limit)
+ */
+void concurrency_init(concurrency_controller_t *controller, uint16_t min_limit, uint16_t max_limit) {
+    if (!controller) {
+        return;
+    }
+    controller->min_limit = min_limit > 0 ? min_limit : 1;
+    controller->max_limit = max_limit >= controller->min_limit ? max_limit : controller->min_limit;
+    controller->limit = controller->min_limit + (controller->max_limit - controller->min_limit) / 2;
+    controller->direction = 1;
+    controller->window_completed = 0;
+    controller->window_start_us = metrics_now_us();
+    controller->last_throughput = 0.0;
+    controller->adjustments = 0;
+}
+
+/*!
+ * @brief concurrency_limit returns the current number of tasks allowed in flight
+ * @param controller the controller
+ * @return the current limit
+ */
+uint16_t concurrency_limit(concurrency_controller_t *controller) {
+    return controller->limit;
+}
+
+/*!
+ * @brief concurrency_step moves the limit by delta, within bounds. Reverses the direction when a bound is hit, so
+ * that the controller keeps probing.
+ * @param controller the controller
+ * @param delta the signed variation of the limit
+ */
+static void concurrency_step(concurrency_controller_t *controller, int32_t delta) {
+    int32_t target = (int32_t) controller->limit + delta;
+    if (target >= controller->max_limit) {
+        target = controller->max_limit;
+        controller->direction = -1;
+    }
+    if (target <= controller->min_limit) {
+        target = controller->min_limit;
+        controller->direction = 1;
+    }
+    if (target != controller->limit) {
+        controller->limit = target;
+        ++controller->adjustments;
+    }
+}
+
+/*!
+ * @brief concurrency_task_done must be called by the dispatcher each time a task completes. At the end of each
+ * measurement window, compares the throughput with the previous window and adjusts the limit.
+ * @param controller the controller
+ */
+void concurrency_task_done(concurrency_controller_t *controller) {
+    if (!controller || controller->min_limit == controller->max_limit) {
+        return;
+    }
+    ++controller->window_completed;
+    uint64_t now = metrics_now_us();
+    uint64_t elapsed = now - controller->window_start_us;
+    if (controller->window_completed < (uint32_t) controller->limit * WINDOW_TASKS_PER_SLOT || elapsed < WINDOW_MIN_US) {
+        return;
+    }
+    double throughput = controller->window_completed * 1e6 / elapsed;
+    if (controller->last_throughput > 0.0) {
+        double change = (throughput - controller->last_throughput) / controller->last_throughput;
+        if (change < -THROUGHPUT_COLLAPSE) {
+            controller->direction = -1;
+            concurrency_step(controller, -(int32_t) (controller->limit / 2));
+        } else if (change < -THROUGHPUT_TOLERANCE) {
+            controller->direction = (int8_t) -controller->direction;
+            concurrency_step(controller, controller->direction);
+        } else if (change > THROUGHPUT_TOLERANCE) {
+            concurrency_step(controller, controller->direction);
+        }
+    } else {
+        concurrency_step(controller, controller->direction);
+    }
+    controller->last_throughput = throughput;
+    controller->window_completed = 0;
+    controller->window_start_us = now;
+}
@@ -0,0 +1,28 @@
+//
+// Created on 19/10/26.
+//
+
+#ifndef A2022_CONCURRENCY_H
+#define A2022_CONCURRENCY_H
+
+#include <stdint.h>
+
+// Hill-climbing controller of the number of in-flight tasks: the limit moves one step at a time in the current
+// direction while the throughput measured over a window improves, reverses when it degrades, and is halved on a
+// sharp drop (AIMD style). It always stays within [min_limit, max_limit].
+typedef struct {
+    uint16_t min_limit;
+    uint16_t max_limit;
+    uint16_t limit;
+    int8_t direction;
+    uint32_t window_completed;
+    uint64_t window_start_us;
+    double last_throughput; // Tasks per second over the previous window, 0 before the first one
+    uint32_t adjustments;
+} concurrency_controller_t;
+
+void concurrency_init(concurrency_controller_t *controller, uint16_t min_limit, uint16_t max_limit);
+uint16_t concurrency_limit(concurrency_controller_t *controller);
+void concurrency_task_done(concurrency_controller_t *controller);
+
+#endif //A2022_CONCURRENCY_H
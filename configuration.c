@@ -12,6 +12,56 @@
 #include <stdarg.h>
 
 #include "utility.h"
+#include "archive_input.h"
+
+// Long options without a short flag
+enum {
+    OPTION_MIN_CONCURRENCY = 256,
+    OPTION_MAX_CONCURRENCY,
+    OPTION_SAMPLE_MODE,
+    OPTION_RESUME,
+    OPTION_LISTEN,
+    OPTION_REMOTE_WORKERS,
+};
+
+/*!
+ * @brief parse_scheduling_policy converts a scheduling policy name to its value
+ * @param name the policy name ("auto" or "multiplier")
+ * @return the matching policy, SCHEDULING_MULTIPLIER if the name is unknown
+ */
+scheduling_policy_t parse_scheduling_policy(char *name) {
+    return strcmp(name, "auto") == 0 ? SCHEDULING_AUTO : SCHEDULING_MULTIPLIER;
+}
+
+/*!
+ * @brief parse_sampling_mode converts a sampling mode name to its value
+ * @param name the mode name ("random" or "stratified")
+ * @return the matching mode, SAMPLING_RANDOM if the name is unknown
+ */
+sampling_mode_t parse_sampling_mode(char *name) {
+    return strcmp(name, "stratified") == 0 ? SAMPLING_STRATIFIED : SAMPLING_RANDOM;
+}
+
+/*!
+ * @brief parse_compression converts a compression name to its value
+ * @param name the compression name ("none", "intermediates" or "all")
+ * @return the matching compression, COMPRESSION_NONE if the name is unknown
+ */
+compression_t parse_compression(char *name) {
+    if (strcmp(name, "all") == 0) {
+        return COMPRESSION_ALL;
+    }
+    return strcmp(name, "intermediates") == 0 ? COMPRESSION_INTERMEDIATES : COMPRESSION_NONE;
+}
+
+/*!
+ * @brief is_true_value tells if a configuration file value means true
+ * @param value the value string
+ * @return true for "true", "1" and "yes", false else
+ */
+bool is_true_value(char *value) {
+    return strcmp(value, "true") == 0 || strcmp(value, "1") == 0 || strcmp(value, "yes") == 0;
+}
 
 /*!
  * @brief make_configuration makes the configuration from the program parameters. CLI parameters are applied after
@@ -30,11 +80,34 @@ configuration_t *make_configuration(configuration_t *base_configuration, char *a
         {.name="output-file",.has_arg=1,.flag=0,.val='o'},
         {.name="cpu-multiplier",.has_arg=1,.flag=0,.val='n'},
         {.name="config-file",.has_arg=1,.flag=0,.val='f'},
+        {.name="metrics-file",.has_arg=1,.flag=0,.val='m'},
+        {.name="trace-file",.has_arg=1,.flag=0,.val='T'},
+        {.name="scheduling",.has_arg=1,.flag=0,.val='s'},
+        {.name="pin-workers",.has_arg=0,.flag=0,.val='p'},
+        {.name="adaptive",.has_arg=0,.flag=0,.val='a'},
+        {.name="top-k",.has_arg=1,.flag=0,.val='k'},
+        {.name="index-file",.has_arg=1,.flag=0,.val='i'},
+        {.name="ephemeral",.has_arg=0,.flag=0,.val='e'},
+        {.name="rejected-log",.has_arg=1,.flag=0,.val='r'},
+        {.name="skip-list",.has_arg=1,.flag=0,.val='x'},
+        {.name="sample-rate",.has_arg=1,.flag=0,.val='S'},
+        {.name="distinct-file",.has_arg=1,.flag=0,.val='D'},
+        {.name="aggregate-file",.has_arg=1,.flag=0,.val='A'},
+        {.name="plugins",.has_arg=1,.flag=0,.val='P'},
+        {.name="timeline-file",.has_arg=1,.flag=0,.val='W'},
+        {.name="alias-file",.has_arg=1,.flag=0,.val='L'},
+        {.name="compression",.has_arg=1,.flag=0,.val='z'},
+        {.name="sample-mode",.has_arg=1,.flag=0,.val=OPTION_SAMPLE_MODE},
+        {.name="min-concurrency",.has_arg=1,.flag=0,.val=OPTION_MIN_CONCURRENCY},
+        {.name="max-concurrency",.has_arg=1,.flag=0,.val=OPTION_MAX_CONCURRENCY},
+        {.name="resume",.has_arg=0,.flag=0,.val=OPTION_RESUME},
+        {.name="listen",.has_arg=1,.flag=0,.val=OPTION_LISTEN},
+        {.name="remote-workers",.has_arg=1,.flag=0,.val=OPTION_REMOTE_WORKERS},
         {.name=0,.has_arg=0,.flag=0,.val=0},
     };
     int opt;
 
-    while ((opt = getopt_long(argc, argv, "vd:t:o:n:f:", my_opts, NULL)) != EOF) {
+    while ((opt = getopt_long(argc, argv, "vd:t:o:n:f:m:T:s:pak:i:er:x:S:D:z:A:P:W:L:", my_opts, NULL)) != EOF) {
         switch (opt) {
             case 'v':
                 base_configuration->is_verbose = true;
@@ -58,6 +131,75 @@ configuration_t *make_configuration(configuration_t *base_configuration, char *a
             case 'f':
                 base_configuration = read_cfg_file(base_configuration, optarg);
                 break;
+            case 'm':
+                strncpy(base_configuration->metrics_file, optarg, STR_MAX_LEN);
+                break;
+            case 'T':
+                strncpy(base_configuration->trace_file, optarg, STR_MAX_LEN);
+                break;
+            case 's':
+                base_configuration->scheduling_policy = parse_scheduling_policy(optarg);
+                break;
+            case 'p':
+                base_configuration->pin_workers = true;
+                break;
+            case 'a':
+                base_configuration->is_adaptive = true;
+                break;
+            case 'k':
+                base_configuration->top_k = strtoul(optarg, NULL, 10);
+                break;
+            case 'i':
+                strncpy(base_configuration->index_file, optarg, STR_MAX_LEN);
+                break;
+            case 'e':
+                base_configuration->ephemeral_intermediates = true;
+                break;
+            case 'r':
+                strncpy(base_configuration->rejected_log, optarg, STR_MAX_LEN);
+                break;
+            case 'x':
+                strncpy(base_configuration->skip_list, optarg, STR_MAX_LEN);
+                break;
+            case 'S':
+                base_configuration->sample_rate = strtod(optarg, NULL);
+                break;
+            case 'D':
+                strncpy(base_configuration->distinct_file, optarg, STR_MAX_LEN);
+                break;
+            case 'A':
+                strncpy(base_configuration->aggregate_file, optarg, STR_MAX_LEN);
+                break;
+            case 'P':
+                strncpy(base_configuration->plugins, optarg, STR_MAX_LEN);
+                break;
+            case 'W':
+                strncpy(base_configuration->timeline_file, optarg, STR_MAX_LEN);
+                break;
+            case 'L':
+                strncpy(base_configuration->alias_file, optarg, STR_MAX_LEN);
+                break;
+            case 'z':
+                base_configuration->compression = parse_compression(optarg);
+                break;
+            case OPTION_SAMPLE_MODE:
+                base_configuration->sample_mode = parse_sampling_mode(optarg);
+                break;
+            case OPTION_MIN_CONCURRENCY:
+                base_configuration->min_concurrency = strtoul(optarg, NULL, 10);
+                break;
+            case OPTION_MAX_CONCURRENCY:
+                base_configuration->max_concurrency = strtoul(optarg, NULL, 10);
+                break;
+            case OPTION_RESUME:
+                base_configuration->resume = true;
+                break;
+            case OPTION_LISTEN:
+                strncpy(base_configuration->listen_address, optarg, STR_MAX_LEN);
+                break;
+            case OPTION_REMOTE_WORKERS:
+                base_configuration->remote_workers = strtoul(optarg, NULL, 10);
+                break;
             default:
                 break;
         }
@@ -112,7 +254,10 @@ char *get_word(char *source, char *target) {
 
 /*!
  * @brief read_cfg_file reads a configuration file (with key = value lines) and extracts all key/values for
- * configuring the program (data_path, output_file, temporary_directory, is_verbose, cpu_core_multiplier)
+ * configuring the program (data_path, output_file, temporary_directory, is_verbose, cpu_core_multiplier,
+ * metrics_file, trace_file, scheduling_policy, pin_workers, concurrency_mode, min_concurrency, max_concurrency,
+ * top_k, index_file, intermediates, rejected_log, skip_list, sample_rate, sample_mode,
+ * distinct_file, aggregate_file, plugins, timeline_file, alias_file, resume, compression, listen, remote_workers)
  * @param base_configuration a pointer to the configuration to update and return
  * @param path_to_cfg_file the path to the configuration file
  * @return a pointer to the base configuration after update, NULL is reading failed.
@@ -141,14 +286,56 @@ configuration_t *read_cfg_file(configuration_t *base_configuration, char *path_t
             strncpy(base_configuration->temporary_directory, value, STR_MAX_LEN);
         } else if (strcmp(key, "output_file") == 0) {
             strncpy(base_configuration->output_file, value, STR_MAX_LEN);
+        } else if (strcmp(key, "metrics_file") == 0) {
+            strncpy(base_configuration->metrics_file, value, STR_MAX_LEN);
+        } else if (strcmp(key, "trace_file") == 0) {
+            strncpy(base_configuration->trace_file, value, STR_MAX_LEN);
         } else if (strcmp(key, "cpu_core_multiplier") == 0) {
             base_configuration->cpu_core_multiplier = strtoul(value, NULL, 10);
         } else if (strcmp(key, "is_verbose") == 0) {
-            if (strcmp(value, "true") == 0 || strcmp(value, "1") == 0 || strcmp(value, "yes") == 0) {
-                base_configuration->is_verbose = true;
-            } else {
-                base_configuration->is_verbose = false;
-            }
+            base_configuration->is_verbose = is_true_value(value);
+        } else if (strcmp(key, "scheduling_policy") == 0) {
+            base_configuration->scheduling_policy = parse_scheduling_policy(value);
+        } else if (strcmp(key, "pin_workers") == 0) {
+            base_configuration->pin_workers = is_true_value(value);
+        } else if (strcmp(key, "concurrency_mode") == 0) {
+            base_configuration->is_adaptive = strcmp(value, "adaptive") == 0;
+        } else if (strcmp(key, "min_concurrency") == 0) {
+            base_configuration->min_concurrency = strtoul(value, NULL, 10);
+        } else if (strcmp(key, "max_concurrency") == 0) {
+            base_configuration->max_concurrency = strtoul(value, NULL, 10);
+        } else if (strcmp(key, "top_k") == 0) {
+            base_configuration->top_k = strtoul(value, NULL, 10);
+        } else if (strcmp(key, "index_file") == 0) {
+            strncpy(base_configuration->index_file, value, STR_MAX_LEN);
+        } else if (strcmp(key, "intermediates") == 0) {
+            base_configuration->ephemeral_intermediates = strcmp(value, "ephemeral") == 0;
+        } else if (strcmp(key, "rejected_log") == 0) {
+            strncpy(base_configuration->rejected_log, value, STR_MAX_LEN);
+        } else if (strcmp(key, "skip_list") == 0) {
+            strncpy(base_configuration->skip_list, value, STR_MAX_LEN);
+        } else if (strcmp(key, "sample_rate") == 0) {
+            base_configuration->sample_rate = strtod(value, NULL);
+        } else if (strcmp(key, "sample_mode") == 0) {
+            base_configuration->sample_mode = parse_sampling_mode(value);
+        } else if (strcmp(key, "distinct_file") == 0) {
+            strncpy(base_configuration->distinct_file, value, STR_MAX_LEN);
+        } else if (strcmp(key, "aggregate_file") == 0) {
+            strncpy(base_configuration->aggregate_file, value, STR_MAX_LEN);
+        } else if (strcmp(key, "plugins") == 0) {
+            strncpy(base_configuration->plugins, value, STR_MAX_LEN);
+        } else if (strcmp(key, "timeline_file") == 0) {
+            strncpy(base_configuration->timeline_file, value, STR_MAX_LEN);
+        } else if (strcmp(key, "alias_file") == 0) {
+            strncpy(base_configuration->alias_file, value, STR_MAX_LEN);
+        } else if (strcmp(key, "resume") == 0) {
+            base_configuration->resume = is_true_value(value);
+        } else if (strcmp(key, "compression") == 0) {
+            base_configuration->compression = parse_compression(value);
+        } else if (strcmp(key, "listen") == 0) {
+            strncpy(base_configuration->listen_address, value, STR_MAX_LEN);
+        } else if (strcmp(key, "remote_workers") == 0) {
+            base_configuration->remote_workers = strtoul(value, NULL, 10);
         } else {
             printf("Unknown key: %s\n", key);
         }
@@ -166,24 +353,66 @@ void display_configuration(configuration_t *configuration) {
     printf("\tData source: %s\n", configuration->data_path);
     printf("\tTemporary directory: %s\n", configuration->temporary_directory);
     printf("\tOutput file: %s\n", configuration->output_file);
+    printf("\tMetrics file: %s\n", configuration->metrics_file[0] ? configuration->metrics_file : "none");
+    printf("\tTrace file: %s\n", configuration->trace_file[0] ? configuration->trace_file : "none");
+    printf("\tGraph index file: %s\n", configuration->index_file[0] ? configuration->index_file : "none");
+    printf("\tRejected files log: %s\n", configuration->rejected_log[0] ? configuration->rejected_log : "none");
+    printf("\tSkip list: %s\n", configuration->skip_list[0] ? configuration->skip_list : "none");
+    printf("\tDistinct correspondents file: %s\n",
+           configuration->distinct_file[0] ? configuration->distinct_file : "none");
+    printf("\tAggregate file: %s\n", configuration->aggregate_file[0] ? configuration->aggregate_file : "none");
+    printf("\tPlugins: %s\n", configuration->plugins[0] ? configuration->plugins : "none");
+    printf("\tTimeline file: %s\n", configuration->timeline_file[0] ? configuration->timeline_file : "none");
+    printf("\tAlias file: %s\n", configuration->alias_file[0] ? configuration->alias_file : "none");
     printf("\tVerbose mode is %s\n", configuration->is_verbose ? "on" : "off");
     printf("\tCPU multiplier is %d\n", configuration->cpu_core_multiplier);
+    printf("\tScheduling policy is %s\n", configuration->scheduling_policy == SCHEDULING_AUTO ? "auto" : "multiplier");
+    printf("\tWorkers pinning is %s\n", configuration->pin_workers ? "on" : "off");
+    if (configuration->is_adaptive) {
+        printf("\tConcurrency is adaptive, between %d and %d\n", configuration->min_concurrency,
+               configuration->max_concurrency);
+    } else {
+        printf("\tConcurrency is fixed\n");
+    }
+    printf("\tIntermediates are %s\n", configuration->ephemeral_intermediates ? "ephemeral" : "durable");
+    if (configuration->compression != COMPRESSION_NONE) {
+        printf("\tCompressing the intermediates%s\n",
+               configuration->compression == COMPRESSION_ALL ? " and the output file" : "");
+    }
+    if (configuration->resume) {
+        printf("\tResuming from the last checkpoint\n");
+    }
+    if (configuration->top_k > 0) {
+        printf("\tKeeping the top %u recipients of each sender\n", configuration->top_k);
+    }
+    if (configuration->sample_rate > 0) {
+        printf("\tApproximate counts on a %s sample of %g of the mails\n",
+               configuration->sample_mode == SAMPLING_STRATIFIED ? "stratified" : "random", configuration->sample_rate);
+    }
     printf("\tProcess count is %d\n", configuration->process_count);
+    if (configuration->remote_workers > 0) {
+        printf("\tAccepting %d remote workers on %s (tcp method)\n", configuration->remote_workers,
+               configuration->listen_address);
+    }
 }
 
 /*!
  * @brief is_configuration_valid tests a configuration to check if it is executable (i.e. data directory and temporary
- * directory both exist, and path to output file exists @see directory_exists and path_to_file_exists in utility.c)
+ * directory both exist, the data source may be an archive instead, and path to output file exists @see
+ * directory_exists and path_to_file_exists in utility.c)
  * @param configuration the configuration to be tested
  * @return true if configuration is valid, false else
  */
 bool is_configuration_valid(configuration_t *configuration)
 {    
-    if (directory_exists(configuration->data_path) && 
+    if ((directory_exists(configuration->data_path) || archive_format(configuration->data_path) != ARCHIVE_NONE) &&
         directory_exists(configuration->temporary_directory) && 
         path_to_file_exists(configuration->output_file) && 
         ((configuration->cpu_core_multiplier <= 10) &&
-         (configuration->cpu_core_multiplier >= 1))) {
+         (configuration->cpu_core_multiplier >= 1)) &&
+        (configuration->max_concurrency == 0 || configuration->min_concurrency <= configuration->max_concurrency) &&
+        (configuration->sample_rate >= 0 && configuration->sample_rate <= 1) &&
+        !(configuration->resume && configuration->ephemeral_intermediates)) {
 
         return true;
     } else {
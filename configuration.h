@@ -10,13 +10,52 @@
 
 #include "global_defs.h"
 
+typedef enum {
+    SCHEDULING_MULTIPLIER, // cpu_core_multiplier workers per online CPU
+    SCHEDULING_AUTO,       // one worker per CPU usable by the process (affinity mask and cgroup quota)
+} scheduling_policy_t;
+
+typedef enum {
+    SAMPLING_RANDOM,     // Each mail is kept with a probability of sample_rate
+    SAMPLING_STRATIFIED, // The same fraction of the mails of each mailbox is kept, at least one per mailbox
+} sampling_mode_t;
+
+typedef enum {
+    COMPRESSION_NONE,
+    COMPRESSION_INTERMEDIATES, // step1/step2 files and directory lists are written as blocks (@see block_file.h)
+    COMPRESSION_ALL,           // The output file too
+} compression_t;
+
 typedef struct {
     char data_path[STR_MAX_LEN];
     char temporary_directory[STR_MAX_LEN];
     char output_file[STR_MAX_LEN];
+    char metrics_file[STR_MAX_LEN];
+    char trace_file[STR_MAX_LEN];
+    char index_file[STR_MAX_LEN];
+    char rejected_log[STR_MAX_LEN]; // Mails which could not be analyzed, with the reason
+    char skip_list[STR_MAX_LEN];    // Mails not to open (e.g. the rejected files log of a previous run)
+    char distinct_file[STR_MAX_LEN]; // Estimates of the distinct correspondents of each sender
+    char aggregate_file[STR_MAX_LEN]; // Counts of the run, mergeable with the ones of other runs
+    char plugins[STR_MAX_LEN];        // Analysis plugins, comma separated (@see plugins.h)
+    char timeline_file[STR_MAX_LEN];  // Mails per edge and day (@see timeline.h)
+    char alias_file[STR_MAX_LEN];     // Aliases of the addresses (@see normalization.h)
     bool is_verbose;
     uint8_t cpu_core_multiplier;
+    scheduling_policy_t scheduling_policy;
+    bool pin_workers;
+    bool is_adaptive;         // Adapt the number of in-flight tasks of each phase to the measured throughput
+    uint16_t min_concurrency; // Bounds of the adaptive concurrency (0 means 1 and process_count respectively)
+    uint16_t max_concurrency;
+    bool ephemeral_intermediates; // Keep step1/step2 files in shared memory, never synced
+    compression_t compression;
+    bool resume;              // Continue from the checkpoint kept in the temporary directory by an interrupted run
+    uint32_t top_k;           // Maximum number of recipients written per sender, 0 to write all of them
+    double sample_rate;       // Fraction of the mails to analyze, with approximate counts; 0 for exact counts
+    sampling_mode_t sample_mode;
     uint16_t process_count;
+    char listen_address[STR_MAX_LEN]; // Where the coordinator of the tcp method accepts workers, as [host:]port
+    uint16_t remote_workers;          // Workers of the tcp method expected from other hosts, besides the local ones
 } configuration_t;
 
 configuration_t *make_configuration(configuration_t *base_configuration, char *argv[], int argc);
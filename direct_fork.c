@@ -11,15 +11,55 @@
 #include <stdlib.h>
 
 #include "analysis.h"
+#include "block_file.h"
+#include "checkpoint.h"
+#include "file_errors.h"
 #include "utility.h"
+#include "metrics.h"
+#include "trace.h"
+#include "scheduling.h"
+
+/*!
+ * @brief wait_for_free_slot waits for children to end until a new one may be started. With a controller, the limit
+ * may shrink between two calls, in which case several children are waited for.
+ * @param current_proc the number of running children
+ * @param nb_proc the maximum number of simultaneous processes (used without controller)
+ * @param controller the adaptive concurrency controller, NULL for a fixed limit
+ * @return the number of running children after waiting
+ */
+uint16_t wait_for_free_slot(uint16_t current_proc, uint16_t nb_proc, concurrency_controller_t *controller) {
+    while (current_proc > 0 && current_proc >= (controller ? concurrency_limit(controller) : nb_proc)) {
+        uint64_t wait_start_us = metrics_now_us();
+        if (wait(NULL) == -1) {
+            return 0;
+        }
+        trace_record(TRACE_DISPATCH_WAIT, wait_start_us, metrics_now_us(), NULL);
+        --current_proc;
+        concurrency_task_done(controller);
+    }
+    return current_proc;
+}
+
+/*!
+ * @brief wait_for_all_children waits for all running children to end
+ * @param current_proc the number of running children
+ * @param controller the adaptive concurrency controller, NULL for a fixed limit
+ */
+static void wait_for_all_children(uint16_t current_proc, concurrency_controller_t *controller) {
+    for (; current_proc > 0 && wait(NULL) != -1; --current_proc) {
+        concurrency_task_done(controller);
+    }
+}
 
 /*!
  * @brief direct_fork_directories runs the directory analysis with direct calls to fork
  * @param data_source the data source directory with 150 directories to analyze (parallelize with fork)
  * @param temp_files the path to the temporary files directory
  * @param nb_proc the maximum number of simultaneous processes
+ * @param controller the adaptive concurrency controller setting the number of simultaneous processes, NULL to always
+ * run nb_proc processes
  */
-void direct_fork_directories(char *data_source, char *temp_files, uint16_t nb_proc) {
+void direct_fork_directories(char *data_source, char *temp_files, uint16_t nb_proc, concurrency_controller_t *controller) {
     // 1. Check parameters
     if (!directory_exists(data_source)) {
         printf("Error: data source directory does not exist.\n");
@@ -32,6 +72,7 @@ void direct_fork_directories(char *data_source, char *temp_files, uint16_t nb_pr
         return;
     }
     uint16_t current_proc = 0;
+    uint32_t tasks_count = 0;
     struct dirent *entry = readdir(dir);
     // 2. Iterate over directories (ignore . and ..)
     while (entry != NULL) {
@@ -40,28 +81,33 @@ void direct_fork_directories(char *data_source, char *temp_files, uint16_t nb_pr
             concat_path(data_source, entry->d_name, entry_path);
             if (directory_exists(entry_path)) {
                 // 3 bis: if max processes count already run, wait for one to end before starting a task.
-                if (current_proc >= nb_proc) {
-                    wait(NULL);
-                    --current_proc;
-                }
+                current_proc = wait_for_free_slot(current_proc, nb_proc, controller);
                 // 3. fork and start a task on current directory.
+                metrics_task_dispatched();
                 pid_t pid = fork();
                 if (pid == 0) {
                     // child process
+                    uint64_t task_start_us = metrics_now_us();
+                    metrics_set_worker(tasks_count);
+                    trace_set_worker(tasks_count);
+                    scheduling_pin_worker(tasks_count);
                     char output_file[STR_MAX_LEN]; 
                     concat_path(temp_files, entry->d_name, output_file);
 
-                    FILE* output = fopen(output_file, "a");
+                    FILE* output = open_intermediate(output_file, "w");
                     if (!output) return;
 
                     parse_dir(entry_path, output);
                     fclose(output);
+                    metrics_task_done();
+                    trace_record(TRACE_DIRECTORY_TASK, task_start_us, metrics_now_us(), entry_path);
 
                     closedir(dir);
                     exit(EXIT_SUCCESS);
                 } else if (pid > 0) {
                     // parent process
                     ++current_proc;
+                    ++tasks_count;
                 } else {
                     // error
                     printf("Error: could not fork.\n");
@@ -84,8 +130,10 @@ void direct_fork_directories(char *data_source, char *temp_files, uint16_t nb_pr
  * @param data_source the data source containing the files (step1_output)
  * @param temp_files the temporary files to write the output (step2_output)
  * @param nb_proc the maximum number of simultaneous processes
+ * @param controller the adaptive concurrency controller setting the number of simultaneous processes, NULL to always
+ * run nb_proc processes
  */
-void direct_fork_files(char *data_source, char *temp_file, uint16_t nb_proc) {
+void direct_fork_files(char *data_source, char *temp_file, uint16_t nb_proc, concurrency_controller_t *controller) {
     // 1. Check parameters
     if (!path_to_file_exists(data_source)) {
         printf("Error: %s does not exist.\n", data_source);
@@ -96,42 +144,65 @@ void direct_fork_files(char *data_source, char *temp_file, uint16_t nb_proc) {
         return;
     }
     uint16_t current_proc = 0;
+    uint32_t tasks_count = 0;
     // 2. Iterate over files in files list (step1_output)
-    FILE* files_list = fopen(data_source, "r");
+    FILE* files_list = open_intermediate(data_source, "r");
     if (files_list == NULL) {
         fclose(files_list);
         printf("Error: could not open %s.\n", data_source);
         return;
     }
+    // The output is resolved and opened once: children inherit the stream instead of resolving and opening it again
+    char output[STR_MAX_LEN];
+    if (!realpath(temp_file, output)) {
+        strncpy(output, temp_file, STR_MAX_LEN - 1);
+        output[STR_MAX_LEN - 1] = '\0';
+    }
+    uint64_t files_done = checkpoint_resume_files(files_list, output);
+    prepare_mail_output(output);
     char file_path[STR_MAX_LEN];
+    off_t next_offset = ftello(files_list);
     while (fgets(file_path, STR_MAX_LEN, files_list) != NULL) {
-        file_path[strlen(file_path) - 1] = '\0';
-        if (path_to_file_exists(file_path)) {
-            if (current_proc > nb_proc) {
-                // 3 bis: if max processes count already run, wait for one to end before starting a task.
-                wait(NULL);
-                --current_proc;
-            }
+        off_t line_offset = next_offset;
+        next_offset = ftello(files_list);
+        file_path[strcspn(file_path, "\n")] = '\0';
+        if (checkpoint_due()) {
+            // Children end out of order: the checkpoint waits for all of them, so that it covers exactly the mails
+            // before the current one
+            wait_for_all_children(current_proc, controller);
+            current_proc = 0;
+            checkpoint_files_progress(line_offset, files_done, output);
+        }
+        ++files_done;
+        if (file_errors_skip(file_path)) {
+            metrics_file_skipped();
+        } else {
+            // The file is not opened here: the child opens it once, and reports it if it cannot
+            // 3 bis: if max processes count already run, wait for one to end before starting a task.
+            current_proc = wait_for_free_slot(current_proc, nb_proc, controller);
+            prepare_mail_directory(file_path); // Inherited by the child, which opens the mail with openat
             // 3. fork and start a task on current file.
+            metrics_task_dispatched();
             pid_t pid = fork();
             if (pid == 0) {
                 // child process
-
-                // realpath could be removed
-                char filepath[STR_MAX_LEN];
-                realpath(file_path, filepath);
-
-                char output[STR_MAX_LEN];
-                realpath(temp_file, output);
+                uint64_t task_start_us = metrics_now_us();
+                metrics_set_worker(tasks_count);
+                trace_set_worker(tasks_count);
+                scheduling_pin_worker(tasks_count);
 
                 // 3. Call parse_file
-                parse_file(filepath, output);
+                parse_file(file_path, output);
+                metrics_task_done();
+                trace_record(TRACE_FILE_TASK, task_start_us, metrics_now_us(), file_path);
 
+                release_mail_caches(); // Writes the line of a compressed output
                 fclose(files_list);
                 exit(EXIT_SUCCESS);
             } else if (pid > 0) {
                 // parent process
                 ++current_proc;
+                ++tasks_count;
             } else {
                 // error
                 printf("Error: could not fork.\n");
@@ -142,9 +213,7 @@ void direct_fork_files(char *data_source, char *temp_file, uint16_t nb_proc) {
     }
 
     // 4. Cleanup
-    
-    for (int i = 0; i < current_proc; ++i) {
-        wait(NULL);
-    }
+    wait_for_all_children(current_proc, controller);
+    release_mail_caches();
     fclose(files_list);
 }
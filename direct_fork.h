@@ -6,8 +6,10 @@
 #define A2022_DIRECT_FORK_H
 
 #include "global_defs.h"
+#include "concurrency.h"
 
-void direct_fork_directories(char *data_source, char *temp_files, uint16_t nb_proc);
-void direct_fork_files(char *data_source, char *temp_files, uint16_t nb_proc);
+uint16_t wait_for_free_slot(uint16_t current_proc, uint16_t nb_proc, concurrency_controller_t *controller);
+void direct_fork_directories(char *data_source, char *temp_files, uint16_t nb_proc, concurrency_controller_t *controller);
+void direct_fork_files(char *data_source, char *temp_files, uint16_t nb_proc, concurrency_controller_t *controller);
 
 #endif //A2022_DIRECT_FORK_H
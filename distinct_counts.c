@@ -0,0 +1,325 @@
+//
+// Created on 19/10/26.
+//
+
+#include "distinct_counts.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "block_file.h"
+#include "global_defs.h"
+#include "plugins.h"
+#include "sketch.h"
+
+// Below this step2 size, forking to count costs more than it saves
+#define PARALLEL_DISTINCT_MIN_BYTES (1 << 22)
+
+// HyperLogLog registers of the recipients of each sender, found by address through an open addressing table, and of
+// all the senders and all the recipients. Memory is HLL_REGISTERS bytes per sender, whatever its correspondents count.
+typedef struct {
+    char **senders;        // Sender addresses, in order of appearance
+    uint8_t *registers;    // HLL_REGISTERS registers per sender, in the same order
+    size_t count;
+    size_t capacity;
+    size_t *slots;         // Sender index + 1 in each slot, 0 for an empty slot
+    size_t slots_capacity; // Always a power of 2
+    uint8_t all_senders[HLL_REGISTERS];
+    uint8_t all_recipients[HLL_REGISTERS];
+} distinct_counts_t;
+
+/*!
+ * @brief find_slot finds the slot of a sender: the slot holding it, or the empty slot where to insert it
+ */
+static size_t find_slot(distinct_counts_t *counts, const char *sender, uint64_t hash) {
+    size_t mask = counts->slots_capacity - 1;
+    size_t slot = hash & mask;
+    while (counts->slots[slot] && strcmp(counts->senders[counts->slots[slot] - 1], sender) != 0) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/*!
+ * @brief grow doubles the senders capacity and the slots table
+ * @return true if both grew, false else
+ */
+static bool grow(distinct_counts_t *counts) {
+    size_t capacity = counts->capacity ? 2 * counts->capacity : 256;
+    char **senders = realloc(counts->senders, capacity * sizeof(char *));
+    if (senders) {
+        counts->senders = senders;
+    }
+    uint8_t *registers = realloc(counts->registers, capacity * HLL_REGISTERS);
+    if (registers) {
+        counts->registers = registers;
+    }
+    size_t *slots = calloc(2 * capacity, sizeof(size_t));
+    if (!senders || !registers || !slots) {
+        free(slots);
+        return false;
+    }
+    free(counts->slots);
+    counts->slots = slots;
+    counts->slots_capacity = 2 * capacity;
+    counts->capacity = capacity;
+    for (size_t i = 0; i < counts->count; ++i) {
+        counts->slots[find_slot(counts, counts->senders[i], hll_hash(counts->senders[i]))] = i + 1;
+    }
+    return true;
+}
+
+/*!
+ * @brief sender_registers gives the registers of a sender, adding it with empty registers if it is unknown
+ * @param counts the counts
+ * @param sender the sender address
+ * @param hash the sender address hash (@see hll_hash)
+ * @return the registers, NULL if the sender could not be added
+ */
+static uint8_t *sender_registers(distinct_counts_t *counts, const char *sender, uint64_t hash) {
+    if (counts->count == counts->capacity && !grow(counts)) {
+        return NULL;
+    }
+    size_t slot = find_slot(counts, sender, hash);
+    if (!counts->slots[slot]) {
+        if (!(counts->senders[counts->count] = strdup(sender))) {
+            return NULL;
+        }
+        memset(counts->registers + counts->count * HLL_REGISTERS, 0, HLL_REGISTERS);
+        counts->slots[slot] = ++counts->count;
+    }
+    return counts->registers + (counts->slots[slot] - 1) * HLL_REGISTERS;
+}
+
+/*!
+ * @brief free_counts releases the senders and registers of counts
+ */
+static void free_counts(distinct_counts_t *counts) {
+    for (size_t i = 0; i < counts->count; ++i) {
+        free(counts->senders[i]);
+    }
+    free(counts->senders);
+    free(counts->registers);
+    free(counts->slots);
+}
+
+/*!
+ * @brief count_range adds the lines of a part of step2_output to counts. A line belongs to the part where it starts,
+ * so that parts can be cut at any byte. In a block file, a block belongs to the part where it starts (@see
+ * block_file_open_part).
+ * @param temp_file path to step2_output
+ * @param start the first byte of the part
+ * @param end the byte after the part
+ * @param is_block_file true if step2_output is compressed
+ * @param counts the counts to update
+ * @return true if the part was read, false else
+ */
+static bool count_range(char *temp_file, off_t start, off_t end, bool is_block_file, distinct_counts_t *counts) {
+    FILE *file = is_block_file ? block_file_open_part(temp_file, start, end) : fopen(temp_file, "r");
+    if (!file) {
+        perror("Cannot open temp_file");
+        return false;
+    }
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t length = 0;
+    off_t position = start;
+    if (is_block_file) {
+        end = (off_t) INT64_MAX; // The stream ends with the part
+    } else if (start > 0) {
+        // Skip the end of the line started in the previous part (only its '\n' if the part starts a line)
+        fseeko(file, start - 1, SEEK_SET);
+        length = getline(&line, &line_capacity, file);
+        position = start - 1 + (length > 0 ? length : 0);
+    }
+    bool success = true;
+    while (success && position < end && (length = getline(&line, &line_capacity, file)) != -1) {
+        position += length;
+        if (line[0] == PLUGIN_LINE_MARK) {
+            continue; // Keys of the plugins (@see plugins.h)
+        }
+        char *save = NULL;
+        char *sender = strtok_r(line, " \n", &save);
+        if (!sender) {
+            continue;
+        }
+        uint64_t hash = hll_hash(sender);
+        hll_add(counts->all_senders, hash);
+        uint8_t *registers = sender_registers(counts, sender, hash);
+        success = registers != NULL;
+        char *recipient;
+        while (success && (recipient = strtok_r(NULL, " \n", &save))) {
+            hash = hll_hash(recipient);
+            hll_add(registers, hash);
+            hll_add(counts->all_recipients, hash);
+        }
+    }
+    free(line);
+    fclose(file);
+    return success;
+}
+
+/*!
+ * @brief save_counts writes the counts of a worker to a file, to be merged by the parent
+ * @param counts the counts
+ * @param path the file path
+ * @return true if the file was written, false else
+ */
+static bool save_counts(distinct_counts_t *counts, char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+    bool success = fwrite(counts->all_senders, HLL_REGISTERS, 1, file) == 1 &&
+                   fwrite(counts->all_recipients, HLL_REGISTERS, 1, file) == 1;
+    for (size_t i = 0; i < counts->count && success; ++i) {
+        uint32_t length = strlen(counts->senders[i]);
+        success = fwrite(&length, sizeof(length), 1, file) == 1 &&
+                  fwrite(counts->senders[i], 1, length, file) == length &&
+                  fwrite(counts->registers + i * HLL_REGISTERS, HLL_REGISTERS, 1, file) == 1;
+    }
+    return fclose(file) == 0 && success;
+}
+
+/*!
+ * @brief merge_counts merges the counts saved by a worker into counts: registers of a same sender merge into those of
+ * the union of its correspondents
+ * @param counts the counts to update
+ * @param path the file written by save_counts
+ * @return true if the file was merged, false else
+ */
+static bool merge_counts(distinct_counts_t *counts, char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return false;
+    }
+    uint8_t registers[HLL_REGISTERS];
+    char sender[STR_MAX_LEN];
+    bool success = fread(registers, HLL_REGISTERS, 1, file) == 1;
+    if (success) {
+        hll_merge(counts->all_senders, registers);
+        success = fread(registers, HLL_REGISTERS, 1, file) == 1;
+    }
+    if (success) {
+        hll_merge(counts->all_recipients, registers);
+    }
+    uint32_t length;
+    while (success && fread(&length, sizeof(length), 1, file) == 1) {
+        success = length < STR_MAX_LEN && fread(sender, 1, length, file) == length &&
+                  fread(registers, HLL_REGISTERS, 1, file) == 1;
+        if (success) {
+            sender[length] = '\0';
+            uint8_t *merged = sender_registers(counts, sender, hll_hash(sender));
+            success = merged != NULL;
+            if (success) {
+                hll_merge(merged, registers);
+            }
+        }
+    }
+    fclose(file);
+    return success;
+}
+
+static char **compared_senders; // qsort has no context parameter
+
+/*!
+ * @brief compare_senders orders sender indices by address (qsort callback)
+ */
+static int compare_senders(const void *a, const void *b) {
+    return strcmp(compared_senders[*(size_t *) a], compared_senders[*(size_t *) b]);
+}
+
+/*!
+ * @brief write_counts writes the estimates: the global ones first, then each sender with its distinct recipients
+ * count, senders sorted by address
+ * @param counts the merged counts
+ * @param output_file the output path
+ * @return true if the file was written, false else
+ */
+static bool write_counts(distinct_counts_t *counts, char *output_file) {
+    FILE *file = fopen(output_file, "w");
+    size_t *order = malloc((counts->count + 1) * sizeof(size_t));
+    if (!file || !order) {
+        perror("Cannot open distinct counts file");
+        if (file) {
+            fclose(file);
+        }
+        free(order);
+        return false;
+    }
+    for (size_t i = 0; i < counts->count; ++i) {
+        order[i] = i;
+    }
+    compared_senders = counts->senders;
+    qsort(order, counts->count, sizeof(size_t), compare_senders);
+
+    fprintf(file, "# HyperLogLog estimates, %d registers, standard error %.2f%%\n", HLL_REGISTERS,
+            100 * hll_standard_error());
+    fprintf(file, "# distinct senders: %.0f\n", hll_estimate(counts->all_senders));
+    fprintf(file, "# distinct recipients: %.0f\n", hll_estimate(counts->all_recipients));
+    for (size_t i = 0; i < counts->count; ++i) {
+        fprintf(file, "%s %.0f\n", counts->senders[order[i]],
+                hll_estimate(counts->registers + order[i] * HLL_REGISTERS));
+    }
+    free(order);
+    return fclose(file) == 0;
+}
+
+/*!
+ * @brief write_distinct_counts estimates the distinct correspondents of each sender, and the distinct senders and
+ * recipients of the corpus, from step2_output. Parts of the file are counted by up to nb_proc processes, whose
+ * registers are merged by the parent (a sender may appear in several parts).
+ * @param temp_file path to step2_output
+ * @param output_file path to the distinct counts file
+ * @param nb_proc the maximum number of counting processes
+ * @return true if the file was written, false else
+ */
+bool write_distinct_counts(char *temp_file, char *output_file, uint16_t nb_proc) {
+    struct stat status;
+    if (stat(temp_file, &status) == -1) {
+        perror("Cannot stat temp_file");
+        return false;
+    }
+    block_file_stats_t blocks;
+    bool is_block_file = block_file_stat(temp_file, &blocks);
+    size_t workers = (nb_proc > 1 && status.st_size >= PARALLEL_DISTINCT_MIN_BYTES) ? nb_proc : 1;
+    pid_t *children = calloc(workers, sizeof(pid_t));
+    char part_path[STR_MAX_LEN];
+    distinct_counts_t counts = {0};
+    bool success = children != NULL;
+    for (size_t worker = 1; worker < workers && success; ++worker) {
+        off_t start = status.st_size * worker / workers, end = status.st_size * (worker + 1) / workers;
+        snprintf(part_path, sizeof(part_path), "%s.distinct%zu", temp_file, worker);
+        children[worker] = fork();
+        if (children[worker] == 0) {
+            bool saved = count_range(temp_file, start, end, is_block_file, &counts) && save_counts(&counts, part_path);
+            exit(saved ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+        if (children[worker] == -1) {
+            success = count_range(temp_file, start, end, is_block_file, &counts);
+        }
+    }
+    success = success && count_range(temp_file, 0, status.st_size / workers, is_block_file, &counts);
+    // Other children (e.g. message queue workers) may be alive: only wait for the counting ones
+    for (size_t worker = 1; worker < workers && children; ++worker) {
+        int child_status;
+        if (children[worker] <= 0 || waitpid(children[worker], &child_status, 0) == -1) {
+            continue;
+        }
+        snprintf(part_path, sizeof(part_path), "%s.distinct%zu", temp_file, worker);
+        success = success && WIFEXITED(child_status) && WEXITSTATUS(child_status) == EXIT_SUCCESS &&
+                  merge_counts(&counts, part_path);
+        unlink(part_path);
+    }
+    free(children);
+    success = success && write_counts(&counts, output_file);
+    if (!success) {
+        printf("Could not estimate distinct correspondents\n");
+    }
+    free_counts(&counts);
+    return success;
+}
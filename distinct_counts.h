@@ -0,0 +1,13 @@
+//
+// Created on 19/10/26.
+//
+
+#ifndef A2022_DISTINCT_COUNTS_H
+#define A2022_DISTINCT_COUNTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+bool write_distinct_counts(char *temp_file, char *output_file, uint16_t nb_proc);
+
+#endif //A2022_DISTINCT_COUNTS_H
@@ -17,6 +17,10 @@
 
 #include "analysis.h"
 #include "utility.h"
+#include "metrics.h"
+#include "trace.h"
+#include "scheduling.h"
+#include "supervision.h"
 
 /*!
  * @brief make_fifos creates FIFOs for processes to communicate with their parent
@@ -29,7 +33,7 @@ void make_fifos(uint16_t processes_count, char *file_format) {
     int i = 0; 
 
     while(i<processes_count){
-        sprintf(buffer,"%s%d",file_format,i);
+        snprintf(buffer,sizeof(buffer),file_format,i);
         if(mkfifo(buffer,0666) == -1){
             if(errno != EEXIST){
                 printf("Could not create a fifo file\n");
@@ -51,7 +55,7 @@ void erase_fifos(uint16_t processes_count, char *file_format) {
     int i = 0;
 
      while(i<processes_count){
-        sprintf(buffer,"%s%d",file_format,i);
+        snprintf(buffer,sizeof(buffer),file_format,i);
         if(remove(buffer) == -1){
             fprintf(stderr,"Could not delete the fifo");
         };
@@ -61,61 +65,85 @@ void erase_fifos(uint16_t processes_count, char *file_format) {
 
 
 /*!
- * @brief make_processes creates processes and starts their code (waiting for commands)
+ * @brief fifo_worker is the code of a worker: it opens its command FIFO (for reading) then its notify FIFO (for
+ * writing), runs the tasks it reads and writes its unflushed tasks (@see unflushed_mail_tasks) on the notify FIFO at
+ * the end of each one. It terminates on a task with a NULL callback, or when its command FIFO is closed.
+ * @param index the worker index, used to name its FIFOs
+ */
+static void fifo_worker(uint16_t index) {
+    char buffer[STR_MAX_LEN];
+    snprintf(buffer, sizeof(buffer), FIFO_COMMAND_FORMAT, index);
+    int read_fd = open(buffer, O_RDONLY);
+    snprintf(buffer, sizeof(buffer), FIFO_NOTIFY_FORMAT, index);
+    int write_fd = open(buffer, O_WRONLY);
+    if (read_fd == -1 || write_fd == -1) {
+        perror("Cannot open worker fifos");
+        exit(EXIT_FAILURE);
+    }
+
+    while (1) {
+        task_t task;
+        uint64_t wait_start_us = metrics_now_us();
+        // Tasks are smaller than PIPE_BUF: they are written and read whole
+        ssize_t read_size = read(read_fd, &task, sizeof(task_t));
+        if (read_size == -1 && errno == EINTR) {
+            continue;
+        }
+        if (read_size != sizeof(task_t) || task.task_callback == NULL) {
+            break;
+        }
+        uint64_t task_start_us = metrics_now_us();
+        metrics_idle(task_start_us - wait_start_us);
+        trace_record(TRACE_WORKER_WAIT, wait_start_us, task_start_us, NULL);
+
+        task.task_callback(&task);
+        metrics_task_done();
+        trace_task(&task, task_start_us, metrics_now_us());
+
+        uint32_t unflushed_tasks = unflushed_mail_tasks();
+        if (write(write_fd, &unflushed_tasks, sizeof(uint32_t)) != sizeof(uint32_t)) {
+            break;
+        }
+    }
+    release_mail_caches();
+    close(read_fd);
+    close(write_fd);
+    exit(EXIT_SUCCESS);
+}
+
+/*!
+ * @brief make_processes creates processes and starts their code (waiting for commands). The parent ignores SIGPIPE
+ * from then on: a task sent to a worker which just died must not kill it (the death is noticed on the notify FIFO).
  * @param processes_count the number of processes to create
  * @return a malloc'ed array with the PIDs of the created processes
  */
 pid_t *make_processes(uint16_t processes_count) {
-    
-    char* file_format_in = "fifo-in-";
-    char* file_format_out = "fifo-out-";
-    char buffer[STR_MAX_LEN];
     // 1. Create PIDs array
     pid_t* PIDs_array = (pid_t*)malloc(sizeof(pid_t)*processes_count);
-    
+    if (PIDs_array == NULL) {
+        return NULL;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
     // 2. Loop over processes_count to fork
     for(uint16_t i = 0; i<processes_count;i++){
-        
         pid_t pid = fork();
         // 2 bis. in fork child part, open reading and writing FIFOs, and start listening on reading FIFO
-
         if (pid == 0){
-            
-            snprintf(buffer,sizeof(buffer),"%s%d",file_format_in,i);
-            int read_fd = open(buffer,O_RDONLY);
-            snprintf(buffer,sizeof(buffer),"%s%d",file_format_out,i);
-            //int write_fd = open(buffer,O_WRONLY);
-
-            while(1){
-                
-                task_t task;
-                ssize_t read_size = read(read_fd, &task, sizeof(task_t));
-                if (read_size != sizeof(task_t)) {
-                   break;
-                }
-                
-                // 3 bis. If task has a NULL callback, terminate process (don't forget cleanup).
-                if (task.task_callback == NULL) {
-                    // TODO: Cleanup
-                    exit(EXIT_SUCCESS);
-                }
-                // 3. Upon reception, apply task
-                task.task_callback(&task);
-            }
-
+            signal(SIGPIPE, SIG_DFL);
+            metrics_set_worker(i);
+            trace_set_worker(i);
+            scheduling_pin_worker(i);
+            fifo_worker(i);
         } else if (pid > 0) {
             PIDs_array[i] = pid;
         } else {
-           
             free(PIDs_array);
             return NULL;
         }
     }
     return PIDs_array;
 }
-   
-    
-
 
 /*!
  * @brief open_fifos opens FIFO from the parent's side
@@ -130,7 +158,7 @@ int *open_fifos(uint16_t processes_count, char *file_format, int flags) {
     char buffer[STR_MAX_LEN];
 
     for(int i = 0 ; i<processes_count; i++ ){
-        sprintf(buffer,"%s%d",file_format,i);
+        snprintf(buffer,sizeof(buffer),file_format,i);
         file_descriptor[i]= open(buffer,flags); 
     }
 
@@ -156,19 +184,27 @@ void close_fifos(uint16_t processes_count, int *files) {
 }
 
 /*!
- * @brief shutdown_processes terminates all worker processes by sending a task with a NULL callback
+ * @brief shutdown_processes terminates all worker processes by sending a task with a NULL callback, and waits for them
  * @param processes_count the number of processes to terminate
  * @param fifos the array to the output FIFOs (used to command the processes) file descriptors
+ * @param children the array of the workers PIDs
  */
-void shutdown_processes(uint16_t processes_count, int *fifos) {
+void shutdown_processes(uint16_t processes_count, int *fifos, pid_t *children) {
     // 1. Loop over processes_count
     for(uint16_t i = 0; i<processes_count; i++){
         // 2. Create an empty task (with a NULL callback)
         task_t task;
-        task.task_callback=NULL;
+        memset(&task, 0, sizeof(task));
         // 3. Send task to current process
-        write(fifos[i],&task,sizeof(task));
+        if (write(fifos[i],&task,sizeof(task)) != sizeof(task)) {
+            fprintf(stderr, "Cannot stop worker %d\n", i);
+        }
+    }
+    for(uint16_t i = 0; i<processes_count; i++){
+        while (waitpid(children[i], NULL, 0) == -1 && errno == EINTR) {
+        }
     }
+    signal(SIGPIPE, SIG_DFL);
 }
 
 /*!
@@ -192,81 +228,169 @@ int prepare_select(fd_set *fds, const int *filesdes, uint16_t nb_proc) {
     return max_fd;
 }
 
+typedef struct {
+    int *notify_fifos;
+    int *command_fifos;
+    pid_t *children;
+    uint16_t count;
+} fifo_workers_t;
+
+/*!
+ * @brief fifo_send_task writes a task on the command FIFO of a worker (@see worker_transport_t). A worker which died
+ * since its last task is not an error: its death is read on its notify FIFO and the task dispatched again.
+ */
+static bool fifo_send_task(void *context, uint16_t worker, task_t *task) {
+    fifo_workers_t *workers = context;
+    ssize_t written;
+    while ((written = write(workers->command_fifos[worker], task, sizeof(task_t))) == -1 && errno == EINTR) {
+    }
+    if (written == -1 && errno != EPIPE) {
+        perror("Cannot send task");
+        return false;
+    }
+    return true;
+}
+
 /*!
- * @brief send_task sends a directory task to a child process. Must send a directory command on object directory
- * data_source/dir_name, to write the result in temp_files/dir_name. Sends on FIFO with FD command_fd
- * @param data_source the data source with directories to analyze
- * @param temp_files the temporary output files directory
- * @param dir_name the current dir name to analyze
- * @param command_fd the child process command FIFO file descriptor
+ * @brief fifo_wait_event waits for a notification (end of a task) or the end of file (death) on the notify FIFOs
+ * (@see worker_transport_t). Notifications are smaller than PIPE_BUF, they are read whole. A dead worker is reaped
+ * before its death is reported.
  */
-void send_task(char *data_source, char *temp_files, char *dir_name, int command_fd) {
-    directory_task_t *t = (directory_task_t *) malloc(sizeof(task_t));
+static worker_event_t fifo_wait_event(void *context, uint16_t *worker, uint32_t *unflushed_tasks) {
+    fifo_workers_t *workers = context;
+    while (true) {
+        fd_set fds;
+        int max_fd = prepare_select(&fds, workers->notify_fifos, workers->count);
+        if (select(max_fd + 1, &fds, NULL, NULL, NULL) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("select");
+            return WORKER_EVENT_ERROR;
+        }
+        for (uint16_t i = 0; i < workers->count; ++i) {
+            if (!FD_ISSET(workers->notify_fifos[i], &fds)) {
+                continue;
+            }
+            ssize_t read_size = read(workers->notify_fifos[i], unflushed_tasks, sizeof(uint32_t));
+            if (read_size == -1 && errno == EINTR) {
+                break;
+            }
+            *worker = i;
+            if (read_size == sizeof(uint32_t)) {
+                return WORKER_TASK_DONE;
+            }
+            while (waitpid(workers->children[i], NULL, 0) == -1 && errno == EINTR) {
+            }
+            return WORKER_DIED;
+        }
+    }
+}
 
-    t->task_callback = process_directory;
-    strncpy(t->object_directory, dir_name, STR_MAX_LEN);
-    strncpy(t->temporary_directory, temp_files, STR_MAX_LEN);
+/*!
+ * @brief fifo_respawn replaces a dead worker, with the same FIFOs (@see worker_transport_t). The FIFOs are opened in
+ * the order of the worker (command then notify), the new worker closing the parent's descriptors it inherited.
+ */
+static bool fifo_respawn(void *context, uint16_t worker) {
+    fifo_workers_t *workers = context;
+    close(workers->command_fifos[worker]);
+    close(workers->notify_fifos[worker]);
+    pid_t pid = fork();
+    if (pid == 0) {
+        for (uint16_t i = 0; i < workers->count; ++i) {
+            if (i != worker) {
+                close(workers->command_fifos[i]);
+                close(workers->notify_fifos[i]);
+            }
+        }
+        signal(SIGPIPE, SIG_DFL);
+        metrics_set_worker(worker);
+        trace_set_worker(worker);
+        scheduling_pin_worker(worker);
+        fifo_worker(worker);
+    }
+    if (pid == -1) {
+        perror("fork");
+        return false;
+    }
+    workers->children[worker] = pid;
+    char buffer[STR_MAX_LEN];
+    snprintf(buffer, sizeof(buffer), FIFO_COMMAND_FORMAT, worker);
+    workers->command_fifos[worker] = open(buffer, O_WRONLY);
+    snprintf(buffer, sizeof(buffer), FIFO_NOTIFY_FORMAT, worker);
+    workers->notify_fifos[worker] = open(buffer, O_RDONLY);
+    return workers->command_fifos[worker] != -1 && workers->notify_fifos[worker] != -1;
+}
 
-    // Send the task to the child process
-    write(command_fd, t, sizeof(task_t));
+/*!
+ * @brief fifo_supervise dispatches all the tasks of a source to the workers, replacing those which die
+ * @param source the tasks to dispatch
+ * @param notify_fifos the FIFOs on which to read for workers to notify end of tasks
+ * @param command_fifos the FIFOs on which to send tasks to workers
+ * @param children the workers PIDs, updated when a worker is replaced
+ * @param nb_proc the number of workers
+ * @param controller the adaptive concurrency controller, NULL to keep all the workers busy
+ */
+static void fifo_supervise(task_source_t *source, int *notify_fifos, int *command_fifos, pid_t *children,
+                           uint16_t nb_proc, concurrency_controller_t *controller) {
+    fifo_workers_t workers = {
+            .notify_fifos = notify_fifos, .command_fifos = command_fifos, .children = children, .count = nb_proc
+    };
+    worker_transport_t transport = {
+            .context = &workers,
+            .send_task = fifo_send_task,
+            .wait_event = fifo_wait_event,
+            .respawn = fifo_respawn,
+    };
+    supervision_stats_t stats;
+    supervise_tasks(&transport, nb_proc, source, controller, &stats);
+    if (stats.respawned > 0) {
+        printf("%u workers died and were replaced, %u tasks given up\n", stats.respawned, stats.abandoned);
+    }
 }
 
 /*!
- * @brief fifo_process_directory is the main function to distribute directory analysis to worker processes.
+ * @brief fifo_process_directory is the main function to distribute directory analysis to worker processes. Each
+ * worker is given one task at a time, the next one when it notifies the end of its current task.
  * @param data_source the data source with the directories to analyze
  * @param temp_files the temporary files directory
  * @param notify_fifos the FIFOs on which to read for workers to notify end of tasks
  * @param command_fifos the FIFOs on which to send tasks to workers
+ * @param children the workers PIDs, updated when a worker is replaced
  * @param nb_proc the maximum number of simultaneous tasks, = to number of workers
- * Uses @see send_task
+ * @param controller the adaptive concurrency controller, NULL to keep all the workers busy
  */
-void fifo_process_directory(char *data_source, char *temp_files, int *notify_fifos, int *command_fifos, uint16_t nb_proc) {
-    // 1. Check parameters
-    if (!directory_exists(data_source)) {
-        printf("Error: data source directory does not exist.\n");
-        return;
-    }
-    DIR *dir = opendir(data_source);
-    // TODO: Memory leak
-    if (!dir) {
+void fifo_process_directory(char *data_source, char *temp_files, int *notify_fifos, int *command_fifos,
+                            pid_t *children, uint16_t nb_proc, concurrency_controller_t *controller) {
+    task_source_t source;
+    if (!task_source_open_directories(&source, data_source, temp_files)) {
         printf("Error: could not open data source directory.\n");
-        closedir(dir);
         return;
     }
-    // 2. Iterate over directories (ignore . and ..)
-    uint16_t current_proc = 0;
-    struct dirent *entry = readdir(dir);
-    while (entry != NULL) {
-        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
-            // 3. Send a directory task to each running worker process
-            char entry_path[STR_MAX_LEN];
-            concat_path(data_source, entry->d_name, entry_path);
-            if (directory_exists(entry_path)) {
-
-                send_task(data_source, temp_files, entry_path, command_fifos[current_proc]);
-            
-            }
-        }  
-        entry = next_dir(entry,dir);    
-        ++current_proc; 
-    }
-    
-    // 4. Iterate over remaining directories by waiting for a process to finish its task before sending a new one.
-    // 5. Cleanup
+    fifo_supervise(&source, notify_fifos, command_fifos, children, nb_proc, controller);
+    task_source_close(&source);
 }
 
 /*!
- * @brief fifo_process_files is the main function to distribute files analysis to worker processes.
- * @param data_source the data source with the files to analyze
+ * @brief fifo_process_files is the main function to distribute files analysis to worker processes: the files listed
+ * in step1_output are analyzed into step2_output. Operates as @see fifo_process_directory.
  * @param temp_files the temporary files directory (step1_output is here)
  * @param notify_fifos the FIFOs on which to read for workers to notify end of tasks
  * @param command_fifos the FIFOs on which to send tasks to workers
+ * @param children the workers PIDs, updated when a worker is replaced
  * @param nb_proc  the maximum number of simultaneous tasks, = to number of workers
+ * @param controller the adaptive concurrency controller, NULL to keep all the workers busy
  */
-void fifo_process_files(char *data_source, char *temp_files, int *notify_fifos, int *command_fifos, uint16_t nb_proc) {
-    // 1. Check parameters
-    // 2. Iterate over files in step1_output
-    // 3. Send a file task to each running worker process (you may create a utility function for this)
-    // 4. Iterate over remaining files by waiting for a process to finish its task before sending a new one.
-    // 5. Cleanup
+void fifo_process_files(char *temp_files, int *notify_fifos, int *command_fifos, pid_t *children, uint16_t nb_proc,
+                        concurrency_controller_t *controller) {
+    char files_list[STR_MAX_LEN], output[STR_MAX_LEN];
+    concat_path(temp_files, "step1_output", files_list);
+    concat_path(temp_files, "step2_output", output);
+    task_source_t source;
+    if (!task_source_open_files(&source, files_list, output)) {
+        printf("Error: could not open files list.\n");
+        return;
+    }
+    fifo_supervise(&source, notify_fifos, command_fifos, children, nb_proc, controller);
+    task_source_close(&source);
 }
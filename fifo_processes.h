@@ -6,17 +6,24 @@
 #define A2022_FIFO_PROCESSES_H
 
 #include "global_defs.h"
+#include "concurrency.h"
 #include <unistd.h>
 #include <stdio.h>
 
+// FIFO names of each worker, from the parent to the worker (tasks) and from the worker to the parent (end of tasks)
+#define FIFO_COMMAND_FORMAT "fifo-in-%d"
+#define FIFO_NOTIFY_FORMAT "fifo-out-%d"
+
 void make_fifos(uint16_t processes_count, char *file_format);
 void erase_fifos(uint16_t processes_count, char *file_format);
 pid_t *make_processes(uint16_t processes_count);
 int *open_fifos(uint16_t processes_count, char *file_format, int flags);
 void close_fifos(uint16_t processes_count, int*files);
-void shutdown_processes(uint16_t processes_count, int *fifos);
+void shutdown_processes(uint16_t processes_count, int *fifos, pid_t *children);
 
-void fifo_process_directory(char *data_source, char *temp_files, int *notify_fifos, int *command_fifos, uint16_t nb_proc);
-void fifo_process_files(char *data_source, char *temp_files, int *notify_fifos, int *command_fifos, uint16_t nb_proc);
+void fifo_process_directory(char *data_source, char *temp_files, int *notify_fifos, int *command_fifos,
+                            pid_t *children, uint16_t nb_proc, concurrency_controller_t *controller);
+void fifo_process_files(char *temp_files, int *notify_fifos, int *command_fifos, pid_t *children, uint16_t nb_proc,
+                        concurrency_controller_t *controller);
 
 #endif //A2022_FIFO_PROCESSES_H
@@ -0,0 +1,164 @@
+//
+// Created on 19/10/26.
+//
+
+#include "file_errors.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "global_defs.h"
+#include "string_set.h"
+
+// Both are set up by the parent before forking: workers append to the inherited log descriptor (O_APPEND, one write
+// per line, so lines of concurrent workers never interleave) and look paths up in their copy of the skip set.
+static int rejected_log_fd = -1;
+static string_set_t skipped_paths;
+// Hash of the skip list, 0 when there is none or when it is the rejected files log, which grows with the run
+static uint64_t skip_list_fingerprint = 0;
+
+static const char *statuses_names[FILE_STATUSES_COUNT] = {
+        "ok", "not_found", "access_denied", "open_failed", "malformed_header", "output_failed", "worker_crashed",
+        "skipped",
+};
+
+/*!
+ * @brief file_status_name returns the name of a status, as written in the rejected files log and metrics
+ * @param status the status
+ * @return the status name
+ */
+const char *file_status_name(file_status_t status) {
+    return status < FILE_STATUSES_COUNT ? statuses_names[status] : "unknown";
+}
+
+/*!
+ * @brief file_status_from_errno converts the errno of a failed open to a status
+ * @param error the errno value
+ * @return the matching status
+ */
+file_status_t file_status_from_errno(int error) {
+    switch (error) {
+        case ENOENT:
+        case ENOTDIR:
+            return FILE_STATUS_NOT_FOUND;
+        case EACCES:
+        case EPERM:
+            return FILE_STATUS_ACCESS_DENIED;
+        default:
+            return FILE_STATUS_OPEN_FAILED;
+    }
+}
+
+/*!
+ * @brief load_skip_list reads the paths to skip from a file: either a rejected files log of a previous run
+ * ("status<TAB>path" lines) or a plain list of paths, one per line
+ * @param skip_list the path to the file
+ * @return true if the file was read, false else
+ */
+static bool load_skip_list(char *skip_list) {
+    FILE *file = fopen(skip_list, "r");
+    if (!file) {
+        perror("Cannot open skip list");
+        return false;
+    }
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t length;
+    bool success = string_set_init(&skipped_paths, 0);
+    while (success && (length = getline(&line, &line_capacity, file)) != -1) {
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+            line[--length] = '\0';
+        }
+        char *tab = strchr(line, '\t');
+        char *path = tab ? tab + 1 : line;
+        if (*path) {
+            success = string_set_add(&skipped_paths, path);
+        }
+    }
+    free(line);
+    fclose(file);
+    return success;
+}
+
+/*!
+ * @brief file_errors_init opens the rejected files log and loads the skip list. Must be called before forking workers.
+ * When both are the same file, or when a run is resumed, the log is appended to, so that it keeps the known-bad paths
+ * across reruns.
+ * @param rejected_log the path to the rejected files log, NULL or empty for none
+ * @param skip_list the path to the list of files not to open, NULL or empty for none
+ * @param is_resuming true if the run continues an interrupted one, whose rejected files are kept
+ * @return true if both could be set up, false else
+ */
+bool file_errors_init(char *rejected_log, char *skip_list, bool is_resuming) {
+    bool success = true;
+    bool has_skip_list = skip_list && skip_list[0] != '\0';
+    if (has_skip_list) {
+        success = load_skip_list(skip_list);
+    }
+    bool is_log_skipped = has_skip_list && rejected_log && strcmp(rejected_log, skip_list) == 0;
+    for (size_t i = 0; success && has_skip_list && !is_log_skipped && i < skipped_paths.capacity; ++i) {
+        skip_list_fingerprint += skipped_paths.slots[i] ? string_hash(skipped_paths.slots[i]) : 0;
+    }
+    if (rejected_log && rejected_log[0] != '\0') {
+        int truncate = (is_resuming || (has_skip_list && strcmp(rejected_log, skip_list) == 0)) ? 0 : O_TRUNC;
+        rejected_log_fd = open(rejected_log, O_WRONLY | O_CREAT | O_APPEND | truncate, 0644);
+        if (rejected_log_fd == -1) {
+            perror("Cannot open rejected files log");
+            success = false;
+        }
+    }
+    return success;
+}
+
+/*!
+ * @brief file_errors_cleanup closes the rejected files log and frees the skip list
+ */
+void file_errors_cleanup() {
+    if (rejected_log_fd != -1) {
+        close(rejected_log_fd);
+        rejected_log_fd = -1;
+    }
+    string_set_free(&skipped_paths);
+    skip_list_fingerprint = 0;
+}
+
+/*!
+ * @brief file_errors_skip_fingerprint hashes the paths of the skip list, whatever their order, so that a resumed run
+ * can check that it skips the same files. A skip list which is also the rejected files log is not hashed: the paths it
+ * gains during a run were rejected by that run anyway.
+ * @return the hash, 0 without skip list
+ */
+uint64_t file_errors_skip_fingerprint() {
+    return skip_list_fingerprint;
+}
+
+/*!
+ * @brief file_errors_skip tells if a file is in the skip list
+ * @param path the file path, as listed in step1_output
+ * @return true if the file must not be processed, false else
+ */
+bool file_errors_skip(char *path) {
+    return skipped_paths.count > 0 && string_set_contains(&skipped_paths, path);
+}
+
+/*!
+ * @brief file_errors_record appends a rejected file to the log. Output failures and skipped files are not logged, as
+ * the mail itself is not at fault.
+ * @param path the file path
+ * @param status the reason why the file was rejected
+ */
+void file_errors_record(char *path, file_status_t status) {
+    if (rejected_log_fd == -1 || status == FILE_STATUS_OK || status == FILE_STATUS_OUTPUT_FAILED ||
+        status == FILE_STATUS_SKIPPED) {
+        return;
+    }
+    char line[2 * STR_MAX_LEN];
+    int length = snprintf(line, sizeof(line), "%s\t%s\n", file_status_name(status), path);
+    if (length > 0 && (size_t) length < sizeof(line) && write(rejected_log_fd, line, length) == -1) {
+        perror("Cannot write rejected files log");
+    }
+}
@@ -0,0 +1,32 @@
+//
+// Created on 19/10/26.
+//
+
+#ifndef A2022_FILE_ERRORS_H
+#define A2022_FILE_ERRORS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+    FILE_STATUS_OK,
+    FILE_STATUS_NOT_FOUND,        // ENOENT
+    FILE_STATUS_ACCESS_DENIED,    // EACCES, EPERM
+    FILE_STATUS_OPEN_FAILED,      // Any other open error
+    FILE_STATUS_MALFORMED_HEADER, // No From: field in the header
+    FILE_STATUS_OUTPUT_FAILED,    // The temporary output could not be written (not the mail's fault)
+    FILE_STATUS_WORKER_CRASHED,   // Its worker died on each of the TASK_MAX_ATTEMPTS dispatches of the mail
+    FILE_STATUS_SKIPPED,          // Listed in the skip list, not opened
+    FILE_STATUSES_COUNT
+} file_status_t;
+
+const char *file_status_name(file_status_t status);
+file_status_t file_status_from_errno(int error);
+
+bool file_errors_init(char *rejected_log, char *skip_list, bool is_resuming);
+void file_errors_cleanup();
+uint64_t file_errors_skip_fingerprint();
+bool file_errors_skip(char *path);
+void file_errors_record(char *path, file_status_t status);
+
+#endif //A2022_FILE_ERRORS_H
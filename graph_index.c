@@ -0,0 +1,313 @@
+//
+// Created on 19/10/26.
+//
+
+#include "graph_index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+typedef struct {
+    uint32_t source;
+    uint32_t target;
+    uint32_t count;
+} index_edge_t;
+
+/*!
+ * @brief compare_strings orders an array of string pointers (qsort/bsearch callback)
+ */
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char **) a, *(char **) b);
+}
+
+/*!
+ * @brief compare_edges orders edges by source, then decreasing count, then target (qsort callback)
+ */
+static int compare_edges(const void *a, const void *b) {
+    const index_edge_t *first = a, *second = b;
+    if (first->source != second->source) {
+        return first->source < second->source ? -1 : 1;
+    }
+    if (first->count != second->count) {
+        return first->count > second->count ? -1 : 1;
+    }
+    return first->target < second->target ? -1 : (first->target > second->target);
+}
+
+/*!
+ * @brief build_address_dictionary builds the sorted dictionary of all the addresses (senders and recipients) of a
+ * senders list: the id of an address is its rank
+ * @param list the senders list, as built by files_reducer
+ * @param addresses_count set to the number of distinct addresses
+ * @param edges_count set to the number of (sender, recipient) pairs
+ * @return the malloc'ed dictionary, pointing into the list, NULL if it could not be allocated
+ */
+char **build_address_dictionary(sender_t *list, uint32_t *addresses_count, uint64_t *edges_count) {
+    size_t names_count = 0;
+    *edges_count = 0;
+    for (sender_t *sender = list; sender != NULL; sender = sender->next) {
+        ++names_count;
+        for (recipient_t *recipient = sender->head; recipient != NULL; recipient = recipient->next) {
+            ++names_count;
+            ++*edges_count;
+        }
+    }
+    char **dictionary = malloc((names_count + 1) * sizeof(char *));
+    if (!dictionary) {
+        return NULL;
+    }
+    size_t n = 0;
+    for (sender_t *sender = list; sender != NULL; sender = sender->next) {
+        dictionary[n++] = sender->sender_address;
+        for (recipient_t *recipient = sender->head; recipient != NULL; recipient = recipient->next) {
+            dictionary[n++] = recipient->recipient_address;
+        }
+    }
+    qsort(dictionary, names_count, sizeof(char *), compare_strings);
+    *addresses_count = 0;
+    for (size_t i = 0; i < names_count; ++i) {
+        if (*addresses_count == 0 || strcmp(dictionary[*addresses_count - 1], dictionary[i]) != 0) {
+            dictionary[(*addresses_count)++] = dictionary[i];
+        }
+    }
+    return dictionary;
+}
+
+/*!
+ * @brief dictionary_address_id finds the id (rank) of an address in the sorted dictionary
+ * @param dictionary the sorted, deduplicated addresses
+ * @param count the dictionary size
+ * @param address the address to look for (must be in the dictionary)
+ * @return the address id
+ */
+uint32_t dictionary_address_id(char **dictionary, uint32_t count, char *address) {
+    char **found = bsearch(&address, dictionary, count, sizeof(char *), compare_strings);
+    return (uint32_t) (found - dictionary);
+}
+
+/*!
+ * @brief write_section writes an array at the current position and pads the file to the next 8 bytes boundary
+ * @param file the index file
+ * @param data the array
+ * @param size the array size in bytes
+ * @param offset the current offset in the file, updated
+ * @return the offset where the array starts
+ */
+static uint64_t write_section(FILE *file, const void *data, size_t size, uint64_t *offset) {
+    static const char padding[8] = {0};
+    uint64_t start = *offset;
+    if (data && size > 0) {
+        fwrite(data, 1, size, file);
+    }
+    size_t padding_size = (8 - size % 8) % 8;
+    fwrite(padding, 1, padding_size, file);
+    *offset += size + padding_size;
+    return start;
+}
+
+/*!
+ * @brief build_csr builds the CSR arrays of a sorted edges array (edges grouped by source)
+ * @param edges the edges, sorted by source
+ * @param edges_count the number of edges
+ * @param nodes_count the number of nodes
+ * @param index the nodes_count + 1 index array to fill
+ * @param targets the edges_count targets array to fill
+ * @param counts the edges_count counts array to fill
+ */
+static void build_csr(index_edge_t *edges, uint64_t edges_count, uint32_t nodes_count, uint64_t *index,
+                      uint32_t *targets, uint32_t *counts) {
+    uint64_t e = 0;
+    for (uint32_t node = 0; node <= nodes_count; ++node) {
+        while (e < edges_count && edges[e].source < node) {
+            targets[e] = edges[e].target;
+            counts[e] = edges[e].count;
+            ++e;
+        }
+        index[node] = e;
+    }
+}
+
+/*!
+ * @brief write_graph_index writes the communication graph of a senders list as a binary index which can be mapped in
+ * memory and queried without parsing (@see graph_index_open)
+ * @param list the senders list, as built by files_reducer
+ * @param path the path to the index file
+ * @return true if the index was written, false else
+ */
+bool write_graph_index(sender_t *list, char *path) {
+    // 1. Build the sorted dictionary of all addresses (senders and recipients)
+    uint32_t addresses_count;
+    uint64_t edges_count;
+    char **dictionary = build_address_dictionary(list, &addresses_count, &edges_count);
+    if (!dictionary) {
+        perror("Cannot allocate index dictionary");
+        return false;
+    }
+
+    // 2. Build the edges in both directions
+    index_edge_t *out_edges = malloc((edges_count + 1) * sizeof(index_edge_t));
+    index_edge_t *in_edges = malloc((edges_count + 1) * sizeof(index_edge_t));
+    uint64_t e = 0;
+    for (sender_t *sender = list; sender != NULL; sender = sender->next) {
+        uint32_t source = dictionary_address_id(dictionary, addresses_count, sender->sender_address);
+        for (recipient_t *recipient = sender->head; recipient != NULL; recipient = recipient->next) {
+            uint32_t target = dictionary_address_id(dictionary, addresses_count, recipient->recipient_address);
+            out_edges[e] = (index_edge_t) {.source = source, .target = target, .count = recipient->occurrences};
+            in_edges[e] = (index_edge_t) {.source = target, .target = source, .count = recipient->occurrences};
+            ++e;
+        }
+    }
+    qsort(out_edges, edges_count, sizeof(index_edge_t), compare_edges);
+    qsort(in_edges, edges_count, sizeof(index_edge_t), compare_edges);
+
+    uint64_t *string_offsets = malloc((addresses_count + 1) * sizeof(uint64_t));
+    uint64_t strings_size = 0;
+    for (uint32_t i = 0; i < addresses_count; ++i) {
+        string_offsets[i] = strings_size;
+        strings_size += strlen(dictionary[i]) + 1;
+    }
+    string_offsets[addresses_count] = strings_size;
+
+    uint64_t *out_index = malloc((addresses_count + 1) * sizeof(uint64_t));
+    uint64_t *in_index = malloc((addresses_count + 1) * sizeof(uint64_t));
+    uint32_t *targets = malloc((edges_count + 1) * sizeof(uint32_t));
+    uint32_t *counts = malloc((edges_count + 1) * sizeof(uint32_t));
+
+    // 3. Write sections (the header is rewritten at the end with the final offsets)
+    bool success = false;
+    FILE *file = fopen(path, "w");
+    if (file) {
+        graph_index_header_t header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, GRAPH_INDEX_MAGIC, sizeof(header.magic));
+        header.addresses_count = addresses_count;
+        header.edges_count = edges_count;
+        uint64_t offset = 0;
+        write_section(file, &header, sizeof(header), &offset);
+        header.string_offsets = write_section(file, string_offsets, (addresses_count + 1) * sizeof(uint64_t), &offset);
+        for (uint32_t i = 0; i < addresses_count; ++i) {
+            fwrite(dictionary[i], 1, strlen(dictionary[i]) + 1, file);
+        }
+        header.strings = write_section(file, NULL, strings_size, &offset); // Strings already written, pads only
+
+        build_csr(out_edges, edges_count, addresses_count, out_index, targets, counts);
+        header.out_index = write_section(file, out_index, (addresses_count + 1) * sizeof(uint64_t), &offset);
+        header.out_targets = write_section(file, targets, edges_count * sizeof(uint32_t), &offset);
+        header.out_counts = write_section(file, counts, edges_count * sizeof(uint32_t), &offset);
+        build_csr(in_edges, edges_count, addresses_count, in_index, targets, counts);
+        header.in_index = write_section(file, in_index, (addresses_count + 1) * sizeof(uint64_t), &offset);
+        header.in_targets = write_section(file, targets, edges_count * sizeof(uint32_t), &offset);
+        header.in_counts = write_section(file, counts, edges_count * sizeof(uint32_t), &offset);
+        header.file_size = offset;
+
+        fseek(file, 0, SEEK_SET);
+        fwrite(&header, sizeof(header), 1, file);
+        success = !ferror(file);
+        success = (fclose(file) == 0) && success;
+    }
+    if (!success) {
+        perror("Cannot write index file");
+    }
+
+    free(counts);
+    free(targets);
+    free(in_index);
+    free(out_index);
+    free(string_offsets);
+    free(in_edges);
+    free(out_edges);
+    free(dictionary);
+    return success;
+}
+
+/*!
+ * @brief graph_index_open maps an index file in memory and checks its consistency
+ * @param index the index structure to fill
+ * @param path the path to the index file
+ * @return true if the index is usable, false else
+ */
+bool graph_index_open(graph_index_t *index, char *path) {
+    memset(index, 0, sizeof(graph_index_t));
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    struct stat status;
+    if (fstat(fd, &status) == -1 || (size_t) status.st_size < sizeof(graph_index_header_t)) {
+        close(fd);
+        return false;
+    }
+    void *mapping = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    index->mapping = mapping;
+    index->size = status.st_size;
+    index->header = mapping;
+    const graph_index_header_t *header = index->header;
+    if (memcmp(header->magic, GRAPH_INDEX_MAGIC, sizeof(header->magic)) != 0 || header->file_size != index->size ||
+        header->in_counts + header->edges_count * sizeof(uint32_t) > index->size) {
+        graph_index_close(index);
+        return false;
+    }
+    const char *base = mapping;
+    index->string_offsets = (const uint64_t *) (base + header->string_offsets);
+    index->strings = base + header->strings;
+    index->out_index = (const uint64_t *) (base + header->out_index);
+    index->out_targets = (const uint32_t *) (base + header->out_targets);
+    index->out_counts = (const uint32_t *) (base + header->out_counts);
+    index->in_index = (const uint64_t *) (base + header->in_index);
+    index->in_targets = (const uint32_t *) (base + header->in_targets);
+    index->in_counts = (const uint32_t *) (base + header->in_counts);
+    return true;
+}
+
+/*!
+ * @brief graph_index_close unmaps an index
+ * @param index the index to close
+ */
+void graph_index_close(graph_index_t *index) {
+    if (index->mapping) {
+        munmap(index->mapping, index->size);
+        index->mapping = NULL;
+    }
+}
+
+/*!
+ * @brief graph_index_address returns the address of an id
+ * @param index the index
+ * @param id the address id
+ * @return the address
+ */
+const char *graph_index_address(graph_index_t *index, uint32_t id) {
+    return index->strings + index->string_offsets[id];
+}
+
+/*!
+ * @brief graph_index_find looks for an address with a binary search in the dictionary
+ * @param index the index
+ * @param address the address to look for
+ * @return the address id, -1 if it is not in the index
+ */
+int64_t graph_index_find(graph_index_t *index, const char *address) {
+    int64_t low = 0, high = (int64_t) index->header->addresses_count - 1;
+    while (low <= high) {
+        int64_t middle = low + (high - low) / 2;
+        int comparison = strcmp(graph_index_address(index, middle), address);
+        if (comparison == 0) {
+            return middle;
+        }
+        if (comparison < 0) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,58 @@
+//
+// Created on 19/10/26.
+//
+
+#ifndef A2022_GRAPH_INDEX_H
+#define A2022_GRAPH_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "reducers.h"
+
+#define GRAPH_INDEX_MAGIC "LP25IDX1"
+
+// On-disk layout: this header, then the sections at the given offsets (all 8 bytes aligned). Addresses are sorted,
+// their id is their rank. Adjacency is stored twice in CSR form: edges of id i are [index[i], index[i+1]) in the
+// targets/counts arrays, sorted by decreasing count then target id, so that top-N lookups read the first N edges.
+typedef struct {
+    char magic[8];
+    uint32_t addresses_count;
+    uint32_t reserved;
+    uint64_t edges_count;
+    uint64_t string_offsets;  // uint64_t[addresses_count + 1], offsets in the strings section
+    uint64_t strings;         // NUL-terminated addresses
+    uint64_t out_index;       // uint64_t[addresses_count + 1], sender -> recipients
+    uint64_t out_targets;     // uint32_t[edges_count]
+    uint64_t out_counts;      // uint32_t[edges_count]
+    uint64_t in_index;        // uint64_t[addresses_count + 1], recipient -> senders
+    uint64_t in_targets;      // uint32_t[edges_count]
+    uint64_t in_counts;       // uint32_t[edges_count]
+    uint64_t file_size;
+} graph_index_header_t;
+
+typedef struct {
+    void *mapping;
+    size_t size;
+    const graph_index_header_t *header;
+    const uint64_t *string_offsets;
+    const char *strings;
+    const uint64_t *out_index;
+    const uint32_t *out_targets;
+    const uint32_t *out_counts;
+    const uint64_t *in_index;
+    const uint32_t *in_targets;
+    const uint32_t *in_counts;
+} graph_index_t;
+
+char **build_address_dictionary(sender_t *list, uint32_t *addresses_count, uint64_t *edges_count);
+uint32_t dictionary_address_id(char **dictionary, uint32_t count, char *address);
+bool write_graph_index(sender_t *list, char *path);
+
+bool graph_index_open(graph_index_t *index, char *path);
+void graph_index_close(graph_index_t *index);
+int64_t graph_index_find(graph_index_t *index, const char *address);
+const char *graph_index_address(graph_index_t *index, uint32_t id);
+
+#endif //A2022_GRAPH_INDEX_H
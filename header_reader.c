@@ -0,0 +1,121 @@
+//
+// Created on 19/10/26.
+//
+
+#include "header_reader.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// First allocation of a growable buffer, enough for most header fields
+#define GROWABLE_BUFFER_MIN_CAPACITY 256
+
+/*!
+ * @brief growable_buffer_append appends data to a buffer, doubling its capacity when needed
+ * @param buffer the buffer
+ * @param data the data to append
+ * @param length the data length
+ * @return true if the data was appended, false if the buffer could not grow
+ */
+bool growable_buffer_append(growable_buffer_t *buffer, const char *data, size_t length) {
+    if (buffer->length + length > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : GROWABLE_BUFFER_MIN_CAPACITY;
+        while (buffer->length + length > capacity) {
+            capacity *= 2;
+        }
+        char *grown = realloc(buffer->data, capacity);
+        if (!grown) {
+            return false;
+        }
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+    return true;
+}
+
+/*!
+ * @brief growable_buffer_free releases the memory of a buffer and empties it
+ * @param buffer the buffer
+ */
+void growable_buffer_free(growable_buffer_t *buffer) {
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->length = 0;
+    buffer->capacity = 0;
+}
+
+/*!
+ * @brief read_line reads the next line of the mail in the reader line buffer, without its line break (LF or CRLF)
+ * @param reader the reader
+ * @return the line length, -1 at end of file
+ */
+static ssize_t read_line(header_reader_t *reader) {
+    ssize_t length = getline(&reader->line, &reader->line_capacity, reader->file);
+    while (length > 0 && (reader->line[length - 1] == '\n' || reader->line[length - 1] == '\r')) {
+        reader->line[--length] = '\0';
+    }
+    return length;
+}
+
+/*!
+ * @brief header_reader_start starts reading the header of a mail. The reader keeps its buffers from previous mails.
+ * @param reader the reader, zero-initialized before its first use
+ * @param file the mail file, opened for reading at its beginning
+ */
+void header_reader_start(header_reader_t *reader, FILE *file) {
+    reader->file = file;
+    reader->ended = false;
+    reader->line_length = read_line(reader);
+}
+
+/*!
+ * @brief header_reader_next reads the next unfolded field of the header. Name and value point into the reader buffer
+ * and are valid until the next call.
+ * @param reader the reader
+ * @param name set to the field name (e.g. "To"), without the colon
+ * @param value set to the field value, without its leading blanks
+ * @return true if a field was read, false at the end of the header
+ */
+bool header_reader_next(header_reader_t *reader, char **name, char **value) {
+    while (!reader->ended) {
+        if (reader->line_length <= 0) {
+            reader->ended = true; // Blank line or end of file
+            return false;
+        }
+        reader->field.length = 0;
+        bool appended = growable_buffer_append(&reader->field, reader->line, reader->line_length);
+        while ((reader->line_length = read_line(reader)) > 0 && (reader->line[0] == ' ' || reader->line[0] == '\t')) {
+            appended = appended && growable_buffer_append(&reader->field, reader->line, reader->line_length);
+        }
+        if (!appended || !growable_buffer_append(&reader->field, "", 1)) {
+            reader->ended = true;
+            return false;
+        }
+
+        char *colon = memchr(reader->field.data, ':', reader->field.length);
+        if (!colon || colon == reader->field.data || reader->field.data[0] == ' ' || reader->field.data[0] == '\t') {
+            continue; // Not a field (e.g. a continuation line at the very beginning of the file)
+        }
+        *colon = '\0';
+        *name = reader->field.data;
+        *value = colon + 1;
+        while (**value == ' ' || **value == '\t') {
+            ++*value;
+        }
+        return true;
+    }
+    return false;
+}
+
+/*!
+ * @brief header_reader_free releases the buffers of a reader
+ * @param reader the reader
+ */
+void header_reader_free(header_reader_t *reader) {
+    free(reader->line);
+    reader->line = NULL;
+    reader->line_capacity = 0;
+    growable_buffer_free(&reader->field);
+}
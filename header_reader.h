@@ -0,0 +1,38 @@
+//
+// Created on 19/10/26.
+//
+
+#ifndef A2022_HEADER_READER_H
+#define A2022_HEADER_READER_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} growable_buffer_t;
+
+// Streaming reader of the header fields of a mail. Fields are unfolded (RFC 5322 continuation lines, starting with a
+// space or a tab, are appended to their field) whatever their length, and reading stops at the blank line ending the
+// header. Buffers only grow: a reader reused from one mail to the next stops allocating once it has seen the longest
+// field of the corpus.
+typedef struct {
+    FILE *file;
+    char *line;              // Raw line read ahead, without its line break
+    size_t line_capacity;
+    ssize_t line_length;     // Length of the line read ahead, 0 for the blank line, -1 at end of file
+    bool ended;
+    growable_buffer_t field; // Current unfolded field, as "name\0value\0"
+} header_reader_t;
+
+bool growable_buffer_append(growable_buffer_t *buffer, const char *data, size_t length);
+void growable_buffer_free(growable_buffer_t *buffer);
+
+void header_reader_start(header_reader_t *reader, FILE *file);
+bool header_reader_next(header_reader_t *reader, char **name, char **value);
+void header_reader_free(header_reader_t *reader);
+
+#endif //A2022_HEADER_READER_H
@@ -0,0 +1,193 @@
+//
+// Created on 19/10/26.
+//
+
+#include "mail_date.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+static const char *const month_names[] = {"jan", "feb", "mar", "apr", "may", "jun",
+                                          "jul", "aug", "sep", "oct", "nov", "dec"};
+
+/*!
+ * @brief month_from_name finds a month from its 3 letters abbreviation
+ * @param name the name, not necessarily NUL-terminated after its 3 letters
+ * @return the month (1 to 12), 0 if the name is not a month
+ */
+static uint8_t month_from_name(const char *name) {
+    for (uint8_t month = 0; month < 12; ++month) {
+        if (strncasecmp(name, month_names[month], 3) == 0) {
+            return month + 1;
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief read_number reads a fixed number of digits
+ * @param text the digits
+ * @param digits the number of digits
+ * @param value set to the number
+ * @return true if text starts with that many digits, false else (reading stops at the first non digit)
+ */
+static bool read_number(const char *text, int digits, int32_t *value) {
+    *value = 0;
+    for (int i = 0; i < digits; ++i) {
+        if (text[i] < '0' || text[i] > '9') {
+            return false;
+        }
+        *value = 10 * *value + (text[i] - '0');
+    }
+    return true;
+}
+
+/*!
+ * @brief parse_zone reads a numeric zone ("+HHMM" or "-HHMM"), or a UTC name
+ * @param text the zone
+ * @param offset set to the offset from UTC in minutes, 0 if the zone is not numeric
+ * @return true for a numeric or UTC zone, false else
+ */
+static bool parse_zone(const char *text, int32_t *offset) {
+    int32_t hours, minutes;
+    *offset = 0;
+    if ((text[0] == '+' || text[0] == '-') && read_number(text + 1, 2, &hours) && read_number(text + 3, 2, &minutes)) {
+        *offset = (text[0] == '-' ? -1 : 1) * (60 * hours + minutes);
+        return true;
+    }
+    return strncasecmp(text, "GMT", 3) == 0 || strncasecmp(text, "UT", 2) == 0 || text[0] == 'Z';
+}
+
+/*!
+ * @brief parse_fixed_date parses the RFC 5322 layout written by mail servers, "[Ddd, ]D[D] Mon YYYY HH:MM:SS +HHMM",
+ * character by character: no tokenization and no locale, unlike strptime
+ * @param text the field value
+ * @param date the date to set
+ * @return true if the value has this layout, false else
+ */
+static bool parse_fixed_date(const char *text, mail_date_t *date) {
+    if (text[0] && text[1] && text[2] && text[3] == ',') {
+        text += text[4] == ' ' ? 5 : 4;
+    }
+    int32_t day, year, hours, minutes, seconds;
+    int day_digits = text[1] >= '0' && text[1] <= '9' ? 2 : 1;
+    if (!read_number(text, day_digits, &day) || text[day_digits] != ' ' || day < 1 || day > 31) {
+        return false;
+    }
+    text += day_digits + 1;
+    if (!text[0] || !text[1] || !text[2] || text[3] != ' ' || !(date->month = month_from_name(text))) {
+        return false;
+    }
+    text += 4;
+    if (!read_number(text, 4, &year) || text[4] != ' ' || !read_number(text + 5, 2, &hours) || text[7] != ':' ||
+        !read_number(text + 8, 2, &minutes) || text[10] != ':' || !read_number(text + 11, 2, &seconds) ||
+        text[13] != ' ' || !parse_zone(text + 14, &date->offset) || hours > 23 || minutes > 59 || seconds > 60) {
+        return false;
+    }
+    date->year = year;
+    date->day = day;
+    date->second = 3600 * hours + 60 * minutes + seconds;
+    return true;
+}
+
+/*!
+ * @brief parse_loose_date parses other layouts: the month is the first month name, the day the number before it (or
+ * after it), the year the number after them (2 digits years are 1950-2049), then an optional H:MM[:SS] time and zone
+ * @param text the field value
+ * @param date the date to set
+ * @return true if a day, a month and a year were found, false else
+ */
+static bool parse_loose_date(const char *text, mail_date_t *date) {
+    memset(date, 0, sizeof(mail_date_t));
+    int32_t previous_number = -1;
+    const char *cursor = text + strspn(text, " \t,");
+    while (*cursor && !date->month) {
+        size_t length = strcspn(cursor, " \t,");
+        if (length == 3 && (date->month = month_from_name(cursor))) {
+            date->day = previous_number > 0 && previous_number <= 31 ? previous_number : 0;
+        } else {
+            char *end;
+            long number = strtol(cursor, &end, 10);
+            previous_number = end == cursor + length ? (int32_t) number : -1;
+        }
+        cursor += length;
+        cursor += strspn(cursor, " \t,");
+    }
+    for (int field = 0; *cursor && field < 4; ++field) {
+        size_t length = strcspn(cursor, " \t,");
+        char *end;
+        long number = strtol(cursor, &end, 10);
+        if (strchr(cursor, ':') && (size_t) (strchr(cursor, ':') - cursor) < length) {
+            long minutes = strtol(end + 1, &end, 10), seconds = *end == ':' ? strtol(end + 1, NULL, 10) : 0;
+            date->second = (int32_t) (3600 * number + 60 * minutes + seconds);
+        } else if (end == cursor + length && date->day == 0 && number > 0 && number <= 31 && length <= 2) {
+            date->day = (uint8_t) number;
+        } else if (end == cursor + length && date->year == 0) {
+            date->year = length == 2 ? (int32_t) number + (number < 50 ? 2000 : 1900) : (int32_t) number;
+        } else if (date->year != 0) {
+            parse_zone(cursor, &date->offset);
+            break;
+        }
+        cursor += length;
+        cursor += strspn(cursor, " \t,");
+    }
+    return date->month && date->day && date->year > 0 && date->second >= 0 && date->second < 86400;
+}
+
+/*!
+ * @brief parse_mail_date parses the value of a Date field. The usual layout is parsed without tokenization, other
+ * layouts with a slower loose parser.
+ * @param value the field value
+ * @param date the date to set
+ * @return true if the value is a date, false else
+ */
+bool parse_mail_date(const char *value, mail_date_t *date) {
+    return parse_fixed_date(value, date) || parse_loose_date(value, date);
+}
+
+/*!
+ * @brief days_from_civil converts a date of the proleptic Gregorian calendar to a day number
+ * @param year the year
+ * @param month the month (1 to 12)
+ * @param day the day of the month
+ * @return the number of days since 1970-01-01
+ */
+int32_t days_from_civil(int32_t year, uint32_t month, uint32_t day) {
+    year -= month <= 2;
+    int32_t era = (year >= 0 ? year : year - 399) / 400;
+    uint32_t year_of_era = (uint32_t) (year - era * 400);
+    uint32_t day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    uint32_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + (int32_t) day_of_era - 719468;
+}
+
+/*!
+ * @brief civil_from_days converts a day number to a date of the proleptic Gregorian calendar
+ * @param days the number of days since 1970-01-01
+ * @param year set to the year
+ * @param month set to the month (1 to 12)
+ * @param day set to the day of the month
+ */
+void civil_from_days(int32_t days, int32_t *year, uint32_t *month, uint32_t *day) {
+    days += 719468;
+    int32_t era = (days >= 0 ? days : days - 146096) / 146097;
+    uint32_t day_of_era = (uint32_t) (days - era * 146097);
+    uint32_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    uint32_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    uint32_t shifted_month = (5 * day_of_year + 2) / 153;
+    *day = day_of_year - (153 * shifted_month + 2) / 5 + 1;
+    *month = shifted_month < 10 ? shifted_month + 3 : shifted_month - 9;
+    *year = (int32_t) year_of_era + era * 400 + (*month <= 2);
+}
+
+/*!
+ * @brief mail_date_utc_day gives the UTC day of a date
+ * @param date the date
+ * @return the number of days since 1970-01-01, in UTC
+ */
+int32_t mail_date_utc_day(mail_date_t *date) {
+    int64_t seconds = (int64_t) days_from_civil(date->year, date->month, date->day) * 86400 + date->second -
+                      (int64_t) date->offset * 60;
+    return (int32_t) (seconds >= 0 ? seconds / 86400 : (seconds - 86399) / 86400);
+}
@@ -0,0 +1,25 @@
+//
+// Created on 19/10/26.
+//
+
+#ifndef A2022_MAIL_DATE_H
+#define A2022_MAIL_DATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Date of a mail, as written in its Date field (local time of the sender and its offset from UTC)
+typedef struct {
+    int32_t year;
+    uint8_t month;  // 1 to 12
+    uint8_t day;    // 1 to 31
+    int32_t second; // Seconds since midnight
+    int32_t offset; // Offset from UTC in minutes, 0 when the zone is unknown
+} mail_date_t;
+
+bool parse_mail_date(const char *value, mail_date_t *date);
+int32_t days_from_civil(int32_t year, uint32_t month, uint32_t day);
+void civil_from_days(int32_t days, int32_t *year, uint32_t *month, uint32_t *day);
+int32_t mail_date_utc_day(mail_date_t *date);
+
+#endif //A2022_MAIL_DATE_H
@@ -9,6 +9,18 @@
 #include "reducers.h"
 #include "utility.h"
 #include "analysis.h"
+#include "file_errors.h"
+#include "metrics.h"
+#include "sampling.h"
+#include "trace.h"
+#include "scheduling.h"
+#include "checkpoint.h"
+#include "archive_input.h"
+#include "block_file.h"
+#include "tcp_processes.h"
+#include "plugins.h"
+#include "timeline.h"
+#include "normalization.h"
 
 #include <sys/msg.h>
 #include <sys/select.h>
@@ -17,68 +29,246 @@
 #include <signal.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <sys/sysinfo.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 
 
 #include <dirent.h>
 
-// Choose a method below by uncommenting ONLY one of the following 3 lines:
+// Choose a method below by uncommenting ONLY one of the following 4 lines:
 #if (defined(MQ))
 #define METHOD_MQ
+#define METHOD_NAME "mq"
 #elif (defined(DIRECT))
 #define METHOD_DIRECT
+#define METHOD_NAME "direct"
 #elif (defined(FIFO))
 #define METHOD_FIFO
+#define METHOD_NAME "fifo"
+#elif (defined(TCP))
+#define METHOD_TCP
+#define METHOD_NAME "tcp"
 #else
-#error "No method defined, please define one of the following: MQ, DIRECT, FIFO (compile with MQ=1, DIRECT=1 or FIFO=1)"
+#error "No method defined, please define one of the following: MQ, DIRECT, FIFO, TCP (compile with MQ=1, DIRECT=1, FIFO=1 or TCP=1)"
 #endif
 
 #ifdef METHOD_MQ
-#if (defined(METHOD_DIRECT) || defined(METHOD_FIFO))
+#if (defined(METHOD_DIRECT) || defined(METHOD_FIFO) || defined(METHOD_TCP))
 #error "Only one method may be defined (METHOD_MQ already defined)"
 #endif
 #endif
 
 #ifdef METHOD_DIRECT
-#ifdef METHOD_FIFO
+#if (defined(METHOD_FIFO) || defined(METHOD_TCP))
 #error "Only one method may be defined (METHOD_DIRECT already defined)"
 #endif
 #endif
 
+#ifdef METHOD_FIFO
+#ifdef METHOD_TCP
+#error "Only one method may be defined (METHOD_FIFO already defined)"
+#endif
+#endif
+
+/*!
+ * @brief sample_mails replaces the files list with a sample of its mails when approximate counts are requested, and
+ * sets the factor scaling the sample counts up to the whole corpus
+ * @param config the configuration
+ * @param files_list the path to the files list (step1_output)
+ * @param options the reducer options, whose scale is set
+ */
+static void sample_mails(configuration_t *config, char *files_list, reducer_options_t *options) {
+    if (config->sample_rate <= 0) {
+        return;
+    }
+    options->scale = 1;
+    sample_stats_t stats;
+    if (config->sample_rate >= 1) {
+        return; // Approximate counts of all the mails
+    }
+    if (!sample_files_list(files_list, config->data_path, config->sample_rate, config->sample_mode, &stats)) {
+        printf("Could not sample the mails, analyzing all of them\n");
+        return;
+    }
+    if (stats.sampled > 0) {
+        options->scale = (double) stats.total / stats.sampled;
+    }
+    print_msg(*config, "Sampled %zu of %zu mails\n", stats.sampled, stats.total);
+}
+
+/*!
+ * @brief discard_intermediates removes the files list and the files analysis output of a previous run, which would
+ * otherwise be taken as directory lists when the directories are analyzed again
+ * @param temporary_directory the temporary directory
+ */
+static void discard_intermediates(char *temporary_directory) {
+    char path[STR_MAX_LEN];
+    concat_path(temporary_directory, "step1_output", path);
+    unlink(path);
+    concat_path(temporary_directory, "step2_output", path);
+    unlink(path);
+}
+
+/*!
+ * @brief print_compression prints the compression ratio of a block file (nothing for a plain file)
+ * @param path the file path
+ * @param name the file name to print
+ */
+static void print_compression(char *path, char *name) {
+    block_file_stats_t stats;
+    if (block_file_stat(path, &stats)) {
+        printf("%s: %lu bytes compressed to %lu in %lu blocks (ratio %.2f)\n", name, (unsigned long) stats.raw_bytes,
+               (unsigned long) stats.packed_bytes, (unsigned long) stats.blocks,
+               (double) stats.raw_bytes / stats.packed_bytes);
+    }
+}
+
 int main(int argc, char *argv[]) {
+    // Line buffering: forked children must not inherit (and flush again) pending output of the parent
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    uint64_t launch_us = metrics_now_us();
 
     configuration_t config = {
             .data_path = "",
             .temporary_directory = "",
             .output_file = "",
+            .metrics_file = "",
+            .trace_file = "",
+            .index_file = "",
+            .rejected_log = "",
+            .skip_list = "",
+            .distinct_file = "",
+            .aggregate_file = "",
+            .plugins = "",
+            .timeline_file = "",
+            .alias_file = "",
             .is_verbose = false,
             .cpu_core_multiplier = 2,
+            .scheduling_policy = SCHEDULING_MULTIPLIER,
+            .pin_workers = false,
+            .is_adaptive = false,
+            .min_concurrency = 0,
+            .max_concurrency = 0,
+            .ephemeral_intermediates = false,
+            .top_k = 0,
+            .sample_rate = 0,
+            .sample_mode = SAMPLING_RANDOM,
+            .resume = false,
+            .compression = COMPRESSION_NONE,
+            .listen_address = "127.0.0.1:0",
+            .remote_workers = 0,
     };
     
     make_configuration(&config, argv, argc);
     
     if (!is_configuration_valid(&config)) {
-        printf("\nUsage: %s -d <data_path> -t <temporary_directory> -o <output_file> [-v] [-n <cpu_core_multiplier>] -f <config-file>\n", argv[0]);
+        printf("\nUsage: %s -d <data_path> -t <temporary_directory> -o <output_file> [-v] [-n <cpu_core_multiplier>] [-s auto|multiplier] [-p] [-a [--min-concurrency <n>] [--max-concurrency <n>]] [-k <top_k>] [-i <index_file>] [-e] [-r <rejected_log>] [-x <skip_list>] [-S <sample_rate> [--sample-mode random|stratified]] [-D <distinct_file>] [-A <aggregate_file>] [-P <plugin>[,<plugin>...]] [-W <timeline_file>] [-L <alias_file>] [--resume] [-z none|intermediates|all] [--listen <[host:]port>] [--remote-workers <n>] [-m <metrics_file>] [-T <trace_file>] -f <config-file>\n", argv[0]);
         display_configuration(&config);
         printf("\nExiting\n");
         return -1;
     }
+    // Inherited by all workers
+    if (!plugins_load(config.plugins) || !aliases_load(config.alias_file)) {
+        printf("\nExiting\n");
+        return -1;
+    }
+    set_timeline_lines_written(config.timeline_file[0] != '\0');
 
-    config.process_count = get_nprocs() * config.cpu_core_multiplier;
+    config.process_count = compute_process_count(&config);
+    scheduling_init(config.pin_workers);
+    if (config.min_concurrency == 0) {
+        config.min_concurrency = 1;
+    }
+    if (config.max_concurrency == 0) {
+        config.max_concurrency = config.process_count + config.remote_workers;
+#ifdef METHOD_TCP
+        // Each tcp worker queues the tasks of its lanes
+        config.max_concurrency *= TCP_PIPELINE_DEPTH;
+#endif
+    }
+    char ephemeral_directory[STR_MAX_LEN] = "";
+    if (config.ephemeral_intermediates) {
+        if (make_ephemeral_directory(ephemeral_directory)) {
+            strncpy(config.temporary_directory, ephemeral_directory, STR_MAX_LEN);
+            set_temporary_files_durable(false);
+        } else {
+            printf("Could not create an ephemeral directory, keeping intermediates in %s\n",
+                   config.temporary_directory);
+            config.ephemeral_intermediates = false;
+        }
+    }
+    // Before any intermediate is written, and inherited by all workers
+    set_intermediates_compressed(config.compression != COMPRESSION_NONE);
     printf("Running analysis on configuration:\n");
     display_configuration(&config);
     print_msg(config, "\nPlease wait, it can take a while\n\n");
 
-    system("rm -rf temp/*");
+    // Ephemeral directories are new. Otherwise the files of the previous run are deleted in the background, while the
+    // workers start, before any output or log (which may be in the temporary directory) is opened.
+    if (!config.resume && !config.ephemeral_intermediates &&
+        !clean_temporary_directory(config.temporary_directory, config.data_path)) {
+        printf("Could not clean the temporary directory %s, only discarding the intermediates\n",
+               config.temporary_directory);
+        discard_intermediates(config.temporary_directory);
+    }
+    if (config.metrics_file[0] != '\0' && !metrics_init(config.process_count, launch_us)) {
+        printf("Could not allocate metrics, running without them\n");
+    }
+    if (config.trace_file[0] != '\0' && !trace_init(config.process_count)) {
+        printf("Could not allocate trace buffers, running without tracing\n");
+    }
+    if (!file_errors_init(config.rejected_log, config.skip_list, config.resume)) {
+        printf("Could not set up the rejected files log or the skip list, running without them\n");
+        file_errors_cleanup();
+    }
+
     FILE *f = fopen(config.output_file, "w");
     fclose(f);
+    reducer_options_t reducer_options = {
+            .top_k = config.top_k,
+            .index_file = config.index_file[0] != '\0' ? config.index_file : NULL,
+            .scale = 0,
+            .distinct_file = config.distinct_file[0] != '\0' ? config.distinct_file : NULL,
+            .aggregate_file = config.aggregate_file[0] != '\0' ? config.aggregate_file : NULL,
+            .timeline_file = config.timeline_file[0] != '\0' ? config.timeline_file : NULL,
+            .process_count = config.process_count,
+            .compress_output = config.compression == COMPRESSION_ALL,
+    };
+    // Checkpoints are kept with the intermediate files: ephemeral ones do not survive an interruption
+    checkpoint_stage_t stage = CHECKPOINT_STARTED;
+    if (!config.ephemeral_intermediates) {
+        stage = checkpoint_open(config.temporary_directory, config.data_path, config.resume, &reducer_options.scale);
+    }
+    if (config.resume && stage == CHECKPOINT_STARTED) {
+        discard_intermediates(config.temporary_directory);
+    }
     // Running the analysis, based on defined method:
 
     struct timeval tv_init, tv_end ;
     gettimeofday(&tv_init, NULL);
 
+    // Archives are read as they are decompressed: there is no files list, all methods only run the final reduce
+    if (stage < CHECKPOINT_FILES_PARSED && is_archive_input(config.data_path)) {
+        print_msg(config, "Analyzing archives\n");
+        if (config.sample_rate > 0 && config.sample_rate < 1) {
+            printf("Sampling is not available for archives, analyzing all the mails\n");
+        }
+        reducer_options.scale = config.sample_rate > 0 ? 1 : 0;
+        char archive_step2_file[STR_MAX_LEN];
+        concat_path(config.temporary_directory, "step2_output", archive_step2_file);
+        metrics_phase_begin(PHASE_FILE_PARSE);
+        analyze_archives(config.data_path, archive_step2_file, config.process_count);
+        sync_temporary_files(config.temporary_directory);
+        checkpoint_files_parsed();
+        metrics_phase_end(PHASE_FILE_PARSE);
+        stage = CHECKPOINT_FILES_PARSED;
+    }
+
+    // Each phase has its own controller: the best concurrency of the I/O bound walk is not the one of the parsing
+    concurrency_controller_t directories_controller, files_controller;
+    concurrency_init(&directories_controller, config.min_concurrency, config.max_concurrency);
+    concurrency_init(&files_controller, config.min_concurrency, config.max_concurrency);
+
 #ifdef METHOD_MQ
     print_msg(config, "Running analysis using message queues\n");
     // Initialization
@@ -90,25 +280,39 @@ int main(int argc, char *argv[]) {
     pid_t *my_children = mq_make_processes(&config, mq);
 	
     // Execution
-    print_msg(config, "Processing directory\n");
-    mq_process_directory(&config, mq, my_children);
-    sync_temporary_files(config.temporary_directory);
-    
     char temp_result_name[STR_MAX_LEN];
     concat_path(config.temporary_directory, "step1_output", temp_result_name);
-    
-    print_msg(config, "Reducing files list\n");
-    files_list_reducer(config.data_path, config.temporary_directory, temp_result_name);
-    
     char step2_file[STR_MAX_LEN];
     concat_path(config.temporary_directory, "step2_output", step2_file);
 
-    print_msg(config, "Processing files\n");
-    mq_process_files(temp_result_name, step2_file, config.process_count, mq, my_children);
-    sync_temporary_files(config.temporary_directory);
+    if (stage < CHECKPOINT_FILES_LISTED) {
+        print_msg(config, "Processing directory\n");
+        metrics_phase_begin(PHASE_DIRECTORY_WALK);
+        mq_process_directory(&config, mq, my_children, config.is_adaptive ? &directories_controller : NULL);
+        sync_temporary_files(config.temporary_directory);
+        metrics_phase_end(PHASE_DIRECTORY_WALK);
+
+        print_msg(config, "Reducing files list\n");
+        metrics_phase_begin(PHASE_LIST_REDUCE);
+        files_list_reducer(config.data_path, config.temporary_directory, temp_result_name, config.process_count);
+        sample_mails(&config, temp_result_name, &reducer_options);
+        checkpoint_files_listed(temp_result_name, reducer_options.scale);
+        metrics_phase_end(PHASE_LIST_REDUCE);
+    }
+
+    if (stage < CHECKPOINT_FILES_PARSED) {
+        print_msg(config, "Processing files\n");
+        metrics_phase_begin(PHASE_FILE_PARSE);
+        mq_process_files(&config, mq, my_children, config.is_adaptive ? &files_controller : NULL);
+        sync_temporary_files(config.temporary_directory);
+        checkpoint_files_parsed();
+        metrics_phase_end(PHASE_FILE_PARSE);
+    }
     
     print_msg(config, "Reducing files\n");
-    files_reducer(step2_file, config.output_file); // error here
+    metrics_phase_begin(PHASE_FINAL_REDUCE);
+    files_reducer(step2_file, config.output_file, &reducer_options); // error here
+    metrics_phase_end(PHASE_FINAL_REDUCE);
         
     print_msg(config, "Cleaning up\n");
     print_msg(config, "Closing processes\n");
@@ -121,59 +325,170 @@ int main(int argc, char *argv[]) {
 
 #ifdef METHOD_FIFO
     print_msg(config, "Running analysis using FIFOs\n");
-    make_fifos(config.process_count, "fifo-in-%d");
-    make_fifos(config.process_count, "fifo-out-%d");
+    make_fifos(config.process_count, FIFO_COMMAND_FORMAT);
+    make_fifos(config.process_count, FIFO_NOTIFY_FORMAT);
     pid_t *children = make_processes(config.process_count);
-    int *command_fifos = open_fifos(config.process_count, "fifo-in-%d", O_WRONLY);
-    int *notify_fifos = open_fifos(config.process_count, "fifo-out-%d", O_RDONLY);
-    fifo_process_directory(config.data_path, config.temporary_directory, notify_fifos, command_fifos, config.process_count);
-    sync_temporary_files(config.temporary_directory);
+    if (children == NULL) {
+        printf("Could not create workers, exiting\n");
+        return -1;
+    }
+    int *command_fifos = open_fifos(config.process_count, FIFO_COMMAND_FORMAT, O_WRONLY);
+    int *notify_fifos = open_fifos(config.process_count, FIFO_NOTIFY_FORMAT, O_RDONLY);
     char fifo_temp_result_name[STR_MAX_LEN];
     concat_path(config.temporary_directory, "step1_output", fifo_temp_result_name);
-    files_list_reducer(config.data_path, config.temporary_directory, fifo_temp_result_name);
-    fifo_process_files(config.data_path, config.temporary_directory, notify_fifos, command_fifos, config.process_count);
-    sync_temporary_files(config.temporary_directory);
     char fifo_step2_file[STR_MAX_LEN];
     concat_path(config.temporary_directory, "step2_output", fifo_step2_file);
-    files_reducer(fifo_step2_file, config.output_file);
-    shutdown_processes(config.process_count, command_fifos);
+    if (stage < CHECKPOINT_FILES_LISTED) {
+        metrics_phase_begin(PHASE_DIRECTORY_WALK);
+        fifo_process_directory(config.data_path, config.temporary_directory, notify_fifos, command_fifos, children,
+                               config.process_count, config.is_adaptive ? &directories_controller : NULL);
+        sync_temporary_files(config.temporary_directory);
+        metrics_phase_end(PHASE_DIRECTORY_WALK);
+        metrics_phase_begin(PHASE_LIST_REDUCE);
+        files_list_reducer(config.data_path, config.temporary_directory, fifo_temp_result_name, config.process_count);
+        sample_mails(&config, fifo_temp_result_name, &reducer_options);
+        checkpoint_files_listed(fifo_temp_result_name, reducer_options.scale);
+        metrics_phase_end(PHASE_LIST_REDUCE);
+    }
+    if (stage < CHECKPOINT_FILES_PARSED) {
+        metrics_phase_begin(PHASE_FILE_PARSE);
+        fifo_process_files(config.temporary_directory, notify_fifos, command_fifos, children, config.process_count,
+                           config.is_adaptive ? &files_controller : NULL);
+        sync_temporary_files(config.temporary_directory);
+        checkpoint_files_parsed();
+        metrics_phase_end(PHASE_FILE_PARSE);
+    }
+    metrics_phase_begin(PHASE_FINAL_REDUCE);
+    files_reducer(fifo_step2_file, config.output_file, &reducer_options);
+    metrics_phase_end(PHASE_FINAL_REDUCE);
+    shutdown_processes(config.process_count, command_fifos, children);
+    free(children);
     close_fifos(config.process_count, command_fifos);
     close_fifos(config.process_count, notify_fifos);
-    erase_fifos(config.process_count, "fifo-in-%d");
-    erase_fifos(config.process_count, "fifo-out-%d");
+    erase_fifos(config.process_count, FIFO_COMMAND_FORMAT);
+    erase_fifos(config.process_count, FIFO_NOTIFY_FORMAT);
 #endif
 
 #ifdef METHOD_DIRECT
     print_msg(config, "Running analysis using direct fork\n");
-    
-    print_msg(config, "Forking directories\n");
-    direct_fork_directories(config.data_path, config.temporary_directory, config.process_count);
-    
-    print_msg(config, "Syncing temporary files\n");
-    sync_temporary_files(config.temporary_directory);
+
     char direct_temp_result_name[STR_MAX_LEN];
     concat_path(config.temporary_directory, "step1_output", direct_temp_result_name);
-    
-    print_msg(config, "Reducing files list\n");
-    files_list_reducer(config.data_path, config.temporary_directory, direct_temp_result_name);
     char direct_step2_file[STR_MAX_LEN];
     concat_path(config.temporary_directory, "step2_output", direct_step2_file);
 
-    print_msg(config, "Forking files\n");
-    direct_fork_files(direct_temp_result_name, direct_step2_file, config.process_count);
+    if (stage < CHECKPOINT_FILES_LISTED) {
+        print_msg(config, "Forking directories\n");
+        metrics_phase_begin(PHASE_DIRECTORY_WALK);
+        direct_fork_directories(config.data_path, config.temporary_directory, config.process_count,
+                                config.is_adaptive ? &directories_controller : NULL);
+
+        print_msg(config, "Syncing temporary files\n");
+        sync_temporary_files(config.temporary_directory);
+        metrics_phase_end(PHASE_DIRECTORY_WALK);
+
+        print_msg(config, "Reducing files list\n");
+        metrics_phase_begin(PHASE_LIST_REDUCE);
+        files_list_reducer(config.data_path, config.temporary_directory, direct_temp_result_name, config.process_count);
+        sample_mails(&config, direct_temp_result_name, &reducer_options);
+        checkpoint_files_listed(direct_temp_result_name, reducer_options.scale);
+        metrics_phase_end(PHASE_LIST_REDUCE);
+    }
+
+    if (stage < CHECKPOINT_FILES_PARSED) {
+        print_msg(config, "Forking files\n");
+        metrics_phase_begin(PHASE_FILE_PARSE);
+        direct_fork_files(direct_temp_result_name, direct_step2_file, config.process_count,
+                          config.is_adaptive ? &files_controller : NULL);
+
+        print_msg(config, "Syncing temporary files\n");
+        sync_temporary_files(config.temporary_directory);
+        checkpoint_files_parsed();
+        metrics_phase_end(PHASE_FILE_PARSE);
+    }
 
-    print_msg(config, "Syncing temporary files\n");
-    sync_temporary_files(config.temporary_directory);
-    
     print_msg(config, "Reducing files\n");
-    files_reducer(direct_step2_file, config.output_file);
+    metrics_phase_begin(PHASE_FINAL_REDUCE);
+    files_reducer(direct_step2_file, config.output_file, &reducer_options);
+    metrics_phase_end(PHASE_FINAL_REDUCE);
     
 #endif
 
+#ifdef METHOD_TCP
+    print_msg(config, "Running analysis using TCP workers\n");
+    tcp_coordinator_t *coordinator = tcp_make_coordinator(&config);
+    if (coordinator == NULL) {
+        printf("Could not start the coordinator, exiting\n");
+        return -1;
+    }
+    char tcp_temp_result_name[STR_MAX_LEN];
+    concat_path(config.temporary_directory, "step1_output", tcp_temp_result_name);
+    char tcp_step2_file[STR_MAX_LEN];
+    concat_path(config.temporary_directory, "step2_output", tcp_step2_file);
+
+    if (stage < CHECKPOINT_FILES_LISTED) {
+        print_msg(config, "Processing directory\n");
+        metrics_phase_begin(PHASE_DIRECTORY_WALK);
+        tcp_process_directory(&config, coordinator, config.is_adaptive ? &directories_controller : NULL);
+        sync_temporary_files(config.temporary_directory);
+        metrics_phase_end(PHASE_DIRECTORY_WALK);
+
+        print_msg(config, "Reducing files list\n");
+        metrics_phase_begin(PHASE_LIST_REDUCE);
+        files_list_reducer(config.data_path, config.temporary_directory, tcp_temp_result_name, config.process_count);
+        sample_mails(&config, tcp_temp_result_name, &reducer_options);
+        checkpoint_files_listed(tcp_temp_result_name, reducer_options.scale);
+        metrics_phase_end(PHASE_LIST_REDUCE);
+    }
+
+    if (stage < CHECKPOINT_FILES_PARSED) {
+        print_msg(config, "Processing files\n");
+        metrics_phase_begin(PHASE_FILE_PARSE);
+        tcp_process_files(&config, coordinator, config.is_adaptive ? &files_controller : NULL);
+        sync_temporary_files(config.temporary_directory);
+        checkpoint_files_parsed();
+        metrics_phase_end(PHASE_FILE_PARSE);
+    }
+
+    print_msg(config, "Closing workers\n");
+    tcp_close_coordinator(coordinator);
+
+    print_msg(config, "Reducing files\n");
+    metrics_phase_begin(PHASE_FINAL_REDUCE);
+    files_reducer(tcp_step2_file, config.output_file, &reducer_options);
+    metrics_phase_end(PHASE_FINAL_REDUCE);
+#endif
+
+    if (config.is_adaptive) {
+        print_msg(config, "Adaptive concurrency: %d for directories (%d changes), %d for files (%d changes)\n",
+                  directories_controller.limit, directories_controller.adjustments, files_controller.limit,
+                  files_controller.adjustments);
+    }
     print_msg(config, "Analysis finished\n");
+    checkpoint_close();
+    if (config.compression != COMPRESSION_NONE) {
+        char compressed_path[STR_MAX_LEN];
+        print_compression(concat_path(config.temporary_directory, "step1_output", compressed_path), "step1_output");
+        print_compression(concat_path(config.temporary_directory, "step2_output", compressed_path), "step2_output");
+        print_compression(config.output_file, "Output file");
+    }
+    file_errors_cleanup();
+    plugins_unload();
+    aliases_unload();
     
     gettimeofday(&tv_end, NULL);
     uint32_t exec_time = 1000000*(tv_end.tv_sec - tv_init.tv_sec) + (tv_end.tv_usec - tv_init.tv_usec);
     printf("Execution time: %u microseconds\n", exec_time);
+
+    if (config.metrics_file[0] != '\0') {
+        print_msg(config, "Writing metrics to %s\n", config.metrics_file);
+        metrics_write_json(config.metrics_file, METHOD_NAME, exec_time);
+        metrics_cleanup();
+    }
+    if (config.trace_file[0] != '\0') {
+        print_msg(config, "Writing trace to %s\n", config.trace_file);
+        trace_write_chrome(config.trace_file);
+        trace_cleanup();
+    }
     return 0;
 }
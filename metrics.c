@@ -0,0 +1,298 @@
+//
+// Created on 19/10/26.
+//
+
+#include "metrics.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+// Counters live in an anonymous shared mapping created before the workers are forked, so that every process updates
+// the same memory. NULL when metrics are disabled: every recording function is then a no-op.
+static metrics_t *metrics = NULL;
+static size_t metrics_size = 0;
+static uint16_t current_worker = 0;
+
+static const char *phases_names[PHASES_COUNT] = {
+        "directory_walk", "list_reduce", "file_parse", "final_reduce",
+};
+
+/*!
+ * @brief metrics_init allocates the shared counters. Must be called before forking the workers.
+ * @param workers_count the number of workers (i.e. the maximum number of simultaneous tasks)
+ * @param launch_us the start of the program (@see metrics_now_us)
+ * @return true if the metrics are enabled, false else
+ */
+bool metrics_init(uint16_t workers_count, uint64_t launch_us) {
+    metrics_size = sizeof(metrics_t) + (workers_count + 1) * sizeof(worker_metrics_t);
+    void *mapping = mmap(NULL, metrics_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+    metrics = (metrics_t *) mapping;
+    memset(metrics, 0, metrics_size);
+    metrics->workers_count = workers_count;
+    metrics->launch_us = launch_us;
+    current_worker = workers_count; // The parent uses the extra slot
+    return true;
+}
+
+/*!
+ * @brief metrics_cleanup releases the shared counters
+ */
+void metrics_cleanup() {
+    if (metrics) {
+        munmap(metrics, metrics_size);
+        metrics = NULL;
+    }
+}
+
+/*!
+ * @brief metrics_set_worker selects the counters slot of the calling process. Called by a worker right after fork.
+ * Several processes may share a slot (e.g. direct fork children): all updates are atomic.
+ * @param worker_index the worker index, wrapped into [0, workers_count)
+ */
+void metrics_set_worker(uint16_t worker_index) {
+    if (metrics) {
+        current_worker = worker_index % metrics->workers_count;
+    }
+}
+
+/*!
+ * @brief metrics_now_us returns a monotonic timestamp
+ * @return the current time in microseconds
+ */
+uint64_t metrics_now_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/*!
+ * @brief metrics_phase_begin starts the timer of a phase (parent side)
+ * @param phase the phase starting
+ */
+void metrics_phase_begin(metrics_phase_t phase) {
+    if (metrics) {
+        metrics->phase_start_us[phase] = metrics_now_us();
+    }
+}
+
+/*!
+ * @brief metrics_phase_end stops the timer of a phase (parent side)
+ * @param phase the phase ending
+ */
+void metrics_phase_end(metrics_phase_t phase) {
+    if (metrics) {
+        metrics->phase_us[phase] += metrics_now_us() - metrics->phase_start_us[phase];
+    }
+}
+
+/*!
+ * @brief metrics_task_dispatched records the dispatch of a task to a worker (parent side): the first one ends the
+ * startup of the program
+ */
+void metrics_task_dispatched() {
+    if (metrics && metrics->first_dispatch_us == 0) {
+        metrics->first_dispatch_us = metrics_now_us();
+    }
+}
+
+/*!
+ * @brief metrics_task_done counts a task executed by the current worker
+ */
+void metrics_task_done() {
+    if (metrics) {
+        __atomic_fetch_add(&metrics->workers[current_worker].tasks, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/*!
+ * @brief metrics_file_parsed records the parsing of one mail file by the current worker
+ * @param bytes the number of bytes read from the file
+ * @param latency_us the time spent to parse the file
+ * @param status the outcome of the parsing (FILE_STATUS_OK on success)
+ */
+void metrics_file_parsed(uint64_t bytes, uint64_t latency_us, file_status_t status) {
+    if (!metrics) {
+        return;
+    }
+    worker_metrics_t *worker = &metrics->workers[current_worker];
+    __atomic_fetch_add(&worker->files, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&worker->bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&worker->statuses[status], 1, __ATOMIC_RELAXED);
+    if (status != FILE_STATUS_OK) {
+        __atomic_fetch_add(&worker->parse_failures, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&worker->latency_total_us, latency_us, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&worker->latency_max_us, __ATOMIC_RELAXED);
+    while (latency_us > max &&
+           !__atomic_compare_exchange_n(&worker->latency_max_us, &max, latency_us, true, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED));
+    uint16_t bucket = 0;
+    while (bucket < METRICS_LATENCY_BUCKETS - 1 && (latency_us >> (bucket + 1)) > 0) {
+        ++bucket;
+    }
+    __atomic_fetch_add(&worker->latency_buckets[bucket], 1, __ATOMIC_RELAXED);
+}
+
+/*!
+ * @brief metrics_file_skipped records a file not parsed because it is in the skip list
+ */
+void metrics_file_skipped() {
+    if (metrics) {
+        __atomic_fetch_add(&metrics->workers[current_worker].statuses[FILE_STATUS_SKIPPED], 1, __ATOMIC_RELAXED);
+    }
+}
+
+/*!
+ * @brief metrics_idle records time spent by the current worker waiting for a task
+ * @param idle_us the waiting time
+ */
+void metrics_idle(uint64_t idle_us) {
+    if (metrics) {
+        __atomic_fetch_add(&metrics->workers[current_worker].idle_us, idle_us, __ATOMIC_RELAXED);
+    }
+}
+
+/*!
+ * @brief metrics_addresses_normalized records the addresses normalized by the current worker
+ * @param addresses the number of addresses
+ * @param rewritten the number of them whose canonical form differs from their raw text
+ * @param cache_hits the number of them found in the cache of the worker
+ */
+void metrics_addresses_normalized(uint64_t addresses, uint64_t rewritten, uint64_t cache_hits) {
+    if (metrics && addresses > 0) {
+        worker_metrics_t *worker = &metrics->workers[current_worker];
+        __atomic_fetch_add(&worker->addresses, addresses, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&worker->addresses_rewritten, rewritten, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&worker->address_cache_hits, cache_hits, __ATOMIC_RELAXED);
+    }
+}
+
+/*!
+ * @brief latency_percentile estimates a percentile from a log2 histogram (upper bound of the matching bucket)
+ * @param buckets the histogram
+ * @param count the total count in the histogram
+ * @param percentile the percentile, in [0, 1]
+ * @param max the maximal observed value, returned when the percentile falls in the last non-empty bucket
+ * @return the estimated percentile, in microseconds
+ */
+static uint64_t latency_percentile(uint64_t *buckets, uint64_t count, double percentile, uint64_t max) {
+    uint64_t rank = (uint64_t) (percentile * count + 0.5), seen = 0;
+    for (uint16_t i = 0; i < METRICS_LATENCY_BUCKETS; ++i) {
+        seen += buckets[i];
+        if (seen >= rank && seen > 0) {
+            uint64_t upper = ((uint64_t) 2 << i) - 1;
+            return upper < max ? upper : max;
+        }
+    }
+    return max;
+}
+
+/*!
+ * @brief write_worker_json writes the counters of one worker (or the totals) as a JSON object body
+ * @param output the JSON file
+ * @param worker the counters
+ */
+static void write_worker_json(FILE *output, worker_metrics_t *worker) {
+    fprintf(output, "\"tasks\": %llu, \"files\": %llu, \"bytes\": %llu, \"parse_failures\": %llu, \"idle_us\": %llu",
+            (unsigned long long) worker->tasks, (unsigned long long) worker->files,
+            (unsigned long long) worker->bytes, (unsigned long long) worker->parse_failures,
+            (unsigned long long) worker->idle_us);
+    fprintf(output, ", \"addresses\": %llu, \"addresses_rewritten\": %llu, \"address_cache_hits\": %llu",
+            (unsigned long long) worker->addresses, (unsigned long long) worker->addresses_rewritten,
+            (unsigned long long) worker->address_cache_hits);
+    fprintf(output, ", \"statuses\": {");
+    for (uint16_t s = 0; s < FILE_STATUSES_COUNT; ++s) {
+        fprintf(output, "%s\"%s\": %llu", s ? ", " : "", file_status_name(s), (unsigned long long) worker->statuses[s]);
+    }
+    fprintf(output, "}");
+}
+
+/*!
+ * @brief metrics_write_json dumps all metrics into a JSON file
+ * @param path the path to the JSON file
+ * @param method the name of the parallelization method used for the run
+ * @param total_us the total execution time
+ * @return true if the file was written, false else
+ */
+bool metrics_write_json(char *path, char *method, uint64_t total_us) {
+    if (!metrics) {
+        return false;
+    }
+    FILE *output = fopen(path, "w");
+    if (!output) {
+        perror("Cannot open metrics file");
+        return false;
+    }
+
+    worker_metrics_t totals;
+    memset(&totals, 0, sizeof(totals));
+    for (uint16_t i = 0; i <= metrics->workers_count; ++i) {
+        worker_metrics_t *worker = &metrics->workers[i];
+        totals.tasks += worker->tasks;
+        totals.files += worker->files;
+        totals.bytes += worker->bytes;
+        totals.parse_failures += worker->parse_failures;
+        for (uint16_t s = 0; s < FILE_STATUSES_COUNT; ++s) {
+            totals.statuses[s] += worker->statuses[s];
+        }
+        totals.idle_us += worker->idle_us;
+        totals.addresses += worker->addresses;
+        totals.addresses_rewritten += worker->addresses_rewritten;
+        totals.address_cache_hits += worker->address_cache_hits;
+        totals.latency_total_us += worker->latency_total_us;
+        if (worker->latency_max_us > totals.latency_max_us) {
+            totals.latency_max_us = worker->latency_max_us;
+        }
+        for (uint16_t b = 0; b < METRICS_LATENCY_BUCKETS; ++b) {
+            totals.latency_buckets[b] += worker->latency_buckets[b];
+        }
+    }
+
+    fprintf(output, "{\n  \"method\": \"%s\",\n  \"workers_count\": %u,\n  \"total_us\": %llu,\n", method,
+            metrics->workers_count, (unsigned long long) total_us);
+    // From the start of the program to the first task dispatched, 0 if none was (e.g. resuming the final reduce)
+    fprintf(output, "  \"startup_us\": %llu,\n",
+            (unsigned long long) (metrics->first_dispatch_us ? metrics->first_dispatch_us - metrics->launch_us : 0));
+    fprintf(output, "  \"phases_us\": {");
+    for (uint16_t p = 0; p < PHASES_COUNT; ++p) {
+        fprintf(output, "%s\"%s\": %llu", p ? ", " : "", phases_names[p], (unsigned long long) metrics->phase_us[p]);
+    }
+    fprintf(output, "},\n  \"totals\": {");
+    write_worker_json(output, &totals);
+
+    fprintf(output, "},\n  \"parse_latency_us\": {\"count\": %llu, \"mean\": %.1f, \"p50\": %llu, \"p90\": %llu, "
+                    "\"p99\": %llu, \"max\": %llu, \"histogram\": [",
+            (unsigned long long) totals.files, totals.files ? (double) totals.latency_total_us / totals.files : 0.0,
+            (unsigned long long) latency_percentile(totals.latency_buckets, totals.files, 0.5, totals.latency_max_us),
+            (unsigned long long) latency_percentile(totals.latency_buckets, totals.files, 0.9, totals.latency_max_us),
+            (unsigned long long) latency_percentile(totals.latency_buckets, totals.files, 0.99, totals.latency_max_us),
+            (unsigned long long) totals.latency_max_us);
+    bool first = true;
+    for (uint16_t b = 0; b < METRICS_LATENCY_BUCKETS; ++b) {
+        if (totals.latency_buckets[b]) {
+            fprintf(output, "%s{\"lt\": %llu, \"count\": %llu}", first ? "" : ", ",
+                    (unsigned long long) ((uint64_t) 2 << b), (unsigned long long) totals.latency_buckets[b]);
+            first = false;
+        }
+    }
+    fprintf(output, "]},\n  \"workers\": [\n");
+    for (uint16_t i = 0; i <= metrics->workers_count; ++i) {
+        fprintf(output, "    {\"worker\": ");
+        if (i < metrics->workers_count) {
+            fprintf(output, "%u, ", i);
+        } else {
+            fprintf(output, "\"parent\", ");
+        }
+        write_worker_json(output, &metrics->workers[i]);
+        fprintf(output, "}%s\n", i < metrics->workers_count ? "," : "");
+    }
+    fprintf(output, "  ]\n}\n");
+    fclose(output);
+    return true;
+}
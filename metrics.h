@@ -0,0 +1,65 @@
+//
+// Created on 19/10/26.
+//
+
+#ifndef A2022_METRICS_H
+#define A2022_METRICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "file_errors.h"
+#include "global_defs.h"
+
+// Latency bucket i counts parses which took [2^i, 2^(i+1)) microseconds (bucket 0 also holds sub-microsecond ones)
+#define METRICS_LATENCY_BUCKETS 32
+
+typedef enum {
+    PHASE_DIRECTORY_WALK,
+    PHASE_LIST_REDUCE,
+    PHASE_FILE_PARSE,
+    PHASE_FINAL_REDUCE,
+    PHASES_COUNT
+} metrics_phase_t;
+
+typedef struct {
+    uint64_t tasks;
+    uint64_t files;
+    uint64_t bytes;
+    uint64_t parse_failures;                  // Files parsed without success, whatever the reason
+    uint64_t statuses[FILE_STATUSES_COUNT];   // Files by outcome (@see file_status_t)
+    uint64_t idle_us;
+    uint64_t addresses;                       // Addresses normalized (@see normalization.h)
+    uint64_t addresses_rewritten;
+    uint64_t address_cache_hits;
+    uint64_t latency_total_us;
+    uint64_t latency_max_us;
+    uint64_t latency_buckets[METRICS_LATENCY_BUCKETS];
+} worker_metrics_t;
+
+typedef struct {
+    uint64_t launch_us;         // Start of the program
+    uint64_t first_dispatch_us; // First task given to a worker, 0 until then
+    uint64_t phase_start_us[PHASES_COUNT];
+    uint64_t phase_us[PHASES_COUNT];
+    uint16_t workers_count;
+    worker_metrics_t workers[]; // workers_count slots, plus one for work done by the parent process
+} metrics_t;
+
+bool metrics_init(uint16_t workers_count, uint64_t launch_us);
+void metrics_cleanup();
+void metrics_set_worker(uint16_t worker_index);
+uint64_t metrics_now_us();
+
+void metrics_phase_begin(metrics_phase_t phase);
+void metrics_phase_end(metrics_phase_t phase);
+void metrics_task_dispatched();
+void metrics_task_done();
+void metrics_file_parsed(uint64_t bytes, uint64_t latency_us, file_status_t status);
+void metrics_file_skipped();
+void metrics_idle(uint64_t idle_us);
+void metrics_addresses_normalized(uint64_t addresses, uint64_t rewritten, uint64_t cache_hits);
+
+bool metrics_write_json(char *path, char *method, uint64_t total_us);
+
+#endif //A2022_METRICS_H
@@ -12,11 +12,15 @@
 #include <stddef.h>
 #include <signal.h>
 #include <stdio.h>
-#include <sys/wait.h>
+#include <errno.h>
 #include <sys/wait.h>
 
 #include "utility.h"
 #include "analysis.h"
+#include "metrics.h"
+#include "trace.h"
+#include "scheduling.h"
+#include "supervision.h"
 
 /*!
  * @brief make_message_queue creates the message queue used for communications between parent and worker processes
@@ -47,37 +51,102 @@ void close_message_queue(int mq)
     }
 }
 
+// Message queue of the running workers, for the SIGCHLD handler, and whether a child exited since the last check
+static int supervised_mq = -1;
+static volatile sig_atomic_t child_exited = 0;
+
+/*!
+ * @brief wake_up_dispatcher is the SIGCHLD handler of the dispatcher: msgrcv cannot wait for a child, so a wake-up
+ * message (no PID) is posted for the dispatcher to look for dead workers
+ * @param signal_number the signal number (SIGCHLD)
+ */
+static void wake_up_dispatcher(int signal_number) {
+    (void) signal_number;
+    int saved_errno = errno;
+    child_exited = 1;
+    mq_message_t message = {.mtype = MQ_PARENT_TYPE};
+    memset(message.mtext, 0, sizeof(pid_t));
+    msgsnd(supervised_mq, &message, sizeof(pid_t), IPC_NOWAIT);
+    errno = saved_errno;
+}
+
 /*!
- * @brief child_process is the function handling code for a child
+ * @brief child_process is the function handling code for a child: it runs the tasks sent with its PID as type, and
+ * notifies the parent (type MQ_PARENT_TYPE, its PID then its unflushed tasks as content) at the end of each one
  * @param mq message queue descriptor used to communicate with the parent
  */
 void child_process(int mq)
 {
+    mq_message_t message;
     task_t task;
+    pid_t pid = getpid();
     while (1)
     {
-        if (msgrcv(mq, &task, sizeof(task_t) - sizeof(long), getpid(), 0) == -1)
+        uint64_t wait_start_us = metrics_now_us();
+        if (msgrcv(mq, &message, sizeof(message.mtext), pid, 0) == -1)
         {
+            if (errno == EINTR)
+            {
+                continue;
+            }
             perror("msgrcv");
             exit(EXIT_FAILURE);
         }
+        uint64_t task_start_us = metrics_now_us();
+        metrics_idle(task_start_us - wait_start_us);
+        trace_record(TRACE_WORKER_WAIT, wait_start_us, task_start_us, NULL);
 
-        if (task.task_callback == NULL)
-
+        memcpy(&task, message.mtext, sizeof(task_t));
         if (task.task_callback == NULL)
         {
             break;
         }
 
         task.task_callback(&task);
-
-        task.task_callback(&task);
+        metrics_task_done();
+        trace_task(&task, task_start_us, metrics_now_us());
+
+        message.mtype = MQ_PARENT_TYPE;
+        uint32_t unflushed_tasks = unflushed_mail_tasks();
+        memcpy(message.mtext, &pid, sizeof(pid_t));
+        memcpy(message.mtext + sizeof(pid_t), &unflushed_tasks, sizeof(uint32_t));
+        while (msgsnd(mq, &message, sizeof(pid_t) + sizeof(uint32_t), 0) == -1)
+        {
+            if (errno != EINTR)
+            {
+                perror("msgsnd");
+                exit(EXIT_FAILURE);
+            }
+        }
     }
+    release_mail_caches();
     exit(EXIT_SUCCESS);
 }
 
 /*!
- * @brief mq_make_processes makes a processes pool used for tasks execution
+ * @brief spawn_worker forks a worker running child_process
+ * @param mq the message queue
+ * @param index the worker index (for metrics, traces and pinning)
+ * @return the worker PID, -1 if the fork failed
+ */
+static pid_t spawn_worker(int mq, uint16_t index)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        signal(SIGCHLD, SIG_DFL);
+        metrics_set_worker(index);
+        trace_set_worker(index);
+        scheduling_pin_worker(index);
+        child_process(mq);
+        exit(EXIT_SUCCESS);
+    }
+    return pid;
+}
+
+/*!
+ * @brief mq_make_processes makes a processes pool used for tasks execution. The parent is notified of the death of a
+ * worker through the message queue (@see wake_up_dispatcher), so that it never waits for a dead worker.
  * @param config a pointer to the program configuration (with all parameters, inc. processes count)
  * @param mq the identifier of the message queue used to communicate between parent and children (workers)
  * @return a malloc'ed array with all children PIDs
@@ -96,23 +165,19 @@ pid_t *mq_make_processes(configuration_t *config, int mq)
         exit(EXIT_FAILURE);
     }
 
+    supervised_mq = mq;
+    struct sigaction action = {.sa_handler = wake_up_dispatcher, .sa_flags = SA_RESTART | SA_NOCLDSTOP};
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGCHLD, &action, NULL);
+
     for (int i = 0; i < config->process_count; i++)
     {
-        pid_t pid = fork();
-        if (pid == -1)
+        children[i] = spawn_worker(mq, i);
+        if (children[i] == -1)
         {
             perror("fork");
             exit(EXIT_FAILURE);
         }
-        else if (pid == 0)
-        {
-            child_process(mq);
-            exit(EXIT_SUCCESS);
-        }
-        else
-        {
-            children[i] = pid;
-        }
     }
 
     return children;
@@ -131,196 +196,221 @@ void close_processes(configuration_t *config, int mq, pid_t children[])
         return;
     }
 
-    task_t task;
-    task.task_callback = NULL;
+    mq_message_t message;
+    memset(&message, 0, sizeof(message)); // NULL callback
 
     for (int i = 0; i < config->process_count; i++)
     {
-        if (msgsnd(mq, &task, sizeof(task_t) - sizeof(long), 0) == -1)
+        message.mtype = children[i];
+        while (msgsnd(mq, &message, sizeof(task_t), 0) == -1)
         {
-            perror("msgsnd");
-            exit(EXIT_FAILURE);
+            if (errno != EINTR)
+            {
+                perror("msgsnd");
+                exit(EXIT_FAILURE);
+            }
         }
     }
     for (int i = 0; i < config->process_count; i++)
     {
-        if (waitpid(children[i], NULL, 0) == -1)
+        while (waitpid(children[i], NULL, 0) == -1 && errno == EINTR)
         {
-            perror("waitpid");
-            exit(EXIT_FAILURE);
         }
     }
-    free(children);
+    signal(SIGCHLD, SIG_DFL);
+    supervised_mq = -1;
 }
 
+typedef struct {
+    int mq;
+    pid_t *children;
+    uint16_t count;
+} mq_workers_t;
+
 /*!
- * @brief send_task_to_mq sends a directory task to a worker through the message queue. Directory task's object is
- * data_source/target_dir, temp output file is temp_files/target_dir. Task is sent through MQ with topic equal to
- * the worker's PID
- * @param data_source the data source directory
- * @param temp_files the temporary files directory
- * @param target_dir the name of the target directory
- * @param mq the MQ descriptor
- * @param worker_pid the worker PID
+ * @brief mq_send_task sends a task to a worker, with the worker PID as message type (@see worker_transport_t)
  */
-void send_task_to_mq(char data_source[], char temp_files[], char target_dir[], int mq, pid_t worker_pid)
+static bool mq_send_task(void *context, uint16_t worker, task_t *task)
 {
-    task_t task;
-    task.task_callback = &process_directory;
-
-    if (msgsnd(mq, &task, sizeof(task_t) - sizeof(long), 0) == -1)
+    mq_workers_t *workers = context;
+    mq_message_t message = {.mtype = workers->children[worker]};
+    memcpy(message.mtext, task, sizeof(task_t));
+    while (msgsnd(workers->mq, &message, sizeof(task_t), 0) == -1)
     {
-        perror("msgsnd");
-        exit(EXIT_FAILURE);
-    }   
+        if (errno != EINTR)
+        {
+            perror("msgsnd");
+            return false;
+        }
+    }
+    return true;
 }
 
 /*!
- * @brief send_file_task_to_mq sends a file task to a worker. It operates similarly to @see send_task_to_mq
- * @param data_source the data source directory
- * @param temp_files the temporary files directory
- * @param target_file the target filename
- * @param mq the MQ descriptor
- * @param worker_pid the worker's PID
+ * @brief mq_worker_index finds the index of a worker from a notification
+ * @param workers the workers
+ * @param message the notification (a PID, 0 for a wake-up)
+ * @return the worker index, workers->count if the notification is not from a current worker
  */
-void send_file_task_to_mq(char data_source[], char temp_files[], char target_file[], int mq, pid_t worker_pid)
+static uint16_t mq_worker_index(mq_workers_t *workers, mq_message_t *message)
 {
-    task_t task;
-    task.task_callback = &process_file;
-
-    if (msgsnd(mq, &task, sizeof(task_t) - sizeof(long), 0) == -1)
+    pid_t pid;
+    memcpy(&pid, message->mtext, sizeof(pid_t));
+    uint16_t index = 0;
+    while (pid != 0 && index < workers->count && workers->children[index] != pid)
     {
-        perror("msgsnd");
-        exit(EXIT_FAILURE);
+        ++index;
     }
+    return pid != 0 ? index : workers->count;
 }
 
-
 /*!
- * @brief mq_process_directory root function for parallelizing directory analysis over workers. Must keep track of the
- * tasks count to ensure every worker handles one and only one task. Relies on two steps: one to fill all workers with
- * a task each, then, waiting for a child to finish its task before sending a new one.
- * @param config a pointer to the configuration with all relevant path and values
- * @param mq the MQ descriptor
- * @param children the children's PIDs used as MQ topics number
+ * @brief mq_wait_event waits for a worker to finish its task or to die (@see worker_transport_t). Notifications
+ * already queued are read before dead workers are looked for, so that a task completed just before its worker died
+ * is not dispatched again.
  */
-void mq_process_directory(configuration_t *config, int mq, pid_t children[])
+static worker_event_t mq_wait_event(void *context, uint16_t *worker, uint32_t *unflushed_tasks)
 {
-    if (config == NULL)
-    {
-        return;
-    }
-    
-    int tasks_count = 0;
-    int workers_count = config->process_count;
-    int workers_done = 0;
-
-    DIR *dir = opendir(config->data_path);
-    if (dir == NULL)
-    {
-        perror("opendir");
-        exit(EXIT_FAILURE);
-    }
-
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL)
+    mq_workers_t *workers = context;
+    mq_message_t message;
+    int flags = IPC_NOWAIT;
+    while (true)
     {
-        if (entry->d_type == DT_DIR && strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+        if (msgrcv(workers->mq, &message, sizeof(message.mtext), MQ_PARENT_TYPE, flags) != -1)
         {
-            if (tasks_count < workers_count)
+            *worker = mq_worker_index(workers, &message);
+            if (*worker < workers->count)
             {
-                send_task_to_mq(config->data_path, config->temporary_directory, entry->d_name, mq, children[tasks_count]);
-                tasks_count++;
+                memcpy(unflushed_tasks, message.mtext + sizeof(pid_t), sizeof(uint32_t));
+                return WORKER_TASK_DONE;
             }
-            else
+            flags = IPC_NOWAIT; // Wake-up, or a worker replaced since: look for dead workers again
+            continue;
+        }
+        if (errno == EINTR)
+        {
+            continue;
+        }
+        if (errno != ENOMSG)
+        {
+            perror("msgrcv");
+            return WORKER_EVENT_ERROR;
+        }
+        if (child_exited)
+        {
+            child_exited = 0;
+            for (uint16_t i = 0; i < workers->count; ++i)
             {
-                task_t task;
-                if (msgrcv(mq, &task, sizeof(task_t) - sizeof(long), 0, 0) == -1)
+                if (waitpid(workers->children[i], NULL, WNOHANG) == workers->children[i])
                 {
-                    perror("msgrcv");
-                    exit(EXIT_FAILURE);
+                    *worker = i;
+                    child_exited = 1; // Others may have died too
+                    return WORKER_DIED;
                 }
-                send_task_to_mq(config->data_path, config->temporary_directory, entry->d_name, mq, children[tasks_count]);
             }
         }
+        flags = 0; // Nothing queued and nobody died: block until a notification or a wake-up
     }
+}
 
-    while (workers_done < workers_count)
+/*!
+ * @brief mq_respawn replaces a dead worker (@see worker_transport_t). Tasks sent to the dead worker and not read are
+ * removed from the queue first: nobody would read them, and they would take up its limited space.
+ */
+static bool mq_respawn(void *context, uint16_t worker)
+{
+    mq_workers_t *workers = context;
+    mq_message_t message;
+    while (msgrcv(workers->mq, &message, sizeof(message.mtext), workers->children[worker], IPC_NOWAIT) != -1 ||
+           errno == EINTR)
     {
-        task_t task;
-        if (msgrcv(mq, &task, sizeof(task_t) - sizeof(long), 0, 0) == -1)
-        {
-            perror("msgrcv");
-            exit(EXIT_FAILURE);
-        }
-
-        workers_done++;
     }
+    workers->children[worker] = spawn_worker(workers->mq, worker);
+    if (workers->children[worker] == -1)
+    {
+        perror("fork");
+        return false;
+    }
+    return true;
+}
 
-    closedir(dir);
+/*!
+ * @brief mq_supervise dispatches all the tasks of a source to the workers, replacing those which die
+ * @param config a pointer to the configuration
+ * @param mq the MQ descriptor
+ * @param children the children's PIDs used as MQ topics number, updated when a worker is replaced
+ * @param source the tasks to dispatch
+ * @param controller the adaptive concurrency controller, NULL to keep all the workers busy
+ */
+static void mq_supervise(configuration_t *config, int mq, pid_t children[], task_source_t *source,
+                         concurrency_controller_t *controller)
+{
+    mq_workers_t workers = {.mq = mq, .children = children, .count = config->process_count};
+    worker_transport_t transport = {
+            .context = &workers,
+            .send_task = mq_send_task,
+            .wait_event = mq_wait_event,
+            .respawn = mq_respawn,
+    };
+    supervision_stats_t stats;
+    supervise_tasks(&transport, config->process_count, source, controller, &stats);
+    if (stats.respawned > 0)
+    {
+        printf("%u workers died and were replaced, %u tasks given up\n", stats.respawned, stats.abandoned);
+    }
 }
 
 /*!
- * @brief mq_process_files root function for parallelizing files analysis over workers. Operates as
- * @see mq_process_directory to limit tasks to one on each worker.
+ * @brief mq_process_directory root function for parallelizing directory analysis over workers. Each worker handles one
+ * task at a time: all workers are first given a task each, then a new task is sent to a worker when it notifies the
+ * end of its current one. Tasks of workers which die are dispatched again (@see supervise_tasks).
  * @param config a pointer to the configuration with all relevant path and values
  * @param mq the MQ descriptor
  * @param children the children's PIDs used as MQ topics number
+ * @param controller the adaptive concurrency controller, NULL to keep all the workers busy
  */
-void mq_process_files(configuration_t *config, int mq, pid_t children[])
+void mq_process_directory(configuration_t *config, int mq, pid_t children[], concurrency_controller_t *controller)
 {
-    if (config == NULL)
+    if (config == NULL || children == NULL)
     {
         return;
     }
 
-    int tasks_count = 0;
-    int workers_count = config->process_count;
-    int workers_done = 0;
-
-    DIR *dir = opendir(config->data_path);
-    if (dir == NULL)
+    task_source_t source;
+    if (!task_source_open_directories(&source, config->data_path, config->temporary_directory))
     {
         perror("opendir");
         exit(EXIT_FAILURE);
     }
+    mq_supervise(config, mq, children, &source, controller);
+    task_source_close(&source);
+}
 
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL)
+/*!
+ * @brief mq_process_files root function for parallelizing files analysis over workers: the files listed in
+ * step1_output are analyzed into step2_output, both in the temporary directory. Operates as
+ * @see mq_process_directory to limit tasks to one on each worker.
+ * @param config a pointer to the configuration with all relevant path and values
+ * @param mq the MQ descriptor
+ * @param children the children's PIDs used as MQ topics number
+ * @param controller the adaptive concurrency controller, NULL to keep all the workers busy
+ */
+void mq_process_files(configuration_t *config, int mq, pid_t children[], concurrency_controller_t *controller)
+{
+    if (config == NULL || children == NULL)
     {
-        if (entry->d_type == DT_REG)
-        {
-            if (tasks_count < workers_count)
-            {
-                send_file_task_to_mq(config->data_path, config->temporary_directory, entry->d_name, mq, children[tasks_count]);
-                tasks_count++;
-            }
-            else
-            {
-                task_t task;
-                if (msgrcv(mq, &task, sizeof(task_t) - sizeof(long), 0, 0) == -1)
-                {
-                    perror("msgrcv");
-                    exit(EXIT_FAILURE);
-                }
-
-                send_file_task_to_mq(config->data_path, config->temporary_directory, entry->d_name, mq, children[tasks_count]);
-            }
-        }
+        return;
     }
 
-    while (workers_done < workers_count)
+    char files_list[STR_MAX_LEN], output[STR_MAX_LEN];
+    concat_path(config->temporary_directory, "step1_output", files_list);
+    concat_path(config->temporary_directory, "step2_output", output);
+    task_source_t source;
+    if (!task_source_open_files(&source, files_list, output))
     {
-        task_t task;
-        if (msgrcv(mq, &task, sizeof(task_t) - sizeof(long), 0, 0) == -1)
-        {
-            perror("msgrcv");
-            exit(EXIT_FAILURE);
-        }
-
-        workers_done++;
+        perror("Cannot open files list");
+        exit(EXIT_FAILURE);
     }
-
-    closedir(dir);
+    mq_supervise(config, mq, children, &source, controller);
+    task_source_close(&source);
 }
-
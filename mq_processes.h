@@ -8,8 +8,13 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include "concurrency.h"
 #include "configuration.h"
 
+// Message types: MQ_PARENT_TYPE for the messages read by the parent (the PID of a worker which finished its task, or
+// 0 to wake the parent up when a child died), the PID of a worker for its tasks
+#define MQ_PARENT_TYPE 1
+
 typedef struct {
     long mtype;
     char mtext[sizeof(task_t)];
@@ -21,7 +26,7 @@ void close_message_queue(int mq);
 void child_process(int mq);
 pid_t *mq_make_processes(configuration_t *config, int mq);
 void close_processes(configuration_t *config, int mq, pid_t children[]);
-void mq_process_directory(configuration_t *config, int mq, pid_t children[]);
-void mq_process_files(configuration_t *config, int mq, pid_t children[]);
+void mq_process_directory(configuration_t *config, int mq, pid_t children[], concurrency_controller_t *controller);
+void mq_process_files(configuration_t *config, int mq, pid_t children[], concurrency_controller_t *controller);
 
 #endif //A2022_MQ_PROCESSES_H
@@ -0,0 +1,222 @@
+//
+// Created on 19/10/26.
+//
+
+#include "normalization.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "global_defs.h"
+#include "string_set.h"
+
+// Aliases are loaded before the workers are forked, which inherit them. The cache and the counters belong to each
+// worker.
+static string_map_t aliases;
+static bool has_aliases = false;
+static string_map_t cache;
+static bool is_cache_used = true;
+static normalization_counts_t counts;
+static char canonical_buffer[STR_MAX_LEN];
+
+/*!
+ * @brief has_upper_case tells if 8 bytes hold an ASCII upper case letter, all at once: adding 0x3f to a byte below
+ * 0x80 sets its high bit from 'A' on, adding 0x25 from '[' on (bytes from 0x80 on are not letters)
+ * @param bytes the 8 bytes
+ * @return true if one of the bytes is in ['A', 'Z'], false else
+ */
+static inline bool has_upper_case(const char *bytes) {
+    const uint64_t ones = 0x0101010101010101ULL;
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    uint64_t low = word & 0x7f * ones;
+    return ((low + 0x3f * ones) & ~(low + 0x25 * ones) & ~word & 0x80 * ones) != 0;
+}
+
+/*!
+ * @brief is_canonical tells if an address is already in canonical form, aliases apart. Addresses are checked 8 bytes
+ * at a time, the last 8 bytes overlapping the previous ones.
+ * @param raw the address (not NUL-terminated)
+ * @param length the address length, at least 1
+ * @return true if no bracket, quote or upper case letter has to be changed, false else
+ */
+static bool is_canonical(const char *raw, size_t length) {
+    if (strchr(NORMALIZATION_OPENINGS, raw[0]) || strchr(NORMALIZATION_CLOSINGS, raw[length - 1])) {
+        return false;
+    }
+    if (length < sizeof(uint64_t)) {
+        for (size_t i = 0; i < length; ++i) {
+            if (raw[i] >= 'A' && raw[i] <= 'Z') {
+                return false;
+            }
+        }
+        return true;
+    }
+    for (size_t i = 0; i + sizeof(uint64_t) < length; i += sizeof(uint64_t)) {
+        if (has_upper_case(raw + i)) {
+            return false;
+        }
+    }
+    return !has_upper_case(raw + length - sizeof(uint64_t));
+}
+
+/*!
+ * @brief canonicalize removes the surrounding brackets and quotes of an address and lower cases it
+ * @param raw the address (not NUL-terminated)
+ * @param length the address length, less than STR_MAX_LEN
+ * @param canonical the buffer of the canonical form, of STR_MAX_LEN bytes
+ * @return the length of the canonical form
+ */
+static size_t canonicalize(const char *raw, size_t length, char *canonical) {
+    while (length > 0 && strchr(NORMALIZATION_OPENINGS, raw[0])) {
+        ++raw;
+        --length;
+    }
+    while (length > 0 && strchr(NORMALIZATION_CLOSINGS, raw[length - 1])) {
+        --length;
+    }
+    for (size_t i = 0; i < length; ++i) {
+        canonical[i] = (char) tolower((unsigned char) raw[i]);
+    }
+    canonical[length] = '\0';
+    return length;
+}
+
+/*!
+ * @brief aliases_load reads an alias file, with one "<alias> <address>" line per alias (blank lines and lines
+ * starting with '#' are ignored). Both addresses are canonicalized, and aliases are not chained. It must be called
+ * before the workers are started.
+ * @param path the alias file, empty for none
+ * @return true if the file was read, false else (with the failure printed)
+ */
+bool aliases_load(char *path) {
+    if (path[0] == '\0') {
+        return true;
+    }
+    FILE *file = fopen(path, "r");
+    if (!file || !string_map_init(&aliases, 0)) {
+        printf("Cannot read alias file %s\n", path);
+        if (file) {
+            fclose(file);
+        }
+        return false;
+    }
+    has_aliases = true;
+    char *line = NULL, *save;
+    size_t line_capacity = 0;
+    bool success = true;
+    while (success && getline(&line, &line_capacity, file) != -1) {
+        char *alias = strtok_r(line, " \t\r\n", &save);
+        char *address = alias ? strtok_r(NULL, " \t\r\n", &save) : NULL;
+        if (!alias || alias[0] == '#') {
+            continue;
+        }
+        if (!address || strlen(alias) >= STR_MAX_LEN || strlen(address) >= STR_MAX_LEN) {
+            printf("Invalid alias line in %s: %s\n", path, alias);
+            success = false;
+            continue;
+        }
+        char canonical_alias[STR_MAX_LEN];
+        canonicalize(alias, strlen(alias), canonical_alias);
+        canonicalize(address, strlen(address), canonical_buffer);
+        success = string_map_put(&aliases, canonical_alias, canonical_buffer) != NULL;
+    }
+    free(line);
+    fclose(file);
+    if (!success) {
+        aliases_unload();
+    }
+    return success;
+}
+
+/*!
+ * @brief aliases_unload releases the aliases
+ */
+void aliases_unload() {
+    if (has_aliases) {
+        string_map_free(&aliases);
+        has_aliases = false;
+    }
+}
+
+/*!
+ * @brief aliases_fingerprint hashes the loaded aliases, whatever their order in the file, so that processes started
+ * apart can check that they use the same ones
+ * @return the hash, 0 without aliases
+ */
+uint64_t aliases_fingerprint() {
+    uint64_t fingerprint = 0;
+    for (size_t i = 0; has_aliases && i < aliases.entries.capacity; ++i) {
+        const char *entry = aliases.entries.slots[i];
+        if (entry) {
+            fingerprint += string_hash(entry) * 0x100000001b3ULL ^ string_hash(entry + strlen(entry) + 1);
+        }
+    }
+    return fingerprint;
+}
+
+/*!
+ * @brief set_normalization_cache_used turns the cache on (the default) or off, to measure it
+ * @param used true to use the cache, false else
+ */
+void set_normalization_cache_used(bool used) {
+    is_cache_used = used;
+}
+
+/*!
+ * @brief normalize_address gives the canonical form of an address
+ * @param raw the address as found in the mail (not NUL-terminated)
+ * @param length the address length
+ * @param normalized_length set to the length of the canonical form
+ * @return the canonical form: raw itself if it is already canonical, else a string valid until the next call
+ */
+const char *normalize_address(const char *raw, size_t length, size_t *normalized_length) {
+    ++counts.addresses;
+    *normalized_length = length;
+    if (length == 0 || length >= STR_MAX_LEN || (!has_aliases && is_canonical(raw, length))) {
+        return raw;
+    }
+    char key[STR_MAX_LEN];
+    memcpy(key, raw, length);
+    key[length] = '\0';
+    const char *normalized = is_cache_used && cache.entries.slots ? string_map_get(&cache, key) : NULL;
+    if (normalized) {
+        ++counts.cache_hits;
+    } else {
+        canonicalize(raw, length, canonical_buffer);
+        const char *alias = has_aliases ? string_map_get(&aliases, canonical_buffer) : NULL;
+        normalized = alias ? alias : canonical_buffer;
+        if (is_cache_used) {
+            if (cache.entries.count >= NORMALIZATION_CACHE_MAX) {
+                string_map_free(&cache);
+            }
+            if (cache.entries.slots || string_map_init(&cache, 0)) {
+                string_map_put(&cache, key, normalized); // Only slower next time if it fails
+            }
+        }
+    }
+    *normalized_length = strlen(normalized);
+    if (*normalized_length != length || memcmp(normalized, raw, length) != 0) {
+        ++counts.rewritten;
+    }
+    return normalized;
+}
+
+/*!
+ * @brief take_normalization_counts gives the counters of the worker since the last call, and resets them
+ * @return the counters
+ */
+normalization_counts_t take_normalization_counts() {
+    normalization_counts_t taken = counts;
+    memset(&counts, 0, sizeof(counts));
+    return taken;
+}
+
+/*!
+ * @brief normalization_cache_free releases the cache of the worker
+ */
+void normalization_cache_free() {
+    string_map_free(&cache);
+}
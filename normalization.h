@@ -0,0 +1,35 @@
+//
+// Created on 19/10/26.
+//
+
+#ifndef A2022_NORMALIZATION_H
+#define A2022_NORMALIZATION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Addresses are written in their canonical form, so that the reducer counts the variants of an address as one: the
+// surrounding angle brackets and quotes are removed ("<john.doe@enron.com>", "'john.doe@enron.com'"), the address is
+// lower cased ("John.Doe@ENRON.COM"), then replaced by its alias target if an alias file was loaded. An address which
+// is already canonical is used as is when there are no aliases; the others go through a cache of each worker, from the
+// raw text to its canonical form.
+#define NORMALIZATION_OPENINGS "<'\""
+#define NORMALIZATION_CLOSINGS ">'\""
+#define NORMALIZATION_CACHE_MAX 65536 // Entries of the cache, emptied when full
+
+typedef struct {
+    uint64_t addresses;  // Addresses normalized
+    uint64_t rewritten;  // Addresses whose canonical form differs from their raw text
+    uint64_t cache_hits; // Addresses found in the cache
+} normalization_counts_t;
+
+bool aliases_load(char *path);
+void aliases_unload();
+uint64_t aliases_fingerprint();
+void set_normalization_cache_used(bool used);
+const char *normalize_address(const char *raw, size_t length, size_t *normalized_length);
+normalization_counts_t take_normalization_counts();
+void normalization_cache_free();
+
+#endif //A2022_NORMALIZATION_H
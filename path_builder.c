@@ -0,0 +1,65 @@
+//
+// Created on 19/10/26.
+//
+
+#include "path_builder.h"
+
+#include <string.h>
+
+/*!
+ * @brief path_builder_init starts a path at its root
+ * @param builder the builder, zero-initialized or freed
+ * @param root the root path (a trailing slash is kept only for the root directory itself)
+ * @return true if the path could be allocated, false else
+ */
+bool path_builder_init(path_builder_t *builder, const char *root) {
+    size_t length = strlen(root);
+    while (length > 1 && root[length - 1] == '/') {
+        --length;
+    }
+    builder->buffer.length = 0;
+    if (!growable_buffer_append(&builder->buffer, root, length) || !growable_buffer_append(&builder->buffer, "", 1)) {
+        return false;
+    }
+    --builder->buffer.length; // The NUL terminator is not part of the path
+    return true;
+}
+
+/*!
+ * @brief path_builder_push appends a component to the path, with a separator if needed
+ * @param builder the builder
+ * @param name the component name
+ * @return the path length before the push, to restore with path_builder_pop
+ */
+size_t path_builder_push(path_builder_t *builder, const char *name) {
+    size_t previous_length = builder->buffer.length;
+    bool appended = true;
+    if (previous_length > 0 && builder->buffer.data[previous_length - 1] != '/') {
+        appended = growable_buffer_append(&builder->buffer, "/", 1);
+    }
+    appended = appended && growable_buffer_append(&builder->buffer, name, strlen(name) + 1);
+    if (!appended) {
+        path_builder_pop(builder, previous_length);
+        return previous_length;
+    }
+    --builder->buffer.length;
+    return previous_length;
+}
+
+/*!
+ * @brief path_builder_pop truncates the path back to a previous length
+ * @param builder the builder
+ * @param length the length returned by the matching path_builder_push
+ */
+void path_builder_pop(path_builder_t *builder, size_t length) {
+    builder->buffer.length = length;
+    builder->buffer.data[length] = '\0';
+}
+
+/*!
+ * @brief path_builder_free releases the path buffer
+ * @param builder the builder
+ */
+void path_builder_free(path_builder_t *builder) {
+    growable_buffer_free(&builder->buffer);
+}
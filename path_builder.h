@@ -0,0 +1,24 @@
+//
+// Created on 19/10/26.
+//
+
+#ifndef A2022_PATH_BUILDER_H
+#define A2022_PATH_BUILDER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "header_reader.h"
+
+// Path kept in a single growable buffer during a recursive walk: entering an entry appends "/name", leaving it
+// truncates back, so that no path is rebuilt from its components. The path is always NUL-terminated.
+typedef struct {
+    growable_buffer_t buffer;
+} path_builder_t;
+
+bool path_builder_init(path_builder_t *builder, const char *root);
+size_t path_builder_push(path_builder_t *builder, const char *name);
+void path_builder_pop(path_builder_t *builder, size_t length);
+void path_builder_free(path_builder_t *builder);
+
+#endif //A2022_PATH_BUILDER_H
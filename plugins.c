@@ -0,0 +1,254 @@
+//
+// Created on 19/10/26.
+//
+
+#include "plugins.h"
+
+#include <ctype.h>
+#include <dlfcn.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "mail_date.h"
+#include "string_set.h"
+
+/*!
+ * @brief capture_month sets the key of a mail to the month of its Date field, as YYYY-MM in the time zone of the
+ * sender (@see plugin_capture_t)
+ */
+static bool capture_month(const char *field, const char *value, char *key, size_t key_size) {
+    (void) field;
+    mail_date_t date;
+    if (!parse_mail_date(value, &date)) {
+        return false;
+    }
+    snprintf(key, key_size, "%04d-%02u", date.year, (unsigned) date.month);
+    return true;
+}
+
+/*!
+ * @brief capture_folder sets the key of a mail to its folder in the mailbox: the X-Folder field without its first
+ * component, which names the mailbox ("\beck-l-6\sent_items" gives "sent_items") (@see plugin_capture_t)
+ */
+static bool capture_folder(const char *field, const char *value, char *key, size_t key_size) {
+    (void) field;
+    value += strspn(value, " \t");
+    const char *folder = value;
+    if (*value == '\\' && (folder = strchr(value + 1, '\\')) != NULL && folder[1] != '\0') {
+        ++folder;
+    } else {
+        folder = value;
+    }
+    size_t length = strlen(folder);
+    while (length > 0 && isspace((unsigned char) folder[length - 1])) {
+        --length;
+    }
+    snprintf(key, key_size, "%.*s", (int) length, folder);
+    return length > 0;
+}
+
+static const char *const month_fields[] = {"Date", NULL};
+static const char *const folder_fields[] = {"X-Folder", NULL};
+
+// Plugins built into the library
+static const analysis_plugin_t builtin_plugins[] = {
+    {.name = "month", .fields = month_fields, .capture = capture_month},
+    {.name = "folder", .fields = folder_fields, .capture = capture_folder},
+};
+
+typedef struct {
+    const char *field;
+    uint8_t plugin;
+} plugin_field_t;
+
+// Active plugins, and their key for the mail being parsed. Loaded before the workers are forked, which inherit them.
+static const analysis_plugin_t *plugins[PLUGINS_MAX];
+static void *plugin_handles[PLUGINS_MAX]; // Shared library of each plugin, NULL for a built-in one
+static size_t plugins_loaded = 0;
+static plugin_field_t *plugin_fields = NULL; // Captured fields of all the plugins, looked up for each header field
+static size_t plugin_fields_count = 0;
+static char plugin_keys[PLUGINS_MAX][PLUGIN_KEY_MAX];
+static bool plugin_done[PLUGINS_MAX];
+
+/*!
+ * @brief find_plugin finds a built-in plugin, or loads a plugin shared library
+ * @param name the name of a built-in plugin, or the path to a shared library (containing a '/')
+ * @param handle set to the library handle, NULL for a built-in plugin
+ * @return the plugin, NULL if it could not be found
+ */
+static const analysis_plugin_t *find_plugin(char *name, void **handle) {
+    *handle = NULL;
+    if (!strchr(name, '/')) {
+        for (size_t i = 0; i < sizeof(builtin_plugins) / sizeof(builtin_plugins[0]); ++i) {
+            if (strcmp(builtin_plugins[i].name, name) == 0) {
+                return &builtin_plugins[i];
+            }
+        }
+        printf("Unknown plugin: %s\n", name);
+        return NULL;
+    }
+    if (!(*handle = dlopen(name, RTLD_NOW | RTLD_LOCAL))) {
+        printf("Cannot load plugin: %s\n", dlerror());
+        return NULL;
+    }
+    const analysis_plugin_t *plugin = dlsym(*handle, PLUGIN_SYMBOL);
+    if (!plugin) {
+        printf("Cannot load plugin: %s\n", dlerror());
+        dlclose(*handle);
+        *handle = NULL;
+    }
+    return plugin;
+}
+
+/*!
+ * @brief add_plugin activates a plugin, after checking its declaration
+ * @param plugin the plugin
+ * @param handle its library handle, NULL for a built-in plugin
+ * @return true if the plugin was activated, false else
+ */
+static bool add_plugin(const analysis_plugin_t *plugin, void *handle) {
+    bool is_valid = plugin->name && plugin->name[0] != '\0' && plugin->name[0] != '@' &&
+                    plugin->name[strcspn(plugin->name, " \t\n/")] == '\0' && plugin->fields && plugin->capture;
+    for (size_t i = 0; i < plugins_loaded && is_valid; ++i) {
+        is_valid = strcmp(plugins[i]->name, plugin->name) != 0;
+    }
+    if (!is_valid || plugins_loaded == PLUGINS_MAX) {
+        printf("Invalid or duplicate plugin: %s\n", plugin->name ? plugin->name : "(unnamed)");
+        return false;
+    }
+    size_t fields_count = 0;
+    while (plugin->fields[fields_count]) {
+        ++fields_count;
+    }
+    plugin_field_t *fields = realloc(plugin_fields, (plugin_fields_count + fields_count + 1) * sizeof(plugin_field_t));
+    if (!fields) {
+        return false;
+    }
+    plugin_fields = fields;
+    for (size_t f = 0; f < fields_count; ++f) {
+        plugin_fields[plugin_fields_count++] = (plugin_field_t) {plugin->fields[f], (uint8_t) plugins_loaded};
+    }
+    plugin_handles[plugins_loaded] = handle;
+    plugins[plugins_loaded++] = plugin;
+    return true;
+}
+
+/*!
+ * @brief plugins_load activates analysis plugins. It must be called before the workers are started.
+ * @param names comma separated plugin names: built-in plugins (month, folder) or paths to plugin shared libraries,
+ * which export an analysis_plugin_t named analysis_plugin; empty for none
+ * @return true if all the plugins were activated, false else (with the failure printed)
+ */
+bool plugins_load(char *names) {
+    char *copy = strdup(names);
+    if (!copy) {
+        return false;
+    }
+    bool success = true;
+    char *save = NULL;
+    for (char *name = strtok_r(copy, ", ", &save); name && success; name = strtok_r(NULL, ", ", &save)) {
+        void *handle;
+        const analysis_plugin_t *plugin = find_plugin(name, &handle);
+        success = plugin && add_plugin(plugin, handle);
+        if (!success && handle) {
+            dlclose(handle);
+        }
+    }
+    free(copy);
+    return success;
+}
+
+/*!
+ * @brief plugins_count gives the number of active plugins
+ * @return the number of active plugins
+ */
+size_t plugins_count() {
+    return plugins_loaded;
+}
+
+/*!
+ * @brief plugins_fingerprint hashes the names of the active plugins in their order, so that processes started apart
+ * can check that they run the same plugins
+ * @return the hash
+ */
+uint64_t plugins_fingerprint() {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < plugins_loaded; ++i) {
+        hash = (hash ^ string_hash(plugins[i]->name)) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/*!
+ * @brief plugins_start_mail resets the keys of the active plugins before the header of a mail is read
+ */
+void plugins_start_mail() {
+    for (size_t i = 0; i < plugins_loaded; ++i) {
+        plugin_keys[i][0] = '\0';
+        plugin_done[i] = false;
+    }
+}
+
+/*!
+ * @brief plugins_capture hands a header field to the plugins which capture it. Blanks of a key are replaced with '_',
+ * so that it is a single word of the output.
+ * @param name the field name
+ * @param value the unfolded field value
+ */
+void plugins_capture(char *name, char *value) {
+    for (size_t f = 0; f < plugin_fields_count; ++f) {
+        uint8_t p = plugin_fields[f].plugin;
+        if (plugin_done[p] || strcasecmp(plugin_fields[f].field, name) != 0) {
+            continue;
+        }
+        plugin_done[p] = plugins[p]->capture(name, value, plugin_keys[p], PLUGIN_KEY_MAX);
+        if (!plugin_done[p]) {
+            plugin_keys[p][0] = '\0';
+        }
+        for (char *c = plugin_keys[p]; *c; ++c) {
+            if (isspace((unsigned char) *c)) {
+                *c = '_';
+            }
+        }
+    }
+}
+
+/*!
+ * @brief plugins_write_keys appends the keys of the mail to its output lines, one line per plugin which set a key
+ * @param lines the output lines of the mail
+ * @param sender the sender of the mail
+ * @return true if the lines were appended, false if memory ran out
+ */
+bool plugins_write_keys(growable_buffer_t *lines, char *sender) {
+    bool success = true;
+    for (size_t i = 0; i < plugins_loaded && success; ++i) {
+        if (plugin_keys[i][0] != '\0') {
+            char mark = PLUGIN_LINE_MARK;
+            success = growable_buffer_append(lines, &mark, 1) &&
+                      growable_buffer_append(lines, plugins[i]->name, strlen(plugins[i]->name)) &&
+                      growable_buffer_append(lines, " ", 1) &&
+                      growable_buffer_append(lines, plugin_keys[i], strlen(plugin_keys[i])) &&
+                      growable_buffer_append(lines, " ", 1) && growable_buffer_append(lines, sender, strlen(sender)) &&
+                      growable_buffer_append(lines, "\n", 1);
+        }
+    }
+    return success;
+}
+
+/*!
+ * @brief plugins_unload deactivates all the plugins and closes their shared libraries
+ */
+void plugins_unload() {
+    for (size_t i = 0; i < plugins_loaded; ++i) {
+        if (plugin_handles[i]) {
+            dlclose(plugin_handles[i]);
+            plugin_handles[i] = NULL;
+        }
+    }
+    plugins_loaded = 0;
+    free(plugin_fields);
+    plugin_fields = NULL;
+    plugin_fields_count = 0;
+}
@@ -0,0 +1,49 @@
+//
+// Created on 19/10/26.
+//
+
+#ifndef A2022_PLUGINS_H
+#define A2022_PLUGINS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "header_reader.h"
+
+// Analysis plugins bucket the mails by a key taken from their header, e.g. the month of their Date field. Each plugin
+// declares the fields it captures: the mapper hands it these fields during its single pass over the header, and the
+// plugin sets the key of the mail. The key is written to step2_output as a line "\t<plugin> <key> <sender>" after the
+// line of the mail (no address contains a tab), and the reducer counts the mails of each sender in each bucket. Tags
+// starting with '@' are kept for the lines of the pipeline itself (@see timeline.h).
+#define PLUGINS_MAX 8
+#define PLUGIN_LINE_MARK '\t'
+#define PLUGIN_KEY_MAX 256              // Longer keys are truncated
+#define PLUGIN_SYMBOL "analysis_plugin" // Symbol of the analysis_plugin_t exported by a plugin shared library
+
+/*!
+ * @brief plugin_capture_t sets the key of a mail from one of the captured fields, called in header order
+ * @param field the field name, as in the mail
+ * @param value the unfolded field value
+ * @param key the key buffer, to be NUL-terminated
+ * @param key_size the key buffer size
+ * @return true once the key is set (the next fields of the mail are not handed to the plugin), false else
+ */
+typedef bool (*plugin_capture_t)(const char *field, const char *value, char *key, size_t key_size);
+
+typedef struct {
+    const char *name;          // Name in the plugins option, suffix of the output file, without spaces
+    const char *const *fields; // Captured fields, NULL-terminated, matched case insensitively
+    plugin_capture_t capture;
+} analysis_plugin_t;
+
+bool plugins_load(char *names);
+size_t plugins_count();
+uint64_t plugins_fingerprint();
+void plugins_start_mail();
+void plugins_capture(char *name, char *value);
+bool plugins_write_keys(growable_buffer_t *lines, char *sender);
+void plugins_unload();
+
+#endif //A2022_PLUGINS_H
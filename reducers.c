@@ -2,16 +2,31 @@
 // Created by flassabe on 26/10/22.
 //
 
+#define _GNU_SOURCE
+
 #include "reducers.h"
 
 #include <dirent.h>
+#include <errno.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
+#include "aggregate.h"
+#include "block_file.h"
+#include "distinct_counts.h"
 #include "global_defs.h"
+#include "graph_index.h"
+#include "header_reader.h"
+#include "plugins.h"
+#include "sketch.h"
+#include "string_set.h"
+#include "timeline.h"
 #include "utility.h"
 
 /*!
@@ -25,7 +40,8 @@ sender_t* add_source_to_list(sender_t* list, char* source_email) {
 
     if (temp_sender == NULL) {
         sender_t* temp_sender = (sender_t*)malloc(sizeof(sender_t));
-        strncpy(temp_sender->sender_address, source_email, STR_MAX_LEN);
+        strncpy(temp_sender->sender_address, source_email, STR_MAX_LEN - 1);
+        temp_sender->sender_address[STR_MAX_LEN - 1] = '\0';
 
         if (list != NULL) {
             temp_sender->next = list;
@@ -88,12 +104,14 @@ void add_recipient_to_source(sender_t* source, char* recipient_email) {
 
     if (!source->head) {
         recipient_t* new_recipient = (recipient_t*)malloc(sizeof(recipient_t));
-        strncpy(new_recipient->recipient_address, recipient_email, STR_MAX_LEN);
+        strncpy(new_recipient->recipient_address, recipient_email, STR_MAX_LEN - 1);
+        new_recipient->recipient_address[STR_MAX_LEN - 1] = '\0';
         new_recipient->occurrences = 1;
         source->head = new_recipient;
-            source->tail = new_recipient;
-            new_recipient->next = NULL;
-            new_recipient->prev = NULL;
+        source->tail = new_recipient;
+        new_recipient->next = NULL;
+        new_recipient->prev = NULL;
+        return;
     }
 
     recipient_t* temp = source->head;
@@ -105,7 +123,8 @@ void add_recipient_to_source(sender_t* source, char* recipient_email) {
         ++(temp->occurrences);
     } else {
         recipient_t* new_recipient = (recipient_t*)malloc(sizeof(recipient_t));
-        strncpy(new_recipient->recipient_address, recipient_email, STR_MAX_LEN);
+        strncpy(new_recipient->recipient_address, recipient_email, STR_MAX_LEN - 1);
+        new_recipient->recipient_address[STR_MAX_LEN - 1] = '\0';
         new_recipient->occurrences = 1;
         
         new_recipient->next = source->head;
@@ -115,22 +134,110 @@ void add_recipient_to_source(sender_t* source, char* recipient_email) {
     }
 }
 
+// Below this total size, forking to concatenate costs more than it saves
+#define PARALLEL_CONCAT_MIN_BYTES (1 << 22)
+// Buffer size of the read/write fallback when copy_file_range is not supported
+#define CONCAT_CHUNK_SIZE (1 << 20)
+
+typedef struct {
+    char path[STR_MAX_LEN];
+    off_t size;
+    off_t offset; // Position of the file content in the concatenated output
+} concat_source_t;
+
+/*!
+ * @brief copy_range copies a whole file at a given offset of the output file. Uses copy_file_range (no copy through
+ * user space, and reflinks on filesystems supporting them), falls back to large pread/pwrite calls when the kernel
+ * or the filesystems do not support it (e.g. files on different filesystems before Linux 5.3).
+ * @param in_fd the input file descriptor
+ * @param out_fd the output file descriptor
+ * @param out_offset the offset where to write the input content
+ * @param size the input size
+ * @return true if the whole input was copied, false else
+ */
+static bool copy_range(int in_fd, int out_fd, off_t out_offset, off_t size) {
+    off_t in_offset = 0;
+    bool use_copy_file_range = true;
+    char *buffer = NULL;
+    while (in_offset < size) {
+        ssize_t copied;
+        if (use_copy_file_range) {
+            loff_t in_position = in_offset, out_position = out_offset;
+            copied = copy_file_range(in_fd, &in_position, out_fd, &out_position, size - in_offset, 0);
+            if (copied == -1 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) {
+                use_copy_file_range = false;
+                continue;
+            }
+        } else {
+            if (!buffer && !(buffer = malloc(CONCAT_CHUNK_SIZE))) {
+                break;
+            }
+            size_t length = size - in_offset < CONCAT_CHUNK_SIZE ? size - in_offset : CONCAT_CHUNK_SIZE;
+            copied = pread(in_fd, buffer, length, in_offset);
+            for (ssize_t written = 0; copied > 0 && written < copied;) {
+                ssize_t result = pwrite(out_fd, buffer + written, copied - written, out_offset + written);
+                if (result == -1 && errno != EINTR) {
+                    copied = -1;
+                } else if (result > 0) {
+                    written += result;
+                }
+            }
+        }
+        if (copied == -1 && errno == EINTR) {
+            continue;
+        }
+        if (copied <= 0) {
+            break; // Error, or the file shrank since its size was read
+        }
+        in_offset += copied;
+        out_offset += copied;
+    }
+    free(buffer);
+    return in_offset == size;
+}
+
+/*!
+ * @brief concat_sources copies a subset of the sources to their offsets in the output file: sources first, first +
+ * stride, first + 2 * stride... so that workers with distinct first indices share the work.
+ * @param sources the sources array
+ * @param count the sources count
+ * @param first the first source index
+ * @param stride the step between two sources
+ * @param output_file the output file, already sized
+ * @return true if all sources were copied, false else
+ */
+static bool concat_sources(concat_source_t *sources, size_t count, size_t first, size_t stride, char *output_file) {
+    int out_fd = open(output_file, O_WRONLY);
+    if (out_fd == -1) {
+        perror("Cannot open output_file");
+        return false;
+    }
+    bool success = true;
+    for (size_t i = first; i < count && success; i += stride) {
+        int in_fd = open(sources[i].path, O_RDONLY);
+        if (in_fd == -1) {
+            perror("Cannot open file");
+            success = false;
+            break;
+        }
+        success = copy_range(in_fd, out_fd, sources[i].offset, sources[i].size);
+        close(in_fd);
+    }
+    close(out_fd);
+    return success;
+}
+
 /*!
  * @brief files_list_reducer is the first reducer. It uses concatenates all temporary files from the first step into
- * a single file. Don't forget to sync filesystem before leaving the function.
+ * a single file. Sizes are read first, so that each file has a precomputed offset in the output: files are then
+ * copied independently, by up to nb_proc processes when the total size is worth it. Only the output file is synced.
  * @param data_source the data source directory (its directories have the same names as the temp files to concatenate)
  * @param temp_files the temporary files directory, where to read files to be concatenated
  * @param output_file path to the output file (default name is step1_output, but we'll keep it as a parameter).
+ * @param nb_proc the maximum number of processes copying files
  */
-void files_list_reducer(char* data_source, char* temp_files, char* output_file)
+void files_list_reducer(char* data_source, char* temp_files, char* output_file, uint16_t nb_proc)
 {
-    // Open the output file for writing
-    FILE* output = fopen(output_file, "w");
-    if (!output) {
-        perror("Cannot open output_file");
-        exit(EXIT_FAILURE);
-    }
-
     // Open the temporary files directory
     DIR* temp_dir = opendir(temp_files);
     if (!temp_dir) {
@@ -138,42 +245,501 @@ void files_list_reducer(char* data_source, char* temp_files, char* output_file)
         exit(EXIT_FAILURE);
     }
 
-    // Read the entries in the directory
-    char buffer[STR_MAX_LEN];
+    // List the temporary files with their offsets in the output
+    concat_source_t *sources = NULL;
+    size_t sources_count = 0, sources_capacity = 0;
+    off_t total_size = 0;
     struct dirent* entry;
     while ((entry = readdir(temp_dir)) != NULL) {
-        
         // Skip the ".", ".." and the output entries
-        if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..")) {
-            
-
-            // Construct the full path to the temporary file
-            char temp_file_path[STR_MAX_LEN];
-            concat_path(temp_files, entry->d_name, temp_file_path);
-            if (strncmp(temp_file_path, output_file, STR_MAX_LEN)) {
-                // Open the temporary file for reading
-                FILE* temp_file = fopen(temp_file_path, "r");
-                if (!temp_file) {
-                    perror("Cannot open file");
-                    exit(EXIT_FAILURE);
-                }
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) {
+            continue;
+        }
+        char temp_file_path[STR_MAX_LEN];
+        concat_path(temp_files, entry->d_name, temp_file_path);
+        struct stat status;
+        if (!strncmp(temp_file_path, output_file, STR_MAX_LEN) || stat(temp_file_path, &status) == -1 ||
+            !S_ISREG(status.st_mode)) {
+            continue;
+        }
+        if (sources_count == sources_capacity) {
+            sources_capacity = sources_capacity ? 2 * sources_capacity : 256;
+            sources = realloc(sources, sources_capacity * sizeof(concat_source_t));
+            if (!sources) {
+                perror("Cannot allocate files list");
+                exit(EXIT_FAILURE);
+            }
+        }
+        strncpy(sources[sources_count].path, temp_file_path, STR_MAX_LEN);
+        sources[sources_count].size = status.st_size;
+        sources[sources_count].offset = total_size;
+        total_size += status.st_size;
+        ++sources_count;
+    }
+    closedir(temp_dir);
+
+    // Size the output once, so that parallel copies never extend it
+    int output = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (output == -1 || ftruncate(output, total_size) == -1) {
+        perror("Cannot open output_file");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t workers = (nb_proc > 1 && total_size >= PARALLEL_CONCAT_MIN_BYTES) ? nb_proc : 1;
+    if (workers > sources_count) {
+        workers = sources_count;
+    }
+    bool success = true;
+    pid_t *children = calloc(workers, sizeof(pid_t));
+    for (size_t worker = 1; worker < workers; ++worker) {
+        children[worker] = fork();
+        if (children[worker] == 0) {
+            exit(concat_sources(sources, sources_count, worker, workers, output_file) ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+        if (children[worker] == -1) {
+            success = concat_sources(sources, sources_count, worker, workers, output_file) && success;
+        }
+    }
+    if (workers > 0) {
+        success = concat_sources(sources, sources_count, 0, workers, output_file) && success;
+    }
+    // Other children (e.g. message queue workers) may be alive: only wait for the copying ones
+    for (size_t worker = 1; worker < workers; ++worker) {
+        int status;
+        if (children[worker] > 0 && waitpid(children[worker], &status, 0) != -1) {
+            success = success && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+        }
+    }
+    free(children);
+    free(sources);
+    if (!success) {
+        printf("Could not concatenate temporary files\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Only the output file needs to reach the disk, not every filesystem of the host
+    sync_temporary_file(output);
+    close(output);
+}
+
+/*!
+ * @brief output_buffer_write appends data to the output buffer, writing the buffer to its file descriptor when full
+ * @param buffer the output buffer
+ * @param data the data to append
+ * @param length the length of data
+ * @return true if all data was buffered or written, false on a write error
+ */
+bool output_buffer_write(output_buffer_t *buffer, const char *data, size_t length) {
+    while (buffer->is_compressed && length > 0) {
+        // Always through the buffer, after the end of its last line: each flush keeps less than a block
+        size_t chunk = length < buffer->capacity - buffer->used ? length : buffer->capacity - buffer->used;
+        memcpy(buffer->data + buffer->used, data, chunk);
+        buffer->used += chunk;
+        data += chunk;
+        length -= chunk;
+        if (buffer->used == buffer->capacity && !output_buffer_flush(buffer)) {
+            return false;
+        }
+    }
+    if (buffer->used + length > buffer->capacity && !output_buffer_flush(buffer)) {
+        return false;
+    }
+    if (length > buffer->capacity) {
+        // Larger than the whole buffer: written directly
+        while (length > 0) {
+            ssize_t written = write(buffer->fd, data, length);
+            if (written <= 0) {
+                return false;
+            }
+            data += written;
+            length -= written;
+        }
+        return true;
+    }
+    memcpy(buffer->data + buffer->used, data, length);
+    buffer->used += length;
+    return true;
+}
 
-                while(fgets(buffer, sizeof(buffer), temp_file) != NULL){
-                    // buffer[strlen(buffer)-1] = '\0';
-                    fputs(buffer, output);
+/*!
+ * @brief output_buffer_flush writes the buffered data to the file descriptor. A compressed buffer keeps the end of its
+ * last line until it is complete.
+ * @param buffer the output buffer
+ * @return true if all data was written, false on a write error
+ */
+bool output_buffer_flush(output_buffer_t *buffer) {
+    if (buffer->is_compressed) {
+        size_t written;
+        bool is_last = buffer->used > 0 && buffer->data[buffer->used - 1] == '\n';
+        if (!block_file_write(buffer->fd, buffer->data, buffer->used, &written, is_last)) {
+            return false;
+        }
+        memmove(buffer->data, buffer->data + written, buffer->used - written);
+        buffer->used -= written;
+        return true;
+    }
+    size_t offset = 0;
+    while (offset < buffer->used) {
+        ssize_t written = write(buffer->fd, buffer->data + offset, buffer->used - offset);
+        if (written <= 0) {
+            return false;
+        }
+        offset += written;
+    }
+    buffer->used = 0;
+    return true;
+}
+
+/*!
+ * @brief compare_senders orders senders by address (qsort callback on an array of sender_t pointers)
+ */
+static int compare_senders(const void *a, const void *b) {
+    return strcmp((*(sender_t **) a)->sender_address, (*(sender_t **) b)->sender_address);
+}
+
+/*!
+ * @brief compare_recipients orders recipients by decreasing occurrences, then by address (qsort callback on an array
+ * of recipient_t pointers)
+ */
+static int compare_recipients(const void *a, const void *b) {
+    recipient_t *first = *(recipient_t **) a, *second = *(recipient_t **) b;
+    if (first->occurrences != second->occurrences) {
+        return first->occurrences > second->occurrences ? -1 : 1;
+    }
+    return strcmp(first->recipient_address, second->recipient_address);
+}
+
+/*!
+ * @brief heap_sift_down restores the heap property from index i in a heap whose root is the worst recipient (the one
+ * that compare_recipients sorts last)
+ * @param heap the heap array
+ * @param size the heap size
+ * @param i the index to start from
+ */
+static void heap_sift_down(recipient_t **heap, size_t size, size_t i) {
+    while (2 * i + 1 < size) {
+        size_t child = 2 * i + 1;
+        if (child + 1 < size && compare_recipients(&heap[child + 1], &heap[child]) > 0) {
+            ++child;
+        }
+        if (compare_recipients(&heap[child], &heap[i]) <= 0) {
+            return;
+        }
+        recipient_t *swap = heap[i];
+        heap[i] = heap[child];
+        heap[child] = swap;
+        i = child;
+    }
+}
+
+/*!
+ * @brief select_recipients fills an array with the recipients of a sender, sorted by decreasing occurrences then
+ * address. When top_k is not 0, only the top_k best recipients are kept, using a bounded heap (the recipients list is
+ * read once, the heap never grows above top_k).
+ * @param sender the sender whose recipients to select
+ * @param top_k the maximum number of recipients to keep, 0 to keep all of them
+ * @param selection the array to fill, grown as needed
+ * @param selection_capacity the capacity of the array, updated when it is grown
+ * @return the number of selected recipients
+ */
+static size_t select_recipients(sender_t *sender, uint32_t top_k, recipient_t ***selection, size_t *selection_capacity) {
+    size_t count = 0;
+    for (recipient_t *recipient = sender->head; recipient != NULL; recipient = recipient->next) {
+        if (top_k > 0 && count == top_k) {
+            // Heap is full: the new recipient replaces the worst kept one if it is better
+            if (compare_recipients(&recipient, &(*selection)[0]) < 0) {
+                (*selection)[0] = recipient;
+                heap_sift_down(*selection, count, 0);
+            }
+            continue;
+        }
+        if (count == *selection_capacity) {
+            *selection_capacity = *selection_capacity ? 2 * *selection_capacity : 64;
+            *selection = realloc(*selection, *selection_capacity * sizeof(recipient_t *));
+        }
+        (*selection)[count++] = recipient;
+        if (top_k > 0 && count == top_k) {
+            for (size_t i = count / 2; i-- > 0;) {
+                heap_sift_down(*selection, count, i);
+            }
+        }
+    }
+    qsort(*selection, count, sizeof(recipient_t *), compare_recipients);
+    return count;
+}
+
+/*!
+ * @brief write_sorted_output writes the senders list to the output file: senders sorted by address, recipients by
+ * decreasing occurrences then address, so that two runs on the same data always produce the same file. All lines go
+ * through a single large buffer.
+ * @param list the senders list
+ * @param output_file the path to the output file
+ * @param top_k the maximum number of recipients written per sender, 0 to write all of them
+ * @param compress true to write the file as blocks (@see block_file.h)
+ */
+void write_sorted_output(sender_t *list, char *output_file, uint32_t top_k, bool compress) {
+    int fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror("Cannot open output_file");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t senders_count = 0;
+    for (sender_t *sender = list; sender != NULL; sender = sender->next) {
+        ++senders_count;
+    }
+    sender_t **senders = malloc((senders_count + 1) * sizeof(sender_t *));
+    senders_count = 0;
+    for (sender_t *sender = list; sender != NULL; sender = sender->next) {
+        senders[senders_count++] = sender;
+    }
+    qsort(senders, senders_count, sizeof(sender_t *), compare_senders);
+
+    output_buffer_t buffer = {.fd = fd, .data = malloc(OUTPUT_BUFFER_SIZE), .used = 0, .capacity = OUTPUT_BUFFER_SIZE,
+                              .is_compressed = compress};
+    recipient_t **selection = NULL;
+    size_t selection_capacity = 0;
+    char count_text[16];
+    bool success = true;
+    for (size_t s = 0; s < senders_count && success; ++s) {
+        success = output_buffer_write(&buffer, senders[s]->sender_address, strlen(senders[s]->sender_address)) &&
+                  output_buffer_write(&buffer, " ", 1);
+        size_t count = select_recipients(senders[s], top_k, &selection, &selection_capacity);
+        for (size_t r = 0; r < count && success; ++r) {
+            int length = snprintf(count_text, sizeof(count_text), "%u:", selection[r]->occurrences);
+            success = output_buffer_write(&buffer, count_text, length) &&
+                      output_buffer_write(&buffer, selection[r]->recipient_address,
+                                          strlen(selection[r]->recipient_address)) &&
+                      output_buffer_write(&buffer, " ", 1);
+        }
+        success = success && output_buffer_write(&buffer, "\n", 1);
+    }
+    if (!success || !output_buffer_flush(&buffer)) {
+        perror("Cannot write output_file");
+    }
+
+    // The final output is the only file which must survive the run, even with ephemeral intermediates
+    fdatasync(fd);
+    free(selection);
+    free(buffer.data);
+    free(senders);
+    close(fd);
+}
+
+/*!
+ * @brief compare_heavy_hitters orders pairs by key, so that the pairs of a sender are contiguous (qsort callback on an
+ * array of heavy_hitter_t pointers)
+ */
+static int compare_heavy_hitters(const void *a, const void *b) {
+    return strcmp((*(heavy_hitter_t **) a)->key, (*(heavy_hitter_t **) b)->key);
+}
+
+/*!
+ * @brief heavy_hitters_to_list builds a senders list from the monitored "sender recipient" pairs, with their scaled
+ * estimates as occurrences
+ * @param heavy_hitters the monitored pairs
+ * @param sketch the sketch of all pairs, whose estimates tighten the heavy hitters ones (both only overestimate)
+ * @param scale the factor from sample counts to corpus counts
+ * @return the senders list
+ */
+static sender_t *heavy_hitters_to_list(space_saving_t *heavy_hitters, count_min_t *sketch, double scale) {
+    heavy_hitter_t **pairs = malloc((heavy_hitters->count + 1) * sizeof(heavy_hitter_t *));
+    if (!pairs) {
+        perror("Cannot allocate heavy hitters");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < heavy_hitters->count; ++i) {
+        pairs[i] = &heavy_hitters->entries[i];
+    }
+    qsort(pairs, heavy_hitters->count, sizeof(heavy_hitter_t *), compare_heavy_hitters);
+
+    sender_t *list = NULL;
+    for (size_t i = 0; i < heavy_hitters->count; ++i) {
+        char *separator = strchr(pairs[i]->key, ' ');
+        size_t sender_length = separator - pairs[i]->key;
+        if (!list || strncmp(list->sender_address, pairs[i]->key, sender_length) != 0 ||
+            list->sender_address[sender_length] != '\0') {
+            sender_t *sender = calloc(1, sizeof(sender_t));
+            snprintf(sender->sender_address, STR_MAX_LEN, "%.*s", (int) sender_length, pairs[i]->key);
+            sender->next = list;
+            if (list) {
+                list->prev = sender;
+            }
+            list = sender;
+        }
+        uint64_t estimate = count_min_estimate(sketch, pairs[i]->hash);
+        if (pairs[i]->count < estimate) {
+            estimate = pairs[i]->count;
+        }
+        double scaled = round(estimate * scale);
+        recipient_t *recipient = calloc(1, sizeof(recipient_t));
+        strncpy(recipient->recipient_address, separator + 1, STR_MAX_LEN - 1);
+        recipient->occurrences = scaled < UINT32_MAX ? (uint32_t) scaled : UINT32_MAX;
+        recipient->next = list->head;
+        if (list->head) {
+            list->head->prev = recipient;
+        } else {
+            list->tail = recipient;
+        }
+        list->head = recipient;
+    }
+    free(pairs);
+    return list;
+}
+
+// Mails counted by the plugins (@see plugins.h): the list of a plugin has a sender_t per key, whose recipients are the
+// senders of the mails with this key
+typedef struct {
+    char name[PLUGIN_KEY_MAX];
+    sender_t *list;
+} plugin_bucket_t;
+
+typedef struct {
+    plugin_bucket_t buckets[PLUGINS_MAX];
+    size_t count;
+} plugin_buckets_t;
+
+/*!
+ * @brief add_plugin_line counts the mail of a plugin line of step2_output ("\t<plugin> <key> <sender>")
+ * @param buckets the counts of the plugins
+ * @param line the line, without its line break
+ */
+static void add_plugin_line(plugin_buckets_t *buckets, char *line) {
+    char *save = NULL;
+    char *name = strtok_r(line + 1, " ", &save);
+    char *key = strtok_r(NULL, " ", &save);
+    char *sender = strtok_r(NULL, " ", &save);
+    if (!sender || name[0] == '@') {
+        return; // Not a plugin line (@see timeline.h)
+    }
+    size_t b = 0;
+    while (b < buckets->count && strcmp(buckets->buckets[b].name, name) != 0) {
+        ++b;
+    }
+    if (b == buckets->count) {
+        if (buckets->count == PLUGINS_MAX) {
+            return;
+        }
+        snprintf(buckets->buckets[b].name, PLUGIN_KEY_MAX, "%s", name);
+        buckets->buckets[b].list = NULL;
+        ++buckets->count;
+    }
+    plugin_bucket_t *bucket = &buckets->buckets[b];
+    bucket->list = add_source_to_list(bucket->list, key);
+    add_recipient_to_source(find_source_in_list(bucket->list, key), sender);
+}
+
+/*!
+ * @brief write_plugin_buckets writes the counts of each plugin to the output file path followed by "." and the plugin
+ * name, in the format of the output file (keys instead of senders, senders instead of recipients), and frees them
+ * @param buckets the counts of the plugins
+ * @param output_file the path to the output file
+ * @param options the output options, NULL for defaults
+ */
+static void write_plugin_buckets(plugin_buckets_t *buckets, char *output_file, reducer_options_t *options) {
+    for (size_t b = 0; b < buckets->count; ++b) {
+        sender_t *list = buckets->buckets[b].list;
+        if (options && options->scale > 0) {
+            for (sender_t *key = list; key != NULL; key = key->next) {
+                for (recipient_t *sender = key->head; sender != NULL; sender = sender->next) {
+                    double scaled = round(sender->occurrences * options->scale);
+                    sender->occurrences = scaled < UINT32_MAX ? (uint32_t) scaled : UINT32_MAX;
                 }
-                // Close the temporary file
-                fclose(temp_file);
             }
         }
+        char path[STR_MAX_LEN];
+        snprintf(path, STR_MAX_LEN, "%s.%s", output_file, buckets->buckets[b].name);
+        write_sorted_output(list, path, options ? options->top_k : 0, options && options->compress_output);
+        clear_sources_list(list);
+        printf("Plugin %s: counts written to %s\n", buckets->buckets[b].name, path);
     }
+    buckets->count = 0;
+}
 
-    // Close the output file and temporary files directory
-    fclose(output);
-    closedir(temp_dir);
+/*!
+ * @brief approximate_files_reducer is files_reducer for a sample of the mails: "sender recipient" pairs are counted
+ * in a Count-Min sketch and a Space-Saving heavy hitters table, both of fixed size, instead of the exact senders
+ * list. The most frequent pairs are written with their counts scaled up to the whole corpus, and the error bounds are
+ * printed.
+ * @param temp_file path to temp output file
+ * @param output_file final output file
+ * @param options the output options, with the scale of the sample
+ */
+static void approximate_files_reducer(char *temp_file, char *output_file, reducer_options_t *options) {
+    FILE *temp_f = open_intermediate(temp_file, "r");
+    if (!temp_f) {
+        perror("Cannot open temp_file");
+        exit(EXIT_FAILURE);
+    }
+    count_min_t sketch;
+    space_saving_t heavy_hitters;
+    if (!count_min_init(&sketch, APPROXIMATE_EPSILON, APPROXIMATE_DELTA) ||
+        !space_saving_init(&heavy_hitters, APPROXIMATE_HEAVY_HITTERS)) {
+        perror("Cannot allocate sketches");
+        exit(EXIT_FAILURE);
+    }
+
+    char *buffer_line = NULL;
+    size_t buffer_size = 0;
+    growable_buffer_t pair = {0};
+    plugin_buckets_t buckets = {.count = 0};
+    while (getline(&buffer_line, &buffer_size, temp_f) != EOF) {
+        char *newline;
+        while ((newline = strchr(buffer_line, '\n')) != NULL) {
+            *newline = '\0';
+        }
+        if (buffer_line[0] == PLUGIN_LINE_MARK) {
+            add_plugin_line(&buckets, buffer_line); // Few keys: counted exactly, then scaled
+            continue;
+        }
+        char *sender = strtok(buffer_line, " ");
+        if (!sender) {
+            continue; // Empty line
+        }
+        size_t sender_length = strlen(sender);
+        char *piece;
+        while ((piece = strtok(NULL, " "))) {
+            pair.length = 0;
+            if (!growable_buffer_append(&pair, sender, sender_length) || !growable_buffer_append(&pair, " ", 1) ||
+                !growable_buffer_append(&pair, piece, strlen(piece) + 1)) {
+                perror("Cannot allocate pair");
+                exit(EXIT_FAILURE);
+            }
+            uint64_t hash = string_hash(pair.data);
+            count_min_add(&sketch, hash, 1);
+            if (!space_saving_add(&heavy_hitters, pair.data, hash, 1)) {
+                perror("Cannot allocate heavy hitter");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    free(buffer_line);
+    growable_buffer_free(&pair);
+    fclose(temp_f);
+
+    write_plugin_buckets(&buckets, output_file, options);
+    sender_t *list = heavy_hitters_to_list(&heavy_hitters, &sketch, options->scale);
+    write_sorted_output(list, output_file, options->top_k, options->compress_output);
+    if (options->index_file) {
+        write_graph_index(list, options->index_file);
+    }
+    if (options->aggregate_file) {
+        write_aggregate(list, options->aggregate_file, AGGREGATE_APPROXIMATE);
+    }
+    clear_sources_list(list);
 
-    //sync the system
-    sync();
+    uint64_t sketch_bound = count_min_error_bound(&sketch);
+    uint64_t heavy_hitters_bound = space_saving_error_bound(&heavy_hitters);
+    printf("Approximate counts: %lu pairs in the sample, %zu most frequent kept, scaled by %.3f\n",
+           (unsigned long) sketch.total, heavy_hitters.count, options->scale);
+    printf("\tSketch overestimate: at most %.0f (probability %.2f%%)\n", ceil(sketch_bound * options->scale),
+           100 * count_min_confidence(&sketch));
+    if (heavy_hitters_bound > 0) {
+        printf("\tPairs counted more than %.0f times are all kept\n", ceil(heavy_hitters_bound * options->scale));
+    }
+    printf("\tSampling standard error of a count c: about sqrt(%.3f * c)\n", options->scale - 1);
+    count_min_free(&sketch);
+    space_saving_free(&heavy_hitters);
 }
 
 /*!
@@ -182,9 +748,20 @@ void files_list_reducer(char* data_source, char* temp_files, char* output_file)
  * containing each a list of recipients with their occurrences).
  * @param temp_file path to temp output file
  * @param output_file final output file to be written by your function
+ * @param options the output options, NULL for defaults (all recipients written)
  */
-void files_reducer(char* temp_file, char* output_file) {
-    FILE* temp_f = fopen(temp_file, "r");
+void files_reducer(char* temp_file, char* output_file, reducer_options_t *options) {
+    if (options && options->distinct_file) {
+        write_distinct_counts(temp_file, options->distinct_file, options->process_count);
+    }
+    if (options && options->timeline_file) {
+        write_timeline(temp_file, options->timeline_file, options->scale);
+    }
+    if (options && options->scale > 0) {
+        approximate_files_reducer(temp_file, output_file, options);
+        return;
+    }
+    FILE* temp_f = open_intermediate(temp_file, "r");
     char* buffer_line = NULL;
 
     if (!temp_f){
@@ -193,57 +770,43 @@ void files_reducer(char* temp_file, char* output_file) {
     }
 
     sender_t* temp_linked_list = NULL;
+    plugin_buckets_t buckets = {.count = 0};
     size_t buffer_size = 0;
     while (getline(&buffer_line, &buffer_size, temp_f) != EOF){
-        if (buffer_size <= 120) {
-            buffer_size = strlen(buffer_line)+1;
-        }
-        buffer_line[buffer_size-1] = '\0';
-
         char* newline;
         while ((newline = strchr(buffer_line, '\n')) != NULL) {
             *newline = '\0';
         }
+        if (buffer_line[0] == PLUGIN_LINE_MARK) {
+            add_plugin_line(&buckets, buffer_line);
+            continue;
+        }
 
-	      char* piece = strtok(buffer_line, " ");
-        char sender[STR_MAX_LEN];
-        strcpy(sender, piece);
+        char* sender = strtok(buffer_line, " ");
+        if (!sender) {
+            continue; // Empty line
+        }
+        // Tokens point into the line, which grows with it: no copy to a fixed size buffer
         temp_linked_list = add_source_to_list(temp_linked_list, sender);
         
         sender_t *source = find_source_in_list(temp_linked_list, sender);
+        char *piece;
         while ((piece = strtok(NULL, " "))) {
             add_recipient_to_source(source, piece);
         }
-        
-        buffer_size = 0; // reset buffer size so getline will allocate a new buffer & not use the old one & economize memory
-        free(buffer_line); // free the old buffer
     }
     free(buffer_line);
 
     fclose(temp_f);
 
-    FILE* output = fopen(output_file, "w");
-    if (!output){
-        perror("Cannot open output_file");
-        exit(EXIT_FAILURE);
+    write_plugin_buckets(&buckets, output_file, options);
+    write_sorted_output(temp_linked_list, output_file, options ? options->top_k : 0,
+                        options && options->compress_output);
+    if (options && options->index_file) {
+        write_graph_index(temp_linked_list, options->index_file);
     }
-    
-    sender_t* temp_sender = temp_linked_list;
-    recipient_t* temp_recipient;
-
-    while (temp_sender != NULL) {
-        temp_recipient = temp_sender->head;
-        fprintf(output, "%s ", temp_sender->sender_address);
-
-        while (temp_recipient != NULL) {
-            fprintf(output, "%d:%s ", temp_recipient->occurrences, temp_recipient->recipient_address);
-            temp_recipient = temp_recipient->next;
-        }
-        fprintf(output, "\n");
-        temp_sender = temp_sender->next;
+    if (options && options->aggregate_file) {
+        write_aggregate(temp_linked_list, options->aggregate_file, 0);
     }
-
-
-    fclose(output);
     clear_sources_list(temp_linked_list);
 }
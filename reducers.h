@@ -7,6 +7,9 @@
 
 #include "global_defs.h"
 
+#include <stdbool.h>
+#include <stddef.h>
+
 typedef struct _recipient {
     char recipient_address[STR_MAX_LEN];
     uint32_t occurrences;
@@ -22,12 +25,44 @@ typedef struct _sender {
     struct _sender *next;
 } sender_t;
 
+// Output of the final reducer is written through a single buffer of this size
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
+typedef struct {
+    int fd;
+    char *data;
+    size_t used;
+    size_t capacity;
+    bool is_compressed; // Written as blocks of whole lines (@see block_file.h)
+} output_buffer_t;
+
+// Approximate counts (@see sketch.h): a pair count is overestimated by at most 0.01% of all the pairs of the sample,
+// with a probability of 99%, and the most frequent pairs are kept
+#define APPROXIMATE_EPSILON 1e-4
+#define APPROXIMATE_DELTA 0.01
+#define APPROXIMATE_HEAVY_HITTERS (1 << 16)
+
+typedef struct {
+    uint32_t top_k;   // Maximum number of recipients written per sender, 0 to write all of them
+    char *index_file; // Path to the binary graph index to write (@see graph_index.h), NULL for none
+    double scale;     // Approximate counts from a sample, multiplied by this factor (listed / sampled mails); 0 for
+                      // exact counts
+    char *distinct_file;    // Path to the distinct correspondents estimates (@see distinct_counts.h), NULL for none
+    char *aggregate_file;   // Path to the mergeable counts of the run (@see aggregate.h), NULL for none
+    char *timeline_file;    // Path to the mails per edge and day (@see timeline.h), NULL for none
+    uint16_t process_count; // Maximum number of processes of the reducers
+    bool compress_output;   // Write the output file as blocks (@see block_file.h)
+} reducer_options_t;
+
 sender_t *add_source_to_list(sender_t *list, char *source_email);
 void clear_sources_list(sender_t *list);
 sender_t *find_source_in_list(sender_t *list, char *source_email);
 void add_recipient_to_source(sender_t *source, char *recipient_email);
 
-void files_list_reducer(char *data_source, char *temp_files, char *output_file);
-void files_reducer(char *temp_file, char *output_file);
+void files_list_reducer(char *data_source, char *temp_files, char *output_file, uint16_t nb_proc);
+bool output_buffer_write(output_buffer_t *buffer, const char *data, size_t length);
+bool output_buffer_flush(output_buffer_t *buffer);
+void write_sorted_output(sender_t *list, char *output_file, uint32_t top_k, bool compress);
+void files_reducer(char *temp_file, char *output_file, reducer_options_t *options);
 
 #endif //A2022_REDUCERS_H
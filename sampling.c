@@ -0,0 +1,196 @@
+//
+// Created on 19/10/26.
+//
+
+#include "sampling.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "block_file.h"
+#include "global_defs.h"
+#include "header_reader.h"
+#include "string_set.h"
+
+typedef struct {
+    size_t offset;         // Position of the path in the paths buffer
+    size_t stratum_length; // Length of the path prefix naming its mailbox
+    uint64_t rank;         // Pseudo-random rank of the path
+    bool is_kept;
+} sampled_path_t;
+
+/*!
+ * @brief path_rank gives a pseudo-random rank to a path: its hash, mixed (splitmix64 finalizer) so that close paths
+ * get unrelated ranks. Ranks only depend on the path, so that two runs analyze the same sample.
+ * @param path the path
+ * @return the rank
+ */
+static uint64_t path_rank(const char *path) {
+    uint64_t rank = string_hash(path);
+    rank = (rank ^ (rank >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    rank = (rank ^ (rank >> 27)) * 0x94d049bb133111ebULL;
+    return rank ^ (rank >> 31);
+}
+
+/*!
+ * @brief is_rank_kept tells if a rank falls in the sampled fraction of the ranks
+ */
+static bool is_rank_kept(uint64_t rank, double rate) {
+    return (rank >> 11) * 0x1.0p-53 < rate;
+}
+
+/*!
+ * @brief stratum_length finds the mailbox of a path: its first directory below the data source, or its parent
+ * directory if it is not below the data source
+ * @param path the mail path
+ * @param data_path the data source directory
+ * @return the length of the path prefix naming the mailbox
+ */
+static size_t stratum_length(const char *path, const char *data_path) {
+    size_t prefix = strlen(data_path);
+    if (strncmp(path, data_path, prefix) == 0) {
+        const char *mailbox = path + prefix;
+        while (*mailbox == '/') {
+            ++mailbox;
+        }
+        const char *end = strchr(mailbox, '/');
+        if (end) {
+            return end - path;
+        }
+    }
+    const char *parent = strrchr(path, '/');
+    return parent ? (size_t) (parent - path) : 0;
+}
+
+static char *compared_paths; // qsort has no context parameter
+
+/*!
+ * @brief compare_sampled_paths orders paths by mailbox, then by rank (qsort callback)
+ */
+static int compare_sampled_paths(const void *a, const void *b) {
+    const sampled_path_t *first = a, *second = b;
+    size_t length = first->stratum_length < second->stratum_length ? first->stratum_length : second->stratum_length;
+    int order = memcmp(compared_paths + first->offset, compared_paths + second->offset, length);
+    if (order == 0 && first->stratum_length != second->stratum_length) {
+        order = first->stratum_length < second->stratum_length ? -1 : 1;
+    }
+    if (order == 0 && first->rank != second->rank) {
+        order = first->rank < second->rank ? -1 : 1;
+    }
+    return order;
+}
+
+/*!
+ * @brief select_stratified keeps the ceil(rate * n) lowest ranked paths of each mailbox of n mails
+ * @param paths the paths, reordered
+ * @param count the paths count
+ * @param buffer the paths buffer
+ * @param rate the sampling rate
+ */
+static void select_stratified(sampled_path_t *paths, size_t count, char *buffer, double rate) {
+    compared_paths = buffer;
+    qsort(paths, count, sizeof(sampled_path_t), compare_sampled_paths);
+    for (size_t first = 0; first < count;) {
+        size_t end = first + 1;
+        while (end < count && paths[end].stratum_length == paths[first].stratum_length &&
+               memcmp(buffer + paths[end].offset, buffer + paths[first].offset, paths[first].stratum_length) == 0) {
+            ++end;
+        }
+        size_t kept = ceil(rate * (end - first));
+        for (size_t i = first; i < end; ++i) {
+            paths[i].is_kept = i - first < kept;
+        }
+        first = end;
+    }
+}
+
+/*!
+ * @brief compare_offsets restores the files list order (qsort callback)
+ */
+static int compare_offsets(const void *a, const void *b) {
+    const sampled_path_t *first = a, *second = b;
+    return first->offset < second->offset ? -1 : (first->offset > second->offset ? 1 : 0);
+}
+
+/*!
+ * @brief sample_files_list replaces the files list (step1_output) with a sample of its mails, so that every method
+ * then analyzes the sample only. Mails are chosen by a pseudo-random rank of their path: random sampling keeps each
+ * mail with a probability of rate, stratified sampling keeps the same fraction of each mailbox (at least one mail).
+ * @param files_list the path to the files list, rewritten in place
+ * @param data_path the data source directory, whose subdirectories are the mailboxes
+ * @param rate the fraction of the mails to keep, in ]0, 1]
+ * @param mode the sampling mode
+ * @param stats set to the number of listed and kept mails
+ * @return true if the list was sampled, false else (the list is then left untouched)
+ */
+bool sample_files_list(char *files_list, char *data_path, double rate, sampling_mode_t mode, sample_stats_t *stats) {
+    char sample_path[STR_MAX_LEN];
+    if (snprintf(sample_path, sizeof(sample_path), "%s.sample", files_list) >= (int) sizeof(sample_path)) {
+        return false;
+    }
+    FILE *list = open_intermediate(files_list, "r");
+    if (!list) {
+        perror("Cannot open files list");
+        return false;
+    }
+
+    growable_buffer_t buffer = {0};
+    sampled_path_t *paths = NULL;
+    size_t capacity = 0;
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t length;
+    bool success = true;
+    stats->total = 0;
+    stats->sampled = 0;
+    while (success && (length = getline(&line, &line_capacity, list)) != -1) {
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+            line[--length] = '\0';
+        }
+        if (length == 0) {
+            continue;
+        }
+        if (stats->total == capacity) {
+            capacity = capacity ? 2 * capacity : 1024;
+            sampled_path_t *grown = realloc(paths, capacity * sizeof(sampled_path_t));
+            if (!grown) {
+                success = false;
+                break;
+            }
+            paths = grown;
+        }
+        uint64_t rank = path_rank(line);
+        paths[stats->total] = (sampled_path_t) {
+                .offset = buffer.length,
+                .stratum_length = stratum_length(line, data_path),
+                .rank = rank,
+                .is_kept = is_rank_kept(rank, rate),
+        };
+        success = growable_buffer_append(&buffer, line, length + 1);
+        ++stats->total;
+    }
+    free(line);
+    fclose(list);
+
+    if (success && mode == SAMPLING_STRATIFIED) {
+        select_stratified(paths, stats->total, buffer.data, rate);
+        qsort(paths, stats->total, sizeof(sampled_path_t), compare_offsets);
+    }
+    FILE *sample = success ? open_intermediate(sample_path, "w") : NULL;
+    for (size_t i = 0; sample && i < stats->total; ++i) {
+        if (paths[i].is_kept) {
+            fprintf(sample, "%s\n", buffer.data + paths[i].offset);
+            ++stats->sampled;
+        }
+    }
+    success = sample && fclose(sample) == 0 && rename(sample_path, files_list) == 0;
+    if (!success) {
+        perror("Cannot write sampled files list");
+        remove(sample_path);
+    }
+    free(paths);
+    growable_buffer_free(&buffer);
+    return success;
+}
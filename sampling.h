@@ -0,0 +1,20 @@
+//
+// Created on 19/10/26.
+//
+
+#ifndef A2022_SAMPLING_H
+#define A2022_SAMPLING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "configuration.h"
+
+typedef struct {
+    size_t total;   // Mails in the files list
+    size_t sampled; // Mails kept
+} sample_stats_t;
+
+bool sample_files_list(char *files_list, char *data_path, double rate, sampling_mode_t mode, sample_stats_t *stats);
+
+#endif //A2022_SAMPLING_H
@@ -0,0 +1,106 @@
+//
+// Created on 19/10/26.
+//
+
+#define _GNU_SOURCE
+
+#include "scheduling.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <sys/sysinfo.h>
+
+// CPUs the program is allowed to run on, captured by the parent before forking. Workers are pinned within this set
+// only, so that taskset/cpuset restrictions are honored.
+static cpu_set_t allowed_cpus;
+static uint16_t allowed_cpus_count = 0;
+static bool pinning_enabled = false;
+
+/*!
+ * @brief cgroup_cpu_limit reads the CPU bandwidth limit of the cgroup (v2 cpu.max file, "quota period"), as set by
+ * container runtimes with --cpus
+ * @return the number of CPUs allowed by the quota (rounded up), 0 if there is no limit
+ */
+static uint16_t cgroup_cpu_limit() {
+    FILE *cpu_max = fopen("/sys/fs/cgroup/cpu.max", "r");
+    if (!cpu_max) {
+        return 0;
+    }
+    long quota = 0, period = 0;
+    char quota_text[32];
+    uint16_t limit = 0;
+    if (fscanf(cpu_max, "%31s %ld", quota_text, &period) == 2 && sscanf(quota_text, "%ld", &quota) == 1 &&
+        quota > 0 && period > 0) {
+        limit = (quota + period - 1) / period;
+    }
+    fclose(cpu_max);
+    return limit;
+}
+
+/*!
+ * @brief available_cpus_count counts the CPUs this process may actually use: its affinity mask (cpusets, taskset),
+ * further limited by the cgroup CPU quota if any
+ * @return the usable CPUs count, at least 1
+ */
+uint16_t available_cpus_count() {
+    cpu_set_t mask;
+    int count = get_nprocs();
+    if (sched_getaffinity(0, sizeof(mask), &mask) == 0) {
+        count = CPU_COUNT(&mask);
+    }
+    uint16_t limit = cgroup_cpu_limit();
+    if (limit > 0 && limit < count) {
+        count = limit;
+    }
+    return count > 0 ? count : 1;
+}
+
+/*!
+ * @brief compute_process_count computes the number of workers according to the scheduling policy: with the
+ * multiplier policy, cpu_core_multiplier workers for each online CPU; with the auto policy, one worker per usable CPU.
+ * @param config the configuration
+ * @return the workers count
+ */
+uint16_t compute_process_count(configuration_t *config) {
+    if (config->scheduling_policy == SCHEDULING_AUTO) {
+        return available_cpus_count();
+    }
+    return get_nprocs() * config->cpu_core_multiplier;
+}
+
+/*!
+ * @brief scheduling_init captures the allowed CPUs. Must be called by the parent before forking workers.
+ * @param pin_workers true to pin each worker to a CPU, false to let the kernel schedule them freely
+ */
+void scheduling_init(bool pin_workers) {
+    pinning_enabled = false;
+    if (!pin_workers || sched_getaffinity(0, sizeof(allowed_cpus), &allowed_cpus) == -1) {
+        return;
+    }
+    allowed_cpus_count = CPU_COUNT(&allowed_cpus);
+    pinning_enabled = allowed_cpus_count > 0;
+}
+
+/*!
+ * @brief scheduling_pin_worker pins the calling worker to one of the allowed CPUs, so that consecutive workers get
+ * distinct CPUs. As Linux allocates pages on the node of the CPU first touching them, the buffers a pinned worker
+ * allocates are local to its NUMA node. Does nothing if pinning is disabled.
+ * @param worker_index the worker index
+ */
+void scheduling_pin_worker(uint16_t worker_index) {
+    if (!pinning_enabled) {
+        return;
+    }
+    uint16_t target = worker_index % allowed_cpus_count;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed_cpus) && target-- == 0) {
+            cpu_set_t mask;
+            CPU_ZERO(&mask);
+            CPU_SET(cpu, &mask);
+            if (sched_setaffinity(0, sizeof(mask), &mask) == -1) {
+                perror("sched_setaffinity");
+            }
+            return;
+        }
+    }
+}
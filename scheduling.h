@@ -0,0 +1,18 @@
+//
+// Created on 19/10/26.
+//
+
+#ifndef A2022_SCHEDULING_H
+#define A2022_SCHEDULING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "configuration.h"
+
+uint16_t available_cpus_count();
+uint16_t compute_process_count(configuration_t *config);
+void scheduling_init(bool pin_workers);
+void scheduling_pin_worker(uint16_t worker_index);
+
+#endif //A2022_SCHEDULING_H
@@ -0,0 +1,342 @@
+//
+// Created on 19/10/26.
+//
+
+#include "sketch.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "string_set.h"
+
+/*!
+ * @brief count_min_init allocates a sketch sized for an error and a failure probability
+ * @param sketch the sketch to initialize
+ * @param epsilon the relative error: estimates exceed true counts by at most epsilon * total (width is rounded up to a
+ * power of 2, so the actual error is at most epsilon)
+ * @param delta the probability that an estimate exceeds this bound
+ * @return true if the counters could be allocated, false else
+ */
+bool count_min_init(count_min_t *sketch, double epsilon, double delta) {
+    sketch->width = 1;
+    while (sketch->width < ceil(M_E / epsilon)) {
+        sketch->width *= 2;
+    }
+    sketch->depth = ceil(log(1 / delta));
+    if (sketch->depth == 0) {
+        sketch->depth = 1;
+    }
+    sketch->total = 0;
+    sketch->counters = calloc((size_t) sketch->width * sketch->depth, sizeof(uint64_t));
+    return sketch->counters != NULL;
+}
+
+/*!
+ * @brief count_min_column gives the counter of a key in a row. Rows use h1 + row * h2 (Kirsch-Mitzenmacher) where h1
+ * and h2 are the two halves of the key hash, which is as good as independent hash functions for this purpose.
+ * @param sketch the sketch
+ * @param hash the key hash
+ * @param row the row
+ * @return the counter index in the row
+ */
+static uint32_t count_min_column(count_min_t *sketch, uint64_t hash, uint32_t row) {
+    uint32_t h1 = (uint32_t) hash, h2 = (uint32_t) (hash >> 32) | 1;
+    return (h1 + row * h2) & (sketch->width - 1);
+}
+
+/*!
+ * @brief count_min_add counts occurrences of a key
+ * @param sketch the sketch
+ * @param hash the key hash
+ * @param count the occurrences to add
+ */
+void count_min_add(count_min_t *sketch, uint64_t hash, uint64_t count) {
+    for (uint32_t row = 0; row < sketch->depth; ++row) {
+        sketch->counters[(size_t) row * sketch->width + count_min_column(sketch, hash, row)] += count;
+    }
+    sketch->total += count;
+}
+
+/*!
+ * @brief count_min_estimate estimates the occurrences of a key
+ * @param sketch the sketch
+ * @param hash the key hash
+ * @return the estimate, never below the true count
+ */
+uint64_t count_min_estimate(count_min_t *sketch, uint64_t hash) {
+    uint64_t estimate = UINT64_MAX;
+    for (uint32_t row = 0; row < sketch->depth; ++row) {
+        uint64_t counter = sketch->counters[(size_t) row * sketch->width + count_min_column(sketch, hash, row)];
+        if (counter < estimate) {
+            estimate = counter;
+        }
+    }
+    return estimate;
+}
+
+/*!
+ * @brief count_min_error_bound gives the maximum overestimate of the current counts
+ * @param sketch the sketch
+ * @return the bound, holding with probability count_min_confidence
+ */
+uint64_t count_min_error_bound(count_min_t *sketch) {
+    return ceil(sketch->total * M_E / sketch->width);
+}
+
+/*!
+ * @brief count_min_confidence gives the probability that an estimate is within count_min_error_bound
+ * @param sketch the sketch
+ * @return the probability
+ */
+double count_min_confidence(count_min_t *sketch) {
+    return 1 - exp(-(double) sketch->depth);
+}
+
+/*!
+ * @brief count_min_free releases the counters of a sketch
+ * @param sketch the sketch
+ */
+void count_min_free(count_min_t *sketch) {
+    free(sketch->counters);
+    sketch->counters = NULL;
+}
+
+/*!
+ * @brief space_saving_init allocates an empty heavy hitters table
+ * @param heavy_hitters the table to initialize
+ * @param capacity the maximum number of monitored keys
+ * @return true if the table could be allocated, false else
+ */
+bool space_saving_init(space_saving_t *heavy_hitters, size_t capacity) {
+    heavy_hitters->capacity = capacity > 0 ? capacity : 1;
+    heavy_hitters->index_capacity = 2;
+    while (heavy_hitters->index_capacity < 2 * heavy_hitters->capacity) {
+        heavy_hitters->index_capacity *= 2;
+    }
+    heavy_hitters->count = 0;
+    heavy_hitters->total = 0;
+    heavy_hitters->entries = calloc(heavy_hitters->capacity, sizeof(heavy_hitter_t));
+    heavy_hitters->index = calloc(heavy_hitters->index_capacity, sizeof(size_t));
+    return heavy_hitters->entries && heavy_hitters->index;
+}
+
+/*!
+ * @brief space_saving_swap swaps two heap entries, keeping the index table pointing to them
+ */
+static void space_saving_swap(space_saving_t *heavy_hitters, size_t a, size_t b) {
+    heavy_hitter_t swap = heavy_hitters->entries[a];
+    heavy_hitters->entries[a] = heavy_hitters->entries[b];
+    heavy_hitters->entries[b] = swap;
+    heavy_hitters->index[heavy_hitters->entries[a].slot] = a + 1;
+    heavy_hitters->index[heavy_hitters->entries[b].slot] = b + 1;
+}
+
+/*!
+ * @brief space_saving_sift_down moves an entry whose count grew down the min-heap
+ */
+static void space_saving_sift_down(space_saving_t *heavy_hitters, size_t i) {
+    heavy_hitter_t *entries = heavy_hitters->entries;
+    while (2 * i + 1 < heavy_hitters->count) {
+        size_t child = 2 * i + 1;
+        if (child + 1 < heavy_hitters->count && entries[child + 1].count < entries[child].count) {
+            ++child;
+        }
+        if (entries[i].count <= entries[child].count) {
+            return;
+        }
+        space_saving_swap(heavy_hitters, i, child);
+        i = child;
+    }
+}
+
+/*!
+ * @brief space_saving_sift_up moves a new entry up the min-heap
+ */
+static void space_saving_sift_up(space_saving_t *heavy_hitters, size_t i) {
+    while (i > 0 && heavy_hitters->entries[(i - 1) / 2].count > heavy_hitters->entries[i].count) {
+        space_saving_swap(heavy_hitters, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+/*!
+ * @brief space_saving_find_slot finds the slot of a key: the slot pointing to its entry, or the empty slot where to
+ * insert it
+ */
+static size_t space_saving_find_slot(space_saving_t *heavy_hitters, const char *key, uint64_t hash) {
+    size_t mask = heavy_hitters->index_capacity - 1;
+    size_t slot = hash & mask;
+    while (heavy_hitters->index[slot]) {
+        heavy_hitter_t *entry = &heavy_hitters->entries[heavy_hitters->index[slot] - 1];
+        if (entry->hash == hash && strcmp(entry->key, key) == 0) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/*!
+ * @brief space_saving_remove_slot empties a slot of the index table, shifting back the following entries of its
+ * probe sequence (linear probing deletion without tombstones)
+ */
+static void space_saving_remove_slot(space_saving_t *heavy_hitters, size_t slot) {
+    size_t mask = heavy_hitters->index_capacity - 1;
+    size_t next = slot;
+    while (true) {
+        next = (next + 1) & mask;
+        if (!heavy_hitters->index[next]) {
+            break;
+        }
+        size_t home = heavy_hitters->entries[heavy_hitters->index[next] - 1].hash & mask;
+        // The entry at next may move to slot only if its home is not between slot (excluded) and next (included)
+        bool stays = slot <= next ? (slot < home && home <= next) : (slot < home || home <= next);
+        if (!stays) {
+            heavy_hitters->index[slot] = heavy_hitters->index[next];
+            heavy_hitters->entries[heavy_hitters->index[slot] - 1].slot = slot;
+            slot = next;
+        }
+    }
+    heavy_hitters->index[slot] = 0;
+}
+
+/*!
+ * @brief space_saving_add counts occurrences of a key. An unknown key is monitored if there is room, else it replaces
+ * the least counted key and starts from its count.
+ * @param heavy_hitters the table
+ * @param key the key, copied when it becomes monitored
+ * @param hash the key hash
+ * @param count the occurrences to add
+ * @return true if the key was counted, false if its copy could not be allocated
+ */
+bool space_saving_add(space_saving_t *heavy_hitters, const char *key, uint64_t hash, uint64_t count) {
+    heavy_hitters->total += count;
+    size_t slot = space_saving_find_slot(heavy_hitters, key, hash);
+    if (heavy_hitters->index[slot]) {
+        size_t position = heavy_hitters->index[slot] - 1;
+        heavy_hitters->entries[position].count += count;
+        space_saving_sift_down(heavy_hitters, position);
+        return true;
+    }
+    char *copy = strdup(key);
+    if (!copy) {
+        return false;
+    }
+    if (heavy_hitters->count < heavy_hitters->capacity) {
+        size_t position = heavy_hitters->count++;
+        heavy_hitters->entries[position] = (heavy_hitter_t) {
+                .key = copy, .hash = hash, .count = count, .error = 0, .slot = slot,
+        };
+        heavy_hitters->index[slot] = position + 1;
+        space_saving_sift_up(heavy_hitters, position);
+        return true;
+    }
+    // Evict the root, then look the slot up again: removing the root slot may have shifted the probe sequence
+    heavy_hitter_t *root = &heavy_hitters->entries[0];
+    space_saving_remove_slot(heavy_hitters, root->slot);
+    free(root->key);
+    root->key = copy;
+    root->hash = hash;
+    root->error = root->count;
+    root->count += count;
+    root->slot = space_saving_find_slot(heavy_hitters, key, hash);
+    heavy_hitters->index[root->slot] = 1;
+    space_saving_sift_down(heavy_hitters, 0);
+    return true;
+}
+
+/*!
+ * @brief space_saving_error_bound gives the maximum overestimate of a monitored count, which is also the count above
+ * which a key is guaranteed to be monitored
+ * @param heavy_hitters the table
+ * @return the smallest monitored count when the table is full, 0 else
+ */
+uint64_t space_saving_error_bound(space_saving_t *heavy_hitters) {
+    return heavy_hitters->count == heavy_hitters->capacity ? heavy_hitters->entries[0].count : 0;
+}
+
+/*!
+ * @brief space_saving_free releases a table and its keys
+ * @param heavy_hitters the table
+ */
+void space_saving_free(space_saving_t *heavy_hitters) {
+    for (size_t i = 0; i < heavy_hitters->count; ++i) {
+        free(heavy_hitters->entries[i].key);
+    }
+    free(heavy_hitters->entries);
+    free(heavy_hitters->index);
+    heavy_hitters->entries = NULL;
+    heavy_hitters->index = NULL;
+    heavy_hitters->count = 0;
+}
+
+/*!
+ * @brief hll_hash hashes an address for HyperLogLog: FNV-1a, mixed (splitmix64 finalizer) so that all its bits are
+ * usable as register index and rank
+ * @param string the address
+ * @return the hash
+ */
+uint64_t hll_hash(const char *string) {
+    uint64_t hash = string_hash(string);
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+    return hash ^ (hash >> 31);
+}
+
+/*!
+ * @brief hll_add adds a hash to a set: the first HLL_PRECISION bits select the register, the rank of the first 1 bit
+ * of the others is kept if it is the largest one of the register
+ * @param registers the HLL_REGISTERS registers of the set
+ * @param hash the hash (@see hll_hash)
+ */
+void hll_add(uint8_t *registers, uint64_t hash) {
+    uint64_t rest = (hash << HLL_PRECISION) | (1ULL << (HLL_PRECISION - 1)); // Bounds the rank
+    uint8_t rank = __builtin_clzll(rest) + 1;
+    uint8_t *reg = &registers[hash >> (64 - HLL_PRECISION)];
+    if (rank > *reg) {
+        *reg = rank;
+    }
+}
+
+/*!
+ * @brief hll_merge merges the registers of a set into another one, which then counts their union
+ * @param registers the registers to update
+ * @param other the registers to merge
+ */
+void hll_merge(uint8_t *registers, const uint8_t *other) {
+    for (size_t i = 0; i < HLL_REGISTERS; ++i) {
+        if (other[i] > registers[i]) {
+            registers[i] = other[i];
+        }
+    }
+}
+
+/*!
+ * @brief hll_estimate estimates the number of distinct hashes added to a set, with the linear counting correction of
+ * small counts (64 bits hashes need no correction of large counts)
+ * @param registers the registers of the set
+ * @return the estimate
+ */
+double hll_estimate(const uint8_t *registers) {
+    double sum = 0;
+    size_t zeros = 0;
+    for (size_t i = 0; i < HLL_REGISTERS; ++i) {
+        sum += ldexp(1, -registers[i]);
+        zeros += registers[i] == 0;
+    }
+    double alpha = 0.7213 / (1 + 1.079 / HLL_REGISTERS);
+    double estimate = alpha * HLL_REGISTERS * HLL_REGISTERS / sum;
+    if (estimate <= 2.5 * HLL_REGISTERS && zeros > 0) {
+        estimate = HLL_REGISTERS * log((double) HLL_REGISTERS / zeros);
+    }
+    return estimate;
+}
+
+/*!
+ * @brief hll_standard_error gives the relative standard error of the estimates
+ * @return the error, 0.0325 for 1024 registers
+ */
+double hll_standard_error() {
+    return 1.04 / sqrt(HLL_REGISTERS);
+}
@@ -0,0 +1,66 @@
+//
+// Created on 19/10/26.
+//
+
+#ifndef A2022_SKETCH_H
+#define A2022_SKETCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Count-Min sketch: depth rows of width counters, a key increments one counter per row and its estimate is the
+// smallest of them. Estimates never underestimate, and overestimate by at most total * e / width with probability
+// 1 - exp(-depth), whatever the number of distinct keys.
+typedef struct {
+    uint32_t width; // Always a power of 2
+    uint32_t depth;
+    uint64_t *counters;
+    uint64_t total; // Sum of all added counts
+} count_min_t;
+
+typedef struct {
+    char *key;
+    uint64_t hash;
+    uint64_t count;
+    uint64_t error; // Count of the evicted key this entry replaced: the true count is in [count - error, count]
+    size_t slot;    // Slot of the entry in the index table
+} heavy_hitter_t;
+
+// Space-Saving heavy hitters: at most capacity keys are monitored; an unknown key replaces the smallest one and
+// inherits its count. Every key counted more than total / capacity times is monitored. Entries are a min-heap on
+// count, found by key through an open addressing table of their heap positions.
+typedef struct {
+    heavy_hitter_t *entries;
+    size_t count;
+    size_t capacity;
+    size_t *index;         // Heap position + 1 of the entry in each slot, 0 for an empty slot
+    size_t index_capacity; // Always a power of 2
+    uint64_t total;
+} space_saving_t;
+
+// HyperLogLog: an address hash sets one of HLL_REGISTERS registers to the maximum rank of its first 1 bit; the
+// number of distinct addresses is estimated from the registers with a standard error of 1.04 / sqrt(HLL_REGISTERS),
+// in HLL_REGISTERS bytes whatever the count. Registers of two sets merge into those of their union with a maximum.
+#define HLL_PRECISION 10
+#define HLL_REGISTERS (1 << HLL_PRECISION)
+
+bool count_min_init(count_min_t *sketch, double epsilon, double delta);
+void count_min_add(count_min_t *sketch, uint64_t hash, uint64_t count);
+uint64_t count_min_estimate(count_min_t *sketch, uint64_t hash);
+uint64_t count_min_error_bound(count_min_t *sketch);
+double count_min_confidence(count_min_t *sketch);
+void count_min_free(count_min_t *sketch);
+
+bool space_saving_init(space_saving_t *heavy_hitters, size_t capacity);
+bool space_saving_add(space_saving_t *heavy_hitters, const char *key, uint64_t hash, uint64_t count);
+uint64_t space_saving_error_bound(space_saving_t *heavy_hitters);
+void space_saving_free(space_saving_t *heavy_hitters);
+
+uint64_t hll_hash(const char *string);
+void hll_add(uint8_t *registers, uint64_t hash);
+void hll_merge(uint8_t *registers, const uint8_t *other);
+double hll_estimate(const uint8_t *registers);
+double hll_standard_error();
+
+#endif //A2022_SKETCH_H
@@ -0,0 +1,194 @@
+//
+// Created on 19/10/26.
+//
+
+#include "string_set.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define STRING_SET_MIN_CAPACITY 64
+
+/*!
+ * @brief string_hash computes the FNV-1a hash of a string
+ * @param string the string
+ * @return the 64 bits hash
+ */
+uint64_t string_hash(const char *string) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (; *string; ++string) {
+        hash ^= (unsigned char) *string;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/*!
+ * @brief string_set_init initializes an empty set
+ * @param set the set to initialize
+ * @param expected_count the number of strings expected, to size the table (it grows anyway)
+ * @return true if the set could be allocated, false else
+ */
+bool string_set_init(string_set_t *set, size_t expected_count) {
+    set->capacity = STRING_SET_MIN_CAPACITY;
+    while (set->capacity < 2 * expected_count) {
+        set->capacity *= 2;
+    }
+    set->count = 0;
+    set->slots = calloc(set->capacity, sizeof(char *));
+    return set->slots != NULL;
+}
+
+/*!
+ * @brief find_slot finds the slot of a string: the slot holding it, or the empty slot where to insert it
+ * @param slots the slots array
+ * @param capacity the slots count (a power of 2)
+ * @param string the string to look for
+ * @return the slot index
+ */
+static size_t find_slot(char **slots, size_t capacity, const char *string) {
+    size_t slot = string_hash(string) & (capacity - 1);
+    while (slots[slot] && strcmp(slots[slot], string) != 0) {
+        slot = (slot + 1) & (capacity - 1);
+    }
+    return slot;
+}
+
+/*!
+ * @brief string_set_grow doubles the capacity of a set and rehashes its strings
+ * @param set the set
+ * @return true if the set grew, false else
+ */
+static bool string_set_grow(string_set_t *set) {
+    size_t capacity = 2 * set->capacity;
+    char **slots = calloc(capacity, sizeof(char *));
+    if (!slots) {
+        return false;
+    }
+    for (size_t i = 0; i < set->capacity; ++i) {
+        if (set->slots[i]) {
+            slots[find_slot(slots, capacity, set->slots[i])] = set->slots[i];
+        }
+    }
+    free(set->slots);
+    set->slots = slots;
+    set->capacity = capacity;
+    return true;
+}
+
+/*!
+ * @brief string_set_intern adds a copy of a string to a set, if it is not in it yet, and returns the copy: equal
+ * strings interned in the same set have the same address, which stays valid until the set is freed
+ * @param set the set
+ * @param string the string to add
+ * @return the copy of the string in the set, NULL if it could not be added
+ */
+const char *string_set_intern(string_set_t *set, const char *string) {
+    if (2 * (set->count + 1) > set->capacity && !string_set_grow(set)) {
+        return NULL;
+    }
+    size_t slot = find_slot(set->slots, set->capacity, string);
+    if (!set->slots[slot]) {
+        if (!(set->slots[slot] = strdup(string))) {
+            return NULL;
+        }
+        ++set->count;
+    }
+    return set->slots[slot];
+}
+
+/*!
+ * @brief string_set_add adds a copy of a string to a set, if it is not in it yet
+ * @param set the set
+ * @param string the string to add
+ * @return true if the string is in the set, false if it could not be added
+ */
+bool string_set_add(string_set_t *set, const char *string) {
+    return string_set_intern(set, string) != NULL;
+}
+
+/*!
+ * @brief string_set_contains tells if a string is in a set
+ * @param set the set
+ * @param string the string to look for
+ * @return true if the string is in the set, false else
+ */
+bool string_set_contains(string_set_t *set, const char *string) {
+    return set->slots && set->slots[find_slot(set->slots, set->capacity, string)] != NULL;
+}
+
+/*!
+ * @brief string_set_free releases a set and its strings
+ * @param set the set
+ */
+void string_set_free(string_set_t *set) {
+    for (size_t i = 0; set->slots && i < set->capacity; ++i) {
+        free(set->slots[i]);
+    }
+    free(set->slots);
+    set->slots = NULL;
+    set->capacity = 0;
+    set->count = 0;
+}
+
+/*!
+ * @brief string_map_init initializes an empty map
+ * @param map the map to initialize
+ * @param expected_count the number of keys expected, to size the table (it grows anyway)
+ * @return true if the map could be allocated, false else
+ */
+bool string_map_init(string_map_t *map, size_t expected_count) {
+    return string_set_init(&map->entries, expected_count);
+}
+
+/*!
+ * @brief string_map_put sets the value of a key, replacing its previous value if any
+ * @param map the map
+ * @param key the key
+ * @param value the value
+ * @return the copy of the value in the map, valid until the key is put again or the map is freed, NULL if it could
+ * not be added
+ */
+const char *string_map_put(string_map_t *map, const char *key, const char *value) {
+    string_set_t *set = &map->entries;
+    if (2 * (set->count + 1) > set->capacity && !string_set_grow(set)) {
+        return NULL;
+    }
+    size_t key_length = strlen(key), value_length = strlen(value);
+    char *entry = malloc(key_length + value_length + 2);
+    if (!entry) {
+        return NULL;
+    }
+    memcpy(entry, key, key_length + 1);
+    memcpy(entry + key_length + 1, value, value_length + 1);
+    size_t slot = find_slot(set->slots, set->capacity, key);
+    if (set->slots[slot]) {
+        free(set->slots[slot]);
+    } else {
+        ++set->count;
+    }
+    set->slots[slot] = entry;
+    return entry + key_length + 1;
+}
+
+/*!
+ * @brief string_map_get finds the value of a key
+ * @param map the map
+ * @param key the key
+ * @return the value, NULL if the key is not in the map
+ */
+const char *string_map_get(string_map_t *map, const char *key) {
+    if (!map->entries.slots) {
+        return NULL;
+    }
+    const char *entry = map->entries.slots[find_slot(map->entries.slots, map->entries.capacity, key)];
+    return entry ? entry + strlen(entry) + 1 : NULL;
+}
+
+/*!
+ * @brief string_map_free releases a map, its keys and its values
+ * @param map the map
+ */
+void string_map_free(string_map_t *map) {
+    string_set_free(&map->entries);
+}
@@ -0,0 +1,37 @@
+//
+// Created on 19/10/26.
+//
+
+#ifndef A2022_STRING_SET_H
+#define A2022_STRING_SET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Hash set of strings (open addressing, linear probing), kept at most half full. Strings are copied.
+typedef struct {
+    char **slots;
+    size_t capacity; // Always a power of 2
+    size_t count;
+} string_set_t;
+
+uint64_t string_hash(const char *string);
+bool string_set_init(string_set_t *set, size_t expected_count);
+const char *string_set_intern(string_set_t *set, const char *string);
+bool string_set_add(string_set_t *set, const char *string);
+bool string_set_contains(string_set_t *set, const char *string);
+void string_set_free(string_set_t *set);
+
+// Hash map of strings: a set whose strings are each a key followed by its value ("key\0value"), so that lookups
+// compare the keys only. Keys and values are copied.
+typedef struct {
+    string_set_t entries;
+} string_map_t;
+
+bool string_map_init(string_map_t *map, size_t expected_count);
+const char *string_map_put(string_map_t *map, const char *key, const char *value);
+const char *string_map_get(string_map_t *map, const char *key);
+void string_map_free(string_map_t *map);
+
+#endif //A2022_STRING_SET_H
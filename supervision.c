@@ -0,0 +1,298 @@
+//
+// Created on 19/10/26.
+//
+
+#include "supervision.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "analysis.h"
+#include "block_file.h"
+#include "checkpoint.h"
+#include "file_errors.h"
+#include "metrics.h"
+#include "trace.h"
+#include "utility.h"
+
+typedef struct {
+    task_t task;
+    uint8_t attempts; // Dispatches of the task so far
+    bool is_busy;     // In-flight slots only: the worker is running the task
+} supervised_task_t;
+
+typedef struct {
+    supervised_task_t *tasks;
+    uint32_t count;
+    uint32_t capacity;
+} task_list_t;
+
+/*!
+ * @brief task_source_open_directories prepares the directory tasks: one per subdirectory of the data source, listing
+ * its files into the temporary file of the same name
+ * @param source the source to initialize
+ * @param data_source the data source directory
+ * @param temp_files the temporary files directory
+ * @return true if the data source could be opened, false else
+ */
+bool task_source_open_directories(task_source_t *source, char *data_source, char *temp_files) {
+    *source = (task_source_t) {.directory = opendir(data_source), .data_source = data_source, .output = temp_files};
+    return source->directory != NULL;
+}
+
+/*!
+ * @brief task_source_open_files prepares the file tasks: one per line of the files list, appending to the output. The
+ * mails analyzed before the last checkpoint are skipped (@see checkpoint_resume_files).
+ * @param source the source to initialize
+ * @param files_list the files list (step1_output)
+ * @param output the output file (step2_output)
+ * @return true if the files list could be opened, false else
+ */
+bool task_source_open_files(task_source_t *source, char *files_list, char *output) {
+    *source = (task_source_t) {.files_list = open_intermediate(files_list, "r"), .output = output};
+    if (source->files_list) {
+        source->files_done = checkpoint_resume_files(source->files_list, output);
+    }
+    return source->files_list != NULL;
+}
+
+/*!
+ * @brief task_source_next fills the next task of a source
+ * @param source the source
+ * @param task the task to fill
+ * @return true if a task was filled, false when the source is exhausted
+ */
+bool task_source_next(task_source_t *source, task_t *task) {
+    memset(task, 0, sizeof(task_t));
+    if (source->directory) {
+        struct dirent *entry;
+        while ((entry = next_dir(NULL, source->directory)) != NULL) {
+            directory_task_t *directory_task = (directory_task_t *) task;
+            if (concat_path(source->data_source, entry->d_name, directory_task->object_directory) &&
+                directory_exists(directory_task->object_directory) &&
+                concat_path(source->output, entry->d_name, directory_task->temporary_directory)) {
+                directory_task->task_callback = process_directory;
+                return true;
+            }
+        }
+        return false;
+    }
+    file_task_t *file_task = (file_task_t *) task;
+    while (source->files_list && fgets(file_task->object_file, STR_MAX_LEN, source->files_list)) {
+        file_task->object_file[strcspn(file_task->object_file, "\n")] = '\0';
+        ++source->files_done;
+        if (file_task->object_file[0] != '\0') {
+            file_task->task_callback = process_file;
+            strncpy(file_task->temporary_directory, source->output, STR_MAX_LEN - 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * @brief task_source_close closes the directory or files list of a source
+ * @param source the source
+ */
+void task_source_close(task_source_t *source) {
+    if (source->directory) {
+        closedir(source->directory);
+    }
+    if (source->files_list) {
+        fclose(source->files_list);
+    }
+    source->directory = NULL;
+    source->files_list = NULL;
+}
+
+/*!
+ * @brief abandon_task gives up a task which killed its worker on each dispatch. A mail is recorded in the rejected
+ * files log, so that the next run may skip it.
+ * @param task the task
+ */
+static void abandon_task(task_t *task) {
+    if (task->task_callback == process_file) {
+        file_task_t *file_task = (file_task_t *) task;
+        printf("Giving up %s: its worker died %d times\n", file_task->object_file, TASK_MAX_ATTEMPTS);
+        metrics_file_parsed(0, 0, FILE_STATUS_WORKER_CRASHED);
+        file_errors_record(file_task->object_file, FILE_STATUS_WORKER_CRASHED);
+    } else {
+        directory_task_t *directory_task = (directory_task_t *) task;
+        printf("Giving up %s: its worker died %d times\n", directory_task->object_directory, TASK_MAX_ATTEMPTS);
+    }
+}
+
+/*!
+ * @brief task_list_push appends a task to a list
+ * @param list the list
+ * @param task the task
+ * @return true if the task was appended, false if memory ran out
+ */
+static bool task_list_push(task_list_t *list, supervised_task_t *task) {
+    if (list->count == list->capacity) {
+        uint32_t capacity = list->capacity > 0 ? 2 * list->capacity : 16;
+        supervised_task_t *grown = realloc(list->tasks, capacity * sizeof(supervised_task_t));
+        if (!grown) {
+            return false;
+        }
+        list->tasks = grown;
+        list->capacity = capacity;
+    }
+    list->tasks[list->count] = *task;
+    list->tasks[list->count++].is_busy = false;
+    return true;
+}
+
+/*!
+ * @brief keep_unflushed_tasks records a task reported done by a worker, and forgets the ones whose lines reached the
+ * output file
+ * @param unflushed the done tasks of the worker whose lines it still buffers
+ * @param task the task reported done
+ * @param unflushed_tasks the number of the last tasks of the worker still buffered, this one included
+ * @return true if the task was recorded, false if memory ran out
+ */
+static bool keep_unflushed_tasks(task_list_t *unflushed, supervised_task_t *task, uint32_t unflushed_tasks) {
+    if (unflushed_tasks == 0 || task->task.task_callback == close_mail_output) {
+        unflushed->count = 0;
+        return true;
+    }
+    if (!task_list_push(unflushed, task)) {
+        return false;
+    }
+    if (unflushed_tasks < unflushed->count) {
+        memmove(unflushed->tasks, unflushed->tasks + unflushed->count - unflushed_tasks,
+                unflushed_tasks * sizeof(supervised_task_t));
+        unflushed->count = unflushed_tasks;
+    }
+    return true;
+}
+
+/*!
+ * @brief supervise_tasks dispatches all the tasks of a source to persistent workers, one task at a time per worker.
+ * The task of each worker is kept until it is reported done: when a worker dies instead, it is replaced and its task
+ * is dispatched again, up to TASK_MAX_ATTEMPTS times, so that a crash never blocks the dispatcher nor loses a task
+ * silently. A task is delivered at least once, not exactly once: with mq and fifo, a worker which writes the lines of
+ * its mail then dies before its done message is read has its task dispatched again, and the mail is counted twice
+ * (the tcp coordinator writes the output of a task only when it is done, so that it never happens there). Workers
+ * which are not ready are skipped, and while tasks are left the dispatcher waits for one to join.
+ * The files analysis is checkpointed when due: no task is dispatched from the source until all the tasks in flight are
+ * done, so that the checkpoint covers exactly the lines read so far. With a controller, the tasks in flight are at
+ * most its limit, the other workers stay idle.
+ * A compressed output buffers the lines of the last tasks of a worker until it writes a block: these tasks are kept
+ * as well, and dispatched again if the worker dies. Once no task is left, the workers which still buffer lines close
+ * their output.
+ * @param transport the communication with the workers
+ * @param workers_count the number of workers
+ * @param source the tasks to dispatch
+ * @param controller the adaptive concurrency controller, NULL to keep all the workers busy
+ * @param stats set to the dispatch counters
+ * @return true if all the tasks were completed or given up, false if the workers could not be reached anymore
+ */
+bool supervise_tasks(worker_transport_t *transport, uint16_t workers_count, task_source_t *source,
+                     concurrency_controller_t *controller, supervision_stats_t *stats) {
+    *stats = (supervision_stats_t) {0};
+    supervised_task_t *in_flight = calloc(workers_count, sizeof(supervised_task_t));
+    task_list_t *unflushed = calloc(workers_count, sizeof(task_list_t));
+    task_list_t retries = {0};
+    if (!in_flight || !unflushed) {
+        free(in_flight);
+        free(unflushed);
+        return false;
+    }
+    uint16_t busy_count = 0;
+    bool is_source_exhausted = false, is_checkpointing = false, success = true;
+    while (success) {
+        is_checkpointing = is_checkpointing || (source->files_list && checkpoint_due());
+        if (is_checkpointing && busy_count == 0 && retries.count == 0) {
+            checkpoint_files_progress(ftello(source->files_list), source->files_done, source->output);
+            is_checkpointing = false;
+        }
+
+        // 1. Give a task to each idle worker, retries first, up to the limit of the controller
+        uint16_t limit = controller ? concurrency_limit(controller) : workers_count;
+        for (uint16_t worker = 0; worker < workers_count && busy_count < limit && success; ++worker) {
+            supervised_task_t *slot = &in_flight[worker];
+            if (slot->is_busy || (transport->is_ready && !transport->is_ready(transport->context, worker))) {
+                continue;
+            }
+            if (retries.count > 0) {
+                *slot = retries.tasks[--retries.count];
+            } else if (!is_source_exhausted && !is_checkpointing && task_source_next(source, &slot->task)) {
+                slot->attempts = 0;
+            } else if (is_checkpointing) {
+                continue;
+            } else {
+                is_source_exhausted = true;
+                if (unflushed[worker].count == 0) {
+                    continue;
+                }
+                // Nothing left to run: the worker writes the lines it buffers
+                memset(&slot->task, 0, sizeof(task_t));
+                slot->task.task_callback = close_mail_output;
+                slot->attempts = 0;
+            }
+            slot->is_busy = true;
+            ++slot->attempts;
+            ++busy_count;
+            ++stats->dispatched;
+            metrics_task_dispatched();
+            success = transport->send_task(transport->context, worker, &slot->task);
+        }
+        // Tasks left but no worker to run them: wait for one to join, if workers may join
+        bool is_waiting_workers = transport->is_ready && (retries.count > 0 || !is_source_exhausted);
+        if (!success || (busy_count == 0 && !is_waiting_workers)) {
+            break;
+        }
+
+        // 2. Wait for a worker to finish its task, to die, or to join
+        uint16_t worker = 0;
+        uint32_t unflushed_tasks = 0;
+        uint64_t wait_start_us = metrics_now_us();
+        worker_event_t event = transport->wait_event(transport->context, &worker, &unflushed_tasks);
+        trace_record(TRACE_DISPATCH_WAIT, wait_start_us, metrics_now_us(), NULL);
+        if (event == WORKER_EVENT_ERROR || worker >= workers_count) {
+            success = false;
+            break;
+        }
+        supervised_task_t *slot = &in_flight[worker];
+        if (event == WORKER_JOINED) {
+            continue;
+        }
+        if (event == WORKER_DIED) {
+            ++stats->respawned;
+            success = transport->respawn(transport->context, worker);
+            // The done tasks whose lines the worker buffered are lost with it, like its current task
+            for (uint32_t i = 0; i < unflushed[worker].count && success; ++i) {
+                unflushed[worker].tasks[i].attempts = 0;
+                success = task_list_push(&retries, &unflushed[worker].tasks[i]);
+            }
+            unflushed[worker].count = 0;
+            bool is_task_lost = slot->is_busy && slot->task.task_callback != close_mail_output;
+            if (is_task_lost && slot->attempts < TASK_MAX_ATTEMPTS) {
+                success = task_list_push(&retries, slot) && success;
+            } else if (is_task_lost) {
+                abandon_task(&slot->task);
+                ++stats->abandoned;
+            }
+        } else if (slot->is_busy) {
+            success = keep_unflushed_tasks(&unflushed[worker], slot, unflushed_tasks);
+        }
+        if (slot->is_busy) {
+            slot->is_busy = false;
+            --busy_count;
+            if (event == WORKER_TASK_DONE) {
+                concurrency_task_done(controller);
+            }
+        }
+    }
+    if (!success) {
+        printf("Workers cannot be reached anymore, %u tasks were not completed\n", busy_count + retries.count);
+    }
+    for (uint16_t worker = 0; worker < workers_count; ++worker) {
+        free(unflushed[worker].tasks);
+    }
+    free(in_flight);
+    free(unflushed);
+    free(retries.tasks);
+    return success;
+}
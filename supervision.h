@@ -0,0 +1,63 @@
+//
+// Created on 19/10/26.
+//
+
+#ifndef A2022_SUPERVISION_H
+#define A2022_SUPERVISION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <dirent.h>
+
+#include "concurrency.h"
+#include "global_defs.h"
+
+// Dispatches of a task before it is given up: a task whose worker dies this many times is most likely the cause
+#define TASK_MAX_ATTEMPTS 3
+
+typedef enum {
+    WORKER_TASK_DONE,   // The worker finished its task and waits for the next one
+    WORKER_DIED,        // The worker was reaped, its task (if any) was not completed
+    WORKER_EVENT_ERROR, // The transport failed, no worker can be reached anymore
+    WORKER_JOINED,      // A worker became reachable (@see worker_transport_t is_ready)
+} worker_event_t;
+
+// Communication between the dispatcher and its persistent workers (message queue, FIFOs or TCP connections). Workers
+// are designated by their index, from 0 to the workers count - 1. Workers which connect on their own (TCP) may not be
+// reachable yet: is_ready tells which ones may be given a task, NULL when all of them always are. With each finished
+// task, wait_event reports how many of the last tasks of the worker, this one included, have lines it still buffers
+// (@see unflushed_mail_tasks).
+typedef struct {
+    void *context;
+    bool (*send_task)(void *context, uint16_t worker, task_t *task);
+    worker_event_t (*wait_event)(void *context, uint16_t *worker, uint32_t *unflushed_tasks);
+    bool (*respawn)(void *context, uint16_t worker); // Replaces a reaped worker with a new process
+    bool (*is_ready)(void *context, uint16_t worker);
+} worker_transport_t;
+
+// Tasks to dispatch: the subdirectories of the data source (directory tasks), or the lines of the files list (file
+// tasks)
+typedef struct {
+    DIR *directory;
+    FILE *files_list;
+    char *data_source;
+    char *output; // Directory tasks: the temporary files directory; file tasks: the output file (step2_output)
+    uint64_t files_done; // File tasks: lines of the files list read so far, checkpointed ones included
+} task_source_t;
+
+typedef struct {
+    uint32_t dispatched; // Dispatches, retries included
+    uint32_t respawned;  // Workers replaced after their death
+    uint32_t abandoned;  // Tasks given up after TASK_MAX_ATTEMPTS dispatches
+} supervision_stats_t;
+
+bool task_source_open_directories(task_source_t *source, char *data_source, char *temp_files);
+bool task_source_open_files(task_source_t *source, char *files_list, char *output);
+bool task_source_next(task_source_t *source, task_t *task);
+void task_source_close(task_source_t *source);
+
+bool supervise_tasks(worker_transport_t *transport, uint16_t workers_count, task_source_t *source,
+                     concurrency_controller_t *controller, supervision_stats_t *stats);
+
+#endif //A2022_SUPERVISION_H
@@ -0,0 +1,896 @@
+//
+// Created on 19/10/26.
+//
+
+#define _GNU_SOURCE // fopencookie
+
+#include "tcp_processes.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/wait.h>
+
+#include "analysis.h"
+#include "block_file.h"
+#include "file_errors.h"
+#include "metrics.h"
+#include "scheduling.h"
+#include "supervision.h"
+#include "trace.h"
+#include "utility.h"
+
+/*!
+ * @brief split_address splits an address into its host and port
+ * @param address the address, as "host:port", "[ipv6]:port" or "port"
+ * @param host set to the host, empty when the address is a port only
+ * @param port set to the port
+ * @return true if the address could be split, false else
+ */
+static bool split_address(char *address, char *host, char *port) {
+    char *colon = strrchr(address, ':');
+    char *port_start = colon ? colon + 1 : address;
+    size_t host_length = colon ? (size_t) (colon - address) : 0;
+    if (host_length >= 2 && address[0] == '[' && address[host_length - 1] == ']') {
+        ++address;
+        host_length -= 2;
+    }
+    if (host_length >= NI_MAXHOST || *port_start == '\0' || strlen(port_start) >= NI_MAXSERV) {
+        return false;
+    }
+    memcpy(host, address, host_length);
+    host[host_length] = '\0';
+    strcpy(port, port_start);
+    return true;
+}
+
+/*!
+ * @brief describe_address formats a socket address as "host:port"
+ * @param address the address
+ * @param length the address length
+ * @param description set to the formatted address, STR_MAX_LEN bytes at most
+ */
+static void describe_address(struct sockaddr *address, socklen_t length, char *description) {
+    char host[NI_MAXHOST], port[NI_MAXSERV];
+    if (getnameinfo(address, length, host, sizeof(host), port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV) != 0) {
+        strcpy(description, "unknown");
+    } else {
+        snprintf(description, STR_MAX_LEN, address->sa_family == AF_INET6 ? "[%s]:%s" : "%s:%s", host, port);
+    }
+}
+
+/*!
+ * @brief set_keepalive makes the kernel probe a silent connection, so that the host of a worker may not vanish
+ * without its connection being reported lost
+ * @param socket the connection
+ */
+static void set_keepalive(int socket) {
+    int enabled = 1, idle = TCP_KEEPALIVE_IDLE_S, interval = TCP_KEEPALIVE_INTERVAL_S, probes = 3;
+    setsockopt(socket, SOL_SOCKET, SO_KEEPALIVE, &enabled, sizeof(enabled));
+    setsockopt(socket, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(socket, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+    setsockopt(socket, IPPROTO_TCP, TCP_KEEPCNT, &probes, sizeof(probes));
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled));
+}
+
+/*!
+ * @brief send_all writes all the data on a connection. A closed connection is an error, not a SIGPIPE.
+ * @param socket the connection
+ * @param data the data
+ * @param length the data length
+ * @return true if all the data was written, false else
+ */
+static bool send_all(int socket, const void *data, size_t length) {
+    const char *position = data;
+    while (length > 0) {
+        ssize_t written = send(socket, position, length, MSG_NOSIGNAL);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        position += written;
+        length -= written;
+    }
+    return true;
+}
+
+/*!
+ * @brief read_all reads exactly length bytes from a connection
+ * @param socket the connection
+ * @param data where to write the bytes
+ * @param length the number of bytes to read
+ * @return true if all the bytes were read, false on error or end of connection
+ */
+static bool read_all(int socket, void *data, size_t length) {
+    char *position = data;
+    while (length > 0) {
+        ssize_t received = recv(socket, position, length, 0);
+        if (received == -1 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+        position += received;
+        length -= received;
+    }
+    return true;
+}
+
+/*!
+ * @brief append_frame appends a frame to a buffer
+ * @param buffer the buffer
+ * @param type the frame type
+ * @param payload the payload
+ * @param length the payload length, TCP_MAX_FRAME at most
+ * @return true if the frame was appended, false if it could not be allocated
+ */
+static bool append_frame(growable_buffer_t *buffer, tcp_message_type_t type, const void *payload, size_t length) {
+    tcp_frame_header_t header = {.type = htonl(type), .length = htonl(length)};
+    return growable_buffer_append(buffer, (char *) &header, sizeof(header)) &&
+           growable_buffer_append(buffer, payload, length);
+}
+
+/*!
+ * @brief connect_address connects to an address
+ * @param address the address
+ * @param length the address length
+ * @return the connection, -1 if it could not be established
+ */
+static int connect_address(struct sockaddr *address, socklen_t length) {
+    int connection = socket(address->sa_family, SOCK_STREAM, 0);
+    if (connection != -1 && connect(connection, address, length) == -1) {
+        close(connection);
+        connection = -1;
+    }
+    if (connection != -1) {
+        set_keepalive(connection);
+    }
+    return connection;
+}
+
+/*!
+ * @brief tcp_connect connects a worker to its coordinator, retrying for TCP_JOIN_TIMEOUT_S seconds so that workers
+ * may be started before the coordinator
+ * @param address the coordinator address, as "host:port"
+ * @return the connection, -1 if it could not be established
+ */
+int tcp_connect(char *address) {
+    char host[NI_MAXHOST], port[NI_MAXSERV];
+    if (!split_address(address, host, port) || host[0] == '\0') {
+        printf("Invalid coordinator address %s, expected host:port\n", address);
+        return -1;
+    }
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM}, *addresses;
+    int error = getaddrinfo(host, port, &hints, &addresses);
+    if (error != 0) {
+        printf("Cannot resolve %s: %s\n", address, gai_strerror(error));
+        return -1;
+    }
+    int connection = -1;
+    for (int attempt = 0; attempt < TCP_JOIN_TIMEOUT_S && connection == -1; ++attempt) {
+        if (attempt > 0) {
+            sleep(1);
+        }
+        for (struct addrinfo *candidate = addresses; candidate && connection == -1; candidate = candidate->ai_next) {
+            connection = connect_address(candidate->ai_addr, candidate->ai_addrlen);
+        }
+    }
+    freeaddrinfo(addresses);
+    if (connection == -1) {
+        printf("Cannot connect to %s\n", address);
+    }
+    return connection;
+}
+
+// Output of the task run by a worker, sent as TCP_OUTPUT frames with the TCP_DONE frame of the task
+typedef struct {
+    int socket;
+    growable_buffer_t pending;
+} tcp_sender_t;
+
+/*!
+ * @brief flush_sender sends the pending frames of a worker
+ * @param sender the worker output
+ * @return true if the frames were sent, false else
+ */
+static bool flush_sender(tcp_sender_t *sender) {
+    bool success = send_all(sender->socket, sender->pending.data, sender->pending.length);
+    sender->pending.length = 0;
+    return success;
+}
+
+/*!
+ * @brief write_output is the write function of the output stream of a worker (fopencookie): the data is framed and
+ * kept until the end of the task, or until TCP_OUTPUT_BUFFER bytes are pending
+ */
+static ssize_t write_output(void *cookie, const char *data, size_t size) {
+    tcp_sender_t *sender = cookie;
+    for (size_t offset = 0; offset < size; offset += TCP_MAX_FRAME) {
+        size_t length = size - offset < TCP_MAX_FRAME ? size - offset : TCP_MAX_FRAME;
+        if (!append_frame(&sender->pending, TCP_OUTPUT, data + offset, length)) {
+            return -1;
+        }
+    }
+    return sender->pending.length < TCP_OUTPUT_BUFFER || flush_sender(sender) ? (ssize_t) size : -1;
+}
+
+/*!
+ * @brief tcp_token gives the secret shared by the coordinator and its workers
+ * @return the value of TCP_TOKEN_VARIABLE, empty when it is not set
+ */
+static const char *tcp_token() {
+    const char *token = getenv(TCP_TOKEN_VARIABLE);
+    return token ? token : "";
+}
+
+/*!
+ * @brief is_token_valid compares the token presented by a worker with the coordinator one, in a time which does not
+ * depend on where they differ
+ * @param expected the coordinator token
+ * @param token the worker token
+ * @return true if both are equal, false else
+ */
+static bool is_token_valid(const char *expected, const char *token) {
+    size_t expected_length = strlen(expected), length = strlen(token);
+    unsigned char difference = expected_length != length;
+    for (size_t i = 0; i < expected_length; ++i) {
+        difference |= expected[i] ^ token[i < length ? i : 0];
+    }
+    return difference == 0;
+}
+
+/*!
+ * @brief tcp_worker runs the tasks sent by the coordinator on a connection, until told to stop. Directory tasks list
+ * their files and file tasks analyze their mail (@see parse_dir, parse_file_to) into a stream whose data is sent back
+ * to the coordinator, followed by the end of the task.
+ * @param socket the connection to the coordinator, closed when done
+ * @param local_index 1 + index of a worker forked by the coordinator, 0 for a remote worker
+ * @return true if the worker was told to stop, false if the connection failed
+ */
+bool tcp_worker(int socket, uint16_t local_index) {
+    tcp_sender_t sender = {.socket = socket};
+    cookie_io_functions_t functions = {.write = write_output};
+    FILE *output = fopencookie(&sender, "w", functions);
+    if (!output) {
+        close(socket);
+        return false;
+    }
+    setvbuf(output, NULL, _IOFBF, TCP_OUTPUT_BUFFER);
+
+    char hello[TCP_HELLO_FIELDS * sizeof(uint32_t) + TCP_TOKEN_MAX + STR_MAX_LEN] = {0};
+    uint64_t settings = settings_fingerprint();
+    uint32_t fields[TCP_HELLO_FIELDS] = {htonl(TCP_PROTOCOL_VERSION), htonl(local_index), htonl(getpid()),
+                                         htonl(settings >> 32), htonl(settings & UINT32_MAX)};
+    memcpy(hello, fields, sizeof(fields));
+    size_t token_length = strnlen(tcp_token(), TCP_TOKEN_MAX), length = sizeof(fields) + token_length + 1;
+    memcpy(hello + sizeof(fields), tcp_token(), token_length < TCP_TOKEN_MAX ? token_length : 0);
+    gethostname(hello + length, STR_MAX_LEN - 1);
+    bool success = token_length < TCP_TOKEN_MAX &&
+                   append_frame(&sender.pending, TCP_HELLO, hello, length + strlen(hello + length)) &&
+                   flush_sender(&sender);
+    while (success) {
+        uint64_t wait_start_us = metrics_now_us();
+        tcp_frame_header_t header;
+        char path[STR_MAX_LEN];
+        if (!read_all(socket, &header, sizeof(header))) {
+            success = false;
+            break;
+        }
+        uint32_t type = ntohl(header.type), length = ntohl(header.length);
+        if (length >= STR_MAX_LEN || !read_all(socket, path, length)) {
+            success = false;
+            break;
+        }
+        path[length] = '\0';
+        uint64_t task_start_us = metrics_now_us();
+        metrics_idle(task_start_us - wait_start_us);
+        trace_record(TRACE_WORKER_WAIT, wait_start_us, task_start_us, NULL);
+        if (type == TCP_STOP) {
+            break;
+        }
+
+        uint32_t status = FILE_STATUS_OK;
+        if (type == TCP_TASK_DIRECTORY) {
+            if (directory_exists(path)) {
+                parse_dir(path, output);
+            }
+        } else if (type == TCP_TASK_FILE) {
+            status = parse_file_to(path, output);
+        } else {
+            success = false;
+            break;
+        }
+        status = htonl(status);
+        success = fflush(output) == 0 && append_frame(&sender.pending, TCP_DONE, &status, sizeof(status)) &&
+                  flush_sender(&sender);
+        metrics_task_done();
+        trace_record(type == TCP_TASK_DIRECTORY ? TRACE_DIRECTORY_TASK : TRACE_FILE_TASK, task_start_us,
+                     metrics_now_us(), path);
+    }
+    sender.pending.length = 0; // Nothing more is sent once stopped
+    fclose(output);
+    growable_buffer_free(&sender.pending);
+    close(socket);
+    return success;
+}
+
+/*!
+ * @brief spawn_local_worker forks a worker connected to the coordinator. The child closes the connections of the
+ * coordinator, so that the end of a worker is seen as the end of its connection.
+ * @param coordinator the coordinator
+ * @param index the local worker index (for metrics, traces and pinning)
+ * @return the worker PID, -1 if the fork failed
+ */
+static pid_t spawn_local_worker(tcp_coordinator_t *coordinator, uint16_t index) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(coordinator->listener);
+        for (uint16_t i = 0; i < coordinator->slots_count; ++i) {
+            if (coordinator->slots[i].socket != -1) {
+                close(coordinator->slots[i].socket);
+            }
+        }
+        metrics_set_worker(index);
+        trace_set_worker(index);
+        scheduling_pin_worker(index);
+        file_errors_cleanup(); // The coordinator skips the mails and records the rejected ones
+        int connection = connect_address((struct sockaddr *) &coordinator->address, coordinator->address_length);
+        bool success = connection != -1 && tcp_worker(connection, index + 1);
+        release_mail_caches();
+        _exit(success ? EXIT_SUCCESS : EXIT_FAILURE); // The streams of the coordinator are not flushed again
+    }
+    if (pid == -1) {
+        perror("fork");
+    }
+    return pid;
+}
+
+/*!
+ * @brief is_loopback tells if a socket address is on the loopback, where no other host may connect
+ * @param address the address
+ * @return true for 127.0.0.0/8 and ::1 (IPv4-mapped loopback addresses included), false else
+ */
+static bool is_loopback(struct sockaddr *address) {
+    if (address->sa_family == AF_INET) {
+        return ntohl(((struct sockaddr_in *) address)->sin_addr.s_addr) >> 24 == 127;
+    }
+    struct in6_addr *address6 = &((struct sockaddr_in6 *) address)->sin6_addr;
+    return address->sa_family == AF_INET6 &&
+           (IN6_IS_ADDR_LOOPBACK(address6) || (IN6_IS_ADDR_V4MAPPED(address6) && address6->s6_addr[12] == 127));
+}
+
+/*!
+ * @brief open_listener listens on an address
+ * @param address the address, as "[host:]port", all interfaces when there is no host
+ * @param coordinator the coordinator, whose listener and local workers address are set
+ * @return true if the coordinator listens, false else
+ */
+static bool open_listener(char *address, tcp_coordinator_t *coordinator) {
+    char host[NI_MAXHOST], port[NI_MAXSERV];
+    if (!split_address(address, host, port)) {
+        printf("Invalid listen address %s, expected [host:]port\n", address);
+        return false;
+    }
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE}, *addresses;
+    int error = getaddrinfo(host[0] != '\0' ? host : NULL, port, &hints, &addresses);
+    if (error != 0) {
+        printf("Cannot resolve %s: %s\n", address, gai_strerror(error));
+        return false;
+    }
+    coordinator->listener = -1;
+    for (struct addrinfo *candidate = addresses; candidate && coordinator->listener == -1;
+         candidate = candidate->ai_next) {
+        int listener = socket(candidate->ai_family, SOCK_STREAM, 0), enabled = 1;
+        if (listener == -1) {
+            continue;
+        }
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &enabled, sizeof(enabled));
+        if (bind(listener, candidate->ai_addr, candidate->ai_addrlen) == 0 &&
+            listen(listener, coordinator->slots_count) == 0) {
+            coordinator->listener = listener;
+        } else {
+            close(listener);
+        }
+    }
+    freeaddrinfo(addresses);
+    if (coordinator->listener == -1) {
+        perror("Cannot listen for workers");
+        return false;
+    }
+
+    // Local workers connect to the bound port, on the loopback when bound to all interfaces
+    coordinator->address_length = sizeof(coordinator->address);
+    struct sockaddr *bound = (struct sockaddr *) &coordinator->address;
+    getsockname(coordinator->listener, bound, &coordinator->address_length);
+    char description[STR_MAX_LEN];
+    describe_address(bound, coordinator->address_length, description);
+    if (coordinator->token[0] == '\0' && !is_loopback(bound)) {
+        printf("Listening on %s requires a shared token, set in %s for the coordinator and its workers\n", description,
+               TCP_TOKEN_VARIABLE);
+        close(coordinator->listener);
+        return false;
+    }
+    printf("Waiting for workers on %s\n", description);
+    if (bound->sa_family == AF_INET && ((struct sockaddr_in *) bound)->sin_addr.s_addr == htonl(INADDR_ANY)) {
+        ((struct sockaddr_in *) bound)->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    } else if (bound->sa_family == AF_INET6 &&
+               memcmp(&((struct sockaddr_in6 *) bound)->sin6_addr, &in6addr_any, sizeof(in6addr_any)) == 0) {
+        ((struct sockaddr_in6 *) bound)->sin6_addr = in6addr_loopback;
+    }
+    return true;
+}
+
+/*!
+ * @brief tcp_make_coordinator listens for workers and forks the local ones. The coordinator has a slot for each
+ * local worker and each remote one (config->remote_workers): workers take any free slot when they connect.
+ * @param config the configuration, with the workers counts and the listen address
+ * @return the coordinator, NULL if it could not listen or allocate its slots
+ */
+tcp_coordinator_t *tcp_make_coordinator(configuration_t *config) {
+    tcp_coordinator_t *coordinator = calloc(1, sizeof(tcp_coordinator_t));
+    if (!coordinator) {
+        return NULL;
+    }
+    coordinator->local_count = config->process_count;
+    coordinator->settings = settings_fingerprint();
+    if (snprintf(coordinator->token, TCP_TOKEN_MAX, "%s", tcp_token()) >= TCP_TOKEN_MAX) {
+        printf("The token in %s is longer than %d characters\n", TCP_TOKEN_VARIABLE, TCP_TOKEN_MAX - 1);
+        free(coordinator);
+        return NULL;
+    }
+    coordinator->slots_count = config->process_count + config->remote_workers;
+    coordinator->slots = calloc(coordinator->slots_count, sizeof(tcp_slot_t));
+    coordinator->poll_fds = calloc(coordinator->slots_count + 1, sizeof(struct pollfd));
+    coordinator->local_workers = calloc(coordinator->local_count, sizeof(pid_t));
+    if (!coordinator->slots || !coordinator->poll_fds || !coordinator->local_workers ||
+        !open_listener(config->listen_address, coordinator)) {
+        free(coordinator->slots);
+        free(coordinator->poll_fds);
+        free(coordinator->local_workers);
+        free(coordinator);
+        return NULL;
+    }
+    for (uint16_t i = 0; i < coordinator->slots_count; ++i) {
+        coordinator->slots[i].socket = -1;
+    }
+    for (uint16_t i = 0; i < coordinator->local_count; ++i) {
+        coordinator->local_workers[i] = spawn_local_worker(coordinator, i);
+    }
+    return coordinator;
+}
+
+/*!
+ * @brief drop_connection closes the connection of a slot. The tasks in flight of a ready worker are reported lost, and
+ * the output of the oldest one discarded.
+ * @param coordinator the coordinator
+ * @param slot the slot
+ */
+static void drop_connection(tcp_coordinator_t *coordinator, tcp_slot_t *slot) {
+    if (slot->state == TCP_SLOT_READY) {
+        if (slot->local_index == 0) {
+            printf("Lost worker %s\n", slot->peer);
+        }
+        // The first lane reports the loss even without a task, so that a local worker is replaced
+        slot->is_lost[slot->sent_count > 0 ? slot->sent[0] : 0] = true;
+        for (uint8_t i = 1; i < slot->sent_count; ++i) {
+            slot->is_lost[slot->sent[i]] = true;
+        }
+        ++coordinator->lost;
+    }
+    slot->sent_count = 0;
+    if (slot->socket != -1) {
+        close(slot->socket);
+    }
+    slot->socket = -1;
+    slot->state = TCP_SLOT_VACANT;
+    slot->has_joined = false;
+    slot->received.length = 0;
+    slot->output.length = 0;
+}
+
+/*!
+ * @brief commit_output writes the output of a completed task to its temporary file: the list of the directory, or the
+ * lines of the mail appended to the output file. Rejected mails are recorded.
+ * @param coordinator the coordinator
+ * @param slot the slot of the worker which completed the task
+ * @param task the completed task
+ * @param status the file status of a file task
+ */
+static void commit_output(tcp_coordinator_t *coordinator, tcp_slot_t *slot, task_t *task, file_status_t status) {
+    if (task->task_callback == process_directory) {
+        directory_task_t *directory_task = (directory_task_t *) task;
+        FILE *list = open_intermediate(directory_task->temporary_directory, "w");
+        if (!list || fwrite(slot->output.data, 1, slot->output.length, list) != slot->output.length) {
+            perror("Cannot write directory list");
+        }
+        if (list) {
+            fclose(list);
+        }
+        return;
+    }
+    file_task_t *file_task = (file_task_t *) task;
+    if (coordinator->output && strcmp(coordinator->output_path, file_task->temporary_directory) != 0) {
+        fclose(coordinator->output);
+        coordinator->output = NULL;
+    }
+    if (!coordinator->output && (coordinator->output = open_intermediate(file_task->temporary_directory, "a"))) {
+        strncpy(coordinator->output_path, file_task->temporary_directory, STR_MAX_LEN - 1);
+    }
+    // Flushed with each task, so that a checkpoint covers all the completed tasks
+    if (!coordinator->output || fwrite(slot->output.data, 1, slot->output.length, coordinator->output) !=
+                                slot->output.length || fflush(coordinator->output) != 0) {
+        perror("Cannot write files analysis output");
+    }
+    file_errors_record(file_task->object_file, status);
+}
+
+/*!
+ * @brief close_output closes the output of the file tasks
+ * @param coordinator the coordinator
+ */
+static void close_output(tcp_coordinator_t *coordinator) {
+    if (coordinator->output) {
+        fclose(coordinator->output);
+        coordinator->output = NULL;
+    }
+}
+
+/*!
+ * @brief read_frames handles the complete frames received from a worker
+ * @param coordinator the coordinator
+ * @param slot the worker slot
+ * @return true if the frames were valid, false on a protocol error
+ */
+static bool read_frames(tcp_coordinator_t *coordinator, tcp_slot_t *slot) {
+    size_t offset = 0;
+    bool success = true;
+    while (success && slot->received.length - offset >= sizeof(tcp_frame_header_t)) {
+        tcp_frame_header_t header;
+        memcpy(&header, slot->received.data + offset, sizeof(header));
+        uint32_t type = ntohl(header.type), length = ntohl(header.length);
+        if (length > TCP_MAX_FRAME) {
+            success = false;
+            break;
+        }
+        if (slot->received.length - offset - sizeof(header) < length) {
+            break;
+        }
+        char *payload = slot->received.data + offset + sizeof(header);
+        offset += sizeof(header) + length;
+        if (type == TCP_HELLO && slot->state == TCP_SLOT_CONNECTING && length >= TCP_HELLO_FIELDS * sizeof(uint32_t)) {
+            uint32_t fields[TCP_HELLO_FIELDS];
+            memcpy(fields, payload, sizeof(fields));
+            uint32_t local_index = ntohl(fields[1]);
+            pid_t pid = (pid_t) ntohl(fields[2]);
+            char *token = payload + sizeof(fields);
+            char *token_end = memchr(token, '\0', length - sizeof(fields));
+            if (ntohl(fields[0]) != TCP_PROTOCOL_VERSION) {
+                printf("Refusing worker %s: protocol version %u, expected %u\n", slot->peer, ntohl(fields[0]),
+                       TCP_PROTOCOL_VERSION);
+                success = false;
+                break;
+            }
+            if (!token_end || !is_token_valid(coordinator->token, token)) {
+                printf("Refusing worker %s: wrong token (%s)\n", slot->peer, TCP_TOKEN_VARIABLE);
+                success = false;
+                break;
+            }
+            if (((uint64_t) ntohl(fields[3]) << 32 | ntohl(fields[4])) != coordinator->settings) {
+                printf("Refusing worker %s: its plugins, timeline or aliases differ from the coordinator ones\n",
+                       slot->peer);
+                success = false;
+                break;
+            }
+            bool is_local = local_index > 0 && local_index <= coordinator->local_count &&
+                            coordinator->local_workers[local_index - 1] == pid;
+            slot->local_index = is_local ? local_index : 0;
+            char *peer_end = slot->peer + strlen(slot->peer);
+            size_t name_length = payload + length - (token_end + 1) < 255 ? payload + length - (token_end + 1) : 255;
+            snprintf(peer_end, STR_MAX_LEN - (peer_end - slot->peer), " (%.*s, pid %d)", (int) name_length,
+                     token_end + 1, pid);
+            if (!is_local) {
+                printf("Worker %s joined\n", slot->peer);
+            }
+            slot->state = TCP_SLOT_READY;
+            slot->has_joined = true;
+            ++coordinator->joined;
+        } else if (type == TCP_OUTPUT && slot->state == TCP_SLOT_READY) {
+            success = growable_buffer_append(&slot->output, payload, length);
+        } else if (type == TCP_DONE && slot->state == TCP_SLOT_READY && length == sizeof(uint32_t) &&
+                   slot->sent_count > 0) {
+            // The worker runs its tasks in the order they were sent
+            uint8_t lane = slot->sent[0];
+            uint32_t status;
+            memcpy(&status, payload, sizeof(status));
+            status = ntohl(status);
+            commit_output(coordinator, slot, &slot->tasks[lane],
+                          status < FILE_STATUSES_COUNT ? status : FILE_STATUS_OUTPUT_FAILED);
+            slot->output.length = 0;
+            memmove(slot->sent, slot->sent + 1, --slot->sent_count);
+            slot->is_done[lane] = true;
+        } else {
+            success = false;
+        }
+    }
+    memmove(slot->received.data, slot->received.data + offset, slot->received.length - offset);
+    slot->received.length -= offset;
+    return success;
+}
+
+/*!
+ * @brief accept_worker accepts a connection into a vacant slot, or refuses it when all the slots are taken
+ * @param coordinator the coordinator
+ */
+static void accept_worker(tcp_coordinator_t *coordinator) {
+    struct sockaddr_storage address;
+    socklen_t length = sizeof(address);
+    int connection = accept(coordinator->listener, (struct sockaddr *) &address, &length);
+    if (connection == -1) {
+        return;
+    }
+    uint16_t index = 0;
+    while (index < coordinator->slots_count && coordinator->slots[index].state != TCP_SLOT_VACANT) {
+        ++index;
+    }
+    if (index == coordinator->slots_count) {
+        close(connection);
+        return;
+    }
+    tcp_slot_t *slot = &coordinator->slots[index];
+    set_keepalive(connection);
+    slot->socket = connection;
+    slot->state = TCP_SLOT_CONNECTING;
+    slot->local_index = 0;
+    describe_address((struct sockaddr *) &address, length, slot->peer);
+}
+
+/*!
+ * @brief tcp_send_task sends a task to a worker (@see worker_transport_t). Skipped mails and the closing of the output
+ * are done by the coordinator itself, and reported done at once. A failed send is reported as the loss of the worker.
+ */
+static bool tcp_send_task(void *context, uint16_t worker, task_t *task) {
+    tcp_coordinator_t *coordinator = context;
+    tcp_slot_t *slot = &coordinator->slots[worker % coordinator->slots_count];
+    uint8_t lane = worker / coordinator->slots_count;
+    memcpy(&slot->tasks[lane], task, sizeof(task_t));
+    if (task->task_callback == close_mail_output) {
+        close_output(coordinator);
+        slot->is_done[lane] = true;
+        return true;
+    }
+    // Both directory_task_t and file_task_t start with the path of their object
+    char *path = task->argument;
+    if (task->task_callback == process_file && file_errors_skip(path)) {
+        metrics_file_skipped();
+        slot->is_done[lane] = true;
+        return true;
+    }
+    char frame[sizeof(tcp_frame_header_t) + STR_MAX_LEN];
+    size_t length = strnlen(path, STR_MAX_LEN - 1);
+    tcp_frame_header_t header = {
+            .type = htonl(task->task_callback == process_directory ? TCP_TASK_DIRECTORY : TCP_TASK_FILE),
+            .length = htonl(length)
+    };
+    memcpy(frame, &header, sizeof(header));
+    memcpy(frame + sizeof(header), path, length);
+    if (slot->state != TCP_SLOT_READY) {
+        slot->is_lost[lane] = true;
+        return true;
+    }
+    slot->sent[slot->sent_count++] = lane;
+    if (!send_all(slot->socket, frame, sizeof(header) + length)) {
+        drop_connection(coordinator, slot);
+    }
+    return true;
+}
+
+/*!
+ * @brief tcp_wait_event waits for a worker to finish its task, to be lost or to join (@see worker_transport_t).
+ * Connections are accepted and frames read until an event is pending. Without any connected worker for
+ * TCP_JOIN_TIMEOUT_S seconds, the workers cannot be reached anymore. The coordinator writes the lines of the workers
+ * itself, a lost worker never takes any with it.
+ */
+static worker_event_t tcp_wait_event(void *context, uint16_t *worker, uint32_t *unflushed_tasks) {
+    tcp_coordinator_t *coordinator = context;
+    *unflushed_tasks = 0;
+    uint64_t alone_since_us = 0;
+    while (true) {
+        bool has_workers = false;
+        for (uint16_t i = 0; i < coordinator->slots_count; ++i) {
+            tcp_slot_t *slot = &coordinator->slots[i];
+            for (uint8_t lane = 0; lane < TCP_PIPELINE_DEPTH; ++lane) {
+                *worker = lane * coordinator->slots_count + i;
+                if (slot->is_done[lane]) {
+                    slot->is_done[lane] = false;
+                    return WORKER_TASK_DONE;
+                }
+                if (slot->is_lost[lane]) {
+                    slot->is_lost[lane] = false;
+                    return WORKER_DIED;
+                }
+            }
+            *worker = i;
+            if (slot->has_joined) {
+                slot->has_joined = false;
+                return WORKER_JOINED;
+            }
+            has_workers = has_workers || slot->state != TCP_SLOT_VACANT;
+        }
+        uint64_t now_us = metrics_now_us();
+        if (has_workers) {
+            alone_since_us = 0;
+        } else if (alone_since_us == 0) {
+            alone_since_us = now_us;
+        } else if (now_us - alone_since_us > TCP_JOIN_TIMEOUT_S * 1000000ULL) {
+            printf("No worker connected for %d seconds\n", TCP_JOIN_TIMEOUT_S);
+            return WORKER_EVENT_ERROR;
+        }
+
+        struct pollfd *fds = coordinator->poll_fds;
+        fds[0] = (struct pollfd) {.fd = coordinator->listener, .events = POLLIN};
+        for (uint16_t i = 0; i < coordinator->slots_count; ++i) {
+            fds[i + 1] = (struct pollfd) {.fd = coordinator->slots[i].socket, .events = POLLIN}; // -1 is ignored
+        }
+        if (poll(fds, coordinator->slots_count + 1, 1000) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            return WORKER_EVENT_ERROR;
+        }
+        if (fds[0].revents & POLLIN) {
+            accept_worker(coordinator);
+        }
+        for (uint16_t i = 0; i < coordinator->slots_count; ++i) {
+            tcp_slot_t *slot = &coordinator->slots[i];
+            if (fds[i + 1].fd == -1 || fds[i + 1].revents == 0 || slot->socket != fds[i + 1].fd) {
+                continue;
+            }
+            char chunk[TCP_OUTPUT_BUFFER];
+            ssize_t received = recv(slot->socket, chunk, sizeof(chunk), 0);
+            if (received == -1 && errno == EINTR) {
+                continue;
+            }
+            if (received <= 0 || !growable_buffer_append(&slot->received, chunk, received)) {
+                drop_connection(coordinator, slot);
+            } else if (!read_frames(coordinator, slot)) {
+                printf("Protocol error from worker %s\n", slot->peer);
+                drop_connection(coordinator, slot);
+            }
+        }
+    }
+}
+
+/*!
+ * @brief tcp_respawn frees the slot of a lost worker for the next connection (@see worker_transport_t). A local worker
+ * is reaped and forked again, once for all its lanes; remote ones have to connect again on their own.
+ */
+static bool tcp_respawn(void *context, uint16_t worker) {
+    tcp_coordinator_t *coordinator = context;
+    tcp_slot_t *slot = &coordinator->slots[worker % coordinator->slots_count];
+    if (slot->local_index == 0) {
+        return true;
+    }
+    uint16_t index = slot->local_index - 1;
+    slot->local_index = 0;
+    while (waitpid(coordinator->local_workers[index], NULL, 0) == -1 && errno == EINTR) {
+    }
+    coordinator->local_workers[index] = spawn_local_worker(coordinator, index);
+    return coordinator->local_workers[index] != -1;
+}
+
+/*!
+ * @brief tcp_is_ready tells if a worker is connected and may be given a task (@see worker_transport_t)
+ */
+static bool tcp_is_ready(void *context, uint16_t worker) {
+    tcp_coordinator_t *coordinator = context;
+    tcp_slot_t *slot = &coordinator->slots[worker % coordinator->slots_count];
+    return slot->state == TCP_SLOT_READY && !slot->is_lost[worker / coordinator->slots_count];
+}
+
+/*!
+ * @brief tcp_supervise dispatches all the tasks of a source to the connected workers, re-dispatching the tasks of the
+ * lost ones
+ * @param coordinator the coordinator
+ * @param source the tasks to dispatch
+ * @param controller the adaptive concurrency controller, NULL to keep all the workers busy
+ */
+static void tcp_supervise(tcp_coordinator_t *coordinator, task_source_t *source, concurrency_controller_t *controller) {
+    worker_transport_t transport = {
+            .context = coordinator,
+            .send_task = tcp_send_task,
+            .wait_event = tcp_wait_event,
+            .respawn = tcp_respawn,
+            .is_ready = tcp_is_ready,
+    };
+    supervision_stats_t stats;
+    uint32_t lost = coordinator->lost;
+    supervise_tasks(&transport, coordinator->slots_count * TCP_PIPELINE_DEPTH, source, controller, &stats);
+    close_output(coordinator);
+    if (coordinator->lost > lost) {
+        printf("%u workers were lost, %u tasks given up\n", coordinator->lost - lost, stats.abandoned);
+    }
+}
+
+/*!
+ * @brief tcp_process_directory lists the files of each directory of the data source with the workers: each list is
+ * written to the temporary directory by the coordinator (@see mq_process_directory)
+ * @param config a pointer to the configuration
+ * @param coordinator the coordinator
+ * @param controller the adaptive concurrency controller, NULL to keep all the workers busy
+ */
+void tcp_process_directory(configuration_t *config, tcp_coordinator_t *coordinator,
+                           concurrency_controller_t *controller) {
+    task_source_t source;
+    if (!task_source_open_directories(&source, config->data_path, config->temporary_directory)) {
+        perror("opendir");
+        exit(EXIT_FAILURE);
+    }
+    tcp_supervise(coordinator, &source, controller);
+    task_source_close(&source);
+}
+
+/*!
+ * @brief tcp_process_files analyzes the files listed in step1_output with the workers: their lines are appended to
+ * step2_output by the coordinator (@see mq_process_files)
+ * @param config a pointer to the configuration
+ * @param coordinator the coordinator
+ * @param controller the adaptive concurrency controller, NULL to keep all the workers busy
+ */
+void tcp_process_files(configuration_t *config, tcp_coordinator_t *coordinator, concurrency_controller_t *controller) {
+    char files_list[STR_MAX_LEN], output[STR_MAX_LEN];
+    concat_path(config->temporary_directory, "step1_output", files_list);
+    concat_path(config->temporary_directory, "step2_output", output);
+    task_source_t source;
+    if (!task_source_open_files(&source, files_list, output)) {
+        perror("Cannot open files list");
+        exit(EXIT_FAILURE);
+    }
+    tcp_supervise(coordinator, &source, controller);
+    task_source_close(&source);
+}
+
+/*!
+ * @brief tcp_close_coordinator tells the connected workers to stop, waits for the local ones and frees the coordinator
+ * @param coordinator the coordinator
+ */
+void tcp_close_coordinator(tcp_coordinator_t *coordinator) {
+    if (!coordinator) {
+        return;
+    }
+    tcp_frame_header_t stop = {.type = htonl(TCP_STOP), .length = 0};
+    for (uint16_t i = 0; i < coordinator->slots_count; ++i) {
+        tcp_slot_t *slot = &coordinator->slots[i];
+        if (slot->state == TCP_SLOT_READY) {
+            send_all(slot->socket, &stop, sizeof(stop));
+        }
+        if (slot->socket != -1) {
+            close(slot->socket); // Workers which did not say hello yet see the end of the connection
+        }
+        growable_buffer_free(&slot->received);
+        growable_buffer_free(&slot->output);
+    }
+    close(coordinator->listener);
+    for (uint16_t i = 0; i < coordinator->local_count; ++i) {
+        while (coordinator->local_workers[i] > 0 && waitpid(coordinator->local_workers[i], NULL, 0) == -1 &&
+               errno == EINTR) {
+        }
+    }
+    if (coordinator->joined > coordinator->local_count || coordinator->lost > 0) {
+        printf("%u workers joined, %u were lost\n", coordinator->joined, coordinator->lost);
+    }
+    close_output(coordinator);
+    free(coordinator->slots);
+    free(coordinator->poll_fds);
+    free(coordinator->local_workers);
+    free(coordinator);
+}
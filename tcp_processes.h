@@ -0,0 +1,104 @@
+//
+// Created on 19/10/26.
+//
+
+#ifndef A2022_TCP_PROCESSES_H
+#define A2022_TCP_PROCESSES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <poll.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "concurrency.h"
+#include "configuration.h"
+#include "header_reader.h"
+
+// Distributed mode: the coordinator (main) accepts workers over TCP, the ones it forks and remote ones started with
+// tools/tcp_worker, and dispatches them the tasks with supervise_tasks. Workers run the tasks on their own host, the
+// data source being mounted at the same path on all hosts, and stream their output back: the coordinator writes it to
+// the temporary files once the task is done, so that the output of a lost worker is never half written. Each worker
+// connection is seen by supervise_tasks as TCP_PIPELINE_DEPTH lanes (worker w is the lane w / slots_count of the slot
+// w % slots_count): the tasks of the lanes are sent ahead and queue on the connection, so that a worker starts its next
+// task without waiting a round trip for it.
+#define TCP_PROTOCOL_VERSION 3
+// Environment variable holding the secret shared by the coordinator and its workers, required to listen beyond the
+// loopback: the workers are given the paths of the data source and their output is written to step2_output
+#define TCP_TOKEN_VARIABLE "LP25_TCP_TOKEN"
+#define TCP_TOKEN_MAX 256
+#define TCP_HELLO_FIELDS 5           // 32 bits fields of a hello, before the host name
+#define TCP_PIPELINE_DEPTH 8         // Tasks in flight on a worker connection at most
+#define TCP_MAX_FRAME (1 << 20)      // Larger frames are a protocol error
+#define TCP_OUTPUT_BUFFER (1 << 16)  // Output held by a worker before it is sent
+#define TCP_JOIN_TIMEOUT_S 30        // Time waited for a worker when none is connected and tasks are left
+#define TCP_KEEPALIVE_IDLE_S 10      // Silent connections are probed after this time, and lost after 3 probes
+#define TCP_KEEPALIVE_INTERVAL_S 5
+
+// Each frame is a header (type and payload length, in network byte order) followed by its payload
+typedef enum {
+    TCP_HELLO = 1,      // Worker: protocol version, local worker index (0 for a remote worker), PID, settings
+                        // fingerprint (high then low 32 bits, @see settings_fingerprint), token (NUL-terminated),
+                        // host name
+    TCP_TASK_DIRECTORY, // Coordinator: the directory to list
+    TCP_TASK_FILE,      // Coordinator: the mail to analyze
+    TCP_STOP,           // Coordinator: no more tasks, the worker exits
+    TCP_OUTPUT,         // Worker: output of the current task (whole lines), the oldest one not done
+    TCP_DONE,           // Worker: end of the current task, with its file status
+} tcp_message_type_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t length;
+} tcp_frame_header_t;
+
+typedef enum {
+    TCP_SLOT_VACANT,
+    TCP_SLOT_CONNECTING, // Accepted, its hello not received yet
+    TCP_SLOT_READY,
+} tcp_slot_state_t;
+
+// A worker connection. Events are kept until the dispatcher waits for the next one (@see worker_transport_t).
+typedef struct {
+    int socket;
+    tcp_slot_state_t state;
+    uint16_t local_index;      // 1 + index of a worker forked by the coordinator, 0 for a remote one
+    bool has_joined;
+    bool is_done[TCP_PIPELINE_DEPTH];
+    bool is_lost[TCP_PIPELINE_DEPTH];
+    task_t tasks[TCP_PIPELINE_DEPTH]; // Task of each lane
+    uint8_t sent[TCP_PIPELINE_DEPTH]; // Lanes whose task was sent to the worker and is not done, in the order sent
+    uint8_t sent_count;
+    growable_buffer_t received; // Frames not read yet
+    growable_buffer_t output;   // Output of the oldest task sent
+    char peer[STR_MAX_LEN];
+} tcp_slot_t;
+
+typedef struct {
+    int listener;
+    struct sockaddr_storage address; // Where local workers connect
+    socklen_t address_length;
+    tcp_slot_t *slots;
+    uint16_t slots_count;
+    struct pollfd *poll_fds; // The listener, then the slots
+    pid_t *local_workers;
+    uint16_t local_count;
+    FILE *output; // Output of the file tasks (step2_output)
+    char output_path[STR_MAX_LEN];
+    uint64_t settings; // Fingerprint of the plugins, timeline and aliases, which workers must share
+    char token[TCP_TOKEN_MAX]; // Secret which workers must present, empty when listening on the loopback only
+    uint32_t joined; // Connections which said hello, reconnections included
+    uint32_t lost;
+} tcp_coordinator_t;
+
+tcp_coordinator_t *tcp_make_coordinator(configuration_t *config);
+void tcp_process_directory(configuration_t *config, tcp_coordinator_t *coordinator,
+                           concurrency_controller_t *controller);
+void tcp_process_files(configuration_t *config, tcp_coordinator_t *coordinator, concurrency_controller_t *controller);
+void tcp_close_coordinator(tcp_coordinator_t *coordinator);
+
+int tcp_connect(char *address);
+bool tcp_worker(int socket, uint16_t local_index);
+
+#endif //A2022_TCP_PROCESSES_H
@@ -0,0 +1,129 @@
+//
+// Created on 19/10/26.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "aggregate.h"
+
+#define INPUTS_COUNT 3
+
+static int failures = 0;
+
+/*!
+ * @brief make_path creates an empty temporary file
+ * @param path the path template, set to the path of the file
+ * @return true if the file was created, false else
+ */
+static bool make_path(char *path) {
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("mkstemp");
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+/*!
+ * @brief write_input writes an aggregate file of one run
+ * @param path the path to the file
+ * @param addresses the dictionary, in strcmp order
+ * @param addresses_count the number of addresses
+ * @param triples the triples with ids of the dictionary, in (sender, recipient) order
+ * @param triples_count the number of triples
+ * @param flags the file flags
+ * @return true if the file was written, false else
+ */
+static bool write_input(char *path, char **addresses, uint32_t addresses_count, aggregate_triple_t *triples,
+                        size_t triples_count, uint32_t flags) {
+    aggregate_writer_t writer;
+    bool success = aggregate_writer_open(&writer, path, flags, 1);
+    for (uint32_t i = 0; i < addresses_count && success; ++i) {
+        success = aggregate_writer_add_address(&writer, addresses[i]);
+    }
+    for (size_t t = 0; t < triples_count && success; ++t) {
+        success = aggregate_writer_add_triple(&writer, &triples[t]);
+    }
+    return aggregate_writer_close(&writer) && success;
+}
+
+/*!
+ * @brief check_merge checks the merge of three aggregates whose dictionaries overlap: the ids of each input are
+ * remapped to the merged dictionary, the counts of a pair found in two inputs are added, and the empty triple of a
+ * sender is kept only when no input gives it a recipient
+ * @param paths the paths to the inputs, then to the output
+ */
+static void check_merge(char **paths) {
+    char *first_addresses[] = {"a@enron.com", "c@enron.com", "d@enron.com"};
+    aggregate_triple_t first_triples[] = {{0, 1, 2}, {0, 2, 1}, {1, AGGREGATE_NO_RECIPIENT, 0}};
+    char *second_addresses[] = {"b@enron.com", "c@enron.com", "e@enron.com"};
+    aggregate_triple_t second_triples[] = {{0, 1, 5}, {1, 2, 3}};
+    char *third_addresses[] = {"a@enron.com", "d@enron.com"};
+    aggregate_triple_t third_triples[] = {{0, 1, 4}, {1, AGGREGATE_NO_RECIPIENT, 0}};
+    if (!write_input(paths[0], first_addresses, 3, first_triples, 3, 0) ||
+        !write_input(paths[1], second_addresses, 3, second_triples, 2, AGGREGATE_APPROXIMATE) ||
+        !write_input(paths[2], third_addresses, 2, third_triples, 2, 0) ||
+        !merge_aggregates(paths, INPUTS_COUNT, paths[INPUTS_COUNT])) {
+        fprintf(stderr, "merge: the aggregates could not be written or merged\n");
+        ++failures;
+        return;
+    }
+
+    char *expected_addresses[] = {"a@enron.com", "b@enron.com", "c@enron.com", "d@enron.com", "e@enron.com"};
+    aggregate_triple_t expected_triples[] = {{0, 2, 2}, {0, 3, 5}, {1, 2, 5}, {2, 4, 3},
+                                             {3, AGGREGATE_NO_RECIPIENT, 0}};
+    aggregate_reader_t reader;
+    if (!aggregate_reader_open(&reader, paths[INPUTS_COUNT])) {
+        ++failures;
+        return;
+    }
+    if (reader.header.addresses_count != 5 || reader.header.triples_count != 5 || reader.header.runs != INPUTS_COUNT ||
+        reader.header.flags != AGGREGATE_APPROXIMATE) {
+        fprintf(stderr, "merge: header of %u addresses, %lu triples, %lu runs, flags %u\n",
+                reader.header.addresses_count, (unsigned long) reader.header.triples_count,
+                (unsigned long) reader.header.runs, reader.header.flags);
+        ++failures;
+    }
+    for (uint32_t i = 0; i < 5; ++i) {
+        if (!aggregate_reader_next_address(&reader) || strcmp(reader.address, expected_addresses[i]) != 0) {
+            fprintf(stderr, "merge: address %u is not %s\n", i, expected_addresses[i]);
+            ++failures;
+        }
+    }
+    aggregate_triple_t triple;
+    for (size_t t = 0; t < 5; ++t) {
+        if (!aggregate_reader_next_triple(&reader, &triple) || triple.sender != expected_triples[t].sender ||
+            triple.recipient != expected_triples[t].recipient || triple.count != expected_triples[t].count) {
+            fprintf(stderr, "merge: triple %zu is not (%u, %u, %lu)\n", t, expected_triples[t].sender,
+                    expected_triples[t].recipient, (unsigned long) expected_triples[t].count);
+            ++failures;
+        }
+    }
+    if (aggregate_reader_next_triple(&reader, &triple)) {
+        fprintf(stderr, "merge: more triples than expected\n");
+        ++failures;
+    }
+    aggregate_reader_close(&reader);
+}
+
+int main() {
+    char paths[INPUTS_COUNT + 1][32];
+    char *path_list[INPUTS_COUNT + 1];
+    bool is_created = true;
+    for (int i = 0; i < INPUTS_COUNT + 1; ++i) {
+        strcpy(paths[i], "/tmp/aggregate_test-XXXXXX");
+        path_list[i] = paths[i];
+        is_created = is_created && make_path(paths[i]);
+    }
+    if (is_created) {
+        check_merge(path_list);
+    }
+    for (int i = 0; i < INPUTS_COUNT + 1; ++i) {
+        unlink(paths[i]);
+    }
+    return is_created && failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
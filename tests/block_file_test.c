@@ -0,0 +1,120 @@
+//
+// Created on 19/10/26.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "block_file.h"
+#include "header_reader.h"
+
+static int failures = 0;
+
+/*!
+ * @brief append_lines appends step2-like lines to a buffer, whose addresses share their domains
+ * @param buffer the buffer
+ * @param first the index of the first line
+ * @param count the number of lines
+ */
+static void append_lines(growable_buffer_t *buffer, int first, int count) {
+    char line[128];
+    for (int i = first; i < first + count; ++i) {
+        int length = snprintf(line, sizeof(line), "user%d@enron.com user%d@enron.com user%d@enron.com \n", i, i % 97,
+                              i % 13);
+        growable_buffer_append(buffer, line, length);
+    }
+}
+
+/*!
+ * @brief check_codec checks that blocks decompress to their data, and that a corrupted block is reported
+ * @param case_name the name of the case, printed on failure
+ * @param data the block data, BLOCK_FILE_SIZE bytes at most
+ * @param length the data length
+ * @param is_compressible true if the block must compress by BLOCK_FILE_MIN_SAVING at least
+ */
+static void check_codec(char *case_name, const char *data, size_t length, bool is_compressible) {
+    static char packed[BLOCK_FILE_SIZE], unpacked[BLOCK_FILE_SIZE];
+    size_t capacity = length - length / BLOCK_FILE_MIN_SAVING;
+    size_t packed_size = block_compress(data, length, packed, capacity);
+    if ((packed_size > 0) != is_compressible) {
+        fprintf(stderr, "%s: %zu bytes compressed to %zu\n", case_name, length, packed_size);
+        ++failures;
+        return;
+    }
+    if (packed_size > 0 && (!block_decompress(packed, packed_size, unpacked, length) ||
+                            memcmp(unpacked, data, length) != 0)) {
+        fprintf(stderr, "%s: the block does not decompress to its data\n", case_name);
+        ++failures;
+    }
+    if (packed_size > 0 && block_decompress(packed, packed_size - 1, unpacked, length)) {
+        fprintf(stderr, "%s: a truncated block is not reported\n", case_name);
+        ++failures;
+    }
+}
+
+/*!
+ * @brief check_file checks that two writers appending to a block file are read back as their concatenated lines
+ * @param path the file path
+ */
+static void check_file(char *path) {
+    growable_buffer_t expected = {0};
+    append_lines(&expected, 0, 5000);
+    size_t first_length = expected.length;
+    append_lines(&expected, 5000, 5000);
+
+    FILE *first = block_file_open(path, "w"), *second = NULL;
+    bool is_written = first && fwrite(expected.data, 1, first_length, first) == first_length && fclose(first) == 0 &&
+                      (second = block_file_open(path, "a")) &&
+                      fwrite(expected.data + first_length, 1, expected.length - first_length, second) ==
+                      expected.length - first_length && fclose(second) == 0;
+
+    growable_buffer_t read_back = {0};
+    char chunk[4096];
+    FILE *input = is_written ? block_file_open(path, "r") : NULL;
+    for (size_t length; input && (length = fread(chunk, 1, sizeof(chunk), input)) > 0;) {
+        growable_buffer_append(&read_back, chunk, length);
+    }
+    if (input) {
+        fclose(input);
+    }
+    block_file_stats_t stats;
+    if (!is_written || read_back.length != expected.length || memcmp(read_back.data, expected.data, expected.length) ||
+        !block_file_stat(path, &stats) || stats.raw_bytes != expected.length || stats.blocks < 2 ||
+        stats.packed_bytes >= stats.raw_bytes) {
+        fprintf(stderr, "block file: %zu bytes read back out of %zu\n", read_back.length, expected.length);
+        ++failures;
+    }
+    growable_buffer_free(&read_back);
+    growable_buffer_free(&expected);
+}
+
+int main() {
+    growable_buffer_t lines = {0};
+    append_lines(&lines, 0, 2000);
+    check_codec("lines", lines.data, BLOCK_FILE_SIZE < lines.length ? BLOCK_FILE_SIZE : lines.length, true);
+
+    char *noise = malloc(BLOCK_FILE_SIZE);
+    srand(25);
+    for (size_t i = 0; noise && i < BLOCK_FILE_SIZE; ++i) {
+        noise[i] = (char) rand();
+    }
+    if (noise) {
+        check_codec("random bytes", noise, BLOCK_FILE_SIZE, false);
+    }
+    free(noise);
+    growable_buffer_free(&lines);
+
+    char path[] = "/tmp/block_file_test-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("mkstemp");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+    check_file(path);
+    unlink(path);
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
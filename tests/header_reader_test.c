@@ -0,0 +1,131 @@
+//
+// Created on 19/10/26.
+//
+
+#define _GNU_SOURCE // fmemopen
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "analysis.h"
+#include "header_reader.h"
+
+static int failures = 0;
+
+/*!
+ * @brief expect_line checks the output line of a mail (@see parse_mail)
+ * @param case_name the name of the case, printed on failure
+ * @param mail the mail text
+ * @param expected the expected output line, NULL if the mail must be rejected
+ */
+static void expect_line(char *case_name, char *mail, char *expected) {
+    FILE *input = fmemopen(mail, strlen(mail), "r");
+    FILE *output = tmpfile();
+    char line[4096] = "";
+    file_status_t status = input && output ? parse_mail(input, output) : FILE_STATUS_OUTPUT_FAILED;
+    if (output) {
+        rewind(output);
+        if (!fgets(line, sizeof(line), output)) {
+            line[0] = '\0';
+        }
+        fclose(output);
+    }
+    if (input) {
+        fclose(input);
+    }
+    bool is_expected = expected ? status == FILE_STATUS_OK && strcmp(line, expected) == 0 : status != FILE_STATUS_OK;
+    if (!is_expected) {
+        fprintf(stderr, "%s: status %d, line \"%s\", \"%s\" expected\n", case_name, status, line,
+                expected ? expected : "(rejected)");
+        ++failures;
+    }
+}
+
+/*!
+ * @brief check_long_continuation checks that a field folded over lines longer than 1 KiB is unfolded whole
+ */
+static void check_long_continuation() {
+    growable_buffer_t mail = {0};
+    char filler[1500];
+    memset(filler, 'x', sizeof(filler) - 1);
+    filler[sizeof(filler) - 1] = '\0';
+    char *start = "From: a@enron.com\nSubject: ";
+    growable_buffer_append(&mail, start, strlen(start));
+    for (int i = 0; i < 3; ++i) {
+        growable_buffer_append(&mail, filler, strlen(filler));
+        growable_buffer_append(&mail, "\n ", 2);
+    }
+    char *end = "end\nTo: b@enron.com\n\nbody\n";
+    growable_buffer_append(&mail, end, strlen(end) + 1);
+
+    FILE *input = fmemopen(mail.data, mail.length - 1, "r");
+    header_reader_t reader = {0};
+    char *name, *value;
+    size_t fields = 0, subject_length = 0;
+    bool has_recipient = false;
+    header_reader_start(&reader, input);
+    while (header_reader_next(&reader, &name, &value)) {
+        ++fields;
+        if (strcmp(name, "Subject") == 0) {
+            subject_length = strlen(value);
+        }
+        has_recipient |= strcmp(name, "To") == 0 && strcmp(value, "b@enron.com") == 0;
+    }
+    // Each continuation line keeps its leading blank
+    if (fields != 3 || subject_length != 3 * (sizeof(filler) - 1) + 3 * 1 + strlen("end") || !has_recipient) {
+        fprintf(stderr, "long continuation: %zu fields, subject of %zu characters\n", fields, subject_length);
+        ++failures;
+    }
+    header_reader_free(&reader);
+    fclose(input);
+    expect_line("long continuation", mail.data, "a@enron.com b@enron.com \n");
+    growable_buffer_free(&mail);
+}
+
+/*!
+ * @brief check_many_recipients checks that all the recipients of a long To field are extracted, in order
+ */
+static void check_many_recipients() {
+    growable_buffer_t field = {0};
+    char address[64];
+    for (int i = 0; i < 300; ++i) {
+        int length = snprintf(address, sizeof(address), "%s\"User %d\" <user%d@enron.com>", i > 0 ? ",\n\t" : "", i, i);
+        growable_buffer_append(&field, address, length);
+    }
+    growable_buffer_append(&field, "", 1);
+    address_list_t list = {0};
+    extract_emails(field.data, &list);
+    bool is_expected = list.count == 300;
+    for (size_t i = 0; i < list.count && is_expected; ++i) {
+        snprintf(address, sizeof(address), "user%zu@enron.com", i);
+        is_expected = list.spans[i].length == strlen(address) &&
+                      memcmp(list.addresses.data + list.spans[i].offset, address, strlen(address)) == 0;
+    }
+    if (!is_expected) {
+        fprintf(stderr, "300 recipients: %zu extracted\n", list.count);
+        ++failures;
+    }
+    address_list_free(&list);
+    growable_buffer_free(&field);
+}
+
+int main() {
+    check_long_continuation();
+    check_many_recipients();
+
+    expect_line("X-To and Reply-To",
+                "From: a@enron.com\nX-To: x@enron.com\nReply-To: r@enron.com\nTo: b@enron.com\n\n",
+                "a@enron.com b@enron.com \n");
+    expect_line("Cc and Bcc after Subject",
+                "From: a@enron.com\nTo: b@enron.com\nSubject: hello\nCc: c@enron.com\nBcc: d@enron.com\n\n",
+                "a@enron.com b@enron.com c@enron.com d@enron.com \n");
+    expect_line("To in the body",
+                "From: a@enron.com\nTo: b@enron.com\n\nTo: z@enron.com\nFrom: y@enron.com\n",
+                "a@enron.com b@enron.com \n");
+    expect_line("end of file without a blank line", "From: a@enron.com\r\nTo: b@enron.com,\r\n c@enron.com",
+                "a@enron.com b@enron.com c@enron.com \n");
+    expect_line("no sender", "To: b@enron.com\n\n", NULL);
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,69 @@
+//
+// Created on 19/10/26.
+//
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sketch.h"
+
+static int failures = 0;
+
+/*!
+ * @brief add_addresses adds a range of addresses to a set, each one twice
+ * @param registers the registers of the set
+ * @param first the index of the first address
+ * @param count the number of addresses
+ */
+static void add_addresses(uint8_t *registers, int first, int count) {
+    char address[32];
+    for (int round = 0; round < 2; ++round) {
+        for (int i = first; i < first + count; ++i) {
+            snprintf(address, sizeof(address), "user%d@enron.com", i);
+            hll_add(registers, hll_hash(address));
+        }
+    }
+}
+
+/*!
+ * @brief expect_estimate checks that an estimate is within 4 standard errors of the true count
+ * @param case_name the name of the case, printed on failure
+ * @param registers the registers of the set
+ * @param expected the true number of distinct addresses
+ */
+static void expect_estimate(char *case_name, const uint8_t *registers, double expected) {
+    double estimate = hll_estimate(registers);
+    if (fabs(estimate - expected) > 4 * hll_standard_error() * expected) {
+        fprintf(stderr, "%s: %.0f estimated, %.0f expected\n", case_name, estimate, expected);
+        ++failures;
+    }
+}
+
+int main() {
+    uint8_t small[HLL_REGISTERS] = {0}, first_half[HLL_REGISTERS] = {0}, second_half[HLL_REGISTERS] = {0};
+    uint8_t all[HLL_REGISTERS] = {0};
+
+    // Small counts are linear counting, almost exact
+    add_addresses(small, 0, 20);
+    if (fabs(hll_estimate(small) - 20) > 1) {
+        fprintf(stderr, "20 addresses: %.1f estimated\n", hll_estimate(small));
+        ++failures;
+    }
+
+    add_addresses(first_half, 0, 60000);
+    add_addresses(second_half, 40000, 60000);
+    add_addresses(all, 0, 100000);
+    expect_estimate("60000 addresses", first_half, 60000);
+
+    // The union of two overlapping sets has exactly the registers of the set of all their addresses
+    hll_merge(first_half, second_half);
+    if (memcmp(first_half, all, HLL_REGISTERS) != 0) {
+        fprintf(stderr, "merged registers differ from the registers of the union\n");
+        ++failures;
+    }
+    expect_estimate("100000 addresses", all, 100000);
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
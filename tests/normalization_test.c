@@ -0,0 +1,170 @@
+//
+// Created on 19/10/26.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "normalization.h"
+
+static int failures = 0;
+
+/*!
+ * @brief check_normalized checks the canonical form of an address
+ * @param raw the address as found in a mail, only its first length bytes being read
+ * @param length the address length
+ * @param expected the expected canonical form
+ * @return the canonical form, NULL on failure
+ */
+static const char *check_normalized(const char *raw, size_t length, const char *expected) {
+    size_t normalized_length;
+    const char *normalized = normalize_address(raw, length, &normalized_length);
+    if (normalized_length != strlen(expected) || strncmp(normalized, expected, normalized_length) != 0) {
+        fprintf(stderr, "%.*s: normalized to %.*s instead of %s\n", (int) length, raw, (int) normalized_length,
+                normalized, expected);
+        ++failures;
+        return NULL;
+    }
+    return normalized;
+}
+
+/*!
+ * @brief check_counts checks the counters of the normalization since the last check
+ * @param case_name the name of the case, printed on failure
+ * @param addresses the expected number of addresses normalized
+ * @param rewritten the expected number of addresses rewritten
+ * @param cache_hits the expected number of cache hits
+ */
+static void check_counts(char *case_name, uint64_t addresses, uint64_t rewritten, uint64_t cache_hits) {
+    normalization_counts_t counts = take_normalization_counts();
+    if (counts.addresses != addresses || counts.rewritten != rewritten || counts.cache_hits != cache_hits) {
+        fprintf(stderr, "%s: %lu addresses, %lu rewritten, %lu cache hits\n", case_name,
+                (unsigned long) counts.addresses, (unsigned long) counts.rewritten, (unsigned long) counts.cache_hits);
+        ++failures;
+    }
+}
+
+/*!
+ * @brief check_canonical_forms checks the canonical forms without aliases, an upper case letter being found at any
+ * position of the 8 bytes words
+ */
+static void check_canonical_forms() {
+    char *canonical = "john.doe@enron.com";
+    if (check_normalized(canonical, strlen(canonical), canonical) != canonical) {
+        fprintf(stderr, "%s: a canonical address is copied\n", canonical);
+        ++failures;
+    }
+    // Bytes next to the upper case letters and UTF-8 bytes are not changed
+    char *not_letters = "a[@z`.caf\xc3\xa9";
+    if (check_normalized(not_letters, strlen(not_letters), not_letters) != not_letters) {
+        fprintf(stderr, "%s: an address without upper case letter is copied\n", not_letters);
+        ++failures;
+    }
+    check_counts("canonical", 2, 0, 0);
+
+    check_normalized("<John.Doe@ENRON.COM>", 20, "john.doe@enron.com");
+    check_normalized("'a@b.c'", 7, "a@b.c");
+    check_normalized("\"<x@Y.org>\"", 11, "x@y.org");
+    check_normalized("AB@c", 4, "ab@c");
+    check_normalized("<A@B.C>trailing", 7, "a@b.c");
+    check_normalized("<>", 2, "");
+    check_counts("variants", 6, 6, 0);
+
+    char address[] = "abcdefghij@enron.com", expected[] = "abcdefghij@enron.com";
+    for (size_t i = 0; i < strlen(address); ++i) {
+        if (address[i] >= 'a' && address[i] <= 'z') {
+            address[i] = (char) (address[i] - 'a' + 'A');
+            check_normalized(address, strlen(address), expected);
+            address[i] = expected[i];
+        }
+    }
+    check_counts("upper case positions", 18, 18, 0);
+}
+
+/*!
+ * @brief check_cache checks that a rewritten address is found in the cache the next times, unless the cache is off
+ */
+static void check_cache() {
+    normalization_cache_free();
+    take_normalization_counts();
+    for (int i = 0; i < 3; ++i) {
+        check_normalized("<Jane@Enron.com>", 16, "jane@enron.com");
+    }
+    check_counts("cache", 3, 3, 2);
+
+    set_normalization_cache_used(false);
+    for (int i = 0; i < 3; ++i) {
+        check_normalized("<Jane@Enron.com>", 16, "jane@enron.com");
+    }
+    check_counts("no cache", 3, 3, 0);
+    set_normalization_cache_used(true);
+    normalization_cache_free();
+}
+
+/*!
+ * @brief write_file writes a text file
+ * @param path the path template, set to the path of the file
+ * @param text the file contents
+ * @return true if the file was written, false else
+ */
+static bool write_file(char *path, char *text) {
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("mkstemp");
+        return false;
+    }
+    bool success = write(fd, text, strlen(text)) == (ssize_t) strlen(text);
+    return close(fd) == 0 && success;
+}
+
+/*!
+ * @brief check_aliases checks that aliases are canonicalized, not chained, found through the cache, and that their
+ * fingerprint does not depend on their order in the file
+ */
+static void check_aliases() {
+    char path[] = "/tmp/normalization_test-XXXXXX", swapped_path[] = "/tmp/normalization_test-XXXXXX";
+    char invalid_path[] = "/tmp/normalization_test-XXXXXX";
+    if (!write_file(path, "# alias address\n\n<JD@Enron.com> John.Doe@enron.com\nx@enron.com jd@enron.com\n") ||
+        !write_file(swapped_path, "x@enron.com jd@enron.com\n<JD@Enron.com>\tJohn.Doe@enron.com\r\n") ||
+        !write_file(invalid_path, "jd@enron.com\n")) {
+        ++failures;
+        return;
+    }
+
+    uint64_t fingerprint = 0;
+    if (!aliases_load("") || aliases_fingerprint() != 0 || !aliases_load(path) ||
+        (fingerprint = aliases_fingerprint()) == 0) {
+        fprintf(stderr, "aliases: %s could not be loaded\n", path);
+        ++failures;
+    }
+    check_normalized("jd@enron.com", 12, "john.doe@enron.com");
+    check_normalized("<JD@ENRON.COM>", 14, "john.doe@enron.com");
+    check_normalized("x@enron.com", 11, "jd@enron.com");
+    check_normalized("john.doe@enron.com", 18, "john.doe@enron.com");
+    check_normalized("jd@enron.com", 12, "john.doe@enron.com");
+    check_counts("aliases", 5, 4, 1);
+    normalization_cache_free();
+    aliases_unload();
+
+    if (!aliases_load(swapped_path) || aliases_fingerprint() != fingerprint) {
+        fprintf(stderr, "aliases: the fingerprint depends on the order of the aliases\n");
+        ++failures;
+    }
+    aliases_unload();
+    if (aliases_load(invalid_path) || aliases_fingerprint() != 0) {
+        fprintf(stderr, "aliases: a line without address is accepted\n");
+        ++failures;
+    }
+    unlink(path);
+    unlink(swapped_path);
+    unlink(invalid_path);
+}
+
+int main() {
+    check_canonical_forms();
+    check_cache();
+    check_aliases();
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
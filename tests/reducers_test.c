@@ -0,0 +1,60 @@
+//
+// Created on 19/10/26.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reducers.h"
+
+static int failures = 0;
+
+/*!
+ * @brief expect_occurrences checks how many times a recipient was counted for a source
+ * @param source the source of the recipient
+ * @param recipient_email the recipient to look for
+ * @param expected the expected occurrences, 0 if the recipient must not be listed
+ */
+static void expect_occurrences(sender_t *source, char *recipient_email, uint32_t expected) {
+    uint32_t occurrences = 0;
+    for (recipient_t *recipient = source->head; recipient; recipient = recipient->next) {
+        if (strcmp(recipient->recipient_address, recipient_email) == 0) {
+            occurrences += recipient->occurrences;
+        }
+    }
+    if (occurrences != expected) {
+        fprintf(stderr, "%s -> %s: %u occurrences, %u expected\n", source->sender_address, recipient_email, occurrences,
+                expected);
+        ++failures;
+    }
+}
+
+int main() {
+    sender_t *list = add_source_to_list(NULL, "a@enron.com");
+    list = add_source_to_list(list, "d@enron.com");
+    sender_t *source = find_source_in_list(list, "a@enron.com");
+    if (!source || find_source_in_list(list, "z@enron.com")) {
+        fprintf(stderr, "sources lookup failed\n");
+        clear_sources_list(list);
+        return EXIT_FAILURE;
+    }
+
+    // The first recipient of a source is counted once, like the next ones, whatever the order of the lines
+    add_recipient_to_source(source, "b@enron.com");
+    add_recipient_to_source(source, "c@enron.com");
+    add_recipient_to_source(source, "b@enron.com");
+    expect_occurrences(source, "b@enron.com", 2);
+    expect_occurrences(source, "c@enron.com", 1);
+
+    source = find_source_in_list(list, "d@enron.com");
+    add_recipient_to_source(source, "c@enron.com");
+    add_recipient_to_source(source, "b@enron.com");
+    add_recipient_to_source(source, "b@enron.com");
+    expect_occurrences(source, "b@enron.com", 2);
+    expect_occurrences(source, "c@enron.com", 1);
+    expect_occurrences(source, "a@enron.com", 0);
+
+    clear_sources_list(list);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
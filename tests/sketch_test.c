@@ -0,0 +1,105 @@
+//
+// Created on 19/10/26.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sketch.h"
+#include "string_set.h"
+
+#define KEYS_COUNT 1000
+
+static int failures = 0;
+
+/*!
+ * @brief true_count gives the occurrences of a key of the test stream: key i occurs i + 1 times, and the keys 0 to 2
+ * are heavy hitters with 10000 more occurrences each
+ * @param key the key index
+ * @return the occurrences
+ */
+static uint64_t true_count(int key) {
+    return key + 1 + (key < 3 ? 10000 : 0);
+}
+
+/*!
+ * @brief check_count_min checks that no estimate is below its true count nor above it by more than the error bound
+ */
+static void check_count_min() {
+    count_min_t sketch;
+    if (!count_min_init(&sketch, 0.001, 0.01)) {
+        fprintf(stderr, "count-min: allocation failed\n");
+        ++failures;
+        return;
+    }
+    char key[32];
+    for (int i = 0; i < KEYS_COUNT; ++i) {
+        snprintf(key, sizeof(key), "user%d@enron.com", i);
+        count_min_add(&sketch, string_hash(key), true_count(i));
+    }
+    uint64_t bound = count_min_error_bound(&sketch), outside_bound = 0;
+    for (int i = 0; i < KEYS_COUNT; ++i) {
+        snprintf(key, sizeof(key), "user%d@enron.com", i);
+        uint64_t estimate = count_min_estimate(&sketch, string_hash(key));
+        if (estimate < true_count(i)) {
+            fprintf(stderr, "count-min: %s estimated %lu, below %lu\n", key, (unsigned long) estimate,
+                    (unsigned long) true_count(i));
+            ++failures;
+        }
+        outside_bound += estimate > true_count(i) + bound;
+    }
+    // The bound holds for each key with probability 0.99: far fewer than 5% of the keys may exceed it
+    if (outside_bound > KEYS_COUNT / 20) {
+        fprintf(stderr, "count-min: %lu estimates above the error bound %lu\n", (unsigned long) outside_bound,
+                (unsigned long) bound);
+        ++failures;
+    }
+    count_min_free(&sketch);
+}
+
+/*!
+ * @brief check_space_saving checks that the heavy hitters are monitored, with their true count in [count - error,
+ * count]
+ */
+static void check_space_saving() {
+    space_saving_t heavy_hitters;
+    if (!space_saving_init(&heavy_hitters, 10)) {
+        fprintf(stderr, "space-saving: allocation failed\n");
+        ++failures;
+        return;
+    }
+    char key[32];
+    // Interleaved, so that the heavy hitters are evicted at first
+    for (int round = 0; round < 2; ++round) {
+        for (int i = KEYS_COUNT - 1; i >= 0; --i) {
+            snprintf(key, sizeof(key), "user%d@enron.com", i);
+            uint64_t count = true_count(i) / 2 + (round == 0 ? true_count(i) % 2 : 0);
+            space_saving_add(&heavy_hitters, key, string_hash(key), count);
+        }
+    }
+    for (int i = 0; i < 3; ++i) {
+        snprintf(key, sizeof(key), "user%d@enron.com", i);
+        heavy_hitter_t *entry = NULL;
+        for (size_t e = 0; e < heavy_hitters.count && !entry; ++e) {
+            entry = strcmp(heavy_hitters.entries[e].key, key) == 0 ? &heavy_hitters.entries[e] : NULL;
+        }
+        if (!entry || entry->count < true_count(i) || entry->count - entry->error > true_count(i)) {
+            fprintf(stderr, "space-saving: %s not monitored with a count around %lu\n", key,
+                    (unsigned long) true_count(i));
+            ++failures;
+        }
+    }
+    if (heavy_hitters.count != 10 || space_saving_error_bound(&heavy_hitters) > heavy_hitters.total / 10) {
+        fprintf(stderr, "space-saving: %zu keys monitored, error bound %lu\n", heavy_hitters.count,
+                (unsigned long) space_saving_error_bound(&heavy_hitters));
+        ++failures;
+    }
+    space_saving_free(&heavy_hitters);
+}
+
+int main() {
+    check_count_min();
+    check_space_saving();
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
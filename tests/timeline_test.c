@@ -0,0 +1,145 @@
+//
+// Created on 19/10/26.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "timeline.h"
+
+#define POINTS_COUNT 5
+
+static int failures = 0;
+
+// The expected points of the store, by sender, recipient then day (ids are the ranks of a, b and c)
+static const struct {
+    uint32_t sender;
+    uint32_t recipient;
+    int32_t day;
+    uint64_t count;
+} expected_points[POINTS_COUNT] = {{0, 1, 100, 2}, {0, 1, 105, 200}, {0, 2, 100, 1}, {1, 2, 90, 1}, {2, 0, 20000, 1}};
+
+typedef struct {
+    size_t visited;
+} scan_context_t;
+
+/*!
+ * @brief check_point checks that the points of a scan of all the store come in the expected order (@see
+ * timeline_visit_t)
+ */
+static void check_point(void *context, uint32_t sender, uint32_t recipient, int32_t day, uint64_t count) {
+    scan_context_t *scan = context;
+    size_t i = scan->visited++;
+    if (i >= POINTS_COUNT || expected_points[i].sender != sender || expected_points[i].recipient != recipient ||
+        expected_points[i].day != day || expected_points[i].count != count) {
+        fprintf(stderr, "scan: unexpected point %zu (%u, %u, day %d, %lu)\n", i, sender, recipient, day,
+                (unsigned long) count);
+        ++failures;
+    }
+}
+
+/*!
+ * @brief write_lines writes the timeline lines of a few mails, with a plugin line and an address line among them. The
+ * large day and count need varints of several bytes.
+ * @param path the path to the lines file
+ * @return true if the file was written, false else
+ */
+static bool write_lines(char *path) {
+    growable_buffer_t lines = {0};
+    char *both = "b@enron.com c@enron.com ", *b = "b@enron.com ", *c = "c@enron.com ", *a = "a@enron.com ";
+    char *other_lines = "a@enron.com b@enron.com \n\t@month 1970-04 a@enron.com 1\n";
+    bool success = write_timeline_line(&lines, "a@enron.com", both, strlen(both), 100) &&
+                   write_timeline_line(&lines, "a@enron.com", b, strlen(b), 100) &&
+                   write_timeline_line(&lines, "b@enron.com", c, strlen(c), 90) &&
+                   write_timeline_line(&lines, "c@enron.com", a, strlen(a), 20000) &&
+                   write_timeline_line(&lines, "c@enron.com", "", 0, 50) &&
+                   growable_buffer_append(&lines, other_lines, strlen(other_lines));
+    for (int i = 0; i < 200 && success; ++i) {
+        success = write_timeline_line(&lines, "a@enron.com", b, strlen(b), 105);
+    }
+    FILE *file = fopen(path, "w");
+    success = success && file && fwrite(lines.data, 1, lines.length, file) == lines.length;
+    success = file && fclose(file) == 0 && success;
+    growable_buffer_free(&lines);
+    return success;
+}
+
+/*!
+ * @brief check_store checks the header of the store, the dictionary lookups and windows on a sender, a recipient and
+ * days
+ * @param timeline the store
+ */
+static void check_store(timeline_t *timeline) {
+    const timeline_header_t *header = timeline->header;
+    if (header->addresses_count != 3 || header->senders_count != 3 || header->edges_count != 4 ||
+        header->points_count != POINTS_COUNT || header->total != 205 || header->first_day != 90 ||
+        header->last_day != 20000) {
+        fprintf(stderr, "store: %u addresses, %u senders, %lu edges, %lu points, total %lu, days %d to %d\n",
+                header->addresses_count, header->senders_count, (unsigned long) header->edges_count,
+                (unsigned long) header->points_count, (unsigned long) header->total, header->first_day,
+                header->last_day);
+        ++failures;
+    }
+    if (timeline_find(timeline, "b@enron.com") != 1 || timeline_find(timeline, "d@enron.com") != -1 ||
+        strcmp(timeline_address(timeline, 2), "c@enron.com") != 0) {
+        fprintf(stderr, "store: the dictionary lookups fail\n");
+        ++failures;
+    }
+
+    scan_context_t scan = {0};
+    timeline_window_t all = {INT32_MIN, INT32_MAX, TIMELINE_ANY, TIMELINE_ANY};
+    uint64_t total = timeline_scan(timeline, &all, check_point, &scan);
+    if (total != 205 || scan.visited != POINTS_COUNT) {
+        fprintf(stderr, "scan: %lu mails in %zu points\n", (unsigned long) total, scan.visited);
+        ++failures;
+    }
+    timeline_window_t sender_days = {100, 104, 0, TIMELINE_ANY};
+    timeline_window_t recipient = {INT32_MIN, INT32_MAX, TIMELINE_ANY, 1};
+    timeline_window_t edge = {0, 100, 1, 2};
+    timeline_window_t none = {101, 104, TIMELINE_ANY, TIMELINE_ANY};
+    if (timeline_scan(timeline, &sender_days, NULL, NULL) != 3 ||
+        timeline_scan(timeline, &recipient, NULL, NULL) != 202 || timeline_scan(timeline, &edge, NULL, NULL) != 1 ||
+        timeline_scan(timeline, &none, NULL, NULL) != 0) {
+        fprintf(stderr, "scan: wrong sums of the windows\n");
+        ++failures;
+    }
+}
+
+int main() {
+    char lines_path[] = "/tmp/timeline_test-XXXXXX", store_path[] = "/tmp/timeline_test-XXXXXX";
+    int lines_fd = mkstemp(lines_path), store_fd = mkstemp(store_path);
+    if (lines_fd == -1 || store_fd == -1) {
+        perror("mkstemp");
+        return EXIT_FAILURE;
+    }
+    close(lines_fd);
+    close(store_fd);
+
+    timeline_t timeline;
+    if (!write_lines(lines_path) || !write_timeline(lines_path, store_path, 0) ||
+        !timeline_open(&timeline, store_path)) {
+        fprintf(stderr, "the store could not be written or opened\n");
+        ++failures;
+    } else {
+        check_store(&timeline);
+        timeline_close(&timeline);
+    }
+
+    // Counts of a sample are scaled up and rounded: 2 * 2.5 + 200 * 2.5 + 3 * round(2.5)
+    if (write_timeline(lines_path, store_path, 2.5) && timeline_open(&timeline, store_path)) {
+        if (timeline.header->total != 514) {
+            fprintf(stderr, "scale: total %lu instead of 514\n", (unsigned long) timeline.header->total);
+            ++failures;
+        }
+        timeline_close(&timeline);
+    } else {
+        fprintf(stderr, "scale: the store could not be written or opened\n");
+        ++failures;
+    }
+
+    unlink(lines_path);
+    unlink(store_path);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
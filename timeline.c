@@ -0,0 +1,515 @@
+//
+// Created on 19/10/26.
+//
+
+#define _GNU_SOURCE // getline
+
+#include "timeline.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "block_file.h"
+#include "header_reader.h"
+#include "plugins.h"
+#include "string_set.h"
+
+// Mails as read from step2_output, addresses interned in a set
+typedef struct {
+    const char *sender;
+    const char *recipient;
+    int32_t day;
+} raw_point_t;
+
+typedef struct {
+    uint32_t sender;
+    uint32_t recipient;
+    int32_t day;
+    uint32_t count;
+} timeline_point_t;
+
+static bool timeline_lines_written = false;
+
+/*!
+ * @brief set_timeline_lines_written enables or disables the timeline lines of the mapper (@see write_timeline_line)
+ * @param written true to write them
+ */
+void set_timeline_lines_written(bool written) {
+    timeline_lines_written = written;
+}
+
+/*!
+ * @brief are_timeline_lines_written tells if the mapper writes the day of the mails
+ * @return true if it writes them
+ */
+bool are_timeline_lines_written() {
+    return timeline_lines_written;
+}
+
+/*!
+ * @brief write_timeline_line appends the timeline line of a mail to its output lines (nothing for a mail without
+ * recipients)
+ * @param lines the output lines of the mail
+ * @param sender the sender
+ * @param recipients the recipients, each followed by a space
+ * @param length the length of the recipients text
+ * @param day the UTC day of the mail
+ * @return true if the line was appended, false if memory ran out
+ */
+bool write_timeline_line(growable_buffer_t *lines, char *sender, const char *recipients, size_t length, int32_t day) {
+    if (length == 0) {
+        return true;
+    }
+    char head[64];
+    int head_length = snprintf(head, sizeof(head), "%c%s %d ", PLUGIN_LINE_MARK, TIMELINE_LINE_TAG, (int) day);
+    return growable_buffer_append(lines, head, head_length) && growable_buffer_append(lines, sender, strlen(sender)) &&
+           growable_buffer_append(lines, " ", 1) && growable_buffer_append(lines, recipients, length) &&
+           growable_buffer_append(lines, "\n", 1);
+}
+
+/*!
+ * @brief compare_strings orders an array of string pointers (qsort/bsearch callback)
+ */
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char **) a, *(char **) b);
+}
+
+/*!
+ * @brief compare_points orders points by sender, recipient then day (qsort callback)
+ */
+static int compare_points(const void *a, const void *b) {
+    const timeline_point_t *first = a, *second = b;
+    if (first->sender != second->sender) {
+        return first->sender < second->sender ? -1 : 1;
+    }
+    if (first->recipient != second->recipient) {
+        return first->recipient < second->recipient ? -1 : 1;
+    }
+    return first->day < second->day ? -1 : (first->day > second->day);
+}
+
+/*!
+ * @brief read_raw_points reads the timeline lines of step2_output
+ * @param temp_file the path to step2_output
+ * @param addresses the set interning the addresses
+ * @param count set to the number of points
+ * @return the points (one per mail and recipient), NULL on failure
+ */
+static raw_point_t *read_raw_points(char *temp_file, string_set_t *addresses, size_t *count) {
+    FILE *file = open_intermediate(temp_file, "r");
+    if (!file) {
+        return NULL;
+    }
+    raw_point_t *points = NULL;
+    size_t capacity = 0;
+    *count = 0;
+    char *line = NULL;
+    size_t line_capacity = 0;
+    size_t tag_length = strlen(TIMELINE_LINE_TAG);
+    bool success = true;
+    while (success && getline(&line, &line_capacity, file) != -1) {
+        if (line[0] != PLUGIN_LINE_MARK || strncmp(line + 1, TIMELINE_LINE_TAG, tag_length) != 0 ||
+            line[1 + tag_length] != ' ') {
+            continue;
+        }
+        char *save = NULL;
+        char *day = strtok_r(line + 2 + tag_length, " \n", &save);
+        char *sender_token = strtok_r(NULL, " \n", &save);
+        const char *sender = sender_token ? string_set_intern(addresses, sender_token) : NULL;
+        char *recipient;
+        while (sender && success && (recipient = strtok_r(NULL, " \n", &save))) {
+            if (*count == capacity) {
+                capacity = capacity ? 2 * capacity : 4096;
+                raw_point_t *grown = realloc(points, capacity * sizeof(raw_point_t));
+                if (!grown) {
+                    success = false;
+                    break;
+                }
+                points = grown;
+            }
+            const char *interned = string_set_intern(addresses, recipient);
+            success = interned != NULL;
+            points[(*count)++] = (raw_point_t) {sender, interned, (int32_t) strtol(day, NULL, 10)};
+        }
+        success = success && (!sender_token || sender);
+    }
+    free(line);
+    fclose(file);
+    if (!success) {
+        free(points);
+        return NULL;
+    }
+    return points ? points : malloc(sizeof(raw_point_t));
+}
+
+/*!
+ * @brief varint_append appends an unsigned LEB128 varint to a column
+ * @param column the column
+ * @param value the value
+ * @return true if the value was appended, false else
+ */
+static bool varint_append(growable_buffer_t *column, uint64_t value) {
+    char bytes[10];
+    size_t length = 0;
+    do {
+        bytes[length++] = (char) ((value & 0x7f) | (value >= 0x80 ? 0x80 : 0));
+        value >>= 7;
+    } while (value > 0);
+    return growable_buffer_append(column, bytes, length);
+}
+
+/*!
+ * @brief write_padded writes a section and pads it to 8 bytes
+ * @param file the store file
+ * @param data the section
+ * @param size the section size in bytes
+ * @param offset the current offset in the file, updated
+ * @return the offset where the section starts
+ */
+static uint64_t write_padded(FILE *file, const void *data, size_t size, uint64_t *offset) {
+    static const char padding[8] = {0};
+    uint64_t start = *offset;
+    if (data && size > 0) {
+        fwrite(data, 1, size, file);
+    }
+    size_t padding_size = (8 - size % 8) % 8;
+    fwrite(padding, 1, padding_size, file);
+    *offset += size + padding_size;
+    return start;
+}
+
+/*!
+ * @brief write_store encodes sorted, merged points into columns and writes the store
+ * @param path the path to the store
+ * @param dictionary the sorted addresses
+ * @param addresses_count the number of addresses
+ * @param points the points, sorted by sender, recipient and day, without duplicates
+ * @param points_count the number of points
+ * @return true if the store was written, false else
+ */
+static bool write_store(char *path, const char **dictionary, uint32_t addresses_count, timeline_point_t *points,
+                        size_t points_count) {
+    timeline_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TIMELINE_MAGIC, sizeof(header.magic));
+    header.addresses_count = addresses_count;
+    header.points_count = points_count;
+    header.first_day = points_count > 0 ? points[0].day : 0;
+    header.last_day = header.first_day;
+    for (size_t p = 0; p < points_count; ++p) {
+        header.first_day = points[p].day < header.first_day ? points[p].day : header.first_day;
+        header.last_day = points[p].day > header.last_day ? points[p].day : header.last_day;
+        header.total += points[p].count;
+    }
+
+    growable_buffer_t recipients = {0}, lengths = {0}, days = {0}, counts = {0};
+    timeline_sender_t *senders = malloc((addresses_count + 1) * sizeof(timeline_sender_t));
+    bool success = senders != NULL;
+    for (size_t p = 0; p < points_count && success;) {
+        timeline_sender_t *row = &senders[header.senders_count++];
+        *row = (timeline_sender_t) {points[p].sender, 0, recipients.length, lengths.length, days.length, counts.length};
+        uint32_t previous_recipient = 0;
+        while (p < points_count && points[p].sender == row->sender && success) {
+            size_t edge_end = p;
+            while (edge_end < points_count && points[edge_end].sender == row->sender &&
+                   points[edge_end].recipient == points[p].recipient) {
+                ++edge_end;
+            }
+            success = varint_append(&recipients, points[p].recipient - previous_recipient) &&
+                      varint_append(&lengths, edge_end - p);
+            previous_recipient = points[p].recipient;
+            int32_t previous_day = header.first_day;
+            for (; p < edge_end && success; ++p) {
+                success = varint_append(&days, (uint64_t) (points[p].day - previous_day)) &&
+                          varint_append(&counts, points[p].count);
+                previous_day = points[p].day;
+            }
+            ++row->edges_count;
+            ++header.edges_count;
+        }
+    }
+
+    uint64_t *string_offsets = malloc((addresses_count + 1) * sizeof(uint64_t));
+    FILE *file = success && string_offsets ? fopen(path, "w") : NULL;
+    if (file) {
+        uint64_t offset = 0, strings_size = 0;
+        for (uint32_t i = 0; i < addresses_count; ++i) {
+            string_offsets[i] = strings_size;
+            strings_size += strlen(dictionary[i]) + 1;
+        }
+        string_offsets[addresses_count] = strings_size;
+        write_padded(file, &header, sizeof(header), &offset);
+        header.string_offsets = write_padded(file, string_offsets, (addresses_count + 1) * sizeof(uint64_t), &offset);
+        for (uint32_t i = 0; i < addresses_count; ++i) {
+            fwrite(dictionary[i], 1, strlen(dictionary[i]) + 1, file);
+        }
+        header.strings = write_padded(file, NULL, strings_size, &offset); // Strings already written, pads only
+        header.senders = write_padded(file, senders, header.senders_count * sizeof(timeline_sender_t), &offset);
+        header.recipients = write_padded(file, recipients.data, recipients.length, &offset);
+        header.lengths = write_padded(file, lengths.data, lengths.length, &offset);
+        header.days = write_padded(file, days.data, days.length, &offset);
+        header.counts = write_padded(file, counts.data, counts.length, &offset);
+        header.columns_size = recipients.length + lengths.length + days.length + counts.length;
+        header.file_size = offset;
+        fseek(file, 0, SEEK_SET);
+        fwrite(&header, sizeof(header), 1, file);
+        success = !ferror(file);
+        success = (fclose(file) == 0) && success;
+    } else {
+        success = false;
+    }
+    if (success) {
+        printf("Timeline: %lu points of %lu edges, %lu bytes of columns (%.2f bytes per point)\n",
+               (unsigned long) header.points_count, (unsigned long) header.edges_count,
+               (unsigned long) header.columns_size,
+               header.points_count ? (double) header.columns_size / header.points_count : 0.0);
+    }
+    free(string_offsets);
+    free(senders);
+    growable_buffer_free(&recipients);
+    growable_buffer_free(&lengths);
+    growable_buffer_free(&days);
+    growable_buffer_free(&counts);
+    return success;
+}
+
+/*!
+ * @brief write_timeline reads the timeline lines of step2_output and writes the store of the mails per edge and day
+ * @param temp_file the path to step2_output
+ * @param path the path to the store
+ * @param scale the factor applied to the counts of a sample, 0 for exact counts
+ * @return true if the store was written, false else
+ */
+bool write_timeline(char *temp_file, char *path, double scale) {
+    string_set_t addresses;
+    if (!string_set_init(&addresses, 0)) {
+        perror("Cannot allocate timeline");
+        return false;
+    }
+    size_t count = 0;
+    raw_point_t *raw_points = read_raw_points(temp_file, &addresses, &count);
+    const char **dictionary = raw_points ? malloc((addresses.count + 1) * sizeof(char *)) : NULL;
+    if (!dictionary) {
+        perror("Cannot read timeline");
+        free(raw_points);
+        string_set_free(&addresses);
+        return false;
+    }
+    uint32_t addresses_count = 0;
+    for (size_t i = 0; i < addresses.capacity; ++i) {
+        if (addresses.slots[i]) {
+            dictionary[addresses_count++] = addresses.slots[i];
+        }
+    }
+    qsort(dictionary, addresses_count, sizeof(char *), compare_strings);
+
+    // Raw points become id points in place: a point is smaller than a raw point, so that the point i never overwrites
+    // a raw point not converted yet
+    timeline_point_t *points = (timeline_point_t *) raw_points;
+    for (size_t i = 0; i < count; ++i) {
+        raw_point_t raw = raw_points[i];
+        const char **sender = bsearch(&raw.sender, dictionary, addresses_count, sizeof(char *), compare_strings);
+        const char **recipient = bsearch(&raw.recipient, dictionary, addresses_count, sizeof(char *), compare_strings);
+        points[i] = (timeline_point_t) {(uint32_t) (sender - dictionary), (uint32_t) (recipient - dictionary), raw.day, 1};
+    }
+    qsort(points, count, sizeof(timeline_point_t), compare_points);
+    size_t merged = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (merged > 0 && compare_points(&points[merged - 1], &points[i]) == 0) {
+            ++points[merged - 1].count;
+        } else {
+            points[merged++] = points[i];
+        }
+    }
+    for (size_t i = 0; scale > 0 && i < merged; ++i) {
+        double scaled = round(points[i].count * scale);
+        points[i].count = scaled < UINT32_MAX ? (uint32_t) scaled : UINT32_MAX;
+    }
+
+    bool success = write_store(path, dictionary, addresses_count, points, merged);
+    if (!success) {
+        perror("Cannot write timeline");
+    }
+    free(dictionary);
+    free(raw_points);
+    string_set_free(&addresses);
+    return success;
+}
+
+/*!
+ * @brief timeline_open maps a store in memory and checks its consistency
+ * @param timeline the store structure to fill
+ * @param path the path to the store
+ * @return true if the store is usable, false else
+ */
+bool timeline_open(timeline_t *timeline, char *path) {
+    memset(timeline, 0, sizeof(timeline_t));
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    struct stat status;
+    if (fstat(fd, &status) == -1 || (size_t) status.st_size < sizeof(timeline_header_t)) {
+        close(fd);
+        return false;
+    }
+    void *mapping = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    timeline->mapping = mapping;
+    timeline->size = status.st_size;
+    timeline->header = mapping;
+    const timeline_header_t *header = timeline->header;
+    if (memcmp(header->magic, TIMELINE_MAGIC, sizeof(header->magic)) != 0 || header->file_size != timeline->size ||
+        header->counts > timeline->size || header->senders + header->senders_count * sizeof(timeline_sender_t) >
+        timeline->size) {
+        timeline_close(timeline);
+        return false;
+    }
+    const char *base = mapping;
+    timeline->string_offsets = (const uint64_t *) (base + header->string_offsets);
+    timeline->strings = base + header->strings;
+    timeline->senders = (const timeline_sender_t *) (base + header->senders);
+    timeline->recipients = (const uint8_t *) (base + header->recipients);
+    timeline->lengths = (const uint8_t *) (base + header->lengths);
+    timeline->days = (const uint8_t *) (base + header->days);
+    timeline->counts = (const uint8_t *) (base + header->counts);
+    return true;
+}
+
+/*!
+ * @brief timeline_close unmaps a store
+ * @param timeline the store to close
+ */
+void timeline_close(timeline_t *timeline) {
+    if (timeline->mapping) {
+        munmap(timeline->mapping, timeline->size);
+        timeline->mapping = NULL;
+    }
+}
+
+/*!
+ * @brief timeline_address returns the address of an id
+ * @param timeline the store
+ * @param id the address id
+ * @return the address
+ */
+const char *timeline_address(timeline_t *timeline, uint32_t id) {
+    return timeline->strings + timeline->string_offsets[id];
+}
+
+/*!
+ * @brief timeline_find looks for an address with a binary search in the dictionary
+ * @param timeline the store
+ * @param address the address to look for
+ * @return the address id, -1 if it is not in the store
+ */
+int64_t timeline_find(timeline_t *timeline, const char *address) {
+    int64_t low = 0, high = (int64_t) timeline->header->addresses_count - 1;
+    while (low <= high) {
+        int64_t middle = low + (high - low) / 2;
+        int comparison = strcmp(timeline_address(timeline, middle), address);
+        if (comparison == 0) {
+            return middle;
+        }
+        if (comparison < 0) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return -1;
+}
+
+/*!
+ * @brief read_varint decodes the next varint of a column
+ * @param cursor the position in the column, moved after the varint
+ * @return the value
+ */
+static inline uint64_t read_varint(const uint8_t **cursor) {
+    uint64_t value = 0;
+    unsigned shift = 0;
+    uint8_t byte;
+    do {
+        byte = *(*cursor)++;
+        value |= (uint64_t) (byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return value;
+}
+
+/*!
+ * @brief skip_varints moves a column cursor after some varints, without decoding them
+ * @param cursor the position in the column, moved after the varints
+ * @param count the number of varints to skip
+ */
+static inline void skip_varints(const uint8_t **cursor, uint64_t count) {
+    while (count > 0) {
+        if (!(*(*cursor)++ & 0x80)) {
+            --count;
+        }
+    }
+}
+
+/*!
+ * @brief timeline_scan sums up the mails of a window and visits its points. Rows of the other senders are not read,
+ * and the points of the other recipients are skipped without being decoded.
+ * @param timeline the store
+ * @param window the window: days, and a sender or a recipient or both
+ * @param visit the function receiving the points of the window, NULL for the sum only
+ * @param context the context given to visit
+ * @return the sum of the counts of the window
+ */
+uint64_t timeline_scan(timeline_t *timeline, timeline_window_t *window, timeline_visit_t visit, void *context) {
+    const timeline_header_t *header = timeline->header;
+    uint32_t first_row = 0, last_row = header->senders_count;
+    if (window->sender != TIMELINE_ANY) {
+        // Binary search of the row of the sender
+        uint32_t low = 0, high = header->senders_count;
+        while (low < high) {
+            uint32_t middle = low + (high - low) / 2;
+            if (timeline->senders[middle].sender < window->sender) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        first_row = low;
+        last_row = low < header->senders_count && timeline->senders[low].sender == window->sender ? low + 1 : low;
+    }
+    uint64_t total = 0;
+    for (uint32_t r = first_row; r < last_row; ++r) {
+        const timeline_sender_t *row = &timeline->senders[r];
+        const uint8_t *recipients = timeline->recipients + row->recipients, *lengths = timeline->lengths + row->lengths;
+        const uint8_t *days = timeline->days + row->days, *counts = timeline->counts + row->counts;
+        uint32_t recipient = 0;
+        for (uint32_t e = 0; e < row->edges_count; ++e) {
+            recipient += (uint32_t) read_varint(&recipients);
+            uint64_t points = read_varint(&lengths);
+            if (window->recipient != TIMELINE_ANY && recipient != window->recipient) {
+                skip_varints(&days, points);
+                skip_varints(&counts, points);
+                continue;
+            }
+            int32_t day = header->first_day;
+            for (uint64_t p = 0; p < points; ++p) {
+                day += (int32_t) read_varint(&days);
+                uint64_t count = read_varint(&counts);
+                if (day >= window->first_day && day <= window->last_day) {
+                    total += count;
+                    if (visit) {
+                        visit(context, row->sender, recipient, day, count);
+                    }
+                }
+            }
+        }
+    }
+    return total;
+}
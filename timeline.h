@@ -0,0 +1,97 @@
+//
+// Created on 19/10/26.
+//
+
+#ifndef A2022_TIMELINE_H
+#define A2022_TIMELINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "header_reader.h"
+
+#define TIMELINE_MAGIC "LP25TSC1"
+// The mapper writes the UTC day of each mail with recipients to step2_output as a line "\t@day <day> <sender>
+// <recipients>" (@see plugins.h for the lines starting with a tab), days being counted from 1970-01-01
+#define TIMELINE_LINE_TAG "@day"
+#define TIMELINE_ANY UINT32_MAX // Window on all senders or all recipients
+
+// On-disk layout: this header, then the sections at the given offsets (all 8 bytes aligned). Addresses are sorted,
+// their id is their rank. Each (sender, recipient, day) point with at least one mail is stored in columns: edges are
+// sorted by sender then recipient, the points of an edge by day. The sender column is run-length encoded as the
+// senders table (one row per sender, with the position of its first edge in each column); the other columns are
+// LEB128 varints, delta encoded: recipient ids from the previous edge of the sender, days from the previous point of
+// the edge (from first_day for the first one). A window on one sender only decodes the rows of this sender.
+typedef struct {
+    char magic[8];
+    uint32_t addresses_count;
+    uint32_t senders_count;
+    uint64_t edges_count;
+    uint64_t points_count;
+    uint64_t total;          // Sum of the counts (mails times recipients)
+    int32_t first_day;
+    int32_t last_day;
+    uint64_t string_offsets; // uint64_t[addresses_count + 1], offsets in the strings section
+    uint64_t strings;        // NUL-terminated addresses
+    uint64_t senders;        // timeline_sender_t[senders_count], sorted by sender
+    uint64_t recipients;     // Varints: recipient id delta, one per edge
+    uint64_t lengths;        // Varints: points of the edge, one per edge
+    uint64_t days;           // Varints: day delta, one per point
+    uint64_t counts;         // Varints: mails, one per point
+    uint64_t columns_size;   // Size of each column, in the same order
+    uint64_t file_size;
+} timeline_header_t;
+
+typedef struct {
+    uint32_t sender;
+    uint32_t edges_count;
+    uint64_t recipients; // Offsets of the first edge of the sender in the columns
+    uint64_t lengths;
+    uint64_t days;
+    uint64_t counts;
+} timeline_sender_t;
+
+typedef struct {
+    void *mapping;
+    size_t size;
+    const timeline_header_t *header;
+    const uint64_t *string_offsets;
+    const char *strings;
+    const timeline_sender_t *senders;
+    const uint8_t *recipients;
+    const uint8_t *lengths;
+    const uint8_t *days;
+    const uint8_t *counts;
+} timeline_t;
+
+typedef struct {
+    int32_t first_day; // Both included
+    int32_t last_day;
+    uint32_t sender;    // TIMELINE_ANY for all senders
+    uint32_t recipient; // TIMELINE_ANY for all recipients
+} timeline_window_t;
+
+/*!
+ * @brief timeline_visit_t receives the points of a scan, by sender, recipient then day
+ * @param context the context given to the scan
+ * @param sender the sender id
+ * @param recipient the recipient id
+ * @param day the day
+ * @param count the mails of the day
+ */
+typedef void (*timeline_visit_t)(void *context, uint32_t sender, uint32_t recipient, int32_t day, uint64_t count);
+
+void set_timeline_lines_written(bool written);
+bool are_timeline_lines_written();
+bool write_timeline_line(growable_buffer_t *lines, char *sender, const char *recipients, size_t length, int32_t day);
+bool write_timeline(char *temp_file, char *path, double scale);
+
+bool timeline_open(timeline_t *timeline, char *path);
+void timeline_close(timeline_t *timeline);
+int64_t timeline_find(timeline_t *timeline, const char *address);
+const char *timeline_address(timeline_t *timeline, uint32_t id);
+uint64_t timeline_scan(timeline_t *timeline, timeline_window_t *window, timeline_visit_t visit, void *context);
+
+#endif //A2022_TIMELINE_H
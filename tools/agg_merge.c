@@ -0,0 +1,85 @@
+//
+// Created on 19/10/26.
+//
+
+// Combines the aggregate files of several runs (-A option), e.g. one run per part of the corpus or per host, into one
+// aggregate, and writes an aggregate as the text output of a run. Files are streamed: memory does not grow with the
+// number of triples.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "aggregate.h"
+
+/*!
+ * @brief usage prints the command line help
+ * @param program the program name
+ */
+static void usage(char *program) {
+    printf("Usage: %s -o <merged_aggregate> <aggregate>...\n", program);
+    printf("       %s -t <output_file> [-k <top_k>] <aggregate>\n", program);
+    printf("       %s -s <aggregate>...\n", program);
+}
+
+/*!
+ * @brief print_stats prints the header of an aggregate file
+ * @param path the file path
+ * @return 0 for an aggregate file, 1 else
+ */
+static int print_stats(char *path) {
+    aggregate_reader_t *reader = malloc(sizeof(aggregate_reader_t));
+    if (!reader || !aggregate_reader_open(reader, path)) {
+        free(reader);
+        return 1;
+    }
+    printf("%s: %u addresses, %lu triples, %lu runs%s\n", path, reader->header.addresses_count,
+           (unsigned long) reader->header.triples_count, (unsigned long) reader->header.runs,
+           reader->header.flags & AGGREGATE_APPROXIMATE ? ", approximate counts" : "");
+    aggregate_reader_close(reader);
+    free(reader);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    char *merged = NULL, *text = NULL;
+    bool is_stats = false;
+    uint32_t top_k = 0;
+    int option;
+    while ((option = getopt(argc, argv, "o:t:k:s")) != -1) {
+        switch (option) {
+            case 'o':
+                merged = optarg;
+                break;
+            case 't':
+                text = optarg;
+                break;
+            case 'k':
+                top_k = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                is_stats = true;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    int inputs_count = argc - optind;
+    if ((merged != NULL) + (text != NULL) + is_stats != 1 || inputs_count < 1 || (text && inputs_count != 1)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (is_stats) {
+        int result = 0;
+        for (int i = optind; i < argc; ++i) {
+            result |= print_stats(argv[i]);
+        }
+        return result;
+    }
+    if (text) {
+        return write_aggregate_text(argv[optind], text, top_k) ? 0 : 1;
+    }
+    return merge_aggregates(&argv[optind], inputs_count, merged) ? 0 : 1;
+}
@@ -0,0 +1,75 @@
+//
+// Created on 19/10/26.
+//
+
+// Reads the files written with compression (-z option): prints their decompressed content, like cat, or the sizes of
+// their blocks. Plain files are printed as they are.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "block_file.h"
+
+/*!
+ * @brief usage prints the command line help
+ * @param program the program name
+ */
+static void usage(char *program) {
+    printf("Usage: %s <file>...\n", program);
+    printf("       %s -s <file>...\n", program);
+}
+
+/*!
+ * @brief print_file copies the decompressed content of a file to the standard output
+ * @param path the file path
+ * @return 0 on success, 1 if the file could not be read
+ */
+static int print_file(char *path) {
+    FILE *file = block_file_open(path, "r");
+    if (!file) {
+        perror(path);
+        return 1;
+    }
+    char buffer[BLOCK_FILE_SIZE];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        fwrite(buffer, 1, length, stdout);
+    }
+    int result = ferror(file) ? 1 : 0;
+    if (result) {
+        fprintf(stderr, "%s: truncated or corrupted block\n", path);
+    }
+    fclose(file);
+    return result;
+}
+
+/*!
+ * @brief print_stats prints the blocks count and the compression ratio of a file
+ * @param path the file path
+ * @return 0 for a block file, 1 else
+ */
+static int print_stats(char *path) {
+    block_file_stats_t stats;
+    if (!block_file_stat(path, &stats)) {
+        printf("%s: not a block file\n", path);
+        return 1;
+    }
+    printf("%s: %lu blocks, %lu bytes compressed to %lu (ratio %.2f)\n", path, (unsigned long) stats.blocks,
+           (unsigned long) stats.raw_bytes, (unsigned long) stats.packed_bytes,
+           (double) stats.raw_bytes / stats.packed_bytes);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    bool is_stats = argc > 1 && strcmp(argv[1], "-s") == 0;
+    int first = is_stats ? 2 : 1;
+    if (argc <= first) {
+        usage(argv[0]);
+        return 1;
+    }
+    int result = 0;
+    for (int i = first; i < argc; ++i) {
+        result |= is_stats ? print_stats(argv[i]) : print_file(argv[i]);
+    }
+    return result;
+}
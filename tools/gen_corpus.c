@@ -0,0 +1,405 @@
+//
+// Created on 19/10/26.
+//
+
+// Synthetic Enron-like corpus generator. It builds a maildir tree (user directories, nested folders, numbered mail
+// files) whose content is fully determined by the seed, so that benchmark runs on different machines are comparable.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#define PATH_LEN 4096
+
+typedef struct {
+    char output_directory[PATH_LEN];
+    uint32_t users_count;
+    uint32_t mails_count;
+    double zipf_exponent;
+    double mean_recipients;
+    uint32_t max_recipients;
+    double broadcast_probability;
+    uint32_t addresses_per_line;
+    double long_line_probability;
+    uint32_t external_addresses;
+    uint64_t seed;
+} generator_config_t;
+
+static const char *first_names[] = {
+    "phillip", "john", "jeff", "sally", "kay", "vince", "louise", "mark", "richard", "susan", "greg", "tana",
+    "steven", "kate", "chris", "james", "sara", "mike", "kim", "eric", "lynn", "gerald", "darron", "andrea",
+};
+static const char *last_names[] = {
+    "allen", "arnold", "badeer", "bailey", "bass", "baughman", "beck", "benson", "blair", "brawner", "buy",
+    "campbell", "carson", "cash", "causholli", "corman", "crandell", "cuilla", "dasovich", "davis", "dean",
+    "delainey", "derrick", "dickson", "donohoe", "dorland", "ermis", "farmer", "fischer", "forney", "fossum",
+    "gang", "gay", "geaccone", "germany", "gilbertsmith", "giron", "griffith", "grigsby", "guzman", "haedicke",
+    "hain", "harris", "hayslett", "heard", "hendrickson", "hernandez", "hodge", "holst", "horton", "hyatt",
+    "hyvl", "jones", "kaminski", "kean", "keavey", "keiser", "king", "kitchen", "kuykendall", "lavorato",
+    "lay", "lenhart", "lewis", "lokay", "lokey", "love", "lucci", "maggi", "mann", "martin", "may", "mccarty",
+    "mcconnell", "mckay", "mclaughlin", "merriss", "meyers", "mims", "motley", "neal", "nemec", "panus",
+    "parks", "pereira", "perlingiere", "persson", "phanis", "pimenov", "platter", "presto", "quenet",
+    "quigley", "rapp", "reitmeyer", "richey", "ring", "rodrique", "rogers", "ruscitti", "sager", "saibi",
+    "salisbury", "sanchez", "sanders", "scholtes", "schoolcraft", "schwieger", "scott", "semperger", "shackleton",
+    "shankman", "shapiro", "shively", "skilling", "slinger", "smith", "solberg", "south", "staab", "stclair",
+    "steffes", "stepenovitch", "stokley", "storey", "sturm", "swerzbin", "symes", "taylor", "tholt", "thomas",
+    "townsend", "tycholiz", "ward", "watson", "weldon", "whalley", "whalley", "white", "whitt", "williams",
+    "wolfe", "ybarbo", "zipper", "zufferli",
+};
+static const char *external_domains[] = {
+    "aol.com", "hotmail.com", "yahoo.com", "dynegy.com", "elpaso.com", "reliant.com", "caiso.com", "ferc.gov",
+};
+static const char *folders[] = {
+    "all_documents", "inbox", "sent", "sent_items", "_sent_mail", "notes_inbox", "discussion_threads",
+    "deleted_items", "calendar", "contacts", "archive/2000", "archive/2001", "projects/california/ferc",
+};
+static const char *weekdays[] = {"Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun"};
+static const char *months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+
+/*!
+ * @brief next_random is a splitmix64 step: small, fast and identical on every platform, which is all we need to
+ * make the corpus reproducible from its seed.
+ * @param state the generator state, updated in place
+ * @return the next 64 bits random value
+ */
+static uint64_t next_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/*!
+ * @brief random_unit returns a uniform double in [0, 1)
+ * @param state the generator state
+ * @return the random value
+ */
+static double random_unit(uint64_t *state) {
+    return (double) (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*!
+ * @brief random_below returns a uniform integer in [0, bound)
+ * @param state the generator state
+ * @param bound the exclusive upper bound (must be > 0)
+ * @return the random value
+ */
+static uint32_t random_below(uint64_t *state, uint32_t bound) {
+    return (uint32_t) (random_unit(state) * bound);
+}
+
+/*!
+ * @brief make_directories creates a directory and all its missing parents (as mkdir -p)
+ * @param path the directory to create
+ * @return true if the directory exists on return, false else
+ */
+static bool make_directories(const char *path) {
+    char buffer[PATH_LEN];
+    strncpy(buffer, path, PATH_LEN - 1);
+    buffer[PATH_LEN - 1] = '\0';
+    for (char *cursor = buffer + 1; *cursor; ++cursor) {
+        if (*cursor == '/') {
+            *cursor = '\0';
+            if (mkdir(buffer, 0755) == -1 && errno != EEXIST) {
+                return false;
+            }
+            *cursor = '/';
+        }
+    }
+    return mkdir(buffer, 0755) == 0 || errno == EEXIST;
+}
+
+/*!
+ * @brief zipf_mailbox_sizes splits the mails count among users following a Zipf law of exponent s: user of rank i
+ * gets a share proportional to 1/(i+1)^s. Every user gets at least one mail. Ranks are shuffled so that the largest
+ * mailboxes are not all at the beginning of the directory listing.
+ * @param config the generator configuration
+ * @param state the generator state
+ * @return a malloc'ed array of users_count mailbox sizes
+ */
+static uint32_t *zipf_mailbox_sizes(generator_config_t *config, uint64_t *state) {
+    uint32_t *sizes = malloc(config->users_count * sizeof(uint32_t));
+    double *weights = malloc(config->users_count * sizeof(double));
+    double total = 0.0;
+    for (uint32_t i = 0; i < config->users_count; ++i) {
+        weights[i] = 1.0 / pow((double) (i + 1), config->zipf_exponent);
+        total += weights[i];
+    }
+    uint32_t remaining = config->mails_count;
+    for (uint32_t i = 0; i < config->users_count; ++i) {
+        uint32_t share = (uint32_t) (config->mails_count * weights[i] / total);
+        sizes[i] = share > 0 ? share : 1;
+        remaining = remaining > sizes[i] ? remaining - sizes[i] : 0;
+    }
+    sizes[0] += remaining; // Rounding leftovers go to the largest mailbox
+    for (uint32_t i = config->users_count - 1; i > 0; --i) {
+        uint32_t j = random_below(state, i + 1);
+        uint32_t swap = sizes[i];
+        sizes[i] = sizes[j];
+        sizes[j] = swap;
+    }
+    free(weights);
+    return sizes;
+}
+
+/*!
+ * @brief pick_address writes a random address into the destination: most addresses are users of the corpus (so
+ * that the communication graph is dense), the others come from a fixed pool of external correspondents.
+ * @param config the generator configuration
+ * @param state the generator state
+ * @param destination the buffer receiving the address
+ * @param size the destination size
+ */
+static void pick_address(generator_config_t *config, uint64_t *state, char *destination, size_t size) {
+    if (random_unit(state) < 0.8) {
+        uint32_t user = random_below(state, config->users_count);
+        snprintf(destination, size, "%s.%s@enron.com", first_names[user % ARRAY_LEN(first_names)],
+                 last_names[(user / ARRAY_LEN(first_names) + user) % ARRAY_LEN(last_names)]);
+    } else {
+        uint32_t external = random_below(state, config->external_addresses);
+        snprintf(destination, size, "contact%u@%s", external, external_domains[external % ARRAY_LEN(external_domains)]);
+    }
+}
+
+/*!
+ * @brief recipients_count draws the number of recipients of a mail: a geometric law of the configured mean, with
+ * occasional broadcasts to a large list (which are the mails producing very long To: headers).
+ * @param config the generator configuration
+ * @param state the generator state
+ * @return the number of recipients (at least 1, at most max_recipients)
+ */
+static uint32_t recipients_count(generator_config_t *config, uint64_t *state) {
+    uint32_t count;
+    if (random_unit(state) < config->broadcast_probability) {
+        uint32_t low = config->max_recipients / 4 + 1;
+        count = low + random_below(state, config->max_recipients - low + 1);
+    } else {
+        double p = 1.0 / config->mean_recipients;
+        count = 1 + (uint32_t) (log(1.0 - random_unit(state)) / log(1.0 - (p < 1.0 ? p : 0.999)));
+    }
+    return count > config->max_recipients ? config->max_recipients : count;
+}
+
+/*!
+ * @brief write_address_field writes a To:, Cc: or Bcc: field the way Outlook exports did in the Enron corpus:
+ * addresses separated by ", " and folded on continuation lines starting with a tab. When unfolded is true, all
+ * addresses are written on a single (possibly very long) line.
+ * @param mail the mail file
+ * @param name the field name (e.g. "To")
+ * @param addresses the addresses to write
+ * @param count the number of addresses
+ * @param per_line the number of addresses before folding
+ * @param unfolded true to disable folding
+ */
+static void write_address_field(FILE *mail, const char *name, char addresses[][128], uint32_t count, uint32_t per_line,
+                                bool unfolded) {
+    fprintf(mail, "%s: ", name);
+    for (uint32_t i = 0; i < count; ++i) {
+        fputs(addresses[i], mail);
+        if (i + 1 < count) {
+            fputc(',', mail);
+            fputs((!unfolded && (i + 1) % per_line == 0) ? "\n\t" : " ", mail);
+        }
+    }
+    fputc('\n', mail);
+}
+
+/*!
+ * @brief write_mail writes one mail file, with a header close to the Enron one (From, To, Subject, Cc, Bcc and the
+ * X- fields which must not be mistaken for recipient fields)
+ * @param config the generator configuration
+ * @param state the generator state
+ * @param path the mail file path
+ * @param owner the mailbox owner address
+ * @param owner_name the mailbox owner directory name
+ * @param folder the folder of the mail
+ * @param index the mail index in the corpus (used for Message-ID and Date)
+ * @return true if the mail was written, false else
+ */
+static bool write_mail(generator_config_t *config, uint64_t *state, const char *path, const char *owner,
+                       const char *owner_name, const char *folder, uint64_t index) {
+    FILE *mail = fopen(path, "w");
+    if (!mail) {
+        return false;
+    }
+    static char addresses[1024][128];
+    char sender[128];
+    if (strstr(folder, "sent") || random_unit(state) < 0.3) {
+        strncpy(sender, owner, sizeof(sender));
+    } else {
+        pick_address(config, state, sender, sizeof(sender));
+    }
+    bool unfolded = random_unit(state) < config->long_line_probability;
+    uint32_t count = recipients_count(config, state);
+    if (unfolded && count < 64) {
+        count = config->max_recipients < 64 ? config->max_recipients : 64; // Makes the To: line longer than 1 KiB
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        pick_address(config, state, addresses[i], sizeof(addresses[i]));
+    }
+    // Split recipients between To, Cc and Bcc (Outlook duplicated Cc into Bcc, so does the generator)
+    uint32_t to_count = count, cc_count = 0;
+    if (count > 1 && random_unit(state) < 0.3) {
+        cc_count = 1 + random_below(state, count - 1);
+        to_count = count - cc_count;
+    }
+
+    uint32_t day = (uint32_t) (index * 7919 % 1096);
+    fprintf(mail, "Message-ID: <%llu.%u.JavaMail.evans@thyme>\n", (unsigned long long) index,
+            (uint32_t) (next_random(state) % 10000000));
+    fprintf(mail, "Date: %s, %u %s %u %02u:%02u:00 -0%u00 (P%cT)\n", weekdays[day % 7], 1 + day % 28,
+            months[(day / 28) % 12], 1999 + day / 365, random_below(state, 24), random_below(state, 60),
+            7 + (day / 28) % 2, (day / 28) % 2 ? 'S' : 'D');
+    fprintf(mail, "From: %s\n", sender);
+    write_address_field(mail, "To", addresses, to_count, config->addresses_per_line, unfolded);
+    if (unfolded && random_unit(state) < 0.5) {
+        // Pathological subject line, well above the 1 KiB line buffer of the parser
+        fputs("Subject: RE: ", mail);
+        for (int i = 0; i < 96; ++i) {
+            fputs("FW: update ", mail);
+        }
+        fputc('\n', mail);
+    } else {
+        fprintf(mail, "Subject: Re: report %llu\n", (unsigned long long) (next_random(state) % 100000));
+    }
+    if (cc_count > 0) {
+        write_address_field(mail, "Cc", addresses + to_count, cc_count, config->addresses_per_line, unfolded);
+    }
+    fputs("Mime-Version: 1.0\nContent-Type: text/plain; charset=us-ascii\nContent-Transfer-Encoding: 7bit\n", mail);
+    if (cc_count > 0) {
+        write_address_field(mail, "Bcc", addresses + to_count, cc_count, config->addresses_per_line, unfolded);
+    }
+    fprintf(mail, "X-From: %s\nX-To: %s\nX-cc: \nX-bcc: \n", sender, addresses[0]);
+    fprintf(mail, "X-Folder: \\%s\\%s\nX-Origin: %s\nX-FileName: %s.nsf\n\n", owner_name, folder, owner_name, owner_name);
+    fprintf(mail, "To: this.line@is.in.the.body.com\nHello,\n\nPlease find the report attached.\n\n-- \n%s\n", sender);
+    fclose(mail);
+    return true;
+}
+
+/*!
+ * @brief generate_corpus writes the whole maildir tree
+ * @param config the generator configuration
+ * @return 0 on success, 1 on error
+ */
+static int generate_corpus(generator_config_t *config) {
+    uint64_t state = config->seed;
+    if (!make_directories(config->output_directory)) {
+        perror(config->output_directory);
+        return 1;
+    }
+    uint32_t *sizes = zipf_mailbox_sizes(config, &state);
+    uint64_t mail_index = 0;
+    char path[2 * PATH_LEN];
+    for (uint32_t user = 0; user < config->users_count; ++user) {
+        const char *first = first_names[user % ARRAY_LEN(first_names)];
+        const char *last = last_names[(user / ARRAY_LEN(first_names) + user) % ARRAY_LEN(last_names)];
+        char owner[128], owner_name[128];
+        snprintf(owner, sizeof(owner), "%s.%s@enron.com", first, last);
+        snprintf(owner_name, sizeof(owner_name), "%s-%c-%u", last, first[0], user);
+
+        uint32_t folders_count = 1 + random_below(&state, 4);
+        uint32_t first_folder = random_below(&state, ARRAY_LEN(folders));
+        uint32_t written = 0;
+        for (uint32_t f = 0; f < folders_count && written < sizes[user]; ++f) {
+            const char *folder = folders[(first_folder + f) % ARRAY_LEN(folders)];
+            snprintf(path, sizeof(path), "%s/%s/%s", config->output_directory, owner_name, folder);
+            if (!make_directories(path)) {
+                perror(path);
+                free(sizes);
+                return 1;
+            }
+            uint32_t in_folder = (f + 1 == folders_count) ? sizes[user] - written : (sizes[user] - written) / 2 + 1;
+            for (uint32_t m = 1; m <= in_folder; ++m) {
+                snprintf(path, sizeof(path), "%s/%s/%s/%u.", config->output_directory, owner_name, folder, m);
+                if (!write_mail(config, &state, path, owner, owner_name, folder, mail_index++)) {
+                    perror(path);
+                    free(sizes);
+                    return 1;
+                }
+            }
+            written += in_folder;
+        }
+    }
+    free(sizes);
+    printf("Generated %llu mails for %u users in %s\n", (unsigned long long) mail_index, config->users_count,
+           config->output_directory);
+    return 0;
+}
+
+static void usage(char *program) {
+    printf("Usage: %s -o <output_directory> [-u users] [-m mails] [-z zipf_exponent] [-r mean_recipients]\n"
+           "\t[-R max_recipients] [-b broadcast_probability] [-w addresses_per_line] [-l long_line_probability]\n"
+           "\t[-e external_addresses] [-s seed]\n", program);
+}
+
+int main(int argc, char *argv[]) {
+    generator_config_t config = {
+            .output_directory = "",
+            .users_count = 150,
+            .mails_count = 10000,
+            .zipf_exponent = 1.0,
+            .mean_recipients = 3.0,
+            .max_recipients = 300,
+            .broadcast_probability = 0.02,
+            .addresses_per_line = 4,
+            .long_line_probability = 0.05,
+            .external_addresses = 2000,
+            .seed = 42,
+    };
+    int opt;
+    while ((opt = getopt(argc, argv, "o:u:m:z:r:R:b:w:l:e:s:h")) != -1) {
+        switch (opt) {
+            case 'o':
+                strncpy(config.output_directory, optarg, PATH_LEN - 1);
+                break;
+            case 'u':
+                config.users_count = strtoul(optarg, NULL, 10);
+                break;
+            case 'm':
+                config.mails_count = strtoul(optarg, NULL, 10);
+                break;
+            case 'z':
+                config.zipf_exponent = strtod(optarg, NULL);
+                break;
+            case 'r':
+                config.mean_recipients = strtod(optarg, NULL);
+                break;
+            case 'R':
+                config.max_recipients = strtoul(optarg, NULL, 10);
+                break;
+            case 'b':
+                config.broadcast_probability = strtod(optarg, NULL);
+                break;
+            case 'w':
+                config.addresses_per_line = strtoul(optarg, NULL, 10);
+                break;
+            case 'l':
+                config.long_line_probability = strtod(optarg, NULL);
+                break;
+            case 'e':
+                config.external_addresses = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                config.seed = strtoull(optarg, NULL, 10);
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (config.output_directory[0] == '\0' || config.users_count == 0 || config.mails_count < config.users_count ||
+        config.mean_recipients < 1.0 || config.max_recipients == 0 || config.max_recipients > 1024 ||
+        config.addresses_per_line == 0 || config.external_addresses == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    return generate_corpus(&config);
+}
@@ -0,0 +1,112 @@
+//
+// Created on 19/10/26.
+//
+
+// Queries on the binary graph index written by the reducer (-i option), without loading the text output: the index
+// is mapped in memory and addresses are found by binary search in its sorted dictionary.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "graph_index.h"
+#include "metrics.h"
+
+#define DEFAULT_TOP_COUNT 10
+
+/*!
+ * @brief usage prints the command line help
+ * @param program the program name
+ */
+static void usage(char *program) {
+    printf("Usage: %s <index_file> stats\n", program);
+    printf("       %s <index_file> out-degree|in-degree <address>\n", program);
+    printf("       %s <index_file> top-recipients|top-senders <address> [<n>]\n", program);
+}
+
+/*!
+ * @brief print_degree prints the number of distinct neighbours of an address and the total of their counts
+ * @param index the index
+ * @param id the address id
+ * @param row_index the CSR index array (out_index or in_index)
+ * @param counts the CSR counts array (out_counts or in_counts)
+ * @param label the degree name
+ */
+static void print_degree(graph_index_t *index, uint32_t id, const uint64_t *row_index, const uint32_t *counts,
+                         char *label) {
+    uint64_t mails = 0;
+    for (uint64_t e = row_index[id]; e < row_index[id + 1]; ++e) {
+        mails += counts[e];
+    }
+    printf("%s %s: %lu addresses, %lu mails\n", graph_index_address(index, id), label,
+           (unsigned long) (row_index[id + 1] - row_index[id]), (unsigned long) mails);
+}
+
+/*!
+ * @brief print_top prints the n first neighbours of an address. Edges are stored by decreasing count, so this reads
+ * the n first edges of the row only.
+ * @param index the index
+ * @param id the address id
+ * @param row_index the CSR index array
+ * @param targets the CSR targets array
+ * @param counts the CSR counts array
+ * @param n the maximum number of neighbours to print
+ */
+static void print_top(graph_index_t *index, uint32_t id, const uint64_t *row_index, const uint32_t *targets,
+                      const uint32_t *counts, uint64_t n) {
+    uint64_t end = row_index[id + 1];
+    if (end - row_index[id] > n) {
+        end = row_index[id] + n;
+    }
+    for (uint64_t e = row_index[id]; e < end; ++e) {
+        printf("%u %s\n", counts[e], graph_index_address(index, targets[e]));
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    graph_index_t index;
+    uint64_t open_start = metrics_now_us();
+    if (!graph_index_open(&index, argv[1])) {
+        fprintf(stderr, "Cannot open graph index %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    uint64_t query_start = metrics_now_us();
+    char *command = argv[2];
+
+    if (strcmp(command, "stats") == 0) {
+        printf("%u addresses, %lu edges, %lu bytes\n", index.header->addresses_count,
+               (unsigned long) index.header->edges_count, (unsigned long) index.size);
+    } else if (argc >= 4) {
+        int64_t id = graph_index_find(&index, argv[3]);
+        uint64_t n = argc >= 5 ? strtoull(argv[4], NULL, 10) : DEFAULT_TOP_COUNT;
+        if (id < 0) {
+            printf("%s: unknown address\n", argv[3]);
+        } else if (strcmp(command, "out-degree") == 0) {
+            print_degree(&index, id, index.out_index, index.out_counts, "out-degree");
+        } else if (strcmp(command, "in-degree") == 0) {
+            print_degree(&index, id, index.in_index, index.in_counts, "in-degree");
+        } else if (strcmp(command, "top-recipients") == 0) {
+            print_top(&index, id, index.out_index, index.out_targets, index.out_counts, n);
+        } else if (strcmp(command, "top-senders") == 0) {
+            print_top(&index, id, index.in_index, index.in_targets, index.in_counts, n);
+        } else {
+            usage(argv[0]);
+            graph_index_close(&index);
+            return EXIT_FAILURE;
+        }
+    } else {
+        usage(argv[0]);
+        graph_index_close(&index);
+        return EXIT_FAILURE;
+    }
+
+    uint64_t end = metrics_now_us();
+    fprintf(stderr, "open: %lu us, query: %lu us\n", (unsigned long) (query_start - open_start),
+            (unsigned long) (end - query_start));
+    graph_index_close(&index);
+    return EXIT_SUCCESS;
+}
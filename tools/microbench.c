@@ -0,0 +1,533 @@
+//
+// Created on 19/10/26.
+//
+
+// Micro-benchmarks of the hot paths of the mapper, run on a maildir tree (e.g. generated by gen_corpus) outside of the
+// whole pipeline, so that a change can be measured in isolation. Each subcommand prints its throughput.
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "analysis.h"
+#include "block_file.h"
+#include "header_reader.h"
+#include "metrics.h"
+#include "normalization.h"
+#include "utility.h"
+
+typedef struct {
+    char **paths;
+    size_t count;
+    size_t capacity;
+} paths_list_t;
+
+typedef struct {
+    char *name;
+    char *description;
+    int (*run)(char *root, paths_list_t *files, int repeats);
+} benchmark_t;
+
+// Files found by the tree walk (nftw callbacks have no user argument)
+static paths_list_t corpus_files;
+
+// Allocations made by the library code linked in this program (see the --wrap linker options in the Makefile). Those
+// made inside the C library itself (e.g. fopen buffers) are not counted.
+static uint64_t allocations_count = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    ++allocations_count;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    ++allocations_count;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size) {
+    ++allocations_count;
+    return __real_realloc(pointer, size);
+}
+
+/*!
+ * @brief collect_file adds each regular file of the tree to the corpus files list (nftw callback)
+ */
+static int collect_file(const char *path, const struct stat *status, int type, struct FTW *ftw) {
+    (void) status;
+    (void) ftw;
+    if (type != FTW_F) {
+        return 0;
+    }
+    if (corpus_files.count == corpus_files.capacity) {
+        corpus_files.capacity = corpus_files.capacity ? 2 * corpus_files.capacity : 1024;
+        corpus_files.paths = realloc(corpus_files.paths, corpus_files.capacity * sizeof(char *));
+        if (!corpus_files.paths) {
+            return -1;
+        }
+    }
+    corpus_files.paths[corpus_files.count++] = strdup(path);
+    return 0;
+}
+
+/*!
+ * @brief print_throughput prints the common results of a benchmark
+ * @param files the number of files processed
+ * @param bytes the number of bytes read
+ * @param elapsed_us the elapsed time
+ */
+static void print_throughput(size_t files, uint64_t bytes, uint64_t elapsed_us) {
+    double seconds = elapsed_us > 0 ? elapsed_us / 1e6 : 1e-6;
+    printf("%zu files, %.2f MiB in %.3f s: %.0f files/s, %.2f MiB/s\n", files, bytes / 1048576.0, seconds,
+           files / seconds, bytes / 1048576.0 / seconds);
+}
+
+/*!
+ * @brief bench_headers reads the header of every file with the unfolding header reader, reused across files, and
+ * counts fields and recipients
+ * @param files the corpus files
+ * @param repeats the number of passes over the corpus
+ * @return EXIT_SUCCESS
+ */
+static int bench_headers(char *root, paths_list_t *files, int repeats) {
+    (void) root;
+    header_reader_t reader = {0};
+    uint64_t bytes = 0, fields = 0, recipients = 0;
+    size_t longest_field = 0, processed = 0;
+    uint64_t start = metrics_now_us();
+    for (int pass = 0; pass < repeats; ++pass) {
+        for (size_t i = 0; i < files->count; ++i) {
+            FILE *file = fopen(files->paths[i], "r");
+            if (!file) {
+                continue;
+            }
+            char *name, *value;
+            header_reader_start(&reader, file);
+            while (header_reader_next(&reader, &name, &value)) {
+                ++fields;
+                if (reader.field.length > longest_field) {
+                    longest_field = reader.field.length;
+                }
+                if (strcasecmp(name, "To") == 0 || strcasecmp(name, "Cc") == 0 || strcasecmp(name, "Bcc") == 0) {
+                    ++recipients;
+                    for (char *comma = strchr(value, ','); comma; comma = strchr(comma + 1, ',')) {
+                        ++recipients;
+                    }
+                }
+            }
+            bytes += ftell(file);
+            ++processed;
+            fclose(file);
+        }
+    }
+    uint64_t elapsed = metrics_now_us() - start;
+    header_reader_free(&reader);
+    print_throughput(processed, bytes, elapsed);
+    printf("%lu fields, %lu recipients, longest unfolded field: %zu bytes\n", (unsigned long) fields,
+           (unsigned long) recipients, longest_field);
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * @brief bench_extract runs the mapper on every file (parse_file, output to /dev/null) and counts its allocations
+ * @param files the corpus files
+ * @param repeats the number of passes over the corpus
+ * @return EXIT_SUCCESS
+ */
+static int bench_extract(char *root, paths_list_t *files, int repeats) {
+    (void) root;
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < files->count; ++i) {
+        struct stat status;
+        if (stat(files->paths[i], &status) == 0) {
+            bytes += status.st_size;
+        }
+    }
+    uint64_t allocations_start = allocations_count;
+    uint64_t start = metrics_now_us();
+    for (int pass = 0; pass < repeats; ++pass) {
+        for (size_t i = 0; i < files->count; ++i) {
+            parse_file(files->paths[i], "/dev/null");
+        }
+    }
+    uint64_t elapsed = metrics_now_us() - start;
+    uint64_t allocations = allocations_count - allocations_start;
+    size_t processed = files->count * repeats;
+    print_throughput(processed, bytes * repeats, elapsed);
+    printf("%lu allocations (%.2f per file)\n", (unsigned long) allocations, (double) allocations / processed);
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * @brief legacy_parse_dir is the directory walk before the path builder: each entry path is rebuilt with concat_path
+ * in a fixed buffer, each subdirectory is opened by its full path
+ * @param path the directory path
+ * @param output_file the list output
+ */
+static void legacy_parse_dir(char *path, FILE *output_file) {
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return;
+    }
+    char entry_path[STR_MAX_LEN];
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_type == DT_DIR && strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+            concat_path(path, entry->d_name, entry_path);
+            legacy_parse_dir(entry_path, output_file);
+        } else if (entry->d_type == DT_REG) {
+            concat_path(path, entry->d_name, entry_path);
+            fprintf(output_file, "%s\n", entry_path);
+        }
+    }
+    closedir(dir);
+}
+
+/*!
+ * @brief bench_paths compares the path handling of the directory walk and of the opening of each mail before
+ * (concat_path, realpath of the mail and of the output, open by full path) and after (path builder, output resolved
+ * once, mails opened with openat relative to their cached directory)
+ * @param root the corpus root directory
+ * @param files the corpus files
+ * @param repeats the number of passes over the corpus
+ * @return EXIT_SUCCESS, EXIT_FAILURE if the scratch output cannot be created
+ */
+static int bench_paths(char *root, paths_list_t *files, int repeats) {
+    FILE *list = fopen("/dev/null", "w");
+    char output[] = "/tmp/microbench-paths-XXXXXX";
+    int output_fd = mkstemp(output);
+    if (!list || output_fd == -1) {
+        perror("Cannot create scratch files");
+        return EXIT_FAILURE;
+    }
+    close(output_fd);
+
+    uint64_t start = metrics_now_us();
+    for (int pass = 0; pass < repeats; ++pass) {
+        legacy_parse_dir(root, list);
+    }
+    uint64_t legacy_walk = metrics_now_us() - start;
+    start = metrics_now_us();
+    for (int pass = 0; pass < repeats; ++pass) {
+        parse_dir(root, list);
+    }
+    uint64_t walk = metrics_now_us() - start;
+
+    start = metrics_now_us();
+    for (int pass = 0; pass < repeats; ++pass) {
+        for (size_t i = 0; i < files->count; ++i) {
+            char resolved_file[STR_MAX_LEN], resolved_output[STR_MAX_LEN];
+            realpath(files->paths[i], resolved_file);
+            realpath(output, resolved_output);
+            FILE *file = fopen(resolved_file, "r");
+            FILE *output_file = fopen(resolved_output, "a");
+            if (file) {
+                fclose(file);
+            }
+            if (output_file) {
+                fclose(output_file);
+            }
+        }
+    }
+    uint64_t legacy_open = metrics_now_us() - start;
+    start = metrics_now_us();
+    for (int pass = 0; pass < repeats; ++pass) {
+        for (size_t i = 0; i < files->count; ++i) {
+            FILE *file = open_mail(files->paths[i]);
+            prepare_mail_output(output);
+            if (file) {
+                fclose(file);
+            }
+        }
+    }
+    uint64_t open = metrics_now_us() - start;
+    release_mail_caches();
+    unlink(output);
+    fclose(list);
+
+    double count = (double) files->count * repeats;
+    printf("walk: %.3f us per file with concat_path, %.3f us with the path builder\n", legacy_walk / count,
+           walk / count);
+    printf("open: %.3f us per file with realpath and full paths, %.3f us with cached paths and openat\n",
+           legacy_open / count, open / count);
+    return EXIT_SUCCESS;
+}
+
+/*!
+ * @brief bench_codec compresses and decompresses data by blocks, as the compressed intermediates are written and read
+ * @param name the data name
+ * @param data the data
+ * @param length the data length
+ * @param repeats the number of passes over the data
+ * @return true if all blocks were decompressed as they were, false else
+ */
+static bool bench_codec(char *name, char *data, size_t length, int repeats) {
+    char packed[BLOCK_FILE_SIZE], raw[BLOCK_FILE_SIZE];
+    uint64_t packed_bytes = 0, compress_us = 0, decompress_us = 0;
+    bool success = true;
+    for (int pass = 0; pass < repeats; ++pass) {
+        packed_bytes = 0;
+        for (size_t offset = 0; offset < length; offset += BLOCK_FILE_SIZE) {
+            size_t size = length - offset < BLOCK_FILE_SIZE ? length - offset : BLOCK_FILE_SIZE;
+            uint64_t start = metrics_now_us();
+            size_t packed_size = block_compress(data + offset, size, packed, size);
+            uint64_t middle = metrics_now_us();
+            bool is_same = packed_size == 0 || (block_decompress(packed, packed_size, raw, size) &&
+                                                memcmp(raw, data + offset, size) == 0);
+            success = success && is_same;
+            decompress_us += metrics_now_us() - middle;
+            compress_us += middle - start;
+            packed_bytes += sizeof(block_header_t) + (packed_size ? packed_size : size);
+        }
+    }
+    double mebibytes = (double) length * repeats / 1048576.0;
+    printf("%s: %.2f MiB, ratio %.2f, compression %.0f MiB/s, decompression %.0f MiB/s\n", name, length / 1048576.0,
+           packed_bytes ? (double) length / packed_bytes : 0, mebibytes / (compress_us > 0 ? compress_us / 1e6 : 1e-6),
+           mebibytes / (decompress_us > 0 ? decompress_us / 1e6 : 1e-6));
+    return success;
+}
+
+/*!
+ * @brief bench_blocks measures the compression of the intermediates (@see block_file.h) on the files list of the
+ * corpus and on the mapper output of its mails
+ * @param files the corpus files
+ * @param repeats the number of passes over the data
+ * @return EXIT_SUCCESS, EXIT_FAILURE if a block was not decompressed as it was
+ */
+static int bench_blocks(char *root, paths_list_t *files, int repeats) {
+    (void) root;
+    growable_buffer_t list = {0};
+    for (size_t i = 0; i < files->count; ++i) {
+        growable_buffer_append(&list, files->paths[i], strlen(files->paths[i]));
+        growable_buffer_append(&list, "\n", 1);
+    }
+    char output_path[] = "/tmp/microbench-XXXXXX";
+    int fd = mkstemp(output_path);
+    if (fd == -1) {
+        perror("Cannot create mapper output");
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < files->count; ++i) {
+        parse_file(files->paths[i], output_path);
+    }
+    release_mail_caches();
+    growable_buffer_t output = {0};
+    char chunk[BLOCK_FILE_SIZE];
+    ssize_t length;
+    while ((length = read(fd, chunk, sizeof(chunk))) > 0) {
+        growable_buffer_append(&output, chunk, length);
+    }
+    close(fd);
+    unlink(output_path);
+
+    bool success = bench_codec("files list", list.data, list.length, repeats) &&
+                   bench_codec("mapper output", output.data, output.length, repeats);
+    growable_buffer_free(&list);
+    growable_buffer_free(&output);
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*!
+ * @brief collect_addresses reads the raw addresses of the mails: the last word of From, and of each comma separated
+ * item of To, Cc and Bcc, as the mapper finds them
+ * @param files the corpus files
+ * @param addresses the list to fill
+ */
+static void collect_addresses(paths_list_t *files, address_list_t *addresses) {
+    header_reader_t reader = {0};
+    for (size_t i = 0; i < files->count; ++i) {
+        FILE *file = fopen(files->paths[i], "r");
+        if (!file) {
+            continue;
+        }
+        char *name, *value;
+        header_reader_start(&reader, file);
+        while (header_reader_next(&reader, &name, &value)) {
+            bool is_sender = strcasecmp(name, "From") == 0;
+            if (!is_sender && strcasecmp(name, "To") != 0 && strcasecmp(name, "Cc") != 0 &&
+                strcasecmp(name, "Bcc") != 0) {
+                continue;
+            }
+            for (char *item = strtok(value, is_sender ? "" : ","); item; item = strtok(NULL, is_sender ? "" : ",")) {
+                char *end = item + strlen(item);
+                while (end > item && isspace((unsigned char) end[-1])) {
+                    --end;
+                }
+                char *start = end;
+                while (start > item && !isspace((unsigned char) start[-1])) {
+                    --start;
+                }
+                if (end - start > 2) {
+                    address_list_add(addresses, start, end - start);
+                }
+            }
+        }
+        fclose(file);
+    }
+    header_reader_free(&reader);
+}
+
+/*!
+ * @brief decorate_addresses copies addresses, three out of four of them written as another variant of the address
+ * (angle brackets, upper case, quotes), so that they take the slow path of the normalization
+ * @param addresses the addresses
+ * @param variants the list to fill
+ */
+static void decorate_addresses(address_list_t *addresses, address_list_t *variants) {
+    char variant[STR_MAX_LEN + 2];
+    for (size_t i = 0; i < addresses->count; ++i) {
+        const char *address = addresses->addresses.data + addresses->spans[i].offset;
+        size_t length = addresses->spans[i].length < STR_MAX_LEN ? addresses->spans[i].length : STR_MAX_LEN - 1;
+        switch (i % 4) {
+            case 1:
+                snprintf(variant, sizeof(variant), "<%.*s>", (int) length, address);
+                break;
+            case 2:
+                for (size_t c = 0; c < length; ++c) {
+                    variant[c] = (char) toupper((unsigned char) address[c]);
+                }
+                variant[length] = '\0';
+                break;
+            case 3:
+                snprintf(variant, sizeof(variant), "'%.*s'", (int) length, address);
+                break;
+            default:
+                snprintf(variant, sizeof(variant), "%.*s", (int) length, address);
+        }
+        address_list_add(variants, variant, strlen(variant));
+    }
+}
+
+/*!
+ * @brief bench_normalize_pass normalizes a list of addresses and prints the throughput
+ * @param name the list name
+ * @param addresses the addresses
+ * @param is_cache_used true to use the cache of the normalization
+ * @param repeats the number of passes over the list
+ */
+static void bench_normalize_pass(char *name, address_list_t *addresses, bool is_cache_used, int repeats) {
+    set_normalization_cache_used(is_cache_used);
+    normalization_cache_free();
+    take_normalization_counts();
+    size_t total_length = 0;
+    uint64_t start = metrics_now_us();
+    for (int pass = 0; pass < repeats; ++pass) {
+        for (size_t i = 0; i < addresses->count; ++i) {
+            size_t length;
+            normalize_address(addresses->addresses.data + addresses->spans[i].offset, addresses->spans[i].length,
+                              &length);
+            total_length += length;
+        }
+    }
+    uint64_t elapsed = metrics_now_us() - start;
+    normalization_counts_t counts = take_normalization_counts();
+    double seconds = elapsed > 0 ? elapsed / 1e6 : 1e-6;
+    printf("%s, cache %s: %.1f M addresses/s (%.1f ns each), %.1f%% rewritten, %.1f%% cache hits\n", name,
+           is_cache_used ? "on" : "off", counts.addresses / seconds / 1e6, elapsed * 1e3 / (counts.addresses + 1),
+           100.0 * counts.rewritten / (counts.addresses + 1), 100.0 * counts.cache_hits / (counts.addresses + 1));
+    (void) total_length;
+}
+
+/*!
+ * @brief bench_normalize measures the normalization of the addresses (@see normalization.h), on the addresses of the
+ * corpus as they are and on variants of them, with and without the cache, with the aliases of NORMALIZE_ALIASES if
+ * this environment variable is set
+ * @param files the corpus files
+ * @param repeats the number of passes over the addresses
+ * @return EXIT_SUCCESS, EXIT_FAILURE if the aliases cannot be read
+ */
+static int bench_normalize(char *root, paths_list_t *files, int repeats) {
+    (void) root;
+    char *alias_file = getenv("NORMALIZE_ALIASES");
+    if (!aliases_load(alias_file ? alias_file : "")) {
+        return EXIT_FAILURE;
+    }
+    address_list_t addresses = {0}, variants = {0};
+    collect_addresses(files, &addresses);
+    decorate_addresses(&addresses, &variants);
+    printf("%zu addresses (%.2f MiB)%s\n", addresses.count, addresses.addresses.length / 1048576.0,
+           alias_file ? ", with aliases" : "");
+    uint64_t start = metrics_now_us();
+    address_list_t copy = {0};
+    for (int pass = 0; pass < repeats; ++pass) {
+        address_list_reset(&copy);
+        for (size_t i = 0; i < addresses.count; ++i) {
+            address_list_add(&copy, addresses.addresses.data + addresses.spans[i].offset, addresses.spans[i].length);
+        }
+    }
+    uint64_t elapsed = metrics_now_us() - start;
+    printf("copy to an address list (mapper baseline): %.1f M addresses/s\n",
+           (double) addresses.count * repeats / (elapsed > 0 ? elapsed : 1));
+    for (int cache = 0; cache <= 1; ++cache) {
+        bench_normalize_pass("as found", &addresses, cache, repeats);
+        bench_normalize_pass("variants", &variants, cache, repeats);
+    }
+    normalization_cache_free();
+    aliases_unload();
+    address_list_free(&addresses);
+    address_list_free(&variants);
+    address_list_free(&copy);
+    return EXIT_SUCCESS;
+}
+
+static benchmark_t benchmarks[] = {
+    {.name = "headers", .description = "header fields tokenizer (unfolding, reused buffers)", .run = bench_headers},
+    {.name = "extract", .description = "mapper (parse_file) time and allocations per mail", .run = bench_extract},
+    {.name = "paths", .description = "directory walk and mail opening, before and after path caching", .run = bench_paths},
+    {.name = "blocks", .description = "compression ratio and speed of the intermediates", .run = bench_blocks},
+    {.name = "normalize", .description = "addresses normalization, with and without its cache", .run = bench_normalize},
+};
+
+#define BENCHMARKS_COUNT (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+/*!
+ * @brief usage prints the command line help with the list of benchmarks
+ * @param program the program name
+ */
+static void usage(char *program) {
+    printf("Usage: %s <benchmark> <maildir> [<repeats>]\n", program);
+    for (size_t i = 0; i < BENCHMARKS_COUNT; ++i) {
+        printf("\t%-10s %s\n", benchmarks[i].name, benchmarks[i].description);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    benchmark_t *benchmark = NULL;
+    for (size_t i = 0; i < BENCHMARKS_COUNT; ++i) {
+        if (strcmp(argv[1], benchmarks[i].name) == 0) {
+            benchmark = &benchmarks[i];
+        }
+    }
+    if (!benchmark) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (nftw(argv[2], collect_file, 64, FTW_PHYS) != 0 || corpus_files.count == 0) {
+        fprintf(stderr, "Cannot read files from %s\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+    int repeats = argc >= 4 ? atoi(argv[3]) : 1;
+    int result = benchmark->run(argv[2], &corpus_files, repeats > 0 ? repeats : 1);
+
+    for (size_t i = 0; i < corpus_files.count; ++i) {
+        free(corpus_files.paths[i]);
+    }
+    free(corpus_files.paths);
+    return result;
+}
@@ -0,0 +1,72 @@
+//
+// Created on 19/10/26.
+//
+
+// Remote worker of the tcp method: connects to the coordinator (main built with TCP=1, started with --listen and
+// --remote-workers) and runs the tasks it sends until told to stop. The data source must be mounted at the same path
+// as on the coordinator host, and the plugins, the timeline option and the alias file must be the ones of the
+// coordinator. The shared token, if the coordinator has one, is read from LP25_TCP_TOKEN (@see TCP_TOKEN_VARIABLE).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "normalization.h"
+#include "plugins.h"
+#include "tcp_processes.h"
+#include "timeline.h"
+
+/*!
+ * @brief usage prints the command line help
+ * @param program the program name
+ */
+static void usage(char *program) {
+    printf("Usage: %s <coordinator host:port> [-j <workers>] [-P <plugin>[,<plugin>...]] [-W] [-L <alias_file>]\n",
+           program);
+}
+
+int main(int argc, char *argv[]) {
+    int workers = 1, option;
+    char *plugins = "", *alias_file = "";
+    while ((option = getopt(argc, argv, "j:P:WL:")) != -1) {
+        switch (option) {
+            case 'j':
+                workers = atoi(optarg);
+                break;
+            case 'P':
+                plugins = optarg;
+                break;
+            case 'W':
+                set_timeline_lines_written(true); // The coordinator writes the timeline (-W <timeline_file>)
+                break;
+            case 'L':
+                alias_file = optarg;
+                break;
+            default:
+                workers = 0;
+        }
+    }
+    if (workers <= 0 || optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!plugins_load(plugins) || !aliases_load(alias_file)) {
+        return 1;
+    }
+    for (int i = 0; i < workers; ++i) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            int connection = tcp_connect(argv[optind]);
+            exit(connection != -1 && tcp_worker(connection, 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+        } else if (pid == -1) {
+            perror("fork");
+            workers = i;
+        }
+    }
+    int result = 0, status;
+    while (wait(&status) != -1) {
+        result |= !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS;
+    }
+    return result;
+}
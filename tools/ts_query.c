@@ -0,0 +1,284 @@
+//
+// Created on 19/10/26.
+//
+
+// Queries on the timeline written by the reducer (-W option): mails per day of an edge, a sender, a recipient or the
+// whole corpus, busiest edges of a window, and burst days. The store is mapped in memory and only the rows of the
+// selected sender are decoded.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mail_date.h"
+#include "metrics.h"
+#include "timeline.h"
+
+#define DEFAULT_TOP_COUNT 10
+#define BURST_HISTORY_DAYS 28 // Burst days are compared to the average of the days before them
+#define BURST_MIN_COUNT 3
+#define DEFAULT_BURST_FACTOR 4.0
+
+/*!
+ * @brief usage prints the command line help
+ * @param program the program name
+ */
+static void usage(char *program) {
+    printf("Usage: %s <timeline_file> stats\n", program);
+    printf("       %s <timeline_file> series <sender>|* <recipient>|* [<from> <to>]\n", program);
+    printf("       %s <timeline_file> top <from> <to> [<n>]\n", program);
+    printf("       %s <timeline_file> bursts <sender>|* <recipient>|* [<factor>]\n", program);
+    printf("Days are written YYYY-MM-DD, in UTC.\n");
+}
+
+/*!
+ * @brief parse_day reads a YYYY-MM-DD day
+ * @param text the day
+ * @param day set to the number of days since 1970-01-01
+ * @return true for a valid day, false else
+ */
+static bool parse_day(char *text, int32_t *day) {
+    int year;
+    unsigned month, day_of_month;
+    char end;
+    if (sscanf(text, "%d-%u-%u%c", &year, &month, &day_of_month, &end) != 3 || month < 1 || month > 12 ||
+        day_of_month < 1 || day_of_month > 31) {
+        return false;
+    }
+    *day = days_from_civil(year, month, day_of_month);
+    return true;
+}
+
+/*!
+ * @brief format_day writes a day as YYYY-MM-DD
+ * @param day the number of days since 1970-01-01
+ * @param text the buffer, of at least 16 bytes
+ * @return the buffer
+ */
+static char *format_day(int32_t day, char *text) {
+    int32_t year;
+    uint32_t month, day_of_month;
+    civil_from_days(day, &year, &month, &day_of_month);
+    snprintf(text, 16, "%04d-%02u-%02u", (int) year, (unsigned) month, (unsigned) day_of_month);
+    return text;
+}
+
+/*!
+ * @brief select_address converts an address argument to its id
+ * @param timeline the store
+ * @param address the address, "*" for all
+ * @param id set to the id, TIMELINE_ANY for "*"
+ * @return true if the address is "*" or in the store, false else
+ */
+static bool select_address(timeline_t *timeline, char *address, uint32_t *id) {
+    if (strcmp(address, "*") == 0) {
+        *id = TIMELINE_ANY;
+        return true;
+    }
+    int64_t found = timeline_find(timeline, address);
+    if (found < 0) {
+        printf("%s: unknown address\n", address);
+        return false;
+    }
+    *id = (uint32_t) found;
+    return true;
+}
+
+typedef struct {
+    int32_t first_day;
+    uint64_t *mails; // Per day from first_day
+} daily_t;
+
+/*!
+ * @brief add_to_day sums up the points by day (@see timeline_visit_t)
+ */
+static void add_to_day(void *context, uint32_t sender, uint32_t recipient, int32_t day, uint64_t count) {
+    (void) sender;
+    (void) recipient;
+    daily_t *daily = context;
+    daily->mails[day - daily->first_day] += count;
+}
+
+typedef struct {
+    uint32_t sender;
+    uint32_t recipient;
+    uint64_t mails;
+} edge_total_t;
+
+typedef struct {
+    edge_total_t *edges;
+    size_t count;
+    size_t capacity;
+} edge_totals_t;
+
+/*!
+ * @brief add_to_edge sums up the points by edge: the points of an edge are visited one after the other (@see
+ * timeline_visit_t)
+ */
+static void add_to_edge(void *context, uint32_t sender, uint32_t recipient, int32_t day, uint64_t count) {
+    (void) day;
+    edge_totals_t *totals = context;
+    if (totals->count > 0 && totals->edges[totals->count - 1].sender == sender &&
+        totals->edges[totals->count - 1].recipient == recipient) {
+        totals->edges[totals->count - 1].mails += count;
+        return;
+    }
+    if (totals->count == totals->capacity) {
+        totals->capacity = totals->capacity ? 2 * totals->capacity : 1024;
+        edge_total_t *grown = realloc(totals->edges, totals->capacity * sizeof(edge_total_t));
+        if (!grown) {
+            perror("Cannot allocate edges");
+            exit(EXIT_FAILURE);
+        }
+        totals->edges = grown;
+    }
+    totals->edges[totals->count++] = (edge_total_t) {sender, recipient, count};
+}
+
+/*!
+ * @brief compare_edge_totals orders edges by decreasing mails, then sender and recipient (qsort callback)
+ */
+static int compare_edge_totals(const void *a, const void *b) {
+    const edge_total_t *first = a, *second = b;
+    if (first->mails != second->mails) {
+        return first->mails > second->mails ? -1 : 1;
+    }
+    if (first->sender != second->sender) {
+        return first->sender < second->sender ? -1 : 1;
+    }
+    return first->recipient < second->recipient ? -1 : (first->recipient > second->recipient);
+}
+
+/*!
+ * @brief scan_daily sums up the mails of a window by day
+ * @param timeline the store
+ * @param window the window
+ * @param daily the daily sums to fill, allocated for the window days
+ * @return the sum of the window
+ */
+static uint64_t scan_daily(timeline_t *timeline, timeline_window_t *window, daily_t *daily) {
+    daily->first_day = window->first_day;
+    daily->mails = calloc((size_t) (window->last_day - window->first_day) + 1, sizeof(uint64_t));
+    if (!daily->mails) {
+        perror("Cannot allocate days");
+        exit(EXIT_FAILURE);
+    }
+    return timeline_scan(timeline, window, add_to_day, daily);
+}
+
+/*!
+ * @brief print_series prints the mails of each day of a window with mails
+ * @param timeline the store
+ * @param window the window
+ */
+static void print_series(timeline_t *timeline, timeline_window_t *window) {
+    daily_t daily;
+    uint64_t total = scan_daily(timeline, window, &daily);
+    char text[16];
+    for (int32_t day = window->first_day; day <= window->last_day; ++day) {
+        if (daily.mails[day - window->first_day] > 0) {
+            printf("%s %lu\n", format_day(day, text), (unsigned long) daily.mails[day - window->first_day]);
+        }
+    }
+    printf("total %lu\n", (unsigned long) total);
+    free(daily.mails);
+}
+
+/*!
+ * @brief print_bursts prints the days whose mails are at least factor times the average of the days before them, once
+ * BURST_HISTORY_DAYS days of the window are known
+ * @param timeline the store
+ * @param window the window
+ * @param factor the burst factor
+ */
+static void print_bursts(timeline_t *timeline, timeline_window_t *window, double factor) {
+    daily_t daily;
+    scan_daily(timeline, window, &daily);
+    uint64_t history = 0; // Mails of the BURST_HISTORY_DAYS days before the current one
+    char text[16];
+    for (int32_t i = 0; i <= window->last_day - window->first_day; ++i) {
+        double average = (double) history / BURST_HISTORY_DAYS;
+        if (i >= BURST_HISTORY_DAYS && daily.mails[i] >= BURST_MIN_COUNT && daily.mails[i] >= factor * average) {
+            printf("%s %lu (average %.2f)\n", format_day(window->first_day + i, text),
+                   (unsigned long) daily.mails[i], average);
+        }
+        history += daily.mails[i];
+        if (i >= BURST_HISTORY_DAYS) {
+            history -= daily.mails[i - BURST_HISTORY_DAYS];
+        }
+    }
+    free(daily.mails);
+}
+
+/*!
+ * @brief print_top prints the edges with the most mails in a window
+ * @param timeline the store
+ * @param window the window
+ * @param n the maximum number of edges to print
+ */
+static void print_top(timeline_t *timeline, timeline_window_t *window, uint64_t n) {
+    edge_totals_t totals = {0};
+    timeline_scan(timeline, window, add_to_edge, &totals);
+    qsort(totals.edges, totals.count, sizeof(edge_total_t), compare_edge_totals);
+    for (size_t e = 0; e < totals.count && e < n; ++e) {
+        printf("%lu %s %s\n", (unsigned long) totals.edges[e].mails,
+               timeline_address(timeline, totals.edges[e].sender),
+               timeline_address(timeline, totals.edges[e].recipient));
+    }
+    free(totals.edges);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    timeline_t timeline;
+    uint64_t open_start = metrics_now_us();
+    if (!timeline_open(&timeline, argv[1])) {
+        fprintf(stderr, "Cannot open timeline %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    uint64_t query_start = metrics_now_us();
+    char *command = argv[2];
+    const timeline_header_t *header = timeline.header;
+    timeline_window_t window = {header->first_day, header->last_day, TIMELINE_ANY, TIMELINE_ANY};
+    bool success = true;
+
+    if (strcmp(command, "stats") == 0) {
+        char first[16], last[16];
+        printf("%u addresses, %u senders, %lu edges, %lu points, %lu mails from %s to %s\n", header->addresses_count,
+               header->senders_count, (unsigned long) header->edges_count, (unsigned long) header->points_count,
+               (unsigned long) header->total, format_day(header->first_day, first),
+               format_day(header->last_day, last));
+        printf("%lu bytes, %lu bytes of columns (%.2f bytes per point)\n", (unsigned long) timeline.size,
+               (unsigned long) header->columns_size,
+               header->points_count ? (double) header->columns_size / header->points_count : 0.0);
+    } else if ((strcmp(command, "series") == 0 || strcmp(command, "bursts") == 0) && argc >= 5) {
+        success = select_address(&timeline, argv[3], &window.sender) &&
+                  select_address(&timeline, argv[4], &window.recipient);
+        if (success && command[0] == 's' && argc >= 7) {
+            success = parse_day(argv[5], &window.first_day) && parse_day(argv[6], &window.last_day) &&
+                      window.first_day <= window.last_day;
+        }
+        if (success && command[0] == 's') {
+            print_series(&timeline, &window);
+        } else if (success) {
+            print_bursts(&timeline, &window, argc >= 6 ? strtod(argv[5], NULL) : DEFAULT_BURST_FACTOR);
+        }
+    } else if (strcmp(command, "top") == 0 && argc >= 5) {
+        success = parse_day(argv[3], &window.first_day) && parse_day(argv[4], &window.last_day);
+        if (success) {
+            print_top(&timeline, &window, argc >= 6 ? strtoull(argv[5], NULL, 10) : DEFAULT_TOP_COUNT);
+        }
+    } else {
+        usage(argv[0]);
+        success = false;
+    }
+
+    uint64_t end = metrics_now_us();
+    fprintf(stderr, "open: %lu us, query: %lu us\n", (unsigned long) (query_start - open_start),
+            (unsigned long) (end - query_start));
+    timeline_close(&timeline);
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
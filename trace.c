@@ -0,0 +1,179 @@
+//
+// Created on 19/10/26.
+//
+
+#include "trace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "analysis.h"
+#include "metrics.h"
+
+// One buffer per worker (plus one for the dispatcher) in a shared anonymous mapping created before forking. A writer
+// reserves a slot with an atomic increment and fills it: no lock is ever taken, even when several direct fork
+// children share a buffer. Buffers are merged when the trace is written, after all workers have ended.
+static trace_buffer_t *buffers = NULL;
+static size_t buffers_size = 0;
+static uint16_t buffers_count = 0;
+static uint16_t current_buffer = 0;
+static uint64_t trace_origin_us = 0;
+
+static const char *kinds_names[TRACE_KINDS_COUNT] = {
+        "directory", "file", "wait_task", "wait_worker",
+};
+
+/*!
+ * @brief trace_init allocates the trace buffers. Must be called before forking the workers.
+ * @param workers_count the number of workers
+ * @return true if tracing is enabled, false else
+ */
+bool trace_init(uint16_t workers_count) {
+    buffers_count = workers_count + 1;
+    buffers_size = buffers_count * sizeof(trace_buffer_t);
+    // Pages are only backed when touched, so short runs do not pay for the whole capacity
+    void *mapping = mmap(NULL, buffers_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE,
+                         -1, 0);
+    if (mapping == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+    buffers = (trace_buffer_t *) mapping;
+    current_buffer = workers_count; // The dispatcher uses the last buffer
+    trace_origin_us = metrics_now_us();
+    return true;
+}
+
+/*!
+ * @brief trace_cleanup releases the trace buffers
+ */
+void trace_cleanup() {
+    if (buffers) {
+        munmap(buffers, buffers_size);
+        buffers = NULL;
+    }
+}
+
+/*!
+ * @brief trace_set_worker selects the buffer of the calling process. Called by a worker right after fork.
+ * @param worker_index the worker index, wrapped into [0, workers_count)
+ */
+void trace_set_worker(uint16_t worker_index) {
+    if (buffers) {
+        current_buffer = worker_index % (buffers_count - 1);
+    }
+}
+
+/*!
+ * @brief trace_record appends an event to the buffer of the calling process. The event is dropped if the buffer is
+ * full.
+ * @param kind the event kind
+ * @param begin_us the event start (@see metrics_now_us)
+ * @param end_us the event end
+ * @param label an optional label (e.g. the path of the task object). Only its end is kept if it is too long.
+ */
+void trace_record(trace_kind_t kind, uint64_t begin_us, uint64_t end_us, char *label) {
+    if (!buffers) {
+        return;
+    }
+    trace_buffer_t *buffer = &buffers[current_buffer];
+    uint32_t index = __atomic_fetch_add(&buffer->count, 1, __ATOMIC_RELAXED);
+    if (index >= TRACE_EVENTS_PER_WORKER) {
+        return;
+    }
+    trace_event_t *event = &buffer->events[index];
+    event->begin_us = begin_us;
+    event->pid = getpid();
+    event->kind = kind;
+    event->label[0] = '\0';
+    if (label) {
+        size_t length = strlen(label);
+        strcpy(event->label, length < TRACE_LABEL_LEN ? label : label + length - TRACE_LABEL_LEN + 1);
+    }
+    __atomic_store_n(&event->end_us, end_us, __ATOMIC_RELEASE); // A non-zero end marks the event as complete
+}
+
+/*!
+ * @brief trace_task records the execution of a task, labelled with the task object (directory or file)
+ * @param task the executed task
+ * @param begin_us the task start
+ * @param end_us the task end
+ */
+void trace_task(task_t *task, uint64_t begin_us, uint64_t end_us) {
+    if (buffers && task) {
+        // Both directory_task_t and file_task_t start with the path of their object
+        trace_record(task->task_callback == process_directory ? TRACE_DIRECTORY_TASK : TRACE_FILE_TASK, begin_us,
+                     end_us, task->argument);
+    }
+}
+
+/*!
+ * @brief write_json_string writes a string as a JSON string literal
+ * @param output the output file
+ * @param string the string to escape
+ */
+static void write_json_string(FILE *output, char *string) {
+    fputc('"', output);
+    for (unsigned char *c = (unsigned char *) string; *c; ++c) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', output);
+            fputc(*c, output);
+        } else if (*c < 0x20) {
+            fprintf(output, "\\u%04x", *c);
+        } else {
+            fputc(*c, output);
+        }
+    }
+    fputc('"', output);
+}
+
+/*!
+ * @brief trace_write_chrome merges all buffers into a Chrome trace event file (readable by chrome://tracing and
+ * Perfetto). Each worker is a thread of a single process, the dispatcher being the last one.
+ * @param path the path to the trace file
+ * @return true if the trace was written, false else
+ */
+bool trace_write_chrome(char *path) {
+    if (!buffers) {
+        return false;
+    }
+    FILE *output = fopen(path, "w");
+    if (!output) {
+        perror("Cannot open trace file");
+        return false;
+    }
+    uint64_t dropped = 0;
+    fprintf(output, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(output, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"analysis\"}}");
+    for (uint16_t b = 0; b < buffers_count; ++b) {
+        fprintf(output, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": ", b);
+        if (b + 1 < buffers_count) {
+            fprintf(output, "\"worker %u\"}}", b);
+        } else {
+            fprintf(output, "\"dispatcher\"}}");
+        }
+        uint32_t count = buffers[b].count;
+        if (count > TRACE_EVENTS_PER_WORKER) {
+            dropped += count - TRACE_EVENTS_PER_WORKER;
+            count = TRACE_EVENTS_PER_WORKER;
+        }
+        for (uint32_t e = 0; e < count; ++e) {
+            trace_event_t *event = &buffers[b].events[e];
+            if (event->end_us == 0) {
+                continue; // Writer died before completing the event
+            }
+            fprintf(output, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, "
+                            "\"ts\": %llu, \"dur\": %llu, \"args\": {\"pid\": %d, \"object\": ",
+                    kinds_names[event->kind], event->kind >= TRACE_WORKER_WAIT ? "wait" : "task", b,
+                    (unsigned long long) (event->begin_us - trace_origin_us),
+                    (unsigned long long) (event->end_us - event->begin_us), (int) event->pid);
+            write_json_string(output, event->label);
+            fprintf(output, "}}");
+        }
+    }
+    fprintf(output, "\n], \"otherData\": {\"dropped_events\": %llu}}\n", (unsigned long long) dropped);
+    fclose(output);
+    return true;
+}
@@ -0,0 +1,45 @@
+//
+// Created on 19/10/26.
+//
+
+#ifndef A2022_TRACE_H
+#define A2022_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "global_defs.h"
+
+#define TRACE_LABEL_LEN 96
+#define TRACE_EVENTS_PER_WORKER 65536
+
+typedef enum {
+    TRACE_DIRECTORY_TASK,
+    TRACE_FILE_TASK,
+    TRACE_WORKER_WAIT,
+    TRACE_DISPATCH_WAIT,
+    TRACE_KINDS_COUNT
+} trace_kind_t;
+
+typedef struct {
+    uint64_t begin_us;
+    uint64_t end_us;
+    pid_t pid;
+    uint8_t kind;
+    char label[TRACE_LABEL_LEN];
+} trace_event_t;
+
+typedef struct {
+    uint32_t count; // Reserved events, may exceed TRACE_EVENTS_PER_WORKER: the extra ones are dropped
+    trace_event_t events[TRACE_EVENTS_PER_WORKER];
+} trace_buffer_t;
+
+bool trace_init(uint16_t workers_count);
+void trace_cleanup();
+void trace_set_worker(uint16_t worker_index);
+void trace_record(trace_kind_t kind, uint64_t begin_us, uint64_t end_us, char *label);
+void trace_task(task_t *task, uint64_t begin_us, uint64_t end_us);
+bool trace_write_chrome(char *path);
+
+#endif //A2022_TRACE_H
@@ -7,13 +7,29 @@
 #include <stdlib.h>
 #include <string.h>
 #include <dirent.h>
-#include <libgen.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <stdio.h> //for path_to_file_exists, may remove file existence check
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
+#include "checkpoint.h"
 #include "global_defs.h"
 
+// Intermediates live in this directory in ephemeral mode (tmpfs on Linux, so they never reach the disk)
+#define EPHEMERAL_ROOT "/dev/shm"
+
+// False in ephemeral mode: intermediates are discarded at the end of the run, syncing them is pure write amplification
+static bool temporary_files_durable = true;
+
+// Ephemeral directory of the run and the process which created it: the workers inherit the exit handler, only the
+// creator removes the directory
+static char ephemeral_directory[STR_MAX_LEN] = "";
+static pid_t ephemeral_directory_owner = -1;
+
 /*!
  * @brief cat_path concatenates two file system paths into a result. It adds the separation /  if required.
  * @param prefix first part of the complete path
@@ -44,14 +60,9 @@ char *concat_path(char *prefix, char *suffix, char *full_path) {
  */
 bool directory_exists(char *path) {
     if (!path) return false;
-    DIR *dir = opendir(path);
-    if (dir) {
-        closedir(dir);
-        return true;
-    } else {
-        return false;
-    }
-    
+    // A stat() is enough: opening the directory would cost an open, a close and the allocation of its stream
+    struct stat status;
+    return stat(path, &status) == 0 && S_ISDIR(status.st_mode);
 }
 
 /*!
@@ -63,30 +74,28 @@ bool directory_exists(char *path) {
  */
 bool path_to_file_exists(char *path) {
     if (!path) return false;
-    char path_copy[STR_MAX_LEN];
-    strcpy(path_copy, path);
-    char *dir_path = dirname(path_copy);
-    bool exists = directory_exists(dir_path);
-    if (exists) {
-        // open file to check if it exists
-        FILE* f = fopen(path, "r");
-        if (f) {
-            fclose(f);
-            return true;
-        } else {
-            return false;
-        }
-    } else {
-        return false;
-    }
+    // The file is not opened: a single access() call tells if it exists, hence if the directory leading to it exists
+    return access(path, F_OK) == 0;
 }
 
 /*!
- * @brief sync_temporary_files waits for filesystem syncing for a path
+ * @brief set_temporary_files_durable enables or disables the syncing of temporary files (@see sync_temporary_files and
+ * sync_temporary_file)
+ * @param durable true to sync temporary files (default), false for ephemeral intermediates
+ */
+void set_temporary_files_durable(bool durable) {
+    temporary_files_durable = durable;
+}
+
+/*!
+ * @brief sync_temporary_files waits for filesystem syncing for a path. Does nothing for ephemeral intermediates.
  * @param temp_dir the path to the directory to wait for
  * Use fsync and dirfd
  */
 void sync_temporary_files(char *temp_dir) {
+    if (!temporary_files_durable) {
+        return;
+    }
     int fd = open(temp_dir, O_RDONLY);
     if (fd == -1) {
         perror("open");
@@ -96,6 +105,67 @@ void sync_temporary_files(char *temp_dir) {
     close(fd);
 }
 
+/*!
+ * @brief sync_temporary_file syncs the data of an open temporary file. Does nothing for ephemeral intermediates.
+ * @param fd the temporary file descriptor
+ */
+void sync_temporary_file(int fd) {
+    if (temporary_files_durable) {
+        fdatasync(fd);
+    }
+}
+
+/*!
+ * @brief remove_ephemeral_directory removes the ephemeral directory when its creator exits, whatever the exit path
+ */
+static void remove_ephemeral_directory() {
+    if (ephemeral_directory[0] != '\0' && getpid() == ephemeral_directory_owner) {
+        remove_directory(ephemeral_directory);
+        ephemeral_directory[0] = '\0';
+    }
+}
+
+/*!
+ * @brief make_ephemeral_directory creates a private directory for intermediates in shared memory. It is removed when
+ * the calling process exits, by returning from main or calling exit.
+ * @param path the created directory path (at least STR_MAX_LEN long)
+ * @return true if the directory was created, false else (e.g. no /dev/shm on this system)
+ */
+bool make_ephemeral_directory(char *path) {
+    snprintf(path, STR_MAX_LEN, "%s/lp25-XXXXXX", EPHEMERAL_ROOT);
+    if (!mkdtemp(path)) {
+        path[0] = '\0';
+        return false;
+    }
+    if (atexit(remove_ephemeral_directory) != 0) {
+        rmdir(path);
+        path[0] = '\0';
+        return false;
+    }
+    strncpy(ephemeral_directory, path, STR_MAX_LEN - 1);
+    ephemeral_directory_owner = getpid();
+    return true;
+}
+
+/*!
+ * @brief remove_directory removes a directory of temporary files (not recursive, temporary directories are flat)
+ * @param path the directory path
+ */
+void remove_directory(char *path) {
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+            unlinkat(dirfd(dir), entry->d_name, 0);
+        }
+    }
+    closedir(dir);
+    rmdir(path);
+}
+
 
 /*!
  * @brief next_dir returns the next directory entry that is not . or ..
@@ -108,4 +178,222 @@ struct dirent *next_dir(struct dirent *entry, DIR *dir) {
         entry = readdir(dir);
     } while (entry && (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) && entry->d_type == DT_DIR);
     return entry;
-}
\ No newline at end of file
+}
+
+/*!
+ * @brief remove_tree deletes a directory and everything below it
+ * @param parent_fd the directory containing it, AT_FDCWD for the current directory
+ * @param name its path, relative to parent_fd
+ */
+static void remove_tree(int parent_fd, const char *name) {
+    int fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    DIR *dir = fd != -1 ? fdopendir(fd) : NULL;
+    if (!dir) {
+        if (fd != -1) {
+            close(fd);
+        }
+        unlinkat(parent_fd, name, AT_REMOVEDIR);
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        if (entry->d_type == DT_DIR ||
+            (unlinkat(dirfd(dir), entry->d_name, 0) == -1 && (errno == EISDIR || errno == EPERM))) {
+            remove_tree(dirfd(dir), entry->d_name);
+        }
+    }
+    closedir(dir);
+    unlinkat(parent_fd, name, AT_REMOVEDIR);
+}
+
+/*!
+ * @brief remove_tree_detached deletes a directory tree in a background process, at the lowest priority. The process is
+ * orphaned at once: workers reaped with wait() never mistake it for one of them, and the run never waits for it.
+ * @param path the directory path
+ */
+static void remove_tree_detached(char *path) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (fork() == 0) {
+            setpriority(PRIO_PROCESS, 0, 19);
+            remove_tree(AT_FDCWD, path);
+        }
+        _exit(EXIT_SUCCESS); // Pending output of the parent is not flushed again
+    } else if (pid > 0) {
+        while (waitpid(pid, NULL, 0) == -1 && errno == EINTR) {
+        }
+    } else {
+        remove_tree(AT_FDCWD, path);
+    }
+}
+
+/*!
+ * @brief is_inside_directory tells if a path is a directory or is below it
+ * @param path the path
+ * @param directory the directory
+ * @return true if both exist and path is directory or below it, false else
+ */
+static bool is_inside_directory(char *path, char *directory) {
+    char real_path[PATH_MAX], real_directory[PATH_MAX];
+    if (!realpath(path, real_path) || !realpath(directory, real_directory)) {
+        return false;
+    }
+    size_t length = strlen(real_directory);
+    return strncmp(real_path, real_directory, length) == 0 &&
+           (length == 1 || real_path[length] == '/' || real_path[length] == '\0');
+}
+
+/*!
+ * @brief is_pipeline_artifact tells if an entry of the temporary directory was written by a previous run: the files
+ * list and the files analysis output, the checkpoint, a directory list (named after a directory of the data source) or
+ * a trash directory left by an interrupted cleaning
+ * @param directory_fd the temporary directory
+ * @param data_fd the data source directory, -1 if it is not a directory (archives)
+ * @param name the entry name
+ * @return true if the entry is an artifact of the pipeline, false else
+ */
+static bool is_pipeline_artifact(int directory_fd, int data_fd, const char *name) {
+    struct stat entry_status, data_status;
+    if (fstatat(directory_fd, name, &entry_status, AT_SYMLINK_NOFOLLOW) == -1) {
+        return false;
+    }
+    if (strncmp(name, ".trash-", strlen(".trash-")) == 0) {
+        return S_ISDIR(entry_status.st_mode);
+    }
+    return S_ISREG(entry_status.st_mode) &&
+           (strcmp(name, "step1_output") == 0 || strcmp(name, "step2_output") == 0 ||
+            strcmp(name, CHECKPOINT_FILE) == 0 || strcmp(name, CHECKPOINT_FILE ".new") == 0 ||
+            (data_fd != -1 && name[0] != '.' && fstatat(data_fd, name, &data_status, 0) == 0 &&
+             S_ISDIR(data_status.st_mode)));
+}
+
+/*!
+ * @brief move_artifacts_to_trash moves the artifacts of a previous run into a trash directory, other entries are left
+ * in place
+ * @param directory the temporary directory
+ * @param data_path the data source
+ * @param trash the trash directory, inside directory
+ * @return true if all the artifacts were moved, false else
+ */
+static bool move_artifacts_to_trash(char *directory, char *data_path, char *trash) {
+    DIR *dir = opendir(directory);
+    int trash_fd = open(trash, O_RDONLY | O_DIRECTORY);
+    int data_fd = open(data_path, O_RDONLY | O_DIRECTORY);
+    bool success = dir && trash_fd != -1;
+    char *trash_name = strrchr(trash, '/') + 1;
+    struct dirent *entry;
+    while (success && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, trash_name) != 0 && is_pipeline_artifact(dirfd(dir), data_fd, entry->d_name)) {
+            success = renameat(dirfd(dir), entry->d_name, trash_fd, entry->d_name) == 0;
+        }
+    }
+    if (dir) {
+        closedir(dir);
+    }
+    if (trash_fd != -1) {
+        close(trash_fd);
+    }
+    if (data_fd != -1) {
+        close(data_fd);
+    }
+    return success;
+}
+
+/*!
+ * @brief count_entries counts the entries of the temporary directory, and the artifacts of a previous run among them
+ * @param directory the temporary directory
+ * @param data_path the data source
+ * @param artifacts set to the number of artifacts
+ * @return the number of entries, -1 if the directory cannot be read
+ */
+static long count_entries(char *directory, char *data_path, long *artifacts) {
+    DIR *dir = opendir(directory);
+    if (!dir) {
+        return -1;
+    }
+    int data_fd = open(data_path, O_RDONLY | O_DIRECTORY);
+    long entries = 0;
+    *artifacts = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+            ++entries;
+            *artifacts += is_pipeline_artifact(dirfd(dir), data_fd, entry->d_name);
+        }
+    }
+    if (data_fd != -1) {
+        close(data_fd);
+    }
+    closedir(dir);
+    return entries;
+}
+
+/*!
+ * @brief is_cleaning_refused tells if a directory must never be cleaned: the root, the current directory or one of its
+ * parents, and mount points
+ * @param directory the temporary directory, without trailing '/'
+ * @param status its status
+ * @return true if the directory is one of them, false else
+ */
+static bool is_cleaning_refused(char *directory, struct stat *status) {
+    char parent[STR_MAX_LEN], cwd[PATH_MAX];
+    struct stat parent_status;
+    if (snprintf(parent, STR_MAX_LEN, "%s/..", directory) >= STR_MAX_LEN || stat(parent, &parent_status) == -1 ||
+        !getcwd(cwd, PATH_MAX)) {
+        return true;
+    }
+    bool is_mount_point = parent_status.st_dev != status->st_dev || parent_status.st_ino == status->st_ino;
+    return is_mount_point || is_inside_directory(cwd, directory);
+}
+
+/*!
+ * @brief clean_temporary_directory removes the files of a previous run from the temporary directory without waiting
+ * for the deletion, leaving any other file in place. A directory which only holds such files is atomically renamed to
+ * a trash directory next to it and created again with the same mode and owner; otherwise the files are moved into a
+ * trash directory inside it. A background process then deletes the trash while the analysis starts. It must be called
+ * before any output or log is opened, as these may be in the temporary directory.
+ * @param path the temporary directory
+ * @param data_path the data source: nothing is removed if it is inside the temporary directory
+ * @return true if the files of the previous run were removed, false if the directory must not or could not be cleaned
+ */
+bool clean_temporary_directory(char *path, char *data_path) {
+    char directory[STR_MAX_LEN], trash[STR_MAX_LEN];
+    struct stat status;
+    if (is_inside_directory(data_path, path) || stat(path, &status) == -1 || !S_ISDIR(status.st_mode) ||
+        snprintf(directory, STR_MAX_LEN, "%s", path) >= STR_MAX_LEN) {
+        return false;
+    }
+    for (size_t length = strlen(directory); length > 1 && directory[length - 1] == '/'; --length) {
+        directory[length - 1] = '\0';
+    }
+    long artifacts, entries;
+    if (is_cleaning_refused(directory, &status) || (entries = count_entries(directory, data_path, &artifacts)) == -1) {
+        return false;
+    }
+    if (artifacts == 0) {
+        return true;
+    }
+    if (artifacts == entries && snprintf(trash, STR_MAX_LEN, "%s.trash-XXXXXX", directory) < STR_MAX_LEN &&
+        mkdtemp(trash)) {
+        if (rename(directory, trash) == 0) { // The empty trash directory is replaced
+            if (mkdir(directory, 0700) == 0 && chmod(directory, status.st_mode & 07777) == 0 &&
+                chown(directory, status.st_uid, status.st_gid) == 0) {
+                remove_tree_detached(trash);
+                return true;
+            }
+            rmdir(directory);
+            rename(trash, directory);
+        } else {
+            rmdir(trash);
+        }
+    }
+    if (snprintf(trash, STR_MAX_LEN, "%s/.trash-XXXXXX", directory) >= STR_MAX_LEN || !mkdtemp(trash)) {
+        return false;
+    }
+    bool is_cleaned = move_artifacts_to_trash(directory, data_path, trash); // The files moved are deleted all the same
+    remove_tree_detached(trash);
+    return is_cleaned;
+}
@@ -11,7 +11,12 @@
 char *concat_path(char *prefix, char *suffix, char *full_path);
 bool directory_exists(char *path);
 bool path_to_file_exists(char *path);
+void set_temporary_files_durable(bool durable);
 void sync_temporary_files(char *temp_dir);
+void sync_temporary_file(int fd);
+bool make_ephemeral_directory(char *path);
+void remove_directory(char *path);
+bool clean_temporary_directory(char *path, char *data_path);
 struct dirent *next_dir(struct dirent *entry, DIR *dir);
 
 #endif //A2022_UTILITY_H